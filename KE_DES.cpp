@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <bitset>
 #include <iostream>
 #include <vector>
@@ -6,377 +7,458 @@
 #include <cstdint>
 #include <fstream>
 #include <chrono>
+#include <string>
+#include <cstdlib>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kedes.h"
+#include "kedes_aio.h"
+#include "kedes_batch.h"
+#include "kedes_container.h"
+#include "kedes_dispatch.h"
+#include "kedes_hex.h"
+#include "kedes_metrics.h"
+#include "kedes_mmap.h"
+#include "kedes_stream.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
 
 using namespace std;
 
 //Key in hexadecimal format
 unsigned long long Key = 0x133457799BBCDFF1ULL;
 
-// PC-1 table (56 positions) - standard DES PC-1 (1-based positions)
-static const int PC1[56] = {
-	57,49,41,33,25,17,9,
-	1,58,50,42,34,26,18,
-	10,2,59,51,43,35,27,
-	19,11,3,60,52,44,36,
-	63,55,47,39,31,23,15,
-	7,62,54,46,38,30,22,
-	14,6,61,53,45,37,29,
-	21,13,5,28,20,12,4
-};
-
-// PC-2 table (48 positions) - standard DES PC-2 (1-based positions on 56-bit input)
-static const int PC2[48] = {
-	14,17,11,24,1,5,
-	3,28,15,6,21,10,
-	23,19,12,4,26,8,
-	16,7,27,20,13,2,
-	41,52,31,37,47,55,
-	30,40,51,45,33,48,
-	44,49,39,56,34,53,
-	46,42,50,36,29,32
-};
-
-// Left rotation schedule for 16 rounds (standard DES)
-static const int SHIFTS[16] = {1,1,2,2,2,2,2,2,1,2,2,2,2,2,2,1};
-
-// Initial Permutation (IP)
-static const int IP[64] = {
-	58,50,42,34,26,18,10,2,
-	60,52,44,36,28,20,12,4,
-	62,54,46,38,30,22,14,6,
-	64,56,48,40,32,24,16,8,
-	57,49,41,33,25,17,9,1,
-	59,51,43,35,27,19,11,3,
-	61,53,45,37,29,21,13,5,
-	63,55,47,39,31,23,15,7
-};
-
-// Inverse IP
-static const int IP_INV[64] = {
-	40,8,48,16,56,24,64,32,
-	39,7,47,15,55,23,63,31,
-	38,6,46,14,54,22,62,30,
-	37,5,45,13,53,21,61,29,
-	36,4,44,12,52,20,60,28,
-	35,3,43,11,51,19,59,27,
-	34,2,42,10,50,18,58,26,
-	33,1,41,9,49,17,57,25
-};
-
-// Expansion table E (32 -> 48)
-static const int E_TABLE[48] = {
-	32,1,2,3,4,5,
-	4,5,6,7,8,9,
-	8,9,10,11,12,13,
-	12,13,14,15,16,17,
-	16,17,18,19,20,21,
-	20,21,22,23,24,25,
-	24,25,26,27,28,29,
-	28,29,30,31,32,1
-};
-
-// P permutation (32)
-static const int P_TABLE[32] = {
-	16,7,20,21,29,12,28,17,
-	1,15,23,26,5,18,31,10,
-	2,8,24,14,32,27,3,9,
-	19,13,30,6,22,11,4,25
-};
-
-static vector<int> ull_to_bits_msb(unsigned long long v, int n) {
-	vector<int> out(n+1); // 1-based
-	for (int i = 1; i <= n; ++i) {
-		int shift = n - i;
-		out[i] = ( (v >> shift) & 1ULL ) ? 1 : 0;
-	}
-	return out;
-}
-
-static vector<int> apply_permutation(const vector<int>& in, const int* table, int tlen) {
-	vector<int> out(tlen+1);
-	for (int i = 0; i < tlen; ++i) {
-		out[i+1] = in[ table[i] ];
-	}
-	return out;
-}
-
-static void odd_even_transform(vector<int>& b) {
-	// produce C0 = 0,1,0,1,... for positions 1..28
-	// and    D0 = 1,0,1,0,... for positions 29..56
-	int n = (int)b.size()-1;
-	for (int j = 1; j <= n; ++j) {
-		if (j <= 28) {
-			// first half: odd positions = 0, even = 1 -> 0,1,0,1,...
-			b[j] = (j % 2 == 0) ? 1 : 0;
-		} else {
-			// second half: odd positions = 1, even = 0 -> 1,0,1,0,...
-			b[j] = (j % 2 == 1) ? 1 : 0;
-		}
-	}
-}
-
-static void rot_left(vector<int>& v, int shifts) {
-	// v is 1-based indexed
-	int n = (int)v.size()-1;
-	if (n == 0) return;
-	shifts %= n;
-	if (shifts == 0) return;
-	vector<int> tmp(n+1);
-	for (int i = 1; i <= n; ++i) {
-		int src = ((i + shifts - 1) % n) + 1;
-		tmp[i] = v[src];
-	}
-	v = tmp;
-}
-
-static string bits_to_hex_string(const vector<int>& bits) {
-	// bits is 1-based MSB-first; produce hex string
-	int n = (int)bits.size()-1;
-	unsigned long long val = 0;
-	for (int i = 1; i <= n; ++i) {
-		val = (val << 1) | (bits[i] & 1);
-	}
-	int hex_digits = (n + 3) / 4;
+static string round_key_hex(uint64_t k48) {
 	stringstream ss;
-	ss << hex << uppercase << setw(hex_digits) << setfill('0') << val;
+	ss << hex << uppercase << setw(12) << setfill('0') << k48;
 	return ss.str();
 }
 
-// Convert 8 bytes (MSB first) to 1-based 64-bit vector
-static vector<int> bytes_to_bits_msb(const vector<uint8_t>& bytes, int start) {
-	// start index in bytes vector (0-based); expects at least 8 bytes available
-	vector<int> bits(64+1);
-	for (int i = 0; i < 8; ++i) {
-		uint8_t b = bytes[start + i];
-		for (int bit = 0; bit < 8; ++bit) {
-			int pos = i*8 + bit; // 0..63
-			// MSB-first: bit 0 is highest bit of byte
-			bits[pos+1] = ( (b >> (7 - bit)) & 1 ) ? 1 : 0;
-		}
-	}
-	return bits;
-}
-
-static vector<uint8_t> bits64_to_bytes(const vector<int>& bits) {
-	vector<uint8_t> out(8, 0);
-	for (int i = 0; i < 8; ++i) {
-		uint8_t b = 0;
-		for (int bit = 0; bit < 8; ++bit) {
-			int pos = i*8 + bit; // 0..63
-			b = (b << 1) | (bits[pos+1] & 1);
-		}
-		out[i] = b;
-	}
-	return out;
-}
-
-// Simplified S-box substitution: maps each 6-bit value to 4-bit deterministically.
-// This keeps the implementation concise; you can replace this with standard DES S-boxes if desired.
-static void sbox_substitution(const vector<int>& in48, vector<int>& out32) {
-	// in48: 1-based 48 bits; out32 will be 1-based 32 bits
-	for (int i = 0; i < 8; ++i) {
-		int base = i*6;
-		int val = 0;
-		for (int b = 0; b < 6; ++b) val = (val << 1) | in48[base + b + 1];
-		// deterministic mapping: mix and reduce to 4 bits
-		int nibble = ((val * (i+1)) ^ (val >> 2)) & 0xF;
-		// put nibble into out32
-		for (int b = 0; b < 4; ++b) {
-			out32[i*4 + b + 1] = ( (nibble >> (3 - b)) & 1 );
-		}
-	}
-}
-
-// Feistel function f: takes 32-bit R (1-based) and 48-bit subkey (1-based), returns 32-bit vector (1-based)
-static vector<int> feistel_f(const vector<int>& R32, const vector<int>& K48) {
-	// expand R from 32->48
-	vector<int> Rexp = apply_permutation(R32, E_TABLE, 48);
-	// XOR with key
-	vector<int> tmp(48+1);
-	for (int i = 1; i <= 48; ++i) tmp[i] = Rexp[i] ^ K48[i];
-	// S-box substitution (simplified)
-	vector<int> sbout(32+1);
-	sbox_substitution(tmp, sbout);
-	// P permutation
-	vector<int> pout = apply_permutation(sbout, P_TABLE, 32);
-	return pout;
-}
-
-// DES-like encrypt single 64-bit block (1-based vector) with provided 16 round keys (each 1-based 48 bits)
-static vector<int> des_encrypt_block(const vector<int>& block64, const vector<vector<int>>& roundKeys) {
-	// Apply IP
-	vector<int> ip = apply_permutation(block64, IP, 64);
-	// split L and R
-	vector<int> L(32+1), R(32+1);
-	for (int i = 1; i <= 32; ++i) { L[i] = ip[i]; R[i] = ip[32 + i]; }
-
-	// 16 rounds
-	for (int r = 0; r < 16; ++r) {
-		vector<int> f = feistel_f(R, roundKeys[r]);
-		vector<int> newR(32+1);
-		for (int i = 1; i <= 32; ++i) newR[i] = L[i] ^ f[i];
-		L = R;
-		R = newR;
-	}
-
-	// preoutput is R||L (swap)
-	vector<int> preout(64+1);
-	for (int i = 1; i <= 32; ++i) {
-		preout[i] = R[i];
-		preout[32 + i] = L[i];
-	}
-	// apply IP_INV
-	vector<int> out = apply_permutation(preout, IP_INV, 64);
-	return out;
-}
-
-int main()
+// usage: KE_DES [-m cbc|ctr|cbc-cmac|cbc-chunked] [--segment bytes] [-f bin|hex] [--iv hex] [-t threads] [--stream | --aio | --mmap] [-q]
+//               [--io auto|uring|threads] [--direct] [--kernel name] [--cross-check N]
+//               [--metrics file] [--metrics-format json|prom] [plaintext file] [ciphertext file]
+//        KE_DES --batch manifest|directory [--out dir] [-m cbc|ctr|cbc-cmac|cbc-chunked] [-f bin|hex] [--iv hex] [-t threads] [-q]
+//   -m, --mode      cbc (default, PKCS#7 padded), ctr (no padding) or cbc-cmac (cbc plus an
+//                   8-byte CMAC tag computed in the same pass; KE_DES_Decrypt rejects a
+//                   file whose tag does not match) or cbc-chunked (cbc restarted every
+//                   segment under an IV of its own, recorded in the container; the segments
+//                   encrypt in parallel)
+//   --segment BYTES cbc-chunked segment size, rounded down to whole blocks; K/M suffixes are
+//                   powers of two (default 256K)
+//   -f, --format    bin (default): KE-DES container, ciphertext.bin
+//                   hex: the ciphertext.txt text layout (IV/mode are not recorded)
+//   --iv, --nonce   CBC IV / initial CTR counter block as hex (default 0)
+//   -t, --threads   CTR / cbc-chunked / batch threads (default: one per hardware thread)
+//   --stream        encrypt in fixed-size chunks with bounded memory instead of loading the file
+//   --aio           asynchronous chunk pipeline between the files (container output only):
+//                   reads, cipher and writes overlap on a ring of aligned buffers
+//   --io BACKEND    auto (default: io_uring when the kernel allows it), uring or threads; implies --aio
+//   --direct        O_DIRECT for the plaintext reads (the container header offsets the writes); implies --aio
+//   --mmap          map the plaintext and the pre-sized container and encrypt from one mapping
+//                   into the other (container output only)
+//   --kernel NAME   block kernel: auto (default: the widest the CPU supports), scalar, bs64,
+//                   sse2, avx2 or avx512; KEDES_KERNEL=NAME does the same
+//   --cross-check N recompute 1 in N blocks with the reference engine and abort on a
+//                   mismatch; KEDES_CROSS_CHECK=N does the same
+//   --batch SRC     encrypt every file of a manifest (input[<TAB>output[<TAB>key]] per line)
+//                   or directory tree; outputs default to input.bin (input.txt with -f hex),
+//                   and a directory scan skips files that already end that way
+//   --out DIR       put batch outputs under DIR instead of next to the inputs
+//   -q, --quiet     no key schedule dump or progress messages, only errors and warnings
+//   --metrics FILE  record counters and stage latencies; written to FILE ("-" = stdout)
+//                   at exit and on SIGUSR1, as json (default) or prom (Prometheus text)
+int main(int argc, char** argv)
 {
-    //convert the key to 64-bits binary format (MSB-first)
-    bitset<64> Key_Bin(Key);
-    cout << "Key in binary format: " << Key_Bin << endl;
+    string mode = "cbc";
+    size_t segment = kedes::CHUNK_BYTES;
+    string format = "bin";
+    uint64_t iv = 0;
+    unsigned threads = 0;
+    bool stream = false;
+    bool aio = false;
+    bool direct = false;
+    bool use_mmap = false;
+    kedes::IoBackend io_backend = kedes::IoBackend::automatic;
+    kedes::Kernel kernel = kedes::Kernel::automatic;
+    int cross_check = -1;
+    bool quiet = false;
+    string metrics_file;
+    string metrics_format = "json";
+    string batch;
+    string out_dir;
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+    	string a = argv[i];
+    	if ((a == "-m" || a == "--mode") && i + 1 < argc) mode = argv[++i];
+    	else if ((a == "-f" || a == "--format") && i + 1 < argc) format = argv[++i];
+    	else if (a == "--segment" && i + 1 < argc) {
+    		uint64_t n;
+    		if (!kedes::parse_count(argv[++i], n)) {
+    			cerr << "Invalid --segment value " << argv[i] << " (expected a number, K/M/G suffixes allowed)\n";
+    			return 1;
+    		}
+    		segment = n > UINT32_MAX ? 0 : (size_t)n / kedes::BLOCK_SIZE * kedes::BLOCK_SIZE;
+    	}
+    	else if ((a == "--iv" || a == "--nonce") && i + 1 < argc) {
+    		if (!kedes::parse_hex64(argv[++i], iv)) {
+    			cerr << "Invalid " << a << " value " << argv[i] << " (expected up to 16 hex digits)\n";
+    			return 1;
+    		}
+    	}
+    	else if ((a == "-t" || a == "--threads" || a == "--cross-check") && i + 1 < argc) {
+    		uint64_t n;
+    		if (!kedes::parse_unsigned(argv[++i], n) || n > UINT32_MAX) {
+    			cerr << "Invalid " << a << " value " << argv[i] << " (expected a number)\n";
+    			return 1;
+    		}
+    		if (a == "--cross-check") cross_check = (int)min<uint64_t>(n, INT32_MAX);
+    		else threads = (unsigned)n;
+    	}
+    	else if (a == "--stream") stream = true;
+    	else if (a == "--aio") aio = true;
+    	else if (a == "--mmap") use_mmap = true;
+    	else if (a == "--direct") aio = direct = true;
+    	else if (a == "--io" && i + 1 < argc) {
+    		if (!kedes::parse_io_backend(argv[++i], io_backend)) {
+    			cerr << "Unknown I/O backend " << argv[i] << " (expected auto, uring or threads)\n";
+    			return 1;
+    		}
+    		aio = true;
+    	}
+    	else if (a == "--kernel" && i + 1 < argc) {
+    		if (!kedes::parse_kernel(argv[++i], kernel)) {
+    			cerr << "Unknown kernel " << argv[i] << " (expected auto, scalar, bs64, sse2, avx2 or avx512)\n";
+    			return 1;
+    		}
+    	}
+    	else if (a == "--batch" && i + 1 < argc) batch = argv[++i];
+    	else if (a == "--out" && i + 1 < argc) out_dir = argv[++i];
+    	else if (a == "-q" || a == "--quiet") quiet = true;
+    	else if (a == "--metrics" && i + 1 < argc) metrics_file = argv[++i];
+    	else if (a == "--metrics-format" && i + 1 < argc) metrics_format = argv[++i];
+    	else if (a.size() > 1 && a[0] == '-') {
+    		cerr << "Unknown option " << a << (i + 1 == argc ? " (or missing its value)" : "") << "\n";
+    		return 1;
+    	}
+    	else args.push_back(a);
+    }
+    if (!batch.empty() && !args.empty()) {
+    	cerr << "Unexpected argument " << args[0] << " (--batch takes its files from the manifest or directory)\n";
+    	return 1;
+    }
+    if (args.size() > 2) {
+    	cerr << "Unexpected argument " << args[2] << " (expected at most a plaintext and a ciphertext file)\n";
+    	return 1;
+    }
+    if (mode != "cbc" && mode != "ctr" && mode != "cbc-cmac" && mode != "cbc-chunked") {
+    	cerr << "Unknown mode " << mode << " (expected cbc, ctr, cbc-cmac or cbc-chunked)\n";
+    	return 1;
+    }
+    const kedes::Mode cipher_mode = mode == "ctr" ? kedes::Mode::ctr
+                                  : mode == "cbc-cmac" ? kedes::Mode::cbc_cmac
+                                  : mode == "cbc-chunked" ? kedes::Mode::cbc_chunked : kedes::Mode::cbc;
+    const bool chunked = cipher_mode == kedes::Mode::cbc_chunked;
+    if (chunked && (segment == 0 || segment > UINT32_MAX)) {
+    	cerr << "Invalid --segment size (expected 8 bytes to 4 GiB)\n";
+    	return 1;
+    }
+    if (format != "bin" && format != "hex") {
+    	cerr << "Unknown format " << format << " (expected bin or hex)\n";
+    	return 1;
+    }
+    if ((aio || use_mmap) && format != "bin") {
+    	cerr << (aio ? "--aio" : "--mmap") << " writes a KE-DES container; it cannot be combined with -f hex\n";
+    	return 1;
+    }
+    if ((int)stream + (int)aio + (int)use_mmap > 1) {
+    	cerr << "--stream, --aio and --mmap are alternatives; pick one\n";
+    	return 1;
+    }
+    if (chunked && format != "bin") {
+    	cerr << "cbc-chunked records its segment IVs in a KE-DES container; it cannot be combined with -f hex\n";
+    	return 1;
+    }
+    kedes::MetricsFormat mfmt;
+    if (!kedes::parse_metrics_format(metrics_format, mfmt)) {
+    	cerr << "Unknown metrics format " << metrics_format << " (expected json or prom)\n";
+    	return 1;
+    }
+    // before any worker threads exist, so they all leave SIGUSR1 to the dump thread
+    if (!metrics_file.empty()) kedes::enable_metrics(metrics_file, mfmt);
+    if (kernel != kedes::Kernel::automatic && !kedes::set_kernel(kernel)) {
+    	cerr << "Kernel " << kedes::to_string(kernel) << " is not supported by this CPU\n";
+    	return 1;
+    }
+    if (cross_check >= 0) kedes::set_cross_check((unsigned)cross_check);
+    const bool hex_out = format == "hex";
+
+    if (!batch.empty()) {
+    	// many files in one process: no key dump, one result line per file
+    	kedes::BatchOptions bopt;
+    	bopt.mode = cipher_mode;
+    	bopt.iv = iv;
+    	bopt.hex = hex_out;
+    	bopt.segment_bytes = segment;
+    	vector<kedes::BatchJob> jobs;
+    	string error;
+    	if (!kedes::load_jobs(batch, out_dir, bopt, Key, jobs, error)) {
+    		cerr << error << "\n";
+    		return 1;
+    	}
+    	kedes::ThreadPool pool(threads);
+    	bopt.pool = threads == 1 ? nullptr : &pool;
+    	size_t failed = 0;
+    	kedes::run_batch(jobs, bopt, [&](const kedes::BatchResult& r) {
+    		if (!r.ok) {
+    			++failed;
+    			cerr << "FAIL " << r.input << ": " << r.message << "\n";
+    		} else if (!r.message.empty()) {
+    			cerr << "WARN " << r.input << ": " << r.message << "\n";
+    		}
+    		if (r.ok && !quiet) cout << "OK   " << r.input << " -> " << r.output << " (" << r.bytes_in << " bytes)\n";
+    	});
+    	if (!quiet) cout << "Batch complete: " << jobs.size() << " files, " << failed << " failed.\n";
+    	return failed ? 1 : 0;
+    }
 
-    // 1) Convert to MSB-first 1-based vector
-    vector<int> key64 = ull_to_bits_msb(Key, 64);
+    const string infile_name = args.size() > 0 ? args[0] : "plaintext.txt";
+    const string outfile_name = args.size() > 1 ? args[1] : (hex_out ? "ciphertext.txt" : "ciphertext.bin");
 
     // start timing key generation (PC-1 .. round key generation)
     auto key_gen_start = chrono::high_resolution_clock::now();
+    kedes::KeySchedule ks(Key);
+    auto key_gen_end = chrono::high_resolution_clock::now();
 
-    // 2) Apply PC-1 to obtain 56-bit key
-    vector<int> key56 = apply_permutation(key64, PC1, 56);
-    cout << "After PC-1 (56 bits): ";
-    for (int i = 1; i <= 56; ++i) cout << key56[i];
-    cout << endl;
-
-    // 3) Apply Odd/Even transform on 56-bit block
-    odd_even_transform(key56);
-    cout << "After Odd/Even transform (56 bits): ";
-    for (int i = 1; i <= 56; ++i) cout << key56[i];
-    cout << endl;
-
-    // 4) Split into C0 and D0 (28 bits each)
-    vector<int> C(29), D(29); // 1-based sizes 28
-    for (int i = 1; i <= 28; ++i) {
-    	C[i] = key56[i];
-    	D[i] = key56[28 + i];
-    }
-    cout << "C0: ";
-    for (int i = 1; i <= 28; ++i) cout << C[i];
-    cout << "\nD0: ";
-    for (int i = 1; i <= 28; ++i) cout << D[i];
-    cout << endl;
-
-    // 5) Generate K1..K16 using left rotations and PC-2
-    vector<string> roundKeysHex;
-    vector<vector<int>> roundKeysBits; // store 1-based 48-bit keys
-    for (int round = 0; round < 16; ++round) {
-    	// left rotate according to schedule
-    	rot_left(C, SHIFTS[round]);
-    	rot_left(D, SHIFTS[round]);
-
-    	// concatenate C||D into 56-bit
-    	vector<int> CD(57);
-    	for (int i = 1; i <= 28; ++i) CD[i] = C[i];
-    	for (int i = 1; i <= 28; ++i) CD[28 + i] = D[i];
-
-    	// apply PC-2 to get 48-bit key
-    	vector<int> K = apply_permutation(CD, PC2, 48);
-
-    	// store hex and bits
-    	string hexk = bits_to_hex_string(K);
-    	roundKeysHex.push_back(hexk);
-    	roundKeysBits.push_back(K);
-
-    	// print round info
-    	cout << "K" << (round+1) << " (48 bits) = ";
-    	for (int i = 1; i <= 48; ++i) cout << K[i];
-    	cout << "  hex: 0x" << hexk << endl;
-
-    	// print K1 generation time (time from key_gen_start to completion of K1)
-    	if (round == 0) {
-    		auto k1_end = chrono::high_resolution_clock::now();
-    		auto k1_ns = chrono::duration_cast<chrono::nanoseconds>(k1_end - key_gen_start).count();
-    		double k1_ms = double(k1_ns) / 1e6;
-    		cout << fixed << setprecision(3) << "K1 generation time: " << k1_ms << " ms" << endl;
-    		cout << defaultfloat;
+    if (!quiet) {
+    	//convert the key to 64-bits binary format (MSB-first)
+    	bitset<64> Key_Bin(Key);
+    	cout << "Key in binary format: " << Key_Bin << "\n";
+
+    	// PC-1 output, Odd/Even transform and the C0/D0 split (28 bits each)
+    	cout << "After PC-1 (56 bits): " << bitset<56>(ks.pc1()) << "\n";
+    	cout << "After Odd/Even transform (56 bits): " << bitset<56>(ks.cd0()) << "\n";
+    	cout << "C0: " << bitset<28>(ks.cd0() >> 28);
+    	cout << "\nD0: " << bitset<28>(ks.cd0());
+    	cout << "\n";
+
+    	// K1..K16 (left rotations and PC-2)
+    	vector<string> roundKeysHex;
+    	for (int round = 0; round < 16; ++round) {
+    		uint64_t K = ks.encrypt_keys()[round];
+    		string hexk = round_key_hex(K);
+    		roundKeysHex.push_back(hexk);
+    		cout << "K" << (round+1) << " (48 bits) = " << bitset<48>(K) << "  hex: 0x" << hexk << "\n";
     	}
-    }
 
-    // stop timing key generation (use nanoseconds for sub-millisecond precision)
-    auto key_gen_end = chrono::high_resolution_clock::now();
-    auto key_gen_ns = chrono::duration_cast<chrono::nanoseconds>(key_gen_end - key_gen_start).count();
-    double key_gen_ms = double(key_gen_ns) / 1e6; // milliseconds with fractional part
-    cout << fixed << setprecision(3) << "Key generation time: " << key_gen_ms << " ms" << endl;
-    cout << defaultfloat; // restore default formatting
+    	// key generation time (use nanoseconds for sub-millisecond precision)
+    	auto key_gen_ns = chrono::duration_cast<chrono::nanoseconds>(key_gen_end - key_gen_start).count();
+    	double key_gen_ms = double(key_gen_ns) / 1e6; // milliseconds with fractional part
+    	cout << fixed << setprecision(3) << "Key generation time: " << key_gen_ms << " ms" << "\n";
+    	cout << defaultfloat; // restore default formatting
 
-    // Optional: list keys summarized
-    cout << "\nRound keys (hex):\n";
-    for (int i = 0; i < (int)roundKeysHex.size(); ++i) {
-    	cout << "K" << (i+1) << ": 0x" << roundKeysHex[i] << "\n";
+    	// Optional: list keys summarized
+    	cout << "\nRound keys (hex):\n";
+    	for (int i = 0; i < (int)roundKeysHex.size(); ++i) {
+    		cout << "K" << (i+1) << ": 0x" << roundKeysHex[i] << "\n";
+    	}
+    	cout << flush;
     }
 
-    // --- New: read plaintext.txt, pad, encrypt in CBC mode, write ciphertext.txt (hex) ---
-    const string infile_name = "plaintext.txt";
-    const string outfile_name = "ciphertext.txt";
-
+    // --- read plaintext, encrypt (CBC or CTR), write ciphertext (container or hex) ---
     ifstream infile(infile_name, ios::binary);
     if (!infile) {
     	cerr << "Cannot open " << infile_name << " for reading.\n";
     	return 1;
     }
-    vector<uint8_t> plain;
     infile.seekg(0, ios::end);
     size_t fsize = infile.tellg();
     infile.seekg(0, ios::beg);
-    plain.resize(fsize);
-    infile.read(reinterpret_cast<char*>(plain.data()), (streamsize)fsize);
-    infile.close();
-
-    // PKCS#7 padding to 8 bytes
-    size_t pad_len = 8 - (plain.size() % 8);
-    if (pad_len == 0) pad_len = 8;
-    for (size_t i = 0; i < pad_len; ++i) plain.push_back((uint8_t)pad_len);
-
-    // CBC IV = 8 zero bytes
-    vector<uint8_t> iv(8, 0);
-    vector<uint8_t> prev_cipher = iv;
-    vector<uint8_t> cipher_bytes;
 
-    for (size_t pos = 0; pos < plain.size(); pos += 8) {
-    	// XOR plaintext block with prev_cipher
-    	vector<uint8_t> block(8);
-    	for (int i = 0; i < 8; ++i) block[i] = plain[pos + i] ^ prev_cipher[i];
-
-    	// convert to bits
-    	vector<int> block_bits = bytes_to_bits_msb(block, 0);
+    unique_ptr<kedes::ThreadPool> pool;
+    if ((mode == "ctr" || chunked) && threads != 1) pool = make_unique<kedes::ThreadPool>(threads);
+
+    kedes::StreamOptions opt;
+    opt.mode = cipher_mode;
+    opt.iv = iv;
+    opt.pool = pool.get();
+    // cbc-chunked: one derived IV per segment, written to the container ahead of the ciphertext
+    vector<uint64_t> segment_ivs;
+    if (chunked) {
+    	segment_ivs.resize(kedes::segment_count(kedes::cipher_size(opt.mode, fsize), segment));
+    	kedes::derive_segment_ivs(ks, iv, segment_ivs);
+    	opt.segments = {segment, segment_ivs};
+    }
 
-    	// encrypt block
-    	vector<int> cipher_bits = des_encrypt_block(block_bits, roundKeysBits);
+    if (aio) {
+    	// read -> cipher -> write straight between the two files, buffers never copied
+    	infile.close();
+    	int in_fd = open(infile_name.c_str(), O_RDONLY | O_CLOEXEC);
+    	if (in_fd < 0) {
+    		cerr << "Cannot open " << infile_name << " for reading.\n";
+    		return 1;
+    	}
+    	int out_fd = open(outfile_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    	if (out_fd < 0) {
+    		cerr << "Cannot open " << outfile_name << " for writing.\n";
+    		close(in_fd);
+    		return 1;
+    	}
+    	kedes::FileCryptOptions fopt;
+    	fopt.stream = opt;
+    	fopt.backend = io_backend;
+    	fopt.direct = direct;
+
+    	kedes::ContainerHeader header;
+    	header.mode = opt.mode;
+    	header.iv = iv;
+    	header.plain_len = fsize;
+    	header.chunk_bytes = (uint32_t)(chunked ? segment : opt.chunk_bytes);
+    	fopt.out_offset = kedes::ciphertext_offset(header);
+    	vector<byte> hdr(fopt.out_offset);
+    	kedes::encode_header(header, span<byte>(hdr).first<kedes::CONTAINER_HEADER_SIZE>());
+    	kedes::encode_segment_index(segment_ivs, span<byte>(hdr).subspan(kedes::CONTAINER_HEADER_SIZE));
+    	bool ok = pwrite(out_fd, hdr.data(), hdr.size(), 0) == (ssize_t)hdr.size();
+
+    	kedes::IoBackend used;
+    	kedes::StreamStats stats = kedes::file_encrypt(in_fd, out_fd, ks, fopt, &used);
+    	close(in_fd);
+    	ok = close(out_fd) == 0 && ok && !stats.write_error;
+    	if (stats.status == kedes::Status::bad_segments) {
+    		cerr << infile_name << " grew while it was encrypted; its segment index is too short\n";
+    		return 1;
+    	}
+    	if (stats.read_error) {
+    		cerr << "Error reading " << infile_name << "\n";
+    		return 1;
+    	}
+    	if (!ok) {
+    		cerr << "Error writing " << outfile_name << "\n";
+    		return 1;
+    	}
+    	if (!quiet) cout << "Encryption complete. Ciphertext written to " << outfile_name << " (KE-DES container, "
+    	                 << kedes::to_string(used) << ").\n";
+    	return 0;
+    }
 
-    	// convert back to bytes
-    	vector<uint8_t> cbytes = bits64_to_bytes(cipher_bits);
-    	// append to result
-    	for (auto b : cbytes) cipher_bytes.push_back(b);
-    	// update prev_cipher
-    	prev_cipher = cbytes;
+    if (use_mmap) {
+    	// the cipher reads the mapped plaintext and writes into the mapped container
+    	infile.close();
+    	kedes::MappedFile in, out;
+    	string error;
+    	kedes::ContainerHeader header;
+    	header.mode = opt.mode;
+    	header.iv = iv;
+    	header.plain_len = fsize;
+    	if (chunked) header.chunk_bytes = (uint32_t)segment;
+    	const size_t offset = kedes::ciphertext_offset(header);
+    	if (!in.open_read(infile_name, error) ||
+    	    !out.create(outfile_name, offset + kedes::cipher_size(opt.mode, in.size()), error)) {
+    		cerr << error << "\n";
+    		return 1;
+    	}
+    	kedes::encode_header(header, out.data().first<kedes::CONTAINER_HEADER_SIZE>());
+    	kedes::encode_segment_index(segment_ivs, out.data().subspan(kedes::CONTAINER_HEADER_SIZE));
+    	kedes::count(kedes::Counter::bytes_in, in.size());
+    	size_t n = kedes::encrypt_mapped(ks, opt.mode, iv, in.data(), out.data().subspan(offset), pool.get(),
+    	                                 opt.segments);
+    	if (chunked && n == 0) {
+    		out.close(0, error);
+    		cerr << infile_name << " grew while it was encrypted; its segment index is too short\n";
+    		return 1;
+    	}
+    	kedes::count(kedes::Counter::bytes_out, offset + n);
+    	if (!out.close(out.size(), error)) {
+    		cerr << "Error writing " << outfile_name << ": " << error << "\n";
+    		return 1;
+    	}
+    	if (!quiet) cout << "Encryption complete. Ciphertext written to " << outfile_name << " (KE-DES container, mmap).\n";
+    	return 0;
     }
 
-    // write ciphertext as hex text file
-    ofstream outfile(outfile_name);
+    ofstream outfile(outfile_name, hex_out ? ios::out : ios::out | ios::binary);
     if (!outfile) {
     	cerr << "Cannot open " << outfile_name << " for writing.\n";
     	return 1;
     }
-    // write hex
-    outfile << hex << uppercase;
-    for (size_t i = 0; i < cipher_bytes.size(); ++i) {
-    	outfile << setw(2) << setfill('0') << (int)cipher_bytes[i];
-    	if ((i+1) % 16 == 0) outfile << "\n";
+    if (!hex_out) {
+    	kedes::ContainerHeader header;
+    	header.mode = opt.mode;
+    	header.iv = iv;
+    	header.plain_len = fsize;
+    	header.chunk_bytes = chunked ? (uint32_t)segment : stream ? (uint32_t)opt.chunk_bytes : 0;
+    	kedes::write_header(outfile, header);
+    	kedes::write_segment_index(outfile, segment_ivs);
+    }
+    const char* format_name = hex_out ? "hex format" : "KE-DES container";
+
+    if (stream) {
+    	// reader / cipher / writer stages over fixed-size chunks
+    	kedes::Sink sink = hex_out ? kedes::hex_sink(outfile) : kedes::ostream_sink(outfile);
+    	kedes::StreamStats stats = kedes::stream_encrypt(kedes::istream_source(infile), sink, ks, opt);
+    	if (stats.status == kedes::Status::bad_segments) {
+    		cerr << infile_name << " grew while it was encrypted; its segment index is too short\n";
+    		return 1;
+    	}
+    	if (stats.write_error) {
+    		cerr << "Error writing " << outfile_name << "\n";
+    		return 1;
+    	}
+    	if (!quiet) cout << "Encryption complete. Ciphertext written to " << outfile_name << " (" << format_name << ").\n";
+    	return 0;
     }
-    outfile << dec << "\n";
-    outfile.close();
 
-    cout << "Encryption complete. Ciphertext written to " << outfile_name << " (hex format).\n";
+    // one buffer, with room for the padding block and tag, holds the plaintext and then the ciphertext
+    vector<byte> buffer(kedes::cipher_size(opt.mode, fsize));
+    {
+    	kedes::StageTimer timer(kedes::Stage::read);
+    	infile.read(reinterpret_cast<char*>(buffer.data()), (streamsize)fsize);
+    	infile.close();
+    }
+    kedes::count(kedes::Counter::bytes_in, fsize);
+
+    size_t cipher_len = fsize;
+    if (opt.mode == kedes::Mode::ctr) {
+    	// CTR: counter blocks are independent, so the keystream is spread over the pool
+    	kedes::ctr_crypt(ks, iv, 0, span<const byte>(buffer.data(), fsize), span<byte>(buffer.data(), fsize), pool.get());
+    } else if (chunked) {
+    	// segments are independent chains, spread over the pool
+    	cipher_len = kedes::pkcs7_pad(buffer, fsize);
+    	uint64_t chain = iv;
+    	kedes::cbc_encrypt_segments(ks, opt.segments, 0, span<const byte>(buffer.data(), cipher_len),
+    	                            span<byte>(buffer.data(), cipher_len), chain, pool.get());
+    } else if (opt.mode == kedes::Mode::cbc_cmac) {
+    	// CBC and the CMAC chain in one pass, the tag appended
+    	cipher_len = kedes::encrypt_authenticated(ks, buffer, fsize, iv);
+    } else {
+    	// PKCS#7 padding and CBC (IV = 8 zero bytes unless --iv is given)
+    	cipher_len = kedes::encrypt_in_place(ks, buffer, fsize, iv);
+    }
+    span<const byte> cipher_bytes(buffer.data(), cipher_len);
+
+    {
+    	kedes::StageTimer timer(kedes::Stage::write);
+    	if (hex_out) {
+    		// write hex (16 bytes per line, then a final newline)
+    		size_t column = 0;
+    		string text(kedes::hex_encoded_size(cipher_bytes.size()) + 1, '\n');
+    		size_t len = kedes::hex_encode_lines(cipher_bytes, column, text.data());
+    		outfile.write(text.data(), (streamsize)len + 1);
+    	} else {
+    		outfile.write(reinterpret_cast<const char*>(cipher_bytes.data()), (streamsize)cipher_bytes.size());
+    	}
+    	outfile.close();
+    }
+    if (!outfile) {
+    	cerr << "Error writing " << outfile_name << "\n";
+    	return 1;
+    }
+    kedes::count(kedes::Counter::bytes_out, cipher_bytes.size());
+
+    if (!quiet) cout << "Encryption complete. Ciphertext written to " << outfile_name << " (" << format_name << ").\n";
 
     return 0;
-}
\ No newline at end of file
+}
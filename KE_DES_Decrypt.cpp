@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -6,302 +7,522 @@
 #include <iomanip>
 #include <cstdint>
 #include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kedes.h"
+#include "kedes_aio.h"
+#include "kedes_batch.h"
+#include "kedes_container.h"
+#include "kedes_dispatch.h"
+#include "kedes_hex.h"
+#include "kedes_metrics.h"
+#include "kedes_mmap.h"
+#include "kedes_stream.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
 
 using namespace std;
 
-// Key and tables (must match the encryption program)
+// Key (must match the encryption program)
 unsigned long long Key = 0x133457799BBCDFF1ULL;
 
-static const int PC1[56] = {
-	57,49,41,33,25,17,9,
-	1,58,50,42,34,26,18,
-	10,2,59,51,43,35,27,
-	19,11,3,60,52,44,36,
-	63,55,47,39,31,23,15,
-	7,62,54,46,38,30,22,
-	14,6,61,53,45,37,29,
-	21,13,5,28,20,12,4
-};
-
-static const int PC2[48] = {
-	14,17,11,24,1,5,
-	3,28,15,6,21,10,
-	23,19,12,4,26,8,
-	16,7,27,20,13,2,
-	41,52,31,37,47,55,
-	30,40,51,45,33,48,
-	44,49,39,56,34,53,
-	46,42,50,36,29,32
-};
-
-static const int SHIFTS[16] = {1,1,2,2,2,2,2,2,1,2,2,2,2,2,2,1};
-
-static const int E_TABLE[48] = {
-	32,1,2,3,4,5,
-	4,5,6,7,8,9,
-	8,9,10,11,12,13,
-	12,13,14,15,16,17,
-	16,17,18,19,20,21,
-	20,21,22,23,24,25,
-	24,25,26,27,28,29,
-	28,29,30,31,32,1
-};
-
-static const int P_TABLE[32] = {
-	16,7,20,21,29,12,28,17,
-	1,15,23,26,5,18,31,10,
-	2,8,24,14,32,27,3,9,
-	19,13,30,6,22,11,4,25
-};
-
-static const int IP[64] = {
-	58,50,42,34,26,18,10,2,
-	60,52,44,36,28,20,12,4,
-	62,54,46,38,30,22,14,6,
-	64,56,48,40,32,24,16,8,
-	57,49,41,33,25,17,9,1,
-	59,51,43,35,27,19,11,3,
-	61,53,45,37,29,21,13,5,
-	63,55,47,39,31,23,15,7
-};
-
-static const int IP_INV[64] = {
-	40,8,48,16,56,24,64,32,
-	39,7,47,15,55,23,63,31,
-	38,6,46,14,54,22,62,30,
-	37,5,45,13,53,21,61,29,
-	36,4,44,12,52,20,60,28,
-	35,3,43,11,51,19,59,27,
-	34,2,42,10,50,18,58,26,
-	33,1,41,9,49,17,57,25
-};
+// Keep printable ASCII and common whitespace; replace other bytes with '?'
+static char clean_char(byte by) {
+	uint8_t b = to_integer<uint8_t>(by);
+	if (b == '\n' || b == '\r' || b == '\t' || (b >= 32 && b <= 126)) return static_cast<char>(b);
+	return '?'; // or drop non-printable bytes instead
+}
 
-// Helpers (1-based vectors)
-static vector<int> ull_to_bits_msb(unsigned long long v, int n) {
-	vector<int> out(n+1);
-	for (int i = 1; i <= n; ++i) {
-		int shift = n - i;
-		out[i] = ((v >> shift) & 1ULL) ? 1 : 0;
+// cleans a slice at a time through a fixed buffer, so the cleaned text is never held
+// in memory as a whole
+static void write_cleaned(span<const byte> bytes, ostream& out) {
+	char slice[64 * 1024];
+	for (size_t pos = 0; pos < bytes.size(); pos += sizeof(slice)) {
+		size_t n = min(sizeof(slice), bytes.size() - pos);
+		for (size_t i = 0; i < n; ++i) slice[i] = clean_char(bytes[pos + i]);
+		out.write(slice, (streamsize)n);
 	}
-	return out;
 }
 
-static vector<int> apply_permutation(const vector<int>& in, const int* table, int tlen) {
-	vector<int> out(tlen+1);
-	for (int i = 0; i < tlen; ++i) out[i+1] = in[ table[i] ];
-	return out;
+static kedes::Mode mode_from_name(const string& mode) {
+	if (mode == "ctr") return kedes::Mode::ctr;
+	if (mode == "cbc-cmac") return kedes::Mode::cbc_cmac;
+	if (mode == "cbc-chunked") return kedes::Mode::cbc_chunked;
+	return kedes::Mode::cbc;
 }
 
-static void odd_even_transform(vector<int>& b) {
-	int n = (int)b.size()-1;
-	for (int j = 1; j <= n; ++j) {
-		if (j <= 28) b[j] = (j % 2 == 0) ? 1 : 0;
-		else b[j] = (j % 2 == 1) ? 1 : 0;
+// usage: KE_DES_Decrypt [-m cbc|ctr|cbc-cmac|cbc-chunked] [--iv hex] [-t threads] [--stream | --aio | --mmap] [-q]
+//                       [--io auto|uring|threads] [--direct] [--kernel name] [--cross-check N]
+//                       [--metrics file] [--metrics-format json|prom] [ciphertext file]
+//                       [decrypted text file] [decrypted raw file]
+//        KE_DES_Decrypt --batch manifest|directory [--out dir] [-m cbc|ctr|cbc-cmac|cbc-chunked] [--iv hex]
+//                       [-t threads] [-q]
+// The input is either a KE-DES container (mode and IV are taken from its header) or hex
+// text; the default input is ciphertext.bin if it exists, else ciphertext.txt.
+//   -m, --mode        cbc (default), ctr or cbc-cmac for hex input; must match the encryption.
+//                     A cbc-cmac input whose tag does not match is rejected: nothing is
+//                     kept (the chunked paths remove what they wrote) and the exit code is 1.
+//                     cbc-chunked needs the segment index of a container, so hex input
+//                     given that mode is rejected
+//   --iv, --nonce     CBC IV / initial CTR counter block as hex for hex input (default 0)
+//   -t, --threads N   decryption threads (default: one per hardware thread, 1 = serial);
+//                     cbc-chunked containers decrypt a segment per task
+//   --stream          decrypt in fixed-size chunks with bounded memory instead of loading the file
+//   --aio             asynchronous chunk pipeline from a container straight into the raw output
+//                     file (the cleaned text is written from the same buffers); hex input
+//                     falls back to the whole-file path
+//   --io BACKEND      auto (default: io_uring when the kernel allows it), uring or threads; implies --aio
+//   --direct          O_DIRECT for the raw plaintext writes; implies --aio
+//   --mmap            decrypt from the mapped container straight into the mapped raw output
+//                     file; hex input falls back to the whole-file path
+//   --kernel NAME     block kernel: auto (default: the widest the CPU supports), scalar, bs64,
+//                     sse2, avx2 or avx512; KEDES_KERNEL=NAME does the same
+//   --cross-check N   recompute 1 in N blocks with the reference engine and abort on a
+//                     mismatch; KEDES_CROSS_CHECK=N does the same
+//   --batch SRC       decrypt every file of a manifest (input[<TAB>output[<TAB>key]] per line)
+//                     or every .bin/.txt file of a directory tree to raw plaintext; outputs
+//                     drop a .bin/.txt suffix or get .dec appended
+//   --out DIR         put batch outputs under DIR instead of next to the inputs
+//   -q, --quiet       no progress messages, only errors and warnings
+//   --metrics FILE    record counters and stage latencies; written to FILE ("-" = stdout)
+//                     at exit and on SIGUSR1, as json (default) or prom (Prometheus text)
+int main(int argc, char** argv) {
+	string mode = "cbc";
+	uint64_t iv = 0;
+	unsigned threads = 0;
+	bool stream = false;
+	bool aio = false;
+	bool direct = false;
+	bool use_mmap = false;
+	kedes::IoBackend io_backend = kedes::IoBackend::automatic;
+	kedes::Kernel kernel = kedes::Kernel::automatic;
+	int cross_check = -1;
+	bool quiet = false;
+	string metrics_file;
+	string metrics_format = "json";
+	string batch;
+	string out_dir;
+	vector<string> args;
+	for (int i = 1; i < argc; ++i) {
+		string a = argv[i];
+		if ((a == "-m" || a == "--mode") && i + 1 < argc) mode = argv[++i];
+		else if ((a == "--iv" || a == "--nonce") && i + 1 < argc) {
+			if (!kedes::parse_hex64(argv[++i], iv)) {
+				cerr << "Invalid " << a << " value " << argv[i] << " (expected up to 16 hex digits)\n";
+				return 1;
+			}
+		}
+		else if ((a == "-t" || a == "--threads" || a == "--cross-check") && i + 1 < argc) {
+			uint64_t n;
+			if (!kedes::parse_unsigned(argv[++i], n) || n > UINT32_MAX) {
+				cerr << "Invalid " << a << " value " << argv[i] << " (expected a number)\n";
+				return 1;
+			}
+			if (a == "--cross-check") cross_check = (int)min<uint64_t>(n, INT32_MAX);
+			else threads = (unsigned)n;
+		}
+		else if (a == "--stream") stream = true;
+		else if (a == "--aio") aio = true;
+		else if (a == "--mmap") use_mmap = true;
+		else if (a == "--direct") aio = direct = true;
+		else if (a == "--io" && i + 1 < argc) {
+			if (!kedes::parse_io_backend(argv[++i], io_backend)) {
+				cerr << "Unknown I/O backend " << argv[i] << " (expected auto, uring or threads)\n";
+				return 1;
+			}
+			aio = true;
+		}
+		else if (a == "--kernel" && i + 1 < argc) {
+			if (!kedes::parse_kernel(argv[++i], kernel)) {
+				cerr << "Unknown kernel " << argv[i] << " (expected auto, scalar, bs64, sse2, avx2 or avx512)\n";
+				return 1;
+			}
+		}
+		else if (a == "--batch" && i + 1 < argc) batch = argv[++i];
+		else if (a == "--out" && i + 1 < argc) out_dir = argv[++i];
+		else if (a == "-q" || a == "--quiet") quiet = true;
+		else if (a == "--metrics" && i + 1 < argc) metrics_file = argv[++i];
+		else if (a == "--metrics-format" && i + 1 < argc) metrics_format = argv[++i];
+		else if (a.size() > 1 && a[0] == '-') {
+			cerr << "Unknown option " << a << (i + 1 == argc ? " (or missing its value)" : "") << "\n";
+			return 1;
+		}
+		else args.push_back(a);
 	}
-}
-
-static void rot_left(vector<int>& v, int shifts) {
-	int n = (int)v.size()-1;
-	if (n == 0) return;
-	shifts %= n;
-	if (shifts == 0) return;
-	vector<int> tmp(n+1);
-	for (int i = 1; i <= n; ++i) {
-		int src = ((i + shifts - 1) % n) + 1;
-		tmp[i] = v[src];
+	if (!batch.empty() && !args.empty()) {
+		cerr << "Unexpected argument " << args[0] << " (--batch takes its files from the manifest or directory)\n";
+		return 1;
 	}
-	v = tmp;
-}
-
-static void sbox_substitution(const vector<int>& in48, vector<int>& out32) {
-	for (int i = 0; i < 8; ++i) {
-		int base = i*6;
-		int val = 0;
-		for (int b = 0; b < 6; ++b) val = (val << 1) | in48[base + b + 1];
-		int nibble = ((val * (i+1)) ^ (val >> 2)) & 0xF;
-		for (int b = 0; b < 4; ++b) out32[i*4 + b + 1] = ((nibble >> (3 - b)) & 1);
+	if (args.size() > 3) {
+		cerr << "Unexpected argument " << args[3] << " (expected at most a ciphertext, a text and a raw output file)\n";
+		return 1;
 	}
-}
-
-static vector<int> feistel_f(const vector<int>& R32, const vector<int>& K48) {
-	vector<int> Rexp = apply_permutation(R32, E_TABLE, 48);
-	vector<int> tmp(48+1);
-	for (int i = 1; i <= 48; ++i) tmp[i] = Rexp[i] ^ K48[i];
-	vector<int> sbout(32+1);
-	sbox_substitution(tmp, sbout);
-	vector<int> pout = apply_permutation(sbout, P_TABLE, 32);
-	return pout;
-}
-
-static vector<int> des_block_operation(const vector<int>& block64, const vector<vector<int>>& roundKeys) {
-	vector<int> ip = apply_permutation(block64, IP, 64);
-	vector<int> L(33), R(33);
-	for (int i = 1; i <= 32; ++i) { L[i] = ip[i]; R[i] = ip[32 + i]; }
-	for (int r = 0; r < 16; ++r) {
-		vector<int> f = feistel_f(R, roundKeys[r]);
-		vector<int> newR(33);
-		for (int i = 1; i <= 32; ++i) newR[i] = L[i] ^ f[i];
-		L = R;
-		R = newR;
+	if (mode != "cbc" && mode != "ctr" && mode != "cbc-cmac" && mode != "cbc-chunked") {
+		cerr << "Unknown mode " << mode << " (expected cbc, ctr, cbc-cmac or cbc-chunked)\n";
+		return 1;
 	}
-	vector<int> preout(65);
-	for (int i = 1; i <= 32; ++i) { preout[i] = R[i]; preout[32 + i] = L[i]; }
-	vector<int> out = apply_permutation(preout, IP_INV, 64);
-	return out;
-}
-
-// bytes <-> bits (MSB first)
-static vector<int> bytes_to_bits_msb(const vector<uint8_t>& bytes, size_t start) {
-	vector<int> bits(64+1);
-	for (int i = 0; i < 8; ++i) {
-		uint8_t b = bytes[start + i];
-		for (int bit = 0; bit < 8; ++bit) bits[i*8 + bit + 1] = ((b >> (7 - bit)) & 1) ? 1 : 0;
+	if ((int)stream + (int)aio + (int)use_mmap > 1) {
+		cerr << "--stream, --aio and --mmap are alternatives; pick one\n";
+		return 1;
 	}
-	return bits;
-}
-
-static vector<uint8_t> bits64_to_bytes(const vector<int>& bits) {
-	vector<uint8_t> out(8,0);
-	for (int i = 0; i < 8; ++i) {
-		uint8_t b = 0;
-		for (int bit = 0; bit < 8; ++bit) b = (b << 1) | (bits[i*8 + bit + 1] & 1);
-		out[i] = b;
+	kedes::MetricsFormat mfmt;
+	if (!kedes::parse_metrics_format(metrics_format, mfmt)) {
+		cerr << "Unknown metrics format " << metrics_format << " (expected json or prom)\n";
+		return 1;
 	}
-	return out;
-}
+	// before any worker threads exist, so they all leave SIGUSR1 to the dump thread
+	if (!metrics_file.empty()) kedes::enable_metrics(metrics_file, mfmt);
+	if (kernel != kedes::Kernel::automatic && !kedes::set_kernel(kernel)) {
+		cerr << "Kernel " << kedes::to_string(kernel) << " is not supported by this CPU\n";
+		return 1;
+	}
+	if (cross_check >= 0) kedes::set_cross_check((unsigned)cross_check);
+
+	if (!batch.empty()) {
+		// containers carry their own mode and IV; -m/--iv apply to hex inputs
+		kedes::BatchOptions bopt;
+		bopt.decrypt = true;
+		bopt.mode = mode_from_name(mode);
+		bopt.iv = iv;
+		vector<kedes::BatchJob> jobs;
+		string error;
+		if (!kedes::load_jobs(batch, out_dir, bopt, Key, jobs, error)) {
+			cerr << error << "\n";
+			return 1;
+		}
+		kedes::ThreadPool pool(threads);
+		bopt.pool = threads == 1 ? nullptr : &pool;
+		size_t failed = 0;
+		kedes::run_batch(jobs, bopt, [&](const kedes::BatchResult& r) {
+			if (!r.ok) {
+				++failed;
+				cerr << "FAIL " << r.input << ": " << r.message << "\n";
+			} else if (!r.message.empty()) {
+				cerr << "WARN " << r.input << ": " << r.message << "\n";
+			}
+			if (r.ok && !quiet) cout << "OK   " << r.input << " -> " << r.output << " (" << r.bytes_out << " bytes)\n";
+		});
+		if (!quiet) cout << "Batch complete: " << jobs.size() << " files, " << failed << " failed.\n";
+		return failed ? 1 : 0;
+	}
+	const string infile_name = args.size() > 0 ? args[0] : (ifstream("ciphertext.bin") ? "ciphertext.bin" : "ciphertext.txt");
+	const string textfile_name = args.size() > 1 ? args[1] : "decrypted.txt";
+	const string rawfile_name = args.size() > 2 ? args[2] : "decrypted_raw.bin";
 
-int main() {
 	// 1) Generate round keys exactly the same as encryption
-	vector<int> key64 = ull_to_bits_msb(Key, 64);
-	vector<int> key56 = apply_permutation(key64, PC1, 56);
-	odd_even_transform(key56);
-	vector<int> C(29), D(29);
-	for (int i = 1; i <= 28; ++i) { C[i] = key56[i]; D[i] = key56[28 + i]; }
-
-	vector<vector<int>> roundKeysBits;
-	for (int round = 0; round < 16; ++round) {
-		rot_left(C, SHIFTS[round]);
-		rot_left(D, SHIFTS[round]);
-		vector<int> CD(57);
-		for (int i = 1; i <= 28; ++i) CD[i] = C[i];
-		for (int i = 1; i <= 28; ++i) CD[28 + i] = D[i];
-		vector<int> K = apply_permutation(CD, PC2, 48);
-		roundKeysBits.push_back(K);
+	kedes::KeySchedule ks(Key);
+
+	unique_ptr<kedes::ThreadPool> pool;
+	if (threads != 1) pool = make_unique<kedes::ThreadPool>(threads);
+
+	// 2) Read ciphertext: KE-DES container (recognised by its magic) or hex text
+	ifstream infile(infile_name, ios::binary);
+	if (!infile) { cerr << "Cannot open " << infile_name << "\n"; return 1; }
+	char magic[4];
+	infile.read(magic, sizeof(magic));
+	const bool container = kedes::is_container(as_bytes(span<const char>(magic, (size_t)infile.gcount())));
+	infile.clear();
+	infile.seekg(0, ios::beg);
+
+	kedes::ContainerHeader header;
+	if (container) {
+		kedes::ContainerError err = kedes::read_header(infile, header);
+		if (err != kedes::ContainerError::none) {
+			cerr << infile_name << ": " << kedes::to_string(err) << "\n";
+			return 1;
+		}
+		mode = header.mode == kedes::Mode::ctr ? "ctr"
+		     : header.mode == kedes::Mode::cbc_cmac ? "cbc-cmac"
+		     : header.mode == kedes::Mode::cbc_chunked ? "cbc-chunked" : "cbc";
+		iv = header.iv;
+	}
+	kedes::Mode cipher_mode = mode_from_name(mode);
+	// cbc-chunked: the segment IVs follow the header
+	vector<uint64_t> segment_ivs;
+	kedes::SegmentLayout segments;
+	if (cipher_mode == kedes::Mode::cbc_chunked) {
+		if (!container) {
+			cerr << infile_name << ": cbc-chunked input must be a container (the segment IVs live in its index)\n";
+			return 1;
+		}
+		kedes::ContainerError err = kedes::read_segment_index(infile, header, segment_ivs);
+		if (err != kedes::ContainerError::none) {
+			cerr << infile_name << ": segment index: " << kedes::to_string(err) << "\n";
+			return 1;
+		}
+		// the index is laid out from plain_len, so a file of another size has a corrupt header
+		infile.seekg(0, ios::end);
+		const uint64_t file_size = (uint64_t)infile.tellg();
+		infile.seekg((streamoff)kedes::ciphertext_offset(header));
+		err = kedes::check_cipher_size(header, file_size - kedes::ciphertext_offset(header));
+		if (err != kedes::ContainerError::none) {
+			cerr << infile_name << ": " << kedes::to_string(err) << " (header records " << header.plain_len << " bytes)\n";
+			return 1;
+		}
+		segments = {header.chunk_bytes, segment_ivs};
 	}
 
-	// reverse keys for decryption: feeding reversed keys into same block operation performs decryption
-	vector<vector<int>> roundKeysRev = roundKeysBits;
-	reverse(roundKeysRev.begin(), roundKeysRev.end());
-
-	// 2) Read ciphertext.txt (hex)
-	ifstream infile("ciphertext.txt");
-	if (!infile) { cerr << "Cannot open ciphertext.txt\n"; return 1; }
-	string all; string line;
-	while (getline(infile, line)) {
-		// accept only hex digits (ignore whitespace, "0x", labels, etc.)
-		for (char c : line) {
-			if (isxdigit(static_cast<unsigned char>(c))) all.push_back(c);
+	// a cbc-cmac input that fails its tag leaves no plaintext behind
+	auto reject = [&](kedes::Status status) {
+		cerr << "Error: " << infile_name
+		     << (status == kedes::Status::bad_length     ? " is not a whole number of blocks"
+		         : status == kedes::Status::bad_segments ? " runs past its segment index"
+		                                                 : " failed authentication (tag mismatch)")
+		     << "; no plaintext written\n";
+		remove(rawfile_name.c_str());
+		remove(textfile_name.c_str());
+		return 1;
+	};
+
+	// warnings and the final message shared by the chunked paths
+	auto finish_stream = [&](const kedes::StreamStats& stats) {
+		if (stats.status == kedes::Status::bad_tag || stats.status == kedes::Status::bad_segments)
+			return reject(stats.status);
+		if (stats.bytes_in == 0 && !container) {
+			cerr << infile_name << " is empty or contains no hex digits\n";
+			cerr << "No cipher bytes parsed; will produce empty " << textfile_name << "\n";
 		}
+		if (stats.truncated != 0) {
+			cerr << "Warning: ciphertext size (" << stats.bytes_in
+			     << " bytes) not multiple of 8; truncating to " << stats.bytes_in - stats.truncated << " bytes\n";
+		}
+		if (stats.bytes_out == 0) {
+			cerr << "No plaintext produced; writing empty " << textfile_name << "\n";
+		} else if (stats.status == kedes::Status::bad_padding) {
+			cerr << "Warning: invalid PKCS#7 padding detected; writing full plaintext without removing padding\n";
+		}
+		if (container && stats.status == kedes::Status::ok && stats.bytes_out != header.plain_len) {
+			cerr << "Warning: container records " << header.plain_len << " plaintext bytes but "
+			     << stats.bytes_out << " were recovered\n";
+		}
+		if (stats.read_error) { cerr << "Error reading " << infile_name << "\n"; return 1; }
+		if (stats.write_error) { cerr << "Error writing " << textfile_name << "\n"; return 1; }
+		if (!quiet) cout << "Decryption complete. Recovered plaintext written to " << textfile_name << "\n";
+		return 0;
+	};
+
+	if (aio && !container) cerr << "Note: --aio needs a KE-DES container; decrypting " << infile_name << " as a whole\n";
+	if (aio && container) {
+		// read -> cipher -> write from the container into the raw output, buffers never copied
+		infile.close();
+		int in_fd = open(infile_name.c_str(), O_RDONLY | O_CLOEXEC);
+		if (in_fd < 0) { cerr << "Cannot open " << infile_name << "\n"; return 1; }
+		int out_fd = open(rawfile_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (out_fd < 0) { cerr << "Cannot open " << rawfile_name << " for writing\n"; close(in_fd); return 1; }
+		ofstream tout(textfile_name); // text mode
+		if (!tout) { cerr << "Cannot open " << textfile_name << " for writing\n"; close(in_fd); close(out_fd); return 1; }
+
+		kedes::FileCryptOptions fopt;
+		fopt.stream.mode = cipher_mode;
+		fopt.stream.iv = iv;
+		fopt.stream.pool = pool.get();
+		fopt.backend = io_backend;
+		fopt.direct = direct;
+		fopt.stream.segments = segments;
+		fopt.in_offset = kedes::ciphertext_offset(header);
+		fopt.tap = [&](span<const byte> data, bool) {
+			write_cleaned(data, tout);
+			return (bool)tout;
+		};
+		kedes::StreamStats stats = kedes::file_decrypt(in_fd, out_fd, ks, fopt);
+		close(in_fd);
+		if (close(out_fd) != 0) stats.write_error = true;
+		return finish_stream(stats);
 	}
-	infile.close();
 
-	if (all.empty()) {
-		cerr << "ciphertext.txt is empty or contains no hex digits\n";
-		// still attempt to create an empty decrypted file below
+	if (use_mmap && !container) cerr << "Note: --mmap needs a KE-DES container; decrypting " << infile_name << " as a whole\n";
+	if (use_mmap && container) {
+		// ciphertext read straight from the mapped container into the mapped raw output
+		infile.close();
+		kedes::MappedFile in, out;
+		string error;
+		if (!in.open_read(infile_name, error)) { cerr << error << "\n"; return 1; }
+		span<const byte> cipher = in.data().subspan(min<uint64_t>(in.size(), kedes::ciphertext_offset(header)));
+		kedes::count(kedes::Counter::bytes_in, cipher.size());
+		if (cipher.size() != kedes::cipher_size(cipher_mode, header.plain_len)) {
+			cerr << "Warning: container records " << header.plain_len << " plaintext bytes but holds "
+			     << cipher.size() << " ciphertext bytes\n";
+		}
+		if (cipher.empty()) cerr << "No cipher bytes parsed; will produce empty " << textfile_name << "\n";
+		if ((cipher_mode == kedes::Mode::cbc || cipher_mode == kedes::Mode::cbc_chunked) && cipher.size() % 8 != 0) {
+			size_t keep = (cipher.size() / 8) * 8;
+			cerr << "Warning: ciphertext size (" << cipher.size()
+			     << " bytes) not multiple of 8; truncating to " << keep << " bytes\n";
+			cipher = cipher.first(keep);
+		}
+		if (!out.create(rawfile_name, cipher.size(), error)) { cerr << error << "\n"; return 1; }
+
+		size_t len;
+		kedes::Status status = kedes::decrypt_mapped(ks, cipher_mode, iv, cipher, out.data(), len, pool.get(), segments);
+		if (status == kedes::Status::bad_tag || status == kedes::Status::bad_length
+		    || status == kedes::Status::bad_segments) {
+			out.close(0, error);
+			return reject(status);
+		}
+		if (len == 0) {
+			cerr << "No plaintext produced; writing empty " << textfile_name << "\n";
+		} else if (status == kedes::Status::bad_padding) {
+			cerr << "Warning: invalid PKCS#7 padding detected; writing full plaintext without removing padding\n";
+		} else if (len != header.plain_len) {
+			cerr << "Warning: container records " << header.plain_len << " plaintext bytes but "
+			     << len << " were recovered\n";
+		}
+		kedes::count(kedes::Counter::bytes_out, len);
+
+		// cleaned text straight from the mapping
+		ofstream tout(textfile_name); // text mode
+		if (!tout) { cerr << "Cannot open " << textfile_name << " for writing\n"; return 1; }
+		write_cleaned(out.data().first(len), tout);
+		tout.close();
+		if (!out.close(len, error)) { cerr << "Error writing " << rawfile_name << ": " << error << "\n"; return 1; }
+		if (!tout) { cerr << "Error writing " << textfile_name << "\n"; return 1; }
+		if (!quiet) cout << "Decryption complete. Recovered plaintext written to " << textfile_name << "\n";
+		return 0;
 	}
 
-	// if odd number of hex chars, prepend '0' so pairs are valid
-	if (all.size() % 2 != 0) {
-		cerr << "Warning: odd-length hex input detected; prepending '0' to parse\n";
-		all.insert(all.begin(), '0');
+	if (stream) {
+		// reader / cipher / writer stages over fixed-size chunks; the raw and cleaned
+		// outputs are written as each chunk completes
+		ofstream bout(rawfile_name, ios::binary);
+		if (!bout) cerr << "Warning: cannot open " << rawfile_name << " for writing\n";
+		ofstream tout(textfile_name); // text mode
+		if (!tout) { cerr << "Cannot open " << textfile_name << " for writing\n"; return 1; }
+		kedes::Sink sink = [&](span<const byte> data, bool) {
+			if (bout) bout.write(reinterpret_cast<const char*>(data.data()), (streamsize)data.size());
+			write_cleaned(data, tout);
+			return (bool)tout;
+		};
+
+		bool odd_digit = false;
+		kedes::StreamOptions opt;
+		opt.mode = cipher_mode;
+		opt.iv = iv;
+		opt.pool = pool.get();
+		opt.segments = segments;
+		kedes::Source source = container ? kedes::istream_source(infile) : kedes::hex_source(infile, &odd_digit);
+		kedes::StreamStats stats = kedes::stream_decrypt(source, sink, ks, opt);
+
+		if (!odd_digit) return finish_stream(stats);
+		// an odd digit count shifts every byte (a '0' is prepended); only known at the end,
+		// so redo the file with the whole-file parser below
+		cerr << "Note: odd-length hex input in streaming mode; re-reading " << infile_name << " as a whole\n";
+		infile.clear();
+		infile.seekg(0, ios::beg);
 	}
+	vector<byte> cipher_bytes;
+	if (container) {
+		// raw ciphertext follows the header (and segment index)
+		streampos start = infile.tellg();
+		infile.seekg(0, ios::end);
+		size_t csize = (size_t)(infile.tellg() - start);
+		infile.seekg(start);
+		cipher_bytes.resize(csize);
+		{
+			kedes::StageTimer timer(kedes::Stage::read);
+			infile.read(reinterpret_cast<char*>(cipher_bytes.data()), (streamsize)csize);
+			infile.close();
+		}
+		kedes::count(kedes::Counter::bytes_in, csize);
+		if (csize != kedes::cipher_size(cipher_mode, header.plain_len)) {
+			cerr << "Warning: container records " << header.plain_len << " plaintext bytes but holds "
+			     << csize << " ciphertext bytes\n";
+		}
+	} else {
+		// keep only hex digits (ignore whitespace, "0x", labels, etc.); one spare byte in
+		// front for the '0' an odd-length input gets
+		infile.seekg(0, ios::end);
+		string all(1 + (size_t)infile.tellg(), '0');
+		infile.seekg(0, ios::beg);
+		{
+			kedes::StageTimer timer(kedes::Stage::read);
+			infile.read(all.data() + 1, (streamsize)(all.size() - 1));
+		}
+		kedes::count(kedes::Counter::bytes_in, (uint64_t)infile.gcount());
+		all.resize(1 + kedes::hex_compact(span<const char>(all.data() + 1, (size_t)infile.gcount()), all.data() + 1));
+		infile.close();
+		size_t digits = all.size() - 1;
+
+		if (digits == 0) {
+			cerr << infile_name << " is empty or contains no hex digits\n";
+			// still attempt to create an empty decrypted file below
+		}
 
-	vector<uint8_t> cipher_bytes;
-	cipher_bytes.reserve(all.size()/2);
-	for (size_t i = 0; i + 1 < all.size(); i += 2) {
-		string bytehex = all.substr(i,2);
-		uint8_t b = static_cast<uint8_t>(strtoul(bytehex.c_str(), nullptr, 16));
-		cipher_bytes.push_back(b);
+		// if odd number of hex chars, prepend '0' so pairs are valid
+		const char* first = all.data() + 1;
+		if (digits % 2 != 0) {
+			cerr << "Warning: odd-length hex input detected; prepending '0' to parse\n";
+			--first;
+			++digits;
+		}
+
+		cipher_bytes.resize(digits / 2);
+		kedes::hex_decode_digits(first, cipher_bytes.size(), cipher_bytes.data());
 	}
 
 	// if ciphertext not multiple of 8 bytes, truncate to nearest lower multiple and warn
 	if (cipher_bytes.empty()) {
-		cerr << "No cipher bytes parsed; will produce empty decrypted.txt\n";
+		cerr << "No cipher bytes parsed; will produce empty " << textfile_name << "\n";
 	}
-	if (cipher_bytes.size() % 8 != 0) {
+	if ((cipher_mode == kedes::Mode::cbc || cipher_mode == kedes::Mode::cbc_chunked) && cipher_bytes.size() % 8 != 0) {
 		size_t keep = (cipher_bytes.size() / 8) * 8;
 		cerr << "Warning: ciphertext size (" << cipher_bytes.size()
 		     << " bytes) not multiple of 8; truncating to " << keep << " bytes\n";
 		cipher_bytes.resize(keep);
 	}
 
-	// CBC IV = 8 zero bytes (same as encryption)
-	vector<uint8_t> iv(8,0), prev_cipher = iv;
-	vector<uint8_t> plain_bytes;
-	plain_bytes.reserve(cipher_bytes.size());
-
-	for (size_t pos = 0; pos < cipher_bytes.size(); pos += 8) {
-		// convert cipher block to bits
-		vector<int> cbits = bytes_to_bits_msb(cipher_bytes, pos);
-		// decrypt block by running block operation with reversed round keys
-		vector<int> dbits = des_block_operation(cbits, roundKeysRev);
-		// convert to bytes
-		vector<uint8_t> pblock = bits64_to_bytes(dbits);
-		// XOR with prev_cipher (CBC)
-		for (int i = 0; i < 8; ++i) {
-			uint8_t pb = pblock[i] ^ prev_cipher[i];
-			plain_bytes.push_back(pb);
-		}
-		// update prev_cipher to current cipher block
-		for (int i = 0; i < 8; ++i) prev_cipher[i] = cipher_bytes[pos + i];
+	// CBC decrypt in place (IV = 8 zero bytes unless recorded or given), chunks spread over
+	// the thread pool, then remove PKCS#7 padding if valid, otherwise write full plaintext
+	// and warn. CTR has no padding and decrypts any length.
+	size_t plain_len = cipher_bytes.size();
+	kedes::Status status = kedes::Status::ok;
+	if (cipher_mode == kedes::Mode::ctr) kedes::ctr_crypt(ks, iv, 0, cipher_bytes, cipher_bytes, pool.get());
+	else if (cipher_mode == kedes::Mode::cbc_cmac) status = kedes::decrypt_authenticated(ks, cipher_bytes, plain_len, iv);
+	else if (cipher_mode == kedes::Mode::cbc_chunked) {
+		uint64_t chain = iv;
+		status = kedes::cbc_decrypt_segments(ks, segments, 0, cipher_bytes, cipher_bytes, chain, pool.get());
+		if (status == kedes::Status::ok) status = kedes::pkcs7_unpad(cipher_bytes, plain_len);
 	}
-
-	// remove PKCS#7 padding if valid, otherwise write full plaintext and warn
+	else status = kedes::decrypt_in_place(ks, cipher_bytes, plain_len, iv, pool.get());
+	if (status == kedes::Status::bad_tag || status == kedes::Status::bad_length
+	    || status == kedes::Status::bad_segments)
+		return reject(status);
+	span<const byte> plain_bytes(cipher_bytes.data(), plain_len);
 	if (plain_bytes.empty()) {
-		cerr << "No plaintext produced; writing empty decrypted.txt\n";
-	} else {
-		uint8_t pad = plain_bytes.back();
-		bool padding_ok = true;
-		if (pad < 1 || pad > 8 || plain_bytes.size() < pad) padding_ok = false;
-		else {
-			for (size_t i = plain_bytes.size() - pad; i < plain_bytes.size(); ++i) {
-				if (plain_bytes[i] != pad) { padding_ok = false; break; }
-			}
-		}
-		if (padding_ok) {
-			plain_bytes.resize(plain_bytes.size() - pad);
-		} else {
-			cerr << "Warning: invalid PKCS#7 padding detected; writing full plaintext without removing padding\n";
-		}
+		cerr << "No plaintext produced; writing empty " << textfile_name << "\n";
+	} else if (status == kedes::Status::bad_padding) {
+		cerr << "Warning: invalid PKCS#7 padding detected; writing full plaintext without removing padding\n";
+	} else if (container && plain_bytes.size() != header.plain_len) {
+		cerr << "Warning: container records " << header.plain_len << " plaintext bytes but "
+		     << plain_bytes.size() << " were recovered\n";
 	}
 
 	// write decrypted bytes to file (always attempt)
+	kedes::StageTimer write_timer(kedes::Stage::write);
+	kedes::count(kedes::Counter::bytes_out, plain_bytes.size());
 	// 1) write raw binary (exact recovered bytes) for verification/debugging
 	{
-		ofstream bout("decrypted_raw.bin", ios::binary);
+		ofstream bout(rawfile_name, ios::binary);
 		if (bout) {
 			if (!plain_bytes.empty()) bout.write(reinterpret_cast<const char*>(plain_bytes.data()), (streamsize)plain_bytes.size());
 			bout.flush();
 			bout.close();
 		} else {
-			cerr << "Warning: cannot open decrypted_raw.bin for writing\n";
+			cerr << "Warning: cannot open " << rawfile_name << " for writing\n";
 		}
 	}
 
-	// 2) produce cleaned human-readable text and write to decrypted.txt
-	// Keep printable ASCII and common whitespace; replace other bytes with '?'
-	string cleaned;
-	cleaned.reserve(plain_bytes.size());
-	for (uint8_t b : plain_bytes) {
-		if (b == '\n' || b == '\r' || b == '\t' || (b >= 32 && b <= 126)) cleaned.push_back(static_cast<char>(b));
-		else cleaned.push_back('?'); // or continue to drop non-printable: continue;
-	}
-	ofstream tout("decrypted.txt"); // text mode
-	if (!tout) { cerr << "Cannot open decrypted.txt for writing\n"; return 1; }
-	tout << cleaned;
+	// 2) produce cleaned human-readable text and write to the decrypted text file
+	ofstream tout(textfile_name); // text mode
+	if (!tout) { cerr << "Cannot open " << textfile_name << " for writing\n"; return 1; }
+	write_cleaned(plain_bytes, tout);
 	tout.flush();
 	tout.close();
 
-	cout << "Decryption complete. Recovered plaintext written to decrypted.txt\n";
+	if (!quiet) cout << "Decryption complete. Recovered plaintext written to " << textfile_name << "\n";
 	return 0;
 }
@@ -0,0 +1,595 @@
+#include "kedes.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "kedes_bitslice.h"
+#include "kedes_dispatch.h"
+#include "kedes_metrics.h"
+#include "kedes_thread_pool.h"
+
+namespace kedes {
+
+KeySchedule::KeySchedule(std::uint64_t key)
+	: key_(key),
+	  pc1_(PC1_LUT(key)),
+	  cd0_(odd_even_transform_packed(pc1_)) {
+	StageTimer timer(Stage::key_schedule);
+	count(Counter::key_schedules);
+	generate_round_keys_packed(key, enc_);
+	if (cross_check_interval()) cross_check_schedule(key, enc_);
+	// reverse keys for decryption: feeding reversed keys into same block operation performs decryption
+	std::reverse_copy(enc_, enc_ + 16, dec_);
+}
+
+std::uint64_t KeySchedule::encrypt_block(std::uint64_t block) const {
+	std::uint64_t out = des_block_packed(block, enc_);
+	if (cross_check_due()) cross_check_block(block, out, enc_, 1);
+	return out;
+}
+
+std::uint64_t KeySchedule::decrypt_block(std::uint64_t block) const {
+	std::uint64_t out = des_block_packed(block, dec_);
+	if (cross_check_due()) cross_check_block(block, out, dec_, 1);
+	return out;
+}
+
+void KeySchedule::encrypt_blocks(std::uint64_t* blocks, std::size_t n) const {
+	des_blocks_packed(blocks, n, enc_);
+}
+
+void KeySchedule::decrypt_blocks(std::uint64_t* blocks, std::size_t n) const {
+	des_blocks_packed(blocks, n, dec_);
+}
+
+TripleKeySchedule::TripleKeySchedule(std::uint64_t k1, std::uint64_t k2, std::uint64_t k3)
+	: k1_(k1), k2_(k2), k3_(k3) {
+	// E_K1, D_K2, E_K3 back to back; decryption is D_K3, E_K2, D_K1
+	std::copy_n(k1_.encrypt_keys(), 16, enc_);
+	std::copy_n(k2_.decrypt_keys(), 16, enc_ + 16);
+	std::copy_n(k3_.encrypt_keys(), 16, enc_ + 32);
+	std::copy_n(k3_.decrypt_keys(), 16, dec_);
+	std::copy_n(k2_.encrypt_keys(), 16, dec_ + 16);
+	std::copy_n(k1_.decrypt_keys(), 16, dec_ + 32);
+}
+
+std::uint64_t TripleKeySchedule::encrypt_block(std::uint64_t block) const {
+	std::uint64_t out = des3_block_packed(block, enc_);
+	if (cross_check_due()) cross_check_block(block, out, enc_, 3);
+	return out;
+}
+
+std::uint64_t TripleKeySchedule::decrypt_block(std::uint64_t block) const {
+	std::uint64_t out = des3_block_packed(block, dec_);
+	if (cross_check_due()) cross_check_block(block, out, dec_, 3);
+	return out;
+}
+
+void TripleKeySchedule::encrypt_blocks(std::uint64_t* blocks, std::size_t n) const {
+	des3_blocks_packed(blocks, n, enc_);
+}
+
+void TripleKeySchedule::decrypt_blocks(std::uint64_t* blocks, std::size_t n) const {
+	des3_blocks_packed(blocks, n, dec_);
+}
+
+std::size_t pkcs7_pad(std::span<std::byte> buf, std::size_t len) {
+	// PKCS#7 padding to 8 bytes (a full block when the input is already aligned)
+	const std::size_t pad_len = BLOCK_SIZE - (len % BLOCK_SIZE);
+	std::fill(buf.begin() + len, buf.begin() + len + pad_len, std::byte(pad_len));
+	return len + pad_len;
+}
+
+Status pkcs7_unpad(std::span<const std::byte> data, std::size_t& len) {
+	len = data.size();
+	if (data.empty()) return Status::ok;
+	const std::size_t pad = std::to_integer<std::size_t>(data.back());
+	bool valid = pad >= 1 && pad <= BLOCK_SIZE && data.size() >= pad;
+	for (std::size_t i = data.size() - pad; valid && i < data.size(); ++i)
+		valid = std::to_integer<std::size_t>(data[i]) == pad;
+	if (!valid) {
+		count(Counter::padding_errors);
+		return Status::bad_padding;
+	}
+	len = data.size() - pad;
+	return Status::ok;
+}
+
+// The modes are written once over the schedule type (KeySchedule or TripleKeySchedule)
+// The CBC bodies read from in and write to out; out may be the same buffer as in
+template <class Cipher>
+static std::uint64_t cbc_encrypt_impl(const Cipher& ks, std::span<const std::byte> in, std::byte* out,
+                                      std::uint64_t iv) {
+	StageTimer timer(Stage::cipher);
+	count(Counter::blocks_encrypted, in.size() / BLOCK_SIZE);
+	auto* src = reinterpret_cast<const uint8_t*>(in.data());
+	auto* dst = reinterpret_cast<uint8_t*>(out);
+	uint64_t prev_cipher = iv;
+	for (std::size_t pos = 0; pos + BLOCK_SIZE <= in.size(); pos += BLOCK_SIZE) {
+		prev_cipher = ks.encrypt_block(load_be64(src + pos) ^ prev_cipher);
+		store_be64(prev_cipher, dst + pos);
+	}
+	return prev_cipher;
+}
+
+// CBC-decrypt nblocks blocks from src into dst (which may equal src); prev_cipher is the
+// ciphertext block before src (or the IV). Every block decrypts independently, so blocks
+// go through the bitsliced kernel in batches and are then XORed with the previous
+// ciphertext block.
+template <class Cipher>
+static void decrypt_cbc_range(const Cipher& ks, const uint8_t* src, uint8_t* dst, std::size_t nblocks,
+                              uint64_t prev_cipher) {
+	constexpr std::size_t batch_blocks = 4096;
+	uint64_t batch[batch_blocks];
+
+	for (std::size_t first = 0; first < nblocks; first += batch_blocks) {
+		std::size_t count = std::min(batch_blocks, nblocks - first);
+		for (std::size_t i = 0; i < count; ++i) batch[i] = load_be64(src + (first + i) * BLOCK_SIZE);
+		ks.decrypt_blocks(batch, count);
+		for (std::size_t i = 0; i < count; ++i) {
+			std::size_t pos = (first + i) * BLOCK_SIZE;
+			uint64_t cblock = load_be64(src + pos);
+			store_be64(batch[i] ^ prev_cipher, dst + pos);
+			prev_cipher = cblock;
+		}
+	}
+}
+
+template <class Cipher>
+static std::uint64_t cbc_decrypt_impl(const Cipher& ks, std::span<const std::byte> in, std::byte* out,
+                                      std::uint64_t iv, ThreadPool* pool) {
+	StageTimer timer(Stage::cipher);
+	auto* src = reinterpret_cast<const uint8_t*>(in.data());
+	auto* dst = reinterpret_cast<uint8_t*>(out);
+	const std::size_t nblocks = in.size() / BLOCK_SIZE;
+	count(Counter::blocks_decrypted, nblocks);
+	if (nblocks == 0) return iv;
+	const uint64_t last_cipher = load_be64(src + (nblocks - 1) * BLOCK_SIZE);
+	const std::size_t chunk_blocks = CHUNK_BYTES / BLOCK_SIZE;
+	const std::size_t nchunks = (nblocks + chunk_blocks - 1) / chunk_blocks;
+
+	if (pool == nullptr || nchunks < 2) {
+		decrypt_cbc_range(ks, src, dst, nblocks, iv);
+		return last_cipher;
+	}
+	// each chunk only needs the last ciphertext block of the chunk before it; collect
+	// those first since decryption may happen in place. The seeds live on the stack, so
+	// the chunks go out in rounds of at most max_round.
+	constexpr std::size_t max_round = 64;
+	uint64_t seeds[max_round];
+	uint64_t prev = iv;
+	for (std::size_t base = 0; base < nchunks; base += max_round) {
+		const std::size_t round = std::min(max_round, nchunks - base);
+		seeds[0] = prev;
+		for (std::size_t k = 1; k < round; ++k)
+			seeds[k] = load_be64(src + ((base + k) * chunk_blocks - 1) * BLOCK_SIZE);
+		const std::size_t end_block = std::min(nblocks, (base + round) * chunk_blocks);
+		prev = load_be64(src + (end_block - 1) * BLOCK_SIZE);
+		pool->parallel_for(round, [&](std::size_t k) {
+			std::size_t first = (base + k) * chunk_blocks;
+			decrypt_cbc_range(ks, src + first * BLOCK_SIZE, dst + first * BLOCK_SIZE,
+			                  std::min(chunk_blocks, nblocks - first), seeds[k]);
+		});
+	}
+	return last_cipher;
+}
+
+template <class Cipher>
+static std::size_t encrypt_in_place_impl(const Cipher& ks, std::span<std::byte> buf, std::size_t len,
+                                         std::uint64_t iv) {
+	const std::size_t padded = len + BLOCK_SIZE - (len % BLOCK_SIZE);
+	if (padded > buf.size()) return 0;
+	pkcs7_pad(buf, len);
+	cbc_encrypt_impl(ks, buf.first(padded), buf.data(), iv);
+	return padded;
+}
+
+template <class Cipher>
+static Status decrypt_in_place_impl(const Cipher& ks, std::span<std::byte> buf, std::size_t& len, std::uint64_t iv,
+                                    ThreadPool* pool) {
+	len = 0;
+	if (buf.size() % BLOCK_SIZE != 0) return Status::bad_length;
+	cbc_decrypt_impl(ks, buf, buf.data(), iv, pool);
+	// padding lives in the final chunk only
+	return pkcs7_unpad(buf, len);
+}
+
+template <class Cipher>
+static std::vector<std::byte> encrypt_impl(const Cipher& ks, std::span<const std::byte> plain, std::uint64_t iv) {
+	std::vector<std::byte> out(plain.size() + BLOCK_SIZE - (plain.size() % BLOCK_SIZE));
+	std::copy(plain.begin(), plain.end(), out.begin());
+	encrypt_in_place_impl(ks, std::span<std::byte>(out), plain.size(), iv);
+	return out;
+}
+
+template <class Cipher>
+static Status decrypt_impl(const Cipher& ks, std::span<const std::byte> cipher, std::vector<std::byte>& plain,
+                           std::uint64_t iv, ThreadPool* pool) {
+	plain.clear();
+	if (cipher.size() % BLOCK_SIZE != 0) return Status::bad_length;
+
+	plain.assign(cipher.begin(), cipher.end());
+	std::size_t len;
+	Status status = decrypt_in_place_impl(ks, std::span<std::byte>(plain), len, iv, pool);
+	plain.resize(len);
+	return status;
+}
+
+// XOR n bytes of CTR keystream, starting at stream position offset, into out
+template <class Cipher>
+static void ctr_range(const Cipher& ks, uint64_t nonce, uint64_t offset, const uint8_t* in, uint8_t* out,
+                      std::size_t n) {
+	constexpr std::size_t batch_blocks = 4096;
+	uint64_t batch[batch_blocks];
+	uint8_t keystream[batch_blocks * BLOCK_SIZE];
+	uint64_t block = offset / BLOCK_SIZE;
+	std::size_t skip = offset % BLOCK_SIZE;
+
+	std::size_t done = 0;
+	while (done < n) {
+		std::size_t count = std::min(batch_blocks, (skip + (n - done) + BLOCK_SIZE - 1) / BLOCK_SIZE);
+		for (std::size_t i = 0; i < count; ++i) batch[i] = nonce + block + i;
+		ks.encrypt_blocks(batch, count);
+		for (std::size_t i = 0; i < count; ++i) store_be64(batch[i], keystream + i * BLOCK_SIZE);
+
+		std::size_t take = std::min(count * BLOCK_SIZE - skip, n - done);
+		const uint8_t* k = keystream + skip;
+		for (std::size_t j = 0; j < take; ++j) out[done + j] = in[done + j] ^ k[j];
+		done += take;
+		block += count;
+		skip = 0;
+	}
+}
+
+template <class Cipher>
+static void ctr_impl(const Cipher& ks, std::uint64_t nonce, std::uint64_t offset, std::span<const std::byte> in,
+                     std::span<std::byte> out, ThreadPool* pool) {
+	StageTimer timer(Stage::cipher);
+	const auto* src = reinterpret_cast<const uint8_t*>(in.data());
+	auto* dst = reinterpret_cast<uint8_t*>(out.data());
+	const std::size_t n = std::min(in.size(), out.size());
+	const std::size_t nchunks = (n + CHUNK_BYTES - 1) / CHUNK_BYTES;
+	count(Counter::blocks_encrypted, (offset % BLOCK_SIZE + n + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+	if (pool == nullptr || nchunks < 2) {
+		ctr_range(ks, nonce, offset, src, dst, n);
+		return;
+	}
+	// counter blocks are independent, so every chunk starts straight at its own offset
+	pool->parallel_for(nchunks, [&](std::size_t k) {
+		std::size_t first = k * CHUNK_BYTES;
+		ctr_range(ks, nonce, offset + first, src + first, dst + first, std::min(CHUNK_BYTES, n - first));
+	});
+}
+
+std::uint64_t cbc_encrypt_blocks(const KeySchedule& ks, std::span<std::byte> data, std::uint64_t iv) {
+	return cbc_encrypt_impl(ks, data, data.data(), iv);
+}
+
+std::uint64_t cbc_decrypt_blocks(const KeySchedule& ks, std::span<std::byte> data, std::uint64_t iv,
+                                 ThreadPool* pool) {
+	return cbc_decrypt_impl(ks, data, data.data(), iv, pool);
+}
+
+std::uint64_t cbc_encrypt_blocks(const KeySchedule& ks, std::span<const std::byte> in, std::span<std::byte> out,
+                                 std::uint64_t iv) {
+	return cbc_encrypt_impl(ks, in.first(std::min(in.size(), out.size())), out.data(), iv);
+}
+
+std::uint64_t cbc_decrypt_blocks(const KeySchedule& ks, std::span<const std::byte> in, std::span<std::byte> out,
+                                 std::uint64_t iv, ThreadPool* pool) {
+	return cbc_decrypt_impl(ks, in.first(std::min(in.size(), out.size())), out.data(), iv, pool);
+}
+
+std::size_t encrypt_in_place(const KeySchedule& ks, std::span<std::byte> buf, std::size_t len, std::uint64_t iv) {
+	return encrypt_in_place_impl(ks, buf, len, iv);
+}
+
+Status decrypt_in_place(const KeySchedule& ks, std::span<std::byte> buf, std::size_t& len, std::uint64_t iv,
+                        ThreadPool* pool) {
+	return decrypt_in_place_impl(ks, buf, len, iv, pool);
+}
+
+std::vector<std::byte> encrypt(const KeySchedule& ks, std::span<const std::byte> plain, std::uint64_t iv) {
+	return encrypt_impl(ks, plain, iv);
+}
+
+Status decrypt(const KeySchedule& ks, std::span<const std::byte> cipher, std::vector<std::byte>& plain,
+               std::uint64_t iv, ThreadPool* pool) {
+	return decrypt_impl(ks, cipher, plain, iv, pool);
+}
+
+void ctr_crypt(const KeySchedule& ks, std::uint64_t nonce, std::uint64_t offset, std::span<const std::byte> in,
+               std::span<std::byte> out, ThreadPool* pool) {
+	ctr_impl(ks, nonce, offset, in, out, pool);
+}
+
+std::vector<std::byte> ctr_crypt(const KeySchedule& ks, std::uint64_t nonce, std::span<const std::byte> in,
+                                 ThreadPool* pool) {
+	std::vector<std::byte> out(in.size());
+	ctr_impl(ks, nonce, 0, in, std::span<std::byte>(out), pool);
+	return out;
+}
+
+std::uint64_t cbc_encrypt_blocks(const TripleKeySchedule& ks, std::span<std::byte> data, std::uint64_t iv) {
+	return cbc_encrypt_impl(ks, data, data.data(), iv);
+}
+
+std::uint64_t cbc_decrypt_blocks(const TripleKeySchedule& ks, std::span<std::byte> data, std::uint64_t iv,
+                                 ThreadPool* pool) {
+	return cbc_decrypt_impl(ks, data, data.data(), iv, pool);
+}
+
+std::size_t encrypt_in_place(const TripleKeySchedule& ks, std::span<std::byte> buf, std::size_t len, std::uint64_t iv) {
+	return encrypt_in_place_impl(ks, buf, len, iv);
+}
+
+Status decrypt_in_place(const TripleKeySchedule& ks, std::span<std::byte> buf, std::size_t& len, std::uint64_t iv,
+                        ThreadPool* pool) {
+	return decrypt_in_place_impl(ks, buf, len, iv, pool);
+}
+
+std::vector<std::byte> encrypt(const TripleKeySchedule& ks, std::span<const std::byte> plain, std::uint64_t iv) {
+	return encrypt_impl(ks, plain, iv);
+}
+
+Status decrypt(const TripleKeySchedule& ks, std::span<const std::byte> cipher, std::vector<std::byte>& plain,
+               std::uint64_t iv, ThreadPool* pool) {
+	return decrypt_impl(ks, cipher, plain, iv, pool);
+}
+
+void ctr_crypt(const TripleKeySchedule& ks, std::uint64_t nonce, std::uint64_t offset, std::span<const std::byte> in,
+               std::span<std::byte> out, ThreadPool* pool) {
+	ctr_impl(ks, nonce, offset, in, out, pool);
+}
+
+std::vector<std::byte> ctr_crypt(const TripleKeySchedule& ks, std::uint64_t nonce, std::span<const std::byte> in,
+                                 ThreadPool* pool) {
+	std::vector<std::byte> out(in.size());
+	ctr_impl(ks, nonce, 0, in, std::span<std::byte>(out), pool);
+	return out;
+}
+
+// "KEDSCMAC": decrypted under the key, it gives the MAC whitening mask
+constexpr std::uint64_t MAC_MASK_LABEL = 0x4B454453434D4143ULL;
+
+// CMAC subkey doubling in GF(2^64)
+static std::uint64_t cmac_double(std::uint64_t v) {
+	return (v << 1) ^ ((v >> 63) ? 0x1B : 0);
+}
+
+AuthCipher::AuthCipher(const KeySchedule& ks, std::uint64_t iv)
+	: ks_(ks),
+	  mask_(ks.decrypt_block(MAC_MASK_LABEL)),
+	  k1_(cmac_double(ks.encrypt_block(mask_) ^ mask_)),
+	  chain_(iv),
+	  state_(0),
+	  pending_(iv) {}
+
+void AuthCipher::encrypt_blocks(std::span<const std::byte> in, std::byte* out) {
+	StageTimer timer(Stage::cipher);
+	count(Counter::blocks_encrypted, in.size() / BLOCK_SIZE);
+	auto* src = reinterpret_cast<const uint8_t*>(in.data());
+	auto* dst = reinterpret_cast<uint8_t*>(out);
+	for (std::size_t pos = 0; pos + BLOCK_SIZE <= in.size(); pos += BLOCK_SIZE) {
+		// c_i = E_K(p_i ^ c_(i-1)) next to state = E_K(state ^ c_(i-1) ^ W) ^ W
+		const uint64_t x = load_be64(src + pos) ^ chain_, m = state_ ^ pending_ ^ mask_;
+		uint64_t c = x, t = m;
+		des_block2_packed(c, ks_.encrypt_keys(), t, ks_.encrypt_keys());
+		if (cross_check_due()) {
+			cross_check_block(x, c, ks_.encrypt_keys(), 1);
+			cross_check_block(m, t, ks_.encrypt_keys(), 1);
+		}
+		store_be64(c, dst + pos);
+		chain_ = pending_ = c;
+		state_ = t ^ mask_;
+	}
+}
+
+void AuthCipher::decrypt_blocks(std::span<const std::byte> in, std::byte* out) {
+	StageTimer timer(Stage::cipher);
+	count(Counter::blocks_decrypted, in.size() / BLOCK_SIZE);
+	auto* src = reinterpret_cast<const uint8_t*>(in.data());
+	auto* dst = reinterpret_cast<uint8_t*>(out);
+	for (std::size_t pos = 0; pos + BLOCK_SIZE <= in.size(); pos += BLOCK_SIZE) {
+		const uint64_t c = load_be64(src + pos), m = state_ ^ pending_ ^ mask_;
+		uint64_t p = c, t = m;
+		des_block2_packed(p, ks_.decrypt_keys(), t, ks_.encrypt_keys());
+		if (cross_check_due()) {
+			cross_check_block(c, p, ks_.decrypt_keys(), 1);
+			cross_check_block(m, t, ks_.encrypt_keys(), 1);
+		}
+		store_be64(p ^ chain_, dst + pos);
+		chain_ = pending_ = c;
+		state_ = t ^ mask_;
+	}
+}
+
+std::uint64_t AuthCipher::tag() const {
+	return ks_.encrypt_block(state_ ^ pending_ ^ k1_ ^ mask_) ^ mask_;
+}
+
+std::size_t encrypt_authenticated(const KeySchedule& ks, std::span<std::byte> buf, std::size_t len,
+                                  std::uint64_t iv) {
+	const std::size_t padded = len + BLOCK_SIZE - (len % BLOCK_SIZE);
+	if (padded + TAG_SIZE > buf.size()) return 0;
+	pkcs7_pad(buf, len);
+	AuthCipher auth(ks, iv);
+	auth.encrypt_blocks(buf.first(padded), buf.data());
+	store_be64(auth.tag(), reinterpret_cast<uint8_t*>(buf.data() + padded));
+	return padded + TAG_SIZE;
+}
+
+Status decrypt_authenticated(const KeySchedule& ks, std::span<const std::byte> in, std::span<std::byte> out,
+                             std::size_t& len, std::uint64_t iv) {
+	len = 0;
+	if (in.size() % BLOCK_SIZE != 0) return Status::bad_length;
+	if (in.size() < BLOCK_SIZE + TAG_SIZE || out.size() < in.size() - TAG_SIZE) {
+		count(Counter::tag_errors);
+		return Status::bad_tag;
+	}
+	const std::span<const std::byte> data = in.first(in.size() - TAG_SIZE);
+	const uint64_t expected = load_be64(reinterpret_cast<const uint8_t*>(in.data() + data.size()));
+	AuthCipher auth(ks, iv);
+	auth.decrypt_blocks(data, out.data());
+	if (auth.tag() != expected) {
+		count(Counter::tag_errors);
+		std::fill_n(out.begin(), data.size(), std::byte(0));
+		return Status::bad_tag;
+	}
+	return pkcs7_unpad(out.first(data.size()), len);
+}
+
+Status decrypt_authenticated(const KeySchedule& ks, std::span<std::byte> buf, std::size_t& len, std::uint64_t iv) {
+	return decrypt_authenticated(ks, buf, buf, len, iv);
+}
+
+// segment size in use: whole blocks, at least one
+static std::size_t segment_stride(std::size_t segment_bytes) {
+	return std::max(BLOCK_SIZE, segment_bytes / BLOCK_SIZE * BLOCK_SIZE);
+}
+
+std::size_t segment_count(std::uint64_t cipher_len, std::size_t segment_bytes) {
+	const std::uint64_t bytes = segment_stride(segment_bytes);
+	return (std::size_t)std::max<std::uint64_t>(1, (cipher_len + bytes - 1) / bytes);
+}
+
+void derive_segment_ivs(const KeySchedule& ks, std::uint64_t iv, std::span<std::uint64_t> ivs) {
+	for (std::size_t i = 0; i < ivs.size(); ++i) ivs[i] = iv + i;
+	ks.encrypt_blocks(ivs.data(), ivs.size());
+}
+
+namespace {
+
+// n bytes at ciphertext position offset, cut at segment boundaries: piece k lies in
+// segment first + k and starts from seed(k)
+struct SegmentPieces {
+	SegmentPieces(const SegmentLayout& seg, std::uint64_t offset, std::size_t n, std::uint64_t chain)
+		: seg(seg), bytes(segment_stride(seg.bytes)), offset(offset), n(n),
+		  chain(chain), first(offset / bytes), count((std::size_t)((offset + n - 1) / bytes - first + 1)) {}
+
+	std::size_t begin(std::size_t k) const { return k == 0 ? 0 : (std::size_t)((first + k) * bytes - offset); }
+	std::size_t end(std::size_t k) const { return (std::size_t)std::min<std::uint64_t>(n, (first + k + 1) * bytes - offset); }
+	// every segment the range starts (all but a first one entered mid-segment) has its IV
+	bool covered() const {
+		const std::uint64_t last = first + count - 1;
+		return (offset % bytes != 0 && count == 1) || last < seg.ivs.size();
+	}
+	std::uint64_t seed(std::size_t k) const {
+		if (k == 0 && offset % bytes != 0) return chain;
+		assert(first + k < seg.ivs.size());
+		return seg.ivs[first + k];
+	}
+
+	const SegmentLayout& seg;
+	std::size_t bytes;
+	std::uint64_t offset;
+	std::size_t n;
+	std::uint64_t chain;
+	std::uint64_t first;
+	std::size_t count;
+};
+
+} // namespace
+
+// one CBC chain over nbytes (whole blocks)
+static void cbc_encrypt_range(const KeySchedule& ks, const uint8_t* src, uint8_t* dst, std::size_t nbytes,
+                              uint64_t chain) {
+	for (std::size_t pos = 0; pos < nbytes; pos += BLOCK_SIZE) {
+		chain = ks.encrypt_block(load_be64(src + pos) ^ chain);
+		store_be64(chain, dst + pos);
+	}
+}
+
+// two independent CBC chains, their blocks interleaved while both last
+static void cbc_encrypt_range2(const KeySchedule& ks, const uint8_t* srcA, uint8_t* dstA, std::size_t nA,
+                               uint64_t chainA, const uint8_t* srcB, uint8_t* dstB, std::size_t nB,
+                               uint64_t chainB) {
+	const std::size_t both = std::min(nA, nB);
+	for (std::size_t pos = 0; pos < both; pos += BLOCK_SIZE) {
+		const uint64_t xA = load_be64(srcA + pos) ^ chainA, xB = load_be64(srcB + pos) ^ chainB;
+		chainA = xA;
+		chainB = xB;
+		des_block2_packed(chainA, ks.encrypt_keys(), chainB, ks.encrypt_keys());
+		if (cross_check_due()) {
+			cross_check_block(xA, chainA, ks.encrypt_keys(), 1);
+			cross_check_block(xB, chainB, ks.encrypt_keys(), 1);
+		}
+		store_be64(chainA, dstA + pos);
+		store_be64(chainB, dstB + pos);
+	}
+	cbc_encrypt_range(ks, srcA + both, dstA + both, nA - both, chainA);
+	cbc_encrypt_range(ks, srcB + both, dstB + both, nB - both, chainB);
+}
+
+Status cbc_encrypt_segments(const KeySchedule& ks, const SegmentLayout& seg, std::uint64_t offset,
+                            std::span<const std::byte> in, std::span<std::byte> out, std::uint64_t& chain,
+                            ThreadPool* pool) {
+	StageTimer timer(Stage::cipher);
+	const std::size_t n = std::min(in.size(), out.size()) / BLOCK_SIZE * BLOCK_SIZE;
+	if (n == 0) return Status::ok;
+	const SegmentPieces p(seg, offset, n, chain);
+	if (!p.covered()) return Status::bad_segments;
+	count(Counter::blocks_encrypted, n / BLOCK_SIZE);
+	auto* src = reinterpret_cast<const uint8_t*>(in.data());
+	auto* dst = reinterpret_cast<uint8_t*>(out.data());
+
+	// a task takes two segments and runs their chains interleaved, unless that would
+	// leave workers idle
+	const bool pair = pool == nullptr || p.count >= 2 * (std::size_t)pool->size();
+	const std::size_t tasks = pair ? (p.count + 1) / 2 : p.count;
+	auto task = [&](std::size_t t) {
+		const std::size_t a = pair ? 2 * t : t, b = a + 1;
+		if (!pair || b == p.count) {
+			cbc_encrypt_range(ks, src + p.begin(a), dst + p.begin(a), p.end(a) - p.begin(a), p.seed(a));
+			return;
+		}
+		cbc_encrypt_range2(ks, src + p.begin(a), dst + p.begin(a), p.end(a) - p.begin(a), p.seed(a),
+		                   src + p.begin(b), dst + p.begin(b), p.end(b) - p.begin(b), p.seed(b));
+	};
+	if (pool == nullptr || tasks < 2) {
+		for (std::size_t t = 0; t < tasks; ++t) task(t);
+	} else {
+		pool->parallel_for(tasks, task);
+	}
+	chain = load_be64(dst + n - BLOCK_SIZE);
+	return Status::ok;
+}
+
+Status cbc_decrypt_segments(const KeySchedule& ks, const SegmentLayout& seg, std::uint64_t offset,
+                            std::span<const std::byte> in, std::span<std::byte> out, std::uint64_t& chain,
+                            ThreadPool* pool) {
+	StageTimer timer(Stage::cipher);
+	const std::size_t n = std::min(in.size(), out.size()) / BLOCK_SIZE * BLOCK_SIZE;
+	if (n == 0) return Status::ok;
+	const SegmentPieces p(seg, offset, n, chain);
+	if (!p.covered()) return Status::bad_segments;
+	count(Counter::blocks_decrypted, n / BLOCK_SIZE);
+	auto* src = reinterpret_cast<const uint8_t*>(in.data());
+	auto* dst = reinterpret_cast<uint8_t*>(out.data());
+	// every piece seeds from an IV or the chain passed in, never from the buffer, so the
+	// pieces may decrypt in place in any order
+	const uint64_t last_cipher = load_be64(src + n - BLOCK_SIZE);
+	auto task = [&](std::size_t k) {
+		decrypt_cbc_range(ks, src + p.begin(k), dst + p.begin(k), (p.end(k) - p.begin(k)) / BLOCK_SIZE, p.seed(k));
+	};
+	if (pool == nullptr || p.count < 2) {
+		for (std::size_t k = 0; k < p.count; ++k) task(k);
+	} else {
+		pool->parallel_for(p.count, task);
+	}
+	chain = last_cipher;
+	return Status::ok;
+}
+
+std::vector<std::byte> ctr_decrypt_range(const KeySchedule& ks, std::uint64_t nonce,
+                                         std::span<const std::byte> cipher, std::uint64_t offset,
+                                         std::size_t len) {
+	if (offset >= cipher.size()) return {};
+	len = std::min<std::size_t>(len, cipher.size() - offset);
+	std::vector<std::byte> out(len);
+	ctr_crypt(ks, nonce, offset, cipher.subspan(offset, len), out);
+	return out;
+}
+
+} // namespace kedes
@@ -0,0 +1,240 @@
+// libkedes - KE-DES (Key-Based Enhancement of DES) as a linkable library.
+// A KeySchedule is built once from a 64-bit key and then used for any number of
+// encrypt/decrypt calls; KE_DES and KE_DES_Decrypt are thin frontends over this API.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace kedes {
+
+class ThreadPool;
+
+constexpr std::size_t BLOCK_SIZE = 8;
+// unit of work for the parallel modes
+constexpr std::size_t CHUNK_BYTES = 256 * 1024;
+// authentication tag of Mode::cbc_cmac
+constexpr std::size_t TAG_SIZE = 8;
+
+// Expanded round keys K1..K16 (packed 48-bit values) for one 64-bit key
+class KeySchedule {
+public:
+	explicit KeySchedule(std::uint64_t key);
+
+	std::uint64_t key() const { return key_; }
+	// 56-bit key after PC-1, and after the odd/even transform (C0||D0)
+	std::uint64_t pc1() const { return pc1_; }
+	std::uint64_t cd0() const { return cd0_; }
+	// K1..K16 for encryption, K16..K1 for decryption
+	const std::uint64_t* encrypt_keys() const { return enc_; }
+	const std::uint64_t* decrypt_keys() const { return dec_; }
+
+	// single packed block (MSB-first, as loaded big-endian from 8 bytes)
+	std::uint64_t encrypt_block(std::uint64_t block) const;
+	std::uint64_t decrypt_block(std::uint64_t block) const;
+	// independent blocks in place (bitsliced kernels when n is large enough)
+	void encrypt_blocks(std::uint64_t* blocks, std::size_t n) const;
+	void decrypt_blocks(std::uint64_t* blocks, std::size_t n) const;
+
+private:
+	std::uint64_t key_;
+	std::uint64_t pc1_;
+	std::uint64_t cd0_;
+	std::uint64_t enc_[16];
+	std::uint64_t dec_[16];
+};
+
+// Three-key KE-DES in EDE form: E_K1, then D_K2, then E_K3. The 48 rounds run back to back
+// on the packed halves; the IP_INV/IP pair between stages cancels, so IP and IP_INV are
+// applied once per block. Works with the CBC/CTR functions below like a KeySchedule.
+class TripleKeySchedule {
+public:
+	TripleKeySchedule(std::uint64_t k1, std::uint64_t k2, std::uint64_t k3);
+
+	const KeySchedule& key1() const { return k1_; }
+	const KeySchedule& key2() const { return k2_; }
+	const KeySchedule& key3() const { return k3_; }
+	// the 48 round keys of the whole EDE sequence, per direction
+	const std::uint64_t* encrypt_keys() const { return enc_; }
+	const std::uint64_t* decrypt_keys() const { return dec_; }
+
+	std::uint64_t encrypt_block(std::uint64_t block) const;
+	std::uint64_t decrypt_block(std::uint64_t block) const;
+	void encrypt_blocks(std::uint64_t* blocks, std::size_t n) const;
+	void decrypt_blocks(std::uint64_t* blocks, std::size_t n) const;
+
+private:
+	KeySchedule k1_, k2_, k3_;
+	std::uint64_t enc_[48];
+	std::uint64_t dec_[48];
+};
+
+// cipher modes
+enum class Mode : std::uint8_t {
+	cbc = 1,
+	ctr = 2,
+	cbc_cmac = 3,     // CBC plus a CMAC tag over IV || ciphertext (AuthCipher)
+	cbc_chunked = 4,  // CBC restarted every segment under its own IV (SegmentLayout)
+};
+
+enum class Status {
+	ok,
+	bad_length,   // ciphertext is not a multiple of BLOCK_SIZE
+	bad_padding,  // PKCS#7 padding invalid; output holds the full plaintext, padding not removed
+	bad_tag,      // authentication tag mismatch (or no room for one); no plaintext is returned
+	bad_segments, // SegmentLayout::ivs lacks the IV of a segment the data reaches; nothing is processed
+};
+
+// PKCS#7: pkcs7_pad appends the pad bytes after buf[0..len) (buf needs BLOCK_SIZE bytes
+// of room past len) and returns the padded length; pkcs7_unpad validates the padding of
+// data and sets len to the unpadded length (data.size() when the padding is invalid)
+std::size_t pkcs7_pad(std::span<std::byte> buf, std::size_t len);
+Status pkcs7_unpad(std::span<const std::byte> data, std::size_t& len);
+
+// Raw CBC over whole blocks in place, no padding (a trailing partial block is left
+// untouched). Returns the last ciphertext block, i.e. the IV to continue the chain with.
+std::uint64_t cbc_encrypt_blocks(const KeySchedule& ks, std::span<std::byte> data, std::uint64_t iv);
+std::uint64_t cbc_decrypt_blocks(const KeySchedule& ks, std::span<std::byte> data, std::uint64_t iv,
+                                 ThreadPool* pool = nullptr);
+// Out-of-place forms over min(in.size(), out.size()) bytes; out may equal in but must
+// not otherwise overlap it
+std::uint64_t cbc_encrypt_blocks(const KeySchedule& ks, std::span<const std::byte> in, std::span<std::byte> out,
+                                 std::uint64_t iv);
+std::uint64_t cbc_decrypt_blocks(const KeySchedule& ks, std::span<const std::byte> in, std::span<std::byte> out,
+                                 std::uint64_t iv, ThreadPool* pool = nullptr);
+
+// CBC with PKCS#7 padding in place on a caller-owned buffer: buf[0..len) holds the
+// plaintext and buf needs room for the padding past it (len rounded up to the next whole
+// block, at most len + BLOCK_SIZE). Returns the ciphertext length, or 0 when buf is too
+// short. No heap allocation.
+std::size_t encrypt_in_place(const KeySchedule& ks, std::span<std::byte> buf, std::size_t len, std::uint64_t iv = 0);
+
+// The inverse over all of buf; len receives the plaintext length (buf.size() when the
+// padding is invalid, 0 with bad_length). Without a pool there is no heap allocation;
+// with one, only the pool's task queue allocates.
+Status decrypt_in_place(const KeySchedule& ks, std::span<std::byte> buf, std::size_t& len, std::uint64_t iv = 0,
+                        ThreadPool* pool = nullptr);
+
+// CBC encryption with PKCS#7 padding (the IV is the 8 IV bytes as a big-endian value)
+std::vector<std::byte> encrypt(const KeySchedule& ks, std::span<const std::byte> plain, std::uint64_t iv = 0);
+
+// CBC decryption; removes the PKCS#7 padding when it is valid. With a pool the
+// ciphertext is split into CHUNK_BYTES chunks that are decrypted in parallel.
+Status decrypt(const KeySchedule& ks, std::span<const std::byte> cipher, std::vector<std::byte>& plain,
+               std::uint64_t iv = 0, ThreadPool* pool = nullptr);
+
+// CTR mode: keystream block i is E(nonce + i) and out = in XOR keystream, so encryption
+// and decryption are the same call and no padding is used. offset is the stream position
+// of in[0]; any range can be processed without touching the bytes before it. With a pool
+// the range is split into CHUNK_BYTES pieces that run in parallel. out may alias in.
+void ctr_crypt(const KeySchedule& ks, std::uint64_t nonce, std::uint64_t offset, std::span<const std::byte> in,
+               std::span<std::byte> out, ThreadPool* pool = nullptr);
+
+std::vector<std::byte> ctr_crypt(const KeySchedule& ks, std::uint64_t nonce, std::span<const std::byte> in,
+                                 ThreadPool* pool = nullptr);
+
+// the same modes over three-key EDE
+std::uint64_t cbc_encrypt_blocks(const TripleKeySchedule& ks, std::span<std::byte> data, std::uint64_t iv);
+std::uint64_t cbc_decrypt_blocks(const TripleKeySchedule& ks, std::span<std::byte> data, std::uint64_t iv,
+                                 ThreadPool* pool = nullptr);
+std::size_t encrypt_in_place(const TripleKeySchedule& ks, std::span<std::byte> buf, std::size_t len,
+                             std::uint64_t iv = 0);
+Status decrypt_in_place(const TripleKeySchedule& ks, std::span<std::byte> buf, std::size_t& len, std::uint64_t iv = 0,
+                        ThreadPool* pool = nullptr);
+std::vector<std::byte> encrypt(const TripleKeySchedule& ks, std::span<const std::byte> plain, std::uint64_t iv = 0);
+Status decrypt(const TripleKeySchedule& ks, std::span<const std::byte> cipher, std::vector<std::byte>& plain,
+               std::uint64_t iv = 0, ThreadPool* pool = nullptr);
+void ctr_crypt(const TripleKeySchedule& ks, std::uint64_t nonce, std::uint64_t offset, std::span<const std::byte> in,
+               std::span<std::byte> out, ThreadPool* pool = nullptr);
+std::vector<std::byte> ctr_crypt(const TripleKeySchedule& ks, std::uint64_t nonce, std::span<const std::byte> in,
+                                 ThreadPool* pool = nullptr);
+
+// Authenticated CBC (Mode::cbc_cmac) in a single pass: every block goes through the CBC
+// chain and the CMAC chain over IV || ciphertext together, the two block operations
+// interleaved round by round (des_block2_packed), so the MAC adds far less than a second
+// pass would. Both chains use the same schedule: the odd/even transform discards the key
+// bits, so a second schedule derived from the key would have the same round keys. The
+// MAC runs over the whitened permutation E_K(x ^ W) ^ W instead, where W = D_K(label).
+// That separates the MAC from the CBC chain only while no one can decrypt under the same
+// key: a plain CBC decryption (Mode::cbc, IV 0) of the block `label` returns W. Keys used
+// for cbc_cmac must not also serve unauthenticated CBC decryption, and since every KE-DES
+// key shares one schedule, that means no exposed KE-DES CBC decryption at all. The
+// message is always whole blocks, so the final block is masked with the CMAC subkey K1
+// only (taken from the whitened permutation). Blocks are fed in order, any number at a
+// time, and tag() may be taken at any point.
+class AuthCipher {
+public:
+	AuthCipher(const KeySchedule& ks, std::uint64_t iv);
+
+	// whole blocks of in to out (out may equal in but must not otherwise overlap it); a
+	// trailing partial block is ignored
+	void encrypt_blocks(std::span<const std::byte> in, std::byte* out);
+	void decrypt_blocks(std::span<const std::byte> in, std::byte* out);
+	// CMAC of IV and the ciphertext so far
+	std::uint64_t tag() const;
+
+private:
+	const KeySchedule& ks_;
+	std::uint64_t mask_;      // W, whitening the MAC chain's block operations
+	std::uint64_t k1_;
+	std::uint64_t chain_;     // previous ciphertext block (CBC)
+	std::uint64_t state_;     // CBC-MAC state before the pending block
+	std::uint64_t pending_;   // last message block, absorbed once the next one arrives
+};
+
+// Mode::cbc_cmac on a caller-owned buffer: buf[0..len) holds the plaintext and buf needs
+// room for the padding and the tag past it (at most len + BLOCK_SIZE + TAG_SIZE). The
+// result is the ciphertext followed by the tag; returns its length, or 0 when buf is too
+// short.
+std::size_t encrypt_authenticated(const KeySchedule& ks, std::span<std::byte> buf, std::size_t len,
+                                  std::uint64_t iv = 0);
+
+// The inverse over all of buf, checking the tag in the same pass. On bad_tag (and
+// bad_length) len is 0 and the decrypted bytes are wiped; with bad_padding len is the
+// length before unpadding, as for decrypt_in_place.
+Status decrypt_authenticated(const KeySchedule& ks, std::span<std::byte> buf, std::size_t& len,
+                             std::uint64_t iv = 0);
+// Out-of-place form: out needs in.size() - TAG_SIZE bytes and may equal in but must not
+// otherwise overlap it
+Status decrypt_authenticated(const KeySchedule& ks, std::span<const std::byte> in, std::span<std::byte> out,
+                             std::size_t& len, std::uint64_t iv = 0);
+
+// Chunked CBC (Mode::cbc_chunked): the ciphertext is cut every `bytes` (rounded down to a
+// multiple of BLOCK_SIZE, at least one block; segment_count and the segment functions
+// round alike) and segment i is CBC under ivs[i], so segments encrypt independently and
+// spread over a pool like CTR does. PKCS#7 padding goes on the last segment only, so the
+// ciphertext is as long as plain CBC's. ivs must hold the IV of every segment a call
+// starts; the segment functions return bad_segments rather than guess one.
+struct SegmentLayout {
+	std::size_t bytes = CHUNK_BYTES;
+	std::span<const std::uint64_t> ivs;
+};
+
+// segments of a cipher_len-byte ciphertext (at least one)
+std::size_t segment_count(std::uint64_t cipher_len, std::size_t segment_bytes);
+
+// the IV of segment i is E_K(iv + i), so no two segments of a file share one
+void derive_segment_ivs(const KeySchedule& ks, std::uint64_t iv, std::span<std::uint64_t> ivs);
+
+// Chunked CBC over the whole blocks of in (a trailing partial block is ignored) into out,
+// which may equal in but must not otherwise overlap it. offset is the ciphertext position
+// of in[0], a multiple of BLOCK_SIZE; when it falls inside a segment, chain is the
+// ciphertext block before it (as left by the previous call). chain receives the value to
+// continue with. Returns bad_segments, out and chain untouched, when seg.ivs is too short
+// for the range. With a pool the segments run in parallel; without one, encryption still
+// interleaves two segments at a time (des_block2_packed).
+Status cbc_encrypt_segments(const KeySchedule& ks, const SegmentLayout& seg, std::uint64_t offset,
+                            std::span<const std::byte> in, std::span<std::byte> out, std::uint64_t& chain,
+                            ThreadPool* pool = nullptr);
+Status cbc_decrypt_segments(const KeySchedule& ks, const SegmentLayout& seg, std::uint64_t offset,
+                            std::span<const std::byte> in, std::span<std::byte> out, std::uint64_t& chain,
+                            ThreadPool* pool = nullptr);
+
+// decrypt bytes [offset, offset+len) of a CTR ciphertext (clamped to its size)
+std::vector<std::byte> ctr_decrypt_range(const KeySchedule& ks, std::uint64_t nonce,
+                                         std::span<const std::byte> cipher, std::uint64_t offset,
+                                         std::size_t len);
+
+} // namespace kedes
@@ -0,0 +1,460 @@
+#include "kedes_aio.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define KEDES_HAVE_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "kedes_metrics.h"
+
+namespace kedes {
+
+namespace {
+
+struct IoOp {
+	bool write;
+	int fd;
+	std::byte* buf;
+	std::size_t len;
+	std::uint64_t offset;
+	std::uint64_t tag;
+};
+
+// Asynchronous pread/pwrite: queue() starts an operation, wait() returns the next
+// completion (res = bytes transferred or -errno)
+class IoEngine {
+public:
+	virtual ~IoEngine() = default;
+	virtual void queue(const IoOp& op) = 0;
+	virtual bool wait(std::uint64_t& tag, std::int64_t& res) = 0;
+};
+
+#ifdef KEDES_HAVE_URING
+class UringEngine : public IoEngine {
+public:
+	~UringEngine() override {
+		if (sqes_) ::munmap(sqes_, sqes_size_);
+		if (cq_ptr_ && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+		if (sq_ptr_) ::munmap(sq_ptr_, sq_size_);
+		if (fd_ >= 0) ::close(fd_);
+	}
+
+	bool init(unsigned entries) {
+		io_uring_params p{};
+		fd_ = (int)::syscall(__NR_io_uring_setup, entries, &p);
+		if (fd_ < 0) return false;
+		sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+		if (single) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+
+		sq_ptr_ = map(sq_size_, IORING_OFF_SQ_RING);
+		if (!sq_ptr_) return false;
+		cq_ptr_ = single ? sq_ptr_ : map(cq_size_, IORING_OFF_CQ_RING);
+		if (!cq_ptr_) return false;
+		sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+		sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+		if (!sqes_) return false;
+
+		auto* sq = static_cast<std::uint8_t*>(sq_ptr_);
+		auto* cq = static_cast<std::uint8_t*>(cq_ptr_);
+		sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+		sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+		sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+		cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+		cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+		cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+		cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+		return supports_read_write();
+	}
+
+	// the pipeline never has more operations outstanding than ring entries
+	void queue(const IoOp& op) override {
+		const unsigned tail = *sq_tail_;
+		const unsigned idx = tail & sq_mask_;
+		io_uring_sqe& sqe = sqes_[idx];
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = op.write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe.fd = op.fd;
+		sqe.addr = reinterpret_cast<std::uint64_t>(op.buf);
+		sqe.len = (std::uint32_t)op.len;
+		sqe.off = op.offset;
+		sqe.user_data = op.tag;
+		sq_array_[idx] = idx;
+		__atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+		++to_submit_;
+	}
+
+	bool wait(std::uint64_t& tag, std::int64_t& res) override {
+		for (;;) {
+			const unsigned head = *cq_head_;
+			if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+				const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+				tag = cqe.user_data;
+				res = cqe.res;
+				__atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+			// submit whatever is queued and sleep until at least one completion
+			long r = ::syscall(__NR_io_uring_enter, fd_, to_submit_, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (r < 0) {
+				if (errno == EINTR) continue;
+				// out of kernel resources or the completion ring is full: reap and retry
+				if (errno == EAGAIN || errno == EBUSY) {
+					std::this_thread::yield();
+					continue;
+				}
+				return false;
+			}
+			to_submit_ -= (unsigned)r;
+		}
+	}
+
+private:
+	// IORING_OP_READ/WRITE arrived in 5.6, after io_uring_setup itself; older kernels
+	// reject the probe too
+	bool supports_read_write() {
+		constexpr unsigned nops = 64;
+		alignas(io_uring_probe) std::uint8_t raw[sizeof(io_uring_probe) + nops * sizeof(io_uring_probe_op)] = {};
+		auto* probe = reinterpret_cast<io_uring_probe*>(raw);
+		if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, nops) < 0) return false;
+		auto supported = [&](unsigned op) {
+			return op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+		};
+		return supported(IORING_OP_READ) && supported(IORING_OP_WRITE);
+	}
+
+	void* map(std::size_t size, off_t what) {
+		void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, what);
+		return p == MAP_FAILED ? nullptr : p;
+	}
+
+	int fd_ = -1;
+	void* sq_ptr_ = nullptr;
+	void* cq_ptr_ = nullptr;
+	std::size_t sq_size_ = 0, cq_size_ = 0, sqes_size_ = 0;
+	io_uring_sqe* sqes_ = nullptr;
+	unsigned* sq_tail_ = nullptr;
+	unsigned sq_mask_ = 0;
+	unsigned* sq_array_ = nullptr;
+	unsigned* cq_head_ = nullptr;
+	unsigned* cq_tail_ = nullptr;
+	unsigned cq_mask_ = 0;
+	io_uring_cqe* cqes_ = nullptr;
+	unsigned to_submit_ = 0;
+};
+#endif
+
+// portable fallback: two threads running blocking pread/pwrite, so a read and a write can
+// be in progress at the same time
+class ThreadEngine : public IoEngine {
+public:
+	ThreadEngine() {
+		for (int i = 0; i < 2; ++i) threads_.emplace_back([this] { loop(); });
+	}
+
+	~ThreadEngine() override {
+		{
+			std::lock_guard<std::mutex> lk(m_);
+			stop_ = true;
+		}
+		op_cv_.notify_all();
+		for (auto& t : threads_) t.join();
+	}
+
+	void queue(const IoOp& op) override {
+		{
+			std::lock_guard<std::mutex> lk(m_);
+			ops_.push_back(op);
+		}
+		op_cv_.notify_one();
+	}
+
+	bool wait(std::uint64_t& tag, std::int64_t& res) override {
+		std::unique_lock<std::mutex> lk(m_);
+		done_cv_.wait(lk, [this] { return !done_.empty(); });
+		tag = done_.front().first;
+		res = done_.front().second;
+		done_.pop_front();
+		return true;
+	}
+
+private:
+	void loop() {
+		for (;;) {
+			IoOp op;
+			{
+				std::unique_lock<std::mutex> lk(m_);
+				op_cv_.wait(lk, [this] { return stop_ || !ops_.empty(); });
+				if (ops_.empty()) return;
+				op = ops_.front();
+				ops_.pop_front();
+			}
+			ssize_t r;
+			do {
+				r = op.write ? ::pwrite(op.fd, op.buf, op.len, (off_t)op.offset)
+				             : ::pread(op.fd, op.buf, op.len, (off_t)op.offset);
+			} while (r < 0 && errno == EINTR);
+			{
+				std::lock_guard<std::mutex> lk(m_);
+				done_.emplace_back(op.tag, r < 0 ? -(std::int64_t)errno : (std::int64_t)r);
+			}
+			done_cv_.notify_one();
+		}
+	}
+
+	std::mutex m_;
+	std::condition_variable op_cv_, done_cv_;
+	std::deque<IoOp> ops_;
+	std::deque<std::pair<std::uint64_t, std::int64_t>> done_;
+	bool stop_ = false;
+	std::vector<std::thread> threads_;
+};
+
+std::unique_ptr<IoEngine> make_engine(IoBackend want, unsigned entries, IoBackend& got) {
+#ifdef KEDES_HAVE_URING
+	if (want != IoBackend::threads) {
+		auto uring = std::make_unique<UringEngine>();
+		if (uring->init(entries)) {
+			got = IoBackend::uring;
+			return uring;
+		}
+	}
+#endif
+	(void)want;
+	(void)entries;
+	got = IoBackend::threads;
+	return std::make_unique<ThreadEngine>();
+}
+
+// toggles O_DIRECT; false when the file system refuses it
+bool set_direct(int fd, bool on) {
+#ifdef O_DIRECT
+	int flags = ::fcntl(fd, F_GETFL);
+	if (flags < 0) return false;
+	flags = on ? flags | O_DIRECT : flags & ~O_DIRECT;
+	return ::fcntl(fd, F_SETFL, flags) == 0;
+#else
+	(void)fd;
+	return !on;
+#endif
+}
+
+struct FreeDeleter {
+	void operator()(std::byte* p) const { std::free(p); }
+};
+
+struct Buffer {
+	std::unique_ptr<std::byte, FreeDeleter> data;
+	std::uint64_t chunk = 0;
+	std::size_t len = 0;        // bytes the current read or write has to move
+	std::size_t done = 0;       // bytes moved so far
+	bool writing = false;
+};
+
+std::size_t align_up(std::size_t n) {
+	return (n + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+}
+
+StreamStats run_file(int in_fd, int out_fd, const KeySchedule& ks, const FileCryptOptions& opt, bool decrypt,
+                     IoBackend* backend_used) {
+	StreamStats stats;
+	struct stat st;
+	if (::fstat(in_fd, &st) != 0) {
+		stats.read_error = true;
+		return stats;
+	}
+	const std::uint64_t size = (std::uint64_t)st.st_size > opt.in_offset ? (std::uint64_t)st.st_size - opt.in_offset : 0;
+	const std::size_t chunk = align_up(std::max<std::size_t>(opt.stream.chunk_bytes, 1));
+	ChunkCipher cipher(ks, opt.stream, decrypt);
+	// an empty input is still one (empty) last chunk, so CBC emits its padding block; a
+	// final chunk too short for the cipher on its own is read as part of the one before it
+	std::uint64_t nchunks = std::max<std::uint64_t>(1, (size + chunk - 1) / chunk);
+	if (nchunks > 1 && size - (nchunks - 1) * chunk < cipher.min_last_chunk()) --nchunks;
+	const unsigned depth = std::max(2u, opt.depth);
+
+	IoBackend got;
+	std::unique_ptr<IoEngine> io = make_engine(opt.backend, depth, got);
+	if (backend_used) *backend_used = got;
+
+	const int in_flags = ::fcntl(in_fd, F_GETFL);
+	const int out_flags = ::fcntl(out_fd, F_GETFL);
+	const bool direct_in = opt.direct && opt.in_offset % IO_ALIGN == 0 && set_direct(in_fd, true);
+	bool direct_out = opt.direct && opt.out_offset % IO_ALIGN == 0 && set_direct(out_fd, true);
+
+	std::vector<Buffer> bufs(depth);
+	std::vector<Buffer*> free_bufs;
+	for (Buffer& b : bufs) {
+		// room for the CBC padding block and tag after a full chunk, or a short tail read
+		// along with it
+		b.data.reset(static_cast<std::byte*>(std::aligned_alloc(IO_ALIGN, chunk + IO_ALIGN)));
+		free_bufs.push_back(&b);
+	}
+	std::vector<Buffer*> ready(depth, nullptr);   // read complete, indexed by chunk % depth
+
+	auto submit = [&](Buffer* b) {
+		const std::uint64_t base = b->writing ? opt.out_offset : opt.in_offset;
+		std::size_t len = b->len - b->done;
+		// O_DIRECT transfers whole pages; a read past the end of the file just comes back short
+		if (!b->writing && direct_in) len = align_up(len);
+		io->queue({b->writing, b->writing ? out_fd : in_fd, b->data.get() + b->done, len,
+		           base + b->chunk * chunk + b->done, (std::uint64_t)(b - bufs.data())});
+	};
+
+	std::uint64_t next_read = 0, next_cipher = 0;
+	unsigned inflight = 0;
+	Buffer* tail = nullptr;     // unaligned final write held back until the others finish
+	bool failed = false;
+	for (;;) {
+		while (!failed && next_read < nchunks && !free_bufs.empty()) {
+			Buffer* b = free_bufs.back();
+			free_bufs.pop_back();
+			b->chunk = next_read++;
+			const std::uint64_t rest = size - std::min(size, b->chunk * chunk);
+			b->len = (std::size_t)(b->chunk + 1 == nchunks ? rest : std::min<std::uint64_t>(chunk, rest));
+			b->done = 0;
+			b->writing = false;
+			if (b->len == 0) {
+				ready[b->chunk % depth] = b;
+				continue;
+			}
+			submit(b);
+			++inflight;
+		}
+
+		Buffer* b = next_cipher < nchunks ? ready[next_cipher % depth] : nullptr;
+		if (!failed && b) {
+			ready[next_cipher % depth] = nullptr;
+			const bool last = next_cipher + 1 == nchunks;
+			stats.bytes_in += b->len;
+			count(Counter::bytes_in, b->len);
+			b->len = cipher.update(std::span<std::byte>(b->data.get(), chunk + IO_ALIGN), b->len, last);
+			if (opt.tap && !stats.write_error && !opt.tap(std::span<const std::byte>(b->data.get(), b->len), last))
+				stats.write_error = true;
+			b->done = 0;
+			b->writing = true;
+			++next_cipher;
+			if (b->len == 0) {
+				free_bufs.push_back(b);
+			} else if (direct_out && b->len % IO_ALIGN != 0) {
+				tail = b;
+			} else {
+				submit(b);
+				++inflight;
+			}
+			continue;
+		}
+
+		if (inflight == 0) {
+			if (tail && !failed) {
+				direct_out = false;
+				set_direct(out_fd, false);
+				submit(tail);
+				tail = nullptr;
+				++inflight;
+				continue;
+			}
+			break;
+		}
+
+		std::uint64_t tag;
+		std::int64_t res;
+		bool ok;
+		{
+			StageTimer timer(Stage::io_wait);
+			ok = io->wait(tag, res);
+		}
+		if (!ok) {
+			// the ring itself failed, so nothing more can be reaped; the kernel may still
+			// be transferring into the buffers in flight, so they are leaked, not freed
+			stats.read_error = true;
+			if (inflight > 0)
+				for (Buffer& leaked : bufs) (void)leaked.data.release();
+			break;
+		}
+		--inflight;
+		Buffer* c = &bufs[tag];
+		if (res <= 0) {
+			// a zero-byte transfer means the input shrank under us or the disk is full
+			(c->writing ? stats.write_error : stats.read_error) = true;
+			failed = true;
+			continue;
+		}
+		c->done = std::min(c->len, c->done + (std::size_t)res);
+		if (c->done < c->len) {
+			submit(c);
+			++inflight;
+		} else if (c->writing) {
+			stats.bytes_out += c->len;
+			count(Counter::bytes_out, c->len);
+			free_bufs.push_back(c);
+		} else {
+			ready[c->chunk % depth] = c;
+		}
+	}
+
+	if (in_flags >= 0) ::fcntl(in_fd, F_SETFL, in_flags);
+	if (out_flags >= 0) ::fcntl(out_fd, F_SETFL, out_flags);
+	stats.status = cipher.status();
+	stats.truncated = cipher.truncated();
+	return stats;
+}
+
+} // namespace
+
+StreamStats file_encrypt(int in_fd, int out_fd, const KeySchedule& ks, const FileCryptOptions& opt,
+                         IoBackend* backend_used) {
+	return run_file(in_fd, out_fd, ks, opt, false, backend_used);
+}
+
+StreamStats file_decrypt(int in_fd, int out_fd, const KeySchedule& ks, const FileCryptOptions& opt,
+                         IoBackend* backend_used) {
+	return run_file(in_fd, out_fd, ks, opt, true, backend_used);
+}
+
+bool uring_available() {
+#ifdef KEDES_HAVE_URING
+	UringEngine probe;
+	return probe.init(1);
+#else
+	return false;
+#endif
+}
+
+const char* to_string(IoBackend b) {
+	switch (b) {
+	case IoBackend::automatic: return "auto";
+	case IoBackend::uring: return "io_uring";
+	case IoBackend::threads: return "threads";
+	}
+	return "unknown";
+}
+
+bool parse_io_backend(const char* name, IoBackend& b) {
+	const std::string s = name;
+	if (s == "auto") b = IoBackend::automatic;
+	else if (s == "uring" || s == "io_uring") b = IoBackend::uring;
+	else if (s == "threads") b = IoBackend::threads;
+	else return false;
+	return true;
+}
+
+} // namespace kedes
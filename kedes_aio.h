@@ -0,0 +1,50 @@
+// Asynchronous file pipeline: read, cipher and write overlap on a ring of aligned buffers.
+// Chunk i of the input is read at in_offset + i*chunk into one of `depth` buffers, ciphered
+// in place on the calling thread (in order, so CBC chains across chunks), then written
+// from the same buffer at out_offset + i*chunk. The buffer goes back to the reads once
+// the write completes, so no chunk is ever copied. Up to depth - 1 reads are in
+// flight ahead of the cipher, and writes drain behind it.
+//
+// Backends: io_uring through the raw system calls (no liburing needed), or a thread-based
+// fallback that runs pread/pwrite on two I/O threads. automatic picks io_uring when the
+// kernel allows it. With direct set, a side whose offset is page aligned is opened with
+// O_DIRECT (the caller opens the files; this only toggles the flag). The final partial
+// write drops O_DIRECT first, the same way dd does.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "kedes.h"
+#include "kedes_stream.h"
+
+namespace kedes {
+
+enum class IoBackend { automatic, uring, threads };
+
+struct FileCryptOptions {
+	StreamOptions stream;                 // mode, IV/nonce, pool; chunk_bytes is rounded up to IO_ALIGN
+	IoBackend backend = IoBackend::automatic;
+	bool direct = false;                  // O_DIRECT on the page-aligned side(s)
+	unsigned depth = 8;                   // buffers in the ring
+	std::uint64_t in_offset = 0;          // where the data starts in the input (e.g. past a container header)
+	std::uint64_t out_offset = 0;         // output bytes in front of the data, written by the caller
+	Sink tap;                             // if set, also sees every output chunk before its write is queued
+};
+
+constexpr std::size_t IO_ALIGN = 4096;
+
+// in_fd must be a regular file (its size decides which chunk is the last one). On a
+// read or write failure StreamStats::write_error or read_error is set. backend_used (if
+// given) receives the backend that actually ran.
+StreamStats file_encrypt(int in_fd, int out_fd, const KeySchedule& ks, const FileCryptOptions& opt,
+                         IoBackend* backend_used = nullptr);
+StreamStats file_decrypt(int in_fd, int out_fd, const KeySchedule& ks, const FileCryptOptions& opt,
+                         IoBackend* backend_used = nullptr);
+
+bool uring_available();
+const char* to_string(IoBackend b);
+bool parse_io_backend(const char* name, IoBackend& b);   // "auto", "uring" or "threads"
+
+} // namespace kedes
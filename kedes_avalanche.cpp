@@ -0,0 +1,174 @@
+// kedes_avalanche: avalanche and diffusion test harness (kedes_diffusion.h). Random
+// blocks (or keys) are encrypted next to their 64 one-bit variants on all cores. For
+// every round count up to --rounds it prints how the output differences spread: mean flip
+// probability, output bits changed per flipped input bit, strict avalanche criterion
+// bias, and how many of the 64 x 64 (input, output) bit dependencies exist.
+//
+// usage: kedes_avalanche [--variant kedes|standard] [--rounds R] [--input plaintext|key]
+//                        [--samples N] [--seed N] [--key HEX] [--bic] [--matrix]
+//                        [-t threads] [--json FILE]
+//   --variant         kedes (default) or standard (DES S-boxes and key schedule)
+//   --rounds R        last round to report, 1..16 (default 16)
+//   --input           flip plaintext bits under a fixed key (default) or key bits
+//   --samples N       random samples, each giving 64 flipped pairs per round; K/M/G
+//                     suffixes are powers of two (default 1M)
+//   --seed N          sample generator seed (default 1)
+//   --key HEX         the fixed key of the plaintext flips (default 133457799BBCDFF1)
+//   --bic             bit independence: the largest correlation between two output bits'
+//                     changes at the final round
+//   --matrix          print the final round's flip probabilities, one row per input bit,
+//                     as tenths (0 = below 0.1, 5 = 0.5 to 0.6, 9 = 0.9 or more)
+//   -t, --threads     worker threads (default: one per hardware thread)
+//   --json FILE       also write every round's flip probability matrix as JSON to FILE
+//                     ("-" for stdout)
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "kedes_diffusion.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
+
+using namespace std;
+
+static void write_json(ostream& out, const kedes::AvalancheOptions& opt, const kedes::AvalancheResult& r,
+                       unsigned threads) {
+	out << "{\n  \"schema\": 1,\n  \"variant\": \"" << kedes::to_string(opt.variant) << "\",\n  \"input\": \""
+	    << kedes::to_string(opt.input) << "\",\n  \"rounds\": " << r.rounds << ",\n  \"samples\": " << r.samples
+	    << ",\n  \"seed\": " << opt.seed << ",\n  \"threads\": " << threads << ",\n  \"seconds\": " << fixed
+	    << setprecision(3) << r.seconds;
+	if (!r.joint.empty()) out << ",\n  \"max_bit_correlation\": " << setprecision(5) << r.max_bit_correlation();
+	out << ",\n  \"per_round\": [\n";
+	for (int round = 1; round <= r.rounds; ++round) {
+		const kedes::DiffusionStats st = r.stats(round);
+		out << setprecision(5) << "    {\"round\": " << round << ", \"mean\": " << st.mean
+		    << ", \"avalanche_min\": " << st.avalanche_min << ", \"avalanche_max\": " << st.avalanche_max
+		    << ", \"sac_max_bias\": " << st.sac_max_bias << ", \"sac_rms_bias\": " << st.sac_rms_bias
+		    << ", \"dependent\": " << st.dependent << ",\n     \"matrix\": [";
+		for (int i = 0; i < 64; ++i) {
+			out << (i ? ",\n                " : "") << "[";
+			for (int j = 0; j < 64; ++j) out << (j ? "," : "") << setprecision(4) << r.probability(round, i, j);
+			out << "]";
+		}
+		out << "]}" << (round < r.rounds ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv)
+{
+	kedes::AvalancheOptions opt;
+	unsigned threads = 0;
+	bool matrix = false;
+	string json;
+	for (int i = 1; i < argc; ++i) {
+		string a = argv[i];
+		if (a == "--bic") {
+			opt.bit_independence = true;
+			continue;
+		}
+		if (a == "--matrix") {
+			matrix = true;
+			continue;
+		}
+		if (i + 1 == argc) {
+			cerr << "Unknown option " << a << " (or missing its value)\n";
+			return 1;
+		}
+		auto next = [&]() { return string(argv[++i]); };
+		uint64_t n = 0;
+		auto number = [&](uint64_t lo, uint64_t hi) {
+			const string v = next();
+			if (kedes::parse_unsigned(v, n) && n >= lo && n <= hi) return true;
+			cerr << "Invalid " << a << " value " << v << " (expected " << lo << " to " << hi << ")\n";
+			return false;
+		};
+		if (a == "--rounds") {
+			if (!number(1, 16)) return 1;
+			opt.rounds = (int)n;
+		} else if (a == "--samples") {
+			string v = next();
+			if (!kedes::parse_count(v, opt.samples)) {
+				cerr << "Invalid --samples value " << v << " (expected a number, K/M/G suffixes allowed)\n";
+				return 1;
+			}
+		} else if (a == "--seed") {
+			if (!number(0, UINT64_MAX)) return 1;
+			opt.seed = n;
+		} else if (a == "--key") {
+			string v = next();
+			if (!kedes::parse_hex64(v, opt.key)) {
+				cerr << "Invalid --key value " << v << " (expected up to 16 hex digits)\n";
+				return 1;
+			}
+		} else if (a == "-t" || a == "--threads") {
+			if (!number(0, UINT32_MAX)) return 1;
+			threads = (unsigned)n;
+		}
+		else if (a == "--json") json = next();
+		else if (a == "--variant") {
+			string v = next();
+			if (!kedes::parse_variant(v, opt.variant)) {
+				cerr << "Unknown variant " << v << " (expected kedes or standard)\n";
+				return 1;
+			}
+		} else if (a == "--input") {
+			string v = next();
+			if (!kedes::parse_avalanche_input(v, opt.input)) {
+				cerr << "Unknown input " << v << " (expected plaintext or key)\n";
+				return 1;
+			}
+		} else {
+			cerr << "Unknown option " << a << "\n";
+			return 1;
+		}
+	}
+
+	kedes::ThreadPool pool(threads);
+	opt.pool = &pool;
+	kedes::AvalancheResult r;
+	string error;
+	if (!kedes::run_avalanche(opt, r, error)) {
+		cerr << "Error: " << error << "\n";
+		return 1;
+	}
+
+	const double pairs = (double)r.pairs() * r.rounds;
+	printf("variant %s, %s flips, %llu samples x 64 bits over rounds 1..%d in %.3f s: %.1f M pairs/s\n",
+	       kedes::to_string(opt.variant), kedes::to_string(opt.input), (unsigned long long)r.samples, r.rounds,
+	       r.seconds, pairs / r.seconds / 1e6);
+	printf("round   mean flip   bits changed min/max   SAC max bias   SAC rms bias   dependent\n");
+	for (int round = 1; round <= r.rounds; ++round) {
+		const kedes::DiffusionStats st = r.stats(round);
+		printf("%5d   %9.4f   %9.2f / %-9.2f   %12.4f   %12.4f   %4d/4096\n", round, st.mean, st.avalanche_min,
+		       st.avalanche_max, st.sac_max_bias, st.sac_rms_bias, st.dependent);
+	}
+	if (opt.bit_independence)
+		printf("bit independence (round %d): max |correlation| %.4f\n", r.rounds, r.max_bit_correlation());
+	if (matrix) {
+		printf("flip probability after round %d (row: input bit, column: output bit, in tenths)\n", r.rounds);
+		for (int i = 0; i < 64; ++i) {
+			char row[65];
+			for (int j = 0; j < 64; ++j) row[j] = (char)('0' + min(9, (int)(r.probability(r.rounds, i, j) * 10)));
+			row[64] = '\0';
+			printf("  %2d %s\n", i, row);
+		}
+	}
+
+	if (json == "-") {
+		write_json(cout, opt, r, pool.size());
+	} else if (!json.empty()) {
+		ofstream out(json);
+		write_json(out, opt, r, pool.size());
+		if (!out) {
+			cerr << "Error writing " << json << "\n";
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,337 @@
+#include "kedes_batch.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include "kedes_container.h"
+#include "kedes_hex.h"
+#include "kedes_metrics.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
+
+namespace kedes {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+bool read_file(const std::string& path, std::vector<std::byte>& data, std::string& error) {
+	StageTimer timer(Stage::read);
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		error = "cannot open for reading";
+		return false;
+	}
+	in.seekg(0, std::ios::end);
+	data.resize((std::size_t)in.tellg());
+	in.seekg(0, std::ios::beg);
+	in.read(reinterpret_cast<char*>(data.data()), (std::streamsize)data.size());
+	if (!in) {
+		error = "read error";
+		return false;
+	}
+	count(Counter::bytes_in, data.size());
+	return true;
+}
+
+// header (may be empty) followed by body
+bool write_file(const std::string& path, std::span<const std::byte> header, std::span<const std::byte> body,
+                std::string& error) {
+	StageTimer timer(Stage::write);
+	std::error_code ec;
+	fs::path parent = fs::path(path).parent_path();
+	if (!parent.empty()) fs::create_directories(parent, ec);
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		error = "cannot open " + path + " for writing";
+		return false;
+	}
+	out.write(reinterpret_cast<const char*>(header.data()), (std::streamsize)header.size());
+	out.write(reinterpret_cast<const char*>(body.data()), (std::streamsize)body.size());
+	out.close();
+	if (!out) {
+		error = "write error on " + path;
+		return false;
+	}
+	count(Counter::bytes_out, header.size() + body.size());
+	return true;
+}
+
+void encrypt_job(const KeySchedule& ks, const BatchOptions& opt, BatchResult& r) {
+	std::vector<std::byte> plain;
+	if (!read_file(r.input, plain, r.message)) return;
+	r.bytes_in = plain.size();
+
+	std::vector<std::byte> cipher;
+	std::vector<std::uint64_t> ivs;
+	if (opt.mode == Mode::cbc_chunked && opt.hex) {
+		r.message = "cbc-chunked needs a container for its segment index";
+		return;
+	}
+	if (opt.mode == Mode::ctr) {
+		cipher = ctr_crypt(ks, opt.iv, plain);
+	} else if (opt.mode == Mode::cbc_cmac) {
+		cipher = std::move(plain);
+		const std::size_t len = cipher.size();
+		cipher.resize(cipher_size(Mode::cbc_cmac, len));
+		encrypt_authenticated(ks, cipher, len, opt.iv);
+	} else if (opt.mode == Mode::cbc_chunked) {
+		// the jobs already share the pool, so the segments of one file stay on its thread
+		cipher = std::move(plain);
+		const std::size_t len = cipher.size();
+		cipher.resize(cipher_size(Mode::cbc, len));
+		pkcs7_pad(cipher, len);
+		ivs.resize(segment_count(cipher.size(), opt.segment_bytes));
+		derive_segment_ivs(ks, opt.iv, ivs);
+		std::uint64_t chain = opt.iv;
+		cbc_encrypt_segments(ks, {opt.segment_bytes, ivs}, 0, cipher, cipher, chain);
+	} else {
+		cipher = encrypt(ks, plain, opt.iv);
+	}
+	if (opt.hex) {
+		std::size_t column = 0;
+		std::vector<std::byte> text(hex_encoded_size(cipher.size()) + 1, std::byte('\n'));
+		std::size_t len = hex_encode_lines(cipher, column, reinterpret_cast<char*>(text.data())) + 1;
+		r.ok = write_file(r.output, {}, std::span<const std::byte>(text.data(), len), r.message);
+		r.bytes_out = len;
+		return;
+	}
+	ContainerHeader h;
+	h.mode = opt.mode;
+	h.iv = opt.iv;
+	h.plain_len = r.bytes_in;
+	if (opt.mode == Mode::cbc_chunked) h.chunk_bytes = (std::uint32_t)opt.segment_bytes;
+	std::vector<std::byte> header(ciphertext_offset(h));
+	encode_header(h, std::span<std::byte>(header).first<CONTAINER_HEADER_SIZE>());
+	encode_segment_index(ivs, std::span<std::byte>(header).subspan(CONTAINER_HEADER_SIZE));
+	r.ok = write_file(r.output, header, cipher, r.message);
+	r.bytes_out = header.size() + cipher.size();
+}
+
+void decrypt_job(const KeySchedule& ks, const BatchOptions& opt, BatchResult& r) {
+	std::vector<std::byte> data;
+	if (!read_file(r.input, data, r.message)) return;
+	r.bytes_in = data.size();
+
+	Mode mode = opt.mode;
+	std::uint64_t iv = opt.iv;
+	std::span<const std::byte> cipher;
+	std::vector<std::byte> parsed;
+	ContainerHeader h;
+	std::vector<std::uint64_t> ivs;
+	const bool container = is_container(data);
+	if (container) {
+		ContainerError err = decode_header(data, h);
+		if (err != ContainerError::none) {
+			r.message = to_string(err);
+			return;
+		}
+		err = decode_segment_index(h, std::span<const std::byte>(data).subspan(CONTAINER_HEADER_SIZE), ivs);
+		if (err == ContainerError::none) err = check_cipher_size(h, data.size() - ciphertext_offset(h));
+		if (err != ContainerError::none) {
+			r.message = to_string(err);
+			return;
+		}
+		mode = h.mode;
+		iv = h.iv;
+		cipher = std::span<const std::byte>(data).subspan(ciphertext_offset(h));
+	} else if (mode == Mode::cbc_chunked) {
+		r.message = "cbc-chunked input must be a container (the segment IVs live in its index)";
+		return;
+	} else {
+		// hex text: same tolerance as KE_DES_Decrypt (non-hex noise skipped, odd length padded)
+		std::string digits(data.size() + 1, '0');
+		std::size_t n = hex_compact(std::span<const char>(reinterpret_cast<const char*>(data.data()), data.size()),
+		                            digits.data() + 1);
+		const char* first = digits.data() + 1;
+		if (n % 2 != 0) {
+			r.message = "odd-length hex input; prepended '0'";
+			--first;
+			++n;
+		}
+		parsed.resize(n / 2);
+		hex_decode_digits(first, parsed.size(), parsed.data());
+		cipher = parsed;
+	}
+
+	std::vector<std::byte> plain;
+	if (mode == Mode::ctr) {
+		plain = ctr_crypt(ks, iv, cipher);
+	} else if (mode == Mode::cbc_cmac) {
+		// nothing is written unless the tag matches
+		plain.resize(cipher.size() > TAG_SIZE ? cipher.size() - TAG_SIZE : 0);
+		std::size_t len;
+		const Status status = decrypt_authenticated(ks, cipher, plain, len, iv);
+		if (status == Status::bad_length || status == Status::bad_tag) {
+			r.message = status == Status::bad_tag ? "authentication failed; nothing written"
+			                                       : "ciphertext size not multiple of 8; nothing written";
+			return;
+		}
+		if (status == Status::bad_padding) r.message = "invalid PKCS#7 padding; wrote full plaintext";
+		plain.resize(len);
+	} else {
+		if (cipher.size() % BLOCK_SIZE != 0) {
+			r.message = "ciphertext size not multiple of 8; truncated";
+			cipher = cipher.first(cipher.size() / BLOCK_SIZE * BLOCK_SIZE);
+		}
+		Status status;
+		if (mode == Mode::cbc_chunked) {
+			plain.assign(cipher.begin(), cipher.end());
+			std::uint64_t chain = iv;
+			if (cbc_decrypt_segments(ks, {h.chunk_bytes, ivs}, 0, plain, plain, chain) != Status::ok) {
+				r.message = "ciphertext runs past its segment index; nothing written";
+				return;
+			}
+			std::size_t len;
+			status = pkcs7_unpad(plain, len);
+			plain.resize(len);
+		} else {
+			status = decrypt(ks, cipher, plain, iv);
+		}
+		if (status == Status::bad_padding) r.message = "invalid PKCS#7 padding; wrote full plaintext";
+	}
+	if (container && r.message.empty() && plain.size() != h.plain_len)
+		r.message = "recovered length differs from the container header";
+	r.ok = write_file(r.output, {}, plain, r.message);
+	r.bytes_out = plain.size();
+}
+
+} // namespace
+
+std::string default_output(const std::string& input, const BatchOptions& opt) {
+	if (!opt.decrypt) return input + (opt.hex ? ".txt" : ".bin");
+	for (const char* ext : {".bin", ".txt"}) {
+		const std::size_t n = std::char_traits<char>::length(ext);
+		if (input.size() > n && input.compare(input.size() - n, n, ext) == 0) return input.substr(0, input.size() - n);
+	}
+	return input + ".dec";
+}
+
+bool read_manifest(std::istream& in, const BatchOptions& opt, std::uint64_t default_key,
+                   std::vector<BatchJob>& jobs, std::string& error) {
+	std::string line;
+	for (std::size_t lineno = 1; std::getline(in, line); ++lineno) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty() || line[0] == '#') continue;
+		std::vector<std::string> fields;
+		std::stringstream ss(line);
+		for (std::string f; std::getline(ss, f, '\t');) fields.push_back(f);
+		if (fields.empty() || fields[0].empty() || fields.size() > 3) {
+			error = "manifest line " + std::to_string(lineno) + ": expected input[<TAB>output[<TAB>key]]";
+			return false;
+		}
+		BatchJob job;
+		job.input = fields[0];
+		job.output = fields.size() > 1 && !fields[1].empty() ? fields[1] : default_output(job.input, opt);
+		job.key = default_key;
+		if (fields.size() > 2 && !parse_hex64(fields[2], job.key)) {
+			error = "manifest line " + std::to_string(lineno) + ": bad key '" + fields[2] + "'";
+			return false;
+		}
+		jobs.push_back(std::move(job));
+	}
+	return true;
+}
+
+bool scan_directory(const std::string& in_dir, const std::string& out_dir, const BatchOptions& opt,
+                    std::uint64_t key, std::vector<BatchJob>& jobs, std::string& error) {
+	// earlier outputs are skipped when encrypting; decryption takes only ciphertext files
+	auto wanted = [&](const fs::path& p) {
+		const fs::path ext = p.extension();
+		if (opt.decrypt) return ext == ".bin" || ext == ".txt";
+		return ext != (opt.hex ? ".txt" : ".bin");
+	};
+	std::error_code ec;
+	std::vector<fs::path> files;
+	for (fs::recursive_directory_iterator it(in_dir, ec), end; !ec && it != end; it.increment(ec))
+		if (it->is_regular_file(ec) && wanted(it->path())) files.push_back(it->path());
+	if (ec) {
+		error = in_dir + ": " + ec.message();
+		return false;
+	}
+	std::sort(files.begin(), files.end());
+	for (const fs::path& p : files) {
+		BatchJob job;
+		job.input = p.string();
+		fs::path out = out_dir.empty() ? p : fs::path(out_dir) / fs::relative(p, in_dir);
+		job.output = default_output(out.string(), opt);
+		job.key = key;
+		jobs.push_back(std::move(job));
+	}
+	return true;
+}
+
+bool check_outputs(const std::vector<BatchJob>& jobs, std::string& error) {
+	// the same file under two spellings ("d/x", "d/../d/x") compares equal after this
+	auto normal = [](const std::string& p) {
+		std::error_code ec;
+		const fs::path abs = fs::absolute(p, ec).lexically_normal();
+		fs::path n = fs::weakly_canonical(abs, ec);
+		return ec ? abs : n;
+	};
+	std::map<fs::path, const BatchJob*> inputs, outputs;
+	for (const BatchJob& job : jobs) inputs.try_emplace(normal(job.input), &job);
+	for (const BatchJob& job : jobs) {
+		const fs::path out = normal(job.output);
+		if (auto in = inputs.find(out); in != inputs.end()) {
+			error = job.output + ": output of " + job.input + " is also the input " + in->second->input;
+			return false;
+		}
+		if (auto [other, fresh] = outputs.try_emplace(out, &job); !fresh) {
+			error = job.output + ": output of both " + other->second->input + " and " + job.input;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool load_jobs(const std::string& source, const std::string& out_dir, const BatchOptions& opt, std::uint64_t key,
+               std::vector<BatchJob>& jobs, std::string& error) {
+	std::error_code ec;
+	if (fs::is_directory(source, ec)) return scan_directory(source, out_dir, opt, key, jobs, error) && check_outputs(jobs, error);
+	std::ifstream in(source);
+	if (!in) {
+		error = "cannot open " + source;
+		return false;
+	}
+	std::vector<BatchJob> listed;
+	if (!read_manifest(in, opt, key, listed, error)) return false;
+	for (BatchJob& job : listed) {
+		if (!out_dir.empty()) job.output = (fs::path(out_dir) / fs::path(job.output).filename()).string();
+		jobs.push_back(std::move(job));
+	}
+	return check_outputs(jobs, error);
+}
+
+std::vector<BatchResult> run_batch(const std::vector<BatchJob>& jobs, const BatchOptions& opt,
+                                   const std::function<void(const BatchResult&)>& done) {
+	// one key schedule per distinct key, shared read-only by all tasks
+	std::map<std::uint64_t, KeySchedule> schedules;
+	for (const BatchJob& job : jobs) schedules.try_emplace(job.key, job.key);
+
+	std::vector<BatchResult> results(jobs.size());
+	std::mutex done_m;
+	auto run_one = [&](std::size_t i) {
+		BatchResult& r = results[i];
+		r.input = jobs[i].input;
+		r.output = jobs[i].output;
+		const KeySchedule& ks = schedules.at(jobs[i].key);
+		if (opt.decrypt) decrypt_job(ks, opt, r);
+		else encrypt_job(ks, opt, r);
+		if (done) {
+			std::lock_guard<std::mutex> lk(done_m);
+			done(r);
+		}
+	};
+	if (opt.pool) opt.pool->parallel_for(jobs.size(), run_one);
+	else for (std::size_t i = 0; i < jobs.size(); ++i) run_one(i);
+	return results;
+}
+
+} // namespace kedes
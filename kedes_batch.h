@@ -0,0 +1,74 @@
+// Batch runner: encrypt or decrypt many files in one process.
+// Jobs come from a manifest or a directory tree. Key schedules are built once per distinct
+// key, then every file is one task on the work-stealing pool. A task reads its file,
+// runs the cipher and writes the result, so one worker's I/O overlaps with another's
+// cipher work. A failing file produces a failed result and the batch keeps going.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "kedes.h"
+
+namespace kedes {
+
+struct BatchJob {
+	std::string input;
+	std::string output;
+	std::uint64_t key = 0;
+};
+
+struct BatchResult {
+	std::string input;
+	std::string output;
+	bool ok = false;
+	std::string message;        // error for failed jobs, warning (e.g. bad padding) otherwise
+	std::uint64_t bytes_in = 0;
+	std::uint64_t bytes_out = 0;
+};
+
+struct BatchOptions {
+	bool decrypt = false;
+	Mode mode = Mode::cbc;      // for encryption and for hex (non-container) decryption input
+	std::uint64_t iv = 0;
+	bool hex = false;           // encrypt to the ciphertext.txt hex layout instead of a container
+	std::size_t segment_bytes = CHUNK_BYTES;  // cbc_chunked encryption; a multiple of BLOCK_SIZE
+	ThreadPool* pool = nullptr; // nullptr runs the jobs on the calling thread
+};
+
+// Manifest lines: input[<TAB>output[<TAB>key as hex]]; blank lines and lines starting with
+// '#' are skipped. A missing output is derived with default_output(), a missing key
+// is default_key. Returns false and sets error on a malformed line.
+bool read_manifest(std::istream& in, const BatchOptions& opt, std::uint64_t default_key,
+                   std::vector<BatchJob>& jobs, std::string& error);
+
+// Every regular file under in_dir (sorted), mirrored under out_dir (or next to the input
+// when out_dir is empty) with the name given by default_output(). Encryption skips files
+// that already carry its output extension (.bin, or .txt for hex); decryption takes only
+// .bin and .txt files.
+bool scan_directory(const std::string& in_dir, const std::string& out_dir, const BatchOptions& opt,
+                    std::uint64_t key, std::vector<BatchJob>& jobs, std::string& error);
+
+// Fails when an output is also an input or two jobs share an output, since jobs run
+// concurrently and one would read or overwrite another's file
+bool check_outputs(const std::vector<BatchJob>& jobs, std::string& error);
+
+// source is a directory (scan_directory) or a manifest file (read_manifest); with out_dir
+// set, manifest outputs are placed in out_dir under their file names. The jobs are
+// checked with check_outputs().
+bool load_jobs(const std::string& source, const std::string& out_dir, const BatchOptions& opt, std::uint64_t key,
+               std::vector<BatchJob>& jobs, std::string& error);
+
+// "x" -> "x.bin" (or "x.txt" for hex) when encrypting; decryption strips ".bin"/".txt"
+// or appends ".dec"
+std::string default_output(const std::string& input, const BatchOptions& opt);
+
+// Runs every job; done (if set) is called once per finished file, serialised, as results
+// come in. The returned results are in job order.
+std::vector<BatchResult> run_batch(const std::vector<BatchJob>& jobs, const BatchOptions& opt,
+                                   const std::function<void(const BatchResult&)>& done = {});
+
+} // namespace kedes
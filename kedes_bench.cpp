@@ -0,0 +1,393 @@
+// Microbenchmarks for libkedes: key schedule, block engine and its variants (standard
+// S-boxes, reduced rounds), CBC/CTR (single and EDE), hex codec and file I/O.
+// Every case is calibrated so that one repetition takes at least --min-time, run --warmup
+// times untimed and then --reps times; ns/op and cycles/byte are reported as min/p50/p90/p99
+// over the repetitions. Cycles are TSC ticks (constant rate, not the core clock).
+//
+// usage: kedes_bench [--reps N] [--warmup N] [--min-time MS] [--max-size BYTES] [--sizes LIST]
+//                    [--threads N] [--kernel NAME] [--filter TEXT] [--json FILE]
+//   --max-size    largest buffer for the size sweeps (default 64M; 1G for the full range)
+//   --sizes       comma-separated sweep sizes with K/M/G suffixes (default 1K,16K,256K,4M,64M,1G)
+//                 (the hex cases stop at 256M to bound the size of the text buffers)
+//   --kernel      block kernel to measure (auto, scalar, bs64, sse2, avx2, avx512; see
+//                 kedes_dispatch.h); the default is the widest the CPU supports
+//   --filter      run only the cases whose name contains TEXT
+//   --json        also write the results as JSON to FILE ("-" for stdout)
+//   --check-allocs  exit 1 if a case marked allocation-free (the single-threaded modes
+//                   and the in-place entry points) allocates during its timed repetitions
+// Heap allocations are counted by replacing the global operator new; allocs/op covers
+// every thread, the pool workers included.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define KEDES_BENCH_TSC 1
+#endif
+
+#include "kedes.h"
+#include "kedes_bitslice.h"
+#include "kedes_dispatch.h"
+#include "kedes_hex.h"
+#include "kedes_multikey.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
+#include "kedes_variant.h"
+
+using namespace std;
+using kedes::percentile;
+
+static atomic<uint64_t> heap_allocs{0};
+
+void* operator new(size_t n) {
+	heap_allocs.fetch_add(1, memory_order_relaxed);
+	if (void* p = malloc(n ? n : 1)) return p;
+	throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static uint64_t read_tsc() {
+#ifdef KEDES_BENCH_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// keep the compiler from dropping work whose result is otherwise unused
+template <class T>
+static inline void keep(const T& value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchOptions {
+	int reps = 10;
+	int warmup = 2;
+	double min_time_ms = 2.0;
+	size_t max_size = 64u << 20;
+	vector<size_t> sizes = {1u << 10, 16u << 10, 256u << 10, 4u << 20, 64u << 20, 1u << 30};
+	unsigned threads = 0;
+	kedes::Kernel kernel = kedes::Kernel::automatic;
+	string filter;
+	string json;
+	bool check_allocs = false;
+};
+
+struct BenchCase {
+	string name;
+	size_t size;          // buffer size of the sweep, 0 for fixed-size ops
+	size_t bytes_per_op;  // 0 when cycles/byte does not apply
+	function<void()> op;
+	bool alloc_free = false;  // checked by --check-allocs
+};
+
+struct BenchResult {
+	string name;
+	size_t size = 0;
+	size_t bytes_per_op = 0;
+	size_t iters = 0;           // ops per repetition
+	vector<double> ns;          // per op, one entry per repetition
+	vector<double> cycles;      // per op
+	double allocs = 0;          // heap allocations per op over the timed repetitions
+};
+
+static BenchResult run_case(const BenchCase& c, const BenchOptions& opt) {
+	BenchResult r;
+	r.name = c.name;
+	r.size = c.size;
+	r.bytes_per_op = c.bytes_per_op;
+
+	auto timed = [&](size_t iters, double& ns, double& cyc) {
+		auto t0 = chrono::steady_clock::now();
+		uint64_t c0 = read_tsc();
+		for (size_t i = 0; i < iters; ++i) c.op();
+		uint64_t c1 = read_tsc();
+		auto t1 = chrono::steady_clock::now();
+		ns = (double)chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count();
+		cyc = (double)(c1 - c0);
+	};
+
+	// calibrate: double the op count until one repetition reaches min_time
+	size_t iters = 1;
+	double ns = 0, cyc = 0;
+	for (;;) {
+		timed(iters, ns, cyc);
+		if (ns >= opt.min_time_ms * 1e6 || iters >= (size_t(1) << 30)) break;
+		iters *= 2;
+	}
+	r.iters = iters;
+
+	for (int i = 0; i < opt.warmup; ++i) timed(iters, ns, cyc);
+	r.ns.reserve(opt.reps);
+	r.cycles.reserve(opt.reps);
+	const uint64_t allocs0 = heap_allocs.load();
+	for (int i = 0; i < opt.reps; ++i) {
+		timed(iters, ns, cyc);
+		r.ns.push_back(ns / (double)iters);
+		r.cycles.push_back(cyc / (double)iters);
+	}
+	r.allocs = (double)(heap_allocs.load() - allocs0) / ((double)iters * opt.reps);
+	sort(r.ns.begin(), r.ns.end());
+	sort(r.cycles.begin(), r.cycles.end());
+	return r;
+}
+
+static string size_label(size_t n) {
+	if (n == 0) return "-";
+	if (n % (1u << 30) == 0) return to_string(n >> 30) + "G";
+	if (n % (1u << 20) == 0) return to_string(n >> 20) + "M";
+	if (n % (1u << 10) == 0) return to_string(n >> 10) + "K";
+	return to_string(n);
+}
+
+static void write_json(ostream& out, const vector<BenchResult>& results, const BenchOptions& opt, unsigned threads) {
+	auto stats = [&](const vector<double>& v, double scale) {
+		ostringstream s;
+		s << fixed << setprecision(3) << "{\"min\": " << v.front() * scale << ", \"p50\": " << percentile(v, 50) * scale
+		  << ", \"p90\": " << percentile(v, 90) * scale << ", \"p99\": " << percentile(v, 99) * scale
+		  << ", \"max\": " << v.back() * scale << "}";
+		return s.str();
+	};
+	out << "{\n  \"schema\": 1,\n  \"reps\": " << opt.reps << ",\n  \"warmup\": " << opt.warmup
+	    << ",\n  \"threads\": " << threads << ",\n  \"kernel\": \"" << kedes::to_string(kedes::active_kernel())
+	    << "\",\n  \"bitslice_width\": " << bs_batch_width()
+	    << ",\n  \"tsc\": " << (read_tsc() ? "true" : "false") << ",\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult& r = results[i];
+		out << "    {\"name\": \"" << r.name << "\", \"size\": " << r.size << ", \"bytes_per_op\": " << r.bytes_per_op
+		    << ", \"iters\": " << r.iters << ",\n     \"ns_per_op\": " << stats(r.ns, 1.0)
+		    << ",\n     \"cycles_per_op\": " << stats(r.cycles, 1.0) << ",\n     \"allocs_per_op\": " << r.allocs;
+		if (r.bytes_per_op) {
+			out << ",\n     \"cycles_per_byte\": " << stats(r.cycles, 1.0 / (double)r.bytes_per_op)
+			    << ",\n     \"mb_per_s\": " << fixed << setprecision(1)
+			    << (double)r.bytes_per_op / percentile(r.ns, 50) * 1e3;
+		}
+		out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions opt;
+	bool sizes_given = false;
+	for (int i = 1; i < argc; ++i) {
+		string a = argv[i];
+		if (a == "--check-allocs") {
+			opt.check_allocs = true;
+			continue;
+		}
+		if (i + 1 == argc) {
+			cerr << "Unknown option " << a << " (or missing its value)\n";
+			return 1;
+		}
+		const string v = argv[++i];
+		uint64_t n = 0;
+		auto number = [&](const string& text, uint64_t lo, uint64_t hi) {
+			if (kedes::parse_count(text, n) && n >= lo && n <= hi) return true;
+			cerr << "Invalid " << a << " value " << text << " (expected " << lo << " to " << hi
+			     << ", K/M/G suffixes allowed)\n";
+			return false;
+		};
+		if (a == "--reps") {
+			if (!number(v, 1, INT32_MAX)) return 1;
+			opt.reps = (int)n;
+		} else if (a == "--warmup") {
+			if (!number(v, 0, INT32_MAX)) return 1;
+			opt.warmup = (int)n;
+		} else if (a == "--min-time") {
+			if (!kedes::parse_decimal(v, opt.min_time_ms)) {
+				cerr << "Invalid --min-time value " << v << " (expected milliseconds)\n";
+				return 1;
+			}
+		} else if (a == "--max-size") {
+			if (!number(v, 1, SIZE_MAX)) return 1;
+			opt.max_size = (size_t)n;
+		} else if (a == "--threads") {
+			if (!number(v, 0, UINT32_MAX)) return 1;
+			opt.threads = (unsigned)n;
+		} else if (a == "--kernel") {
+			if (!kedes::parse_kernel(v, opt.kernel)) {
+				cerr << "Unknown kernel " << v << "\n";
+				return 1;
+			}
+		} else if (a == "--filter") opt.filter = v;
+		else if (a == "--json") opt.json = v;
+		else if (a == "--sizes") {
+			opt.sizes.clear();
+			stringstream list(v);
+			for (string item; getline(list, item, ',');) {
+				if (!number(item, 1, SIZE_MAX)) return 1;
+				opt.sizes.push_back((size_t)n);
+			}
+			sizes_given = true;
+		} else {
+			cerr << "Unknown option " << a << "\n";
+			return 1;
+		}
+	}
+	if (!kedes::set_kernel(opt.kernel)) {
+		cerr << "Kernel " << kedes::to_string(opt.kernel) << " is not supported by this CPU\n";
+		return 1;
+	}
+	vector<size_t> sizes;
+	for (size_t n : opt.sizes)
+		if (n >= kedes::BLOCK_SIZE && (sizes_given || n <= opt.max_size)) sizes.push_back(n / kedes::BLOCK_SIZE * kedes::BLOCK_SIZE);
+
+	kedes::ThreadPool pool(opt.threads);
+	const kedes::KeySchedule ks(0x133457799BBCDFF1ULL);
+	const kedes::TripleKeySchedule ks3(0x133457799BBCDFF1ULL, 0x0E329232EA6D0D73ULL, 0x8000000000000000ULL);
+	const kedes::VariantSchedule<kedes::StandardDes> ks_std(0x133457799BBCDFF1ULL);
+	const kedes::VariantSchedule<kedes::KeDesRounds<8>> ks_r8(0x133457799BBCDFF1ULL);
+	const filesystem::path tmp = filesystem::temp_directory_path() / ("kedes_bench." + to_string(getpid()));
+
+	size_t largest = sizes.empty() ? 0 : *max_element(sizes.begin(), sizes.end());
+	vector<byte> buf(largest);
+	for (size_t i = 0; i < buf.size(); ++i) buf[i] = byte(i * 131 + 7);
+	const size_t HEX_MAX = 256u << 20;
+	string text(kedes::hex_encoded_size(min(largest, HEX_MAX)), '\0');
+	string digits(text.size(), '\0');
+
+	vector<BenchCase> cases;
+	uint64_t block = 0x0123456789ABCDEFULL;
+	cases.push_back({"key_schedule", 0, 0, [&] { kedes::KeySchedule k(block++); keep(k); }});
+	cases.push_back({"block_encrypt", 0, kedes::BLOCK_SIZE, [&] { block = ks.encrypt_block(block); keep(block); }, true});
+	cases.push_back({"block_decrypt", 0, kedes::BLOCK_SIZE, [&] { block = ks.decrypt_block(block); keep(block); }, true});
+	cases.push_back({"block_encrypt3", 0, kedes::BLOCK_SIZE, [&] { block = ks3.encrypt_block(block); keep(block); }, true});
+	cases.push_back({"block_encrypt_std", 0, kedes::BLOCK_SIZE, [&] { block = ks_std.encrypt_block(block); keep(block); }, true});
+	cases.push_back({"block_encrypt_r8", 0, kedes::BLOCK_SIZE, [&] { block = ks_r8.encrypt_block(block); keep(block); }, true});
+
+	// multi-tenant records: 64K blocks over 1024 keys through the schedule cache, and the
+	// per-lane key-slice kernel on its own with genuinely different round keys
+	const size_t MULTI = 64 * 1024;
+	kedes::KeyScheduleCache cache;
+	vector<kedes::KeyedBlock> records(MULTI);
+	for (size_t i = 0; i < MULTI; ++i) records[i] = {i * 0x9E3779B97F4A7C15ULL % 1024, i};
+	vector<uint64_t> lane_cd0(MULTI), lane_blocks(MULTI);
+	for (size_t i = 0; i < MULTI; ++i) lane_cd0[i] = (i * 0x5851F42D4C957F2DULL) >> 8;
+	cases.push_back({"multikey_cached", MULTI * kedes::BLOCK_SIZE, MULTI * kedes::BLOCK_SIZE, [&] {
+		kedes::encrypt_multi(records, cache);
+		keep(records[0].block);
+	}});
+	cases.push_back({"multikey_sliced", MULTI * kedes::BLOCK_SIZE, MULTI * kedes::BLOCK_SIZE, [&] {
+		des_blocks_multi_packed<false>(lane_blocks.data(), MULTI, lane_cd0.data());
+		keep(lane_blocks[0]);
+	}});
+	for (size_t n : sizes) {
+		span<byte> data(buf.data(), n);
+		uint64_t* blocks = reinterpret_cast<uint64_t*>(buf.data());
+		cases.push_back({"ecb_blocks", n, n, [=, &ks] { ks.encrypt_blocks(blocks, n / kedes::BLOCK_SIZE); keep(blocks[0]); }, true});
+		cases.push_back({"ecb_blocks_std", n, n, [=, &ks_std] {
+			ks_std.encrypt_blocks(blocks, n / kedes::BLOCK_SIZE);
+			keep(blocks[0]);
+		}, true});
+		cases.push_back({"ecb_blocks_r8", n, n, [=, &ks_r8] {
+			ks_r8.encrypt_blocks(blocks, n / kedes::BLOCK_SIZE);
+			keep(blocks[0]);
+		}, true});
+		cases.push_back({"cbc_encrypt", n, n, [=, &ks] { keep(kedes::cbc_encrypt_blocks(ks, data, 0)); }, true});
+		cases.push_back({"cbc_decrypt", n, n, [=, &ks] { keep(kedes::cbc_decrypt_blocks(ks, data, 0)); }, true});
+		cases.push_back({"cbc_decrypt_pool", n, n, [=, &ks, &pool] { keep(kedes::cbc_decrypt_blocks(ks, data, 0, &pool)); }});
+		// a whole padded message (the last block is the padding) and its decryption, in place
+		cases.push_back({"encrypt_in_place", n, n, [=, &ks] {
+			keep(kedes::encrypt_in_place(ks, data, n - kedes::BLOCK_SIZE, 0));
+		}, true});
+		cases.push_back({"decrypt_in_place", n, n, [=, &ks] {
+			size_t len;
+			keep(kedes::decrypt_in_place(ks, data, len, 0));
+			keep(len);
+		}, true});
+		cases.push_back({"ctr", n, n, [=, &ks] { kedes::ctr_crypt(ks, 0, 0, data, data); keep(data[0]); }, true});
+		cases.push_back({"ctr_pool", n, n, [=, &ks, &pool] { kedes::ctr_crypt(ks, 0, 0, data, data, &pool); keep(data[0]); }});
+		cases.push_back({"cbc3_encrypt", n, n, [=, &ks3] { keep(kedes::cbc_encrypt_blocks(ks3, data, 0)); }, true});
+		cases.push_back({"cbc3_decrypt", n, n, [=, &ks3] { keep(kedes::cbc_decrypt_blocks(ks3, data, 0)); }, true});
+		cases.push_back({"ctr3", n, n, [=, &ks3] { kedes::ctr_crypt(ks3, 0, 0, data, data); keep(data[0]); }, true});
+		if (n <= HEX_MAX) {
+			cases.push_back({"hex_encode", n, n, [=, &text] {
+				size_t column = 0;
+				keep(kedes::hex_encode_lines(data, column, text.data()));
+			}});
+			cases.push_back({"hex_decode", n, n, [=, &text, &digits] {
+				size_t len = kedes::hex_compact(span<const char>(text.data(), kedes::hex_encoded_size(n)), digits.data());
+				kedes::hex_decode_digits(digits.data(), len / 2, data.data());
+				keep(data[0]);
+			}});
+		}
+		cases.push_back({"file_write", n, n, [=, &tmp] {
+			ofstream out(tmp, ios::binary | ios::trunc);
+			out.write(reinterpret_cast<const char*>(data.data()), (streamsize)n);
+		}});
+		cases.push_back({"file_read", n, n, [=, &tmp] {
+			ifstream in(tmp, ios::binary);
+			in.read(reinterpret_cast<char*>(data.data()), (streamsize)n);
+			keep(data[0]);
+		}});
+	}
+
+	cout << left << setw(18) << "case" << right << setw(6) << "size" << setw(14) << "p50 ns/op" << setw(14) << "p99 ns/op"
+	     << setw(12) << "cyc/byte" << setw(12) << "MB/s" << setw(11) << "allocs/op" << "\n";
+	vector<BenchResult> results;
+	vector<string> allocating;
+	for (const BenchCase& c : cases) {
+		if (!opt.filter.empty() && c.name.find(opt.filter) == string::npos) continue;
+		if (c.name == "file_read") {
+			// file_read needs the file of this size in place
+			ofstream out(tmp, ios::binary | ios::trunc);
+			out.write(reinterpret_cast<const char*>(buf.data()), (streamsize)c.size);
+		}
+		if (c.name == "hex_decode") {
+			size_t column = 0;
+			kedes::hex_encode_lines(span<const byte>(buf.data(), c.size), column, text.data());
+		}
+		BenchResult r = run_case(c, opt);
+		double p50 = percentile(r.ns, 50);
+		cout << left << setw(18) << r.name << right << setw(6) << size_label(r.size) << fixed << setprecision(1)
+		     << setw(14) << p50 << setw(14) << percentile(r.ns, 99);
+		if (r.bytes_per_op)
+			cout << setprecision(2) << setw(12) << percentile(r.cycles, 50) / (double)r.bytes_per_op
+			     << setprecision(1) << setw(12) << (double)r.bytes_per_op / p50 * 1e3;
+		else
+			cout << setw(24) << "";
+		cout << setprecision(2) << setw(11) << r.allocs << "\n" << flush;
+		if (c.alloc_free && r.allocs > 0) allocating.push_back(r.name + "/" + size_label(r.size));
+		results.push_back(move(r));
+	}
+	error_code ec;
+	filesystem::remove(tmp, ec);
+
+	if (opt.json == "-") {
+		write_json(cout, results, opt, pool.size());
+	} else if (!opt.json.empty()) {
+		ofstream out(opt.json);
+		write_json(out, results, opt, pool.size());
+		if (!out) {
+			cerr << "Error writing " << opt.json << "\n";
+			return 1;
+		}
+	}
+	if (opt.check_allocs && !allocating.empty()) {
+		cerr << "Heap allocations in allocation-free cases:";
+		for (const string& name : allocating) cerr << " " << name;
+		cerr << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,379 @@
+// Bitsliced KE-DES kernels for batches of independent blocks (ECB-style, CTR keystream,
+// CBC decryption).
+// A batch is transposed so that slice p holds bit p+1 (MSB-first) of every block; the
+// permutations then become plain renaming and the simplified S-box formula
+// ((val*(i+1)) ^ (val>>2)) & 0xF becomes a small adder circuit per S-box.
+// One slice is a uint64_t (64 blocks), a 128-bit vector (SSE2, 128 blocks), a 256-bit
+// vector (AVX2, 256 blocks) or a 512-bit vector (AVX-512, 512 blocks). The dispatchers at
+// the bottom run the active kernel (kedes_dispatch.h: the widest the CPU supports unless
+// one is forced), then the narrower ones, and anything left over goes through the scalar
+// engine in kedes_block.h. They also take the cross-check samples.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "kedes_block.h"
+#include "kedes_dispatch.h"
+
+#define KEDES_BS_INLINE inline __attribute__((always_inline))
+
+typedef uint64_t bs_v128 __attribute__((vector_size(16)));
+typedef uint64_t bs_v256 __attribute__((vector_size(32)));
+typedef uint64_t bs_v512 __attribute__((vector_size(64)));
+
+// P_INV[q] is the output position of S-box output bit q (both 0-based)
+struct PInvTable {
+	int t[32];
+};
+
+static constexpr PInvTable make_p_inv() {
+	PInvTable p{};
+	for (int j = 0; j < 32; ++j) p.t[P_TABLE[j] - 1] = j;
+	return p;
+}
+
+static constexpr PInvTable P_INV = make_p_inv();
+
+// Round keys shared by all lanes: each key bit is XORed in as an all-zeros or
+// all-ones slice
+template <class V>
+struct BsBroadcastKeys {
+	const uint64_t* roundKeys;
+
+	KEDES_BS_INLINE void mix(V& x, int round, int bit) const {
+		uint64_t kb = (roundKeys[round] >> (47 - bit)) & 1ULL;
+		x ^= V{} - kb;
+	}
+};
+
+// 64x64 bit matrix transpose applied lane-wise (Hacker's Delight, 6 swap stages)
+template <class V>
+static KEDES_BS_INLINE void bs_transpose64(V a[64]) {
+	uint64_t m = 0x00000000FFFFFFFFULL;
+	for (int j = 32; j != 0; j >>= 1, m ^= m << j) {
+		for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+			V t = (a[k] ^ (a[k | j] >> j)) & m;
+			a[k] ^= t;
+			a[k | j] ^= t << j;
+		}
+	}
+}
+
+// 4-bit ripple-carry add p += q (mod 16), LSB-first slices
+template <class V>
+static KEDES_BS_INLINE void bs_add4(V p[4], const V q[4]) {
+	V c = V{};
+	for (int m = 0; m < 4; ++m) {
+		V x = p[m] ^ q[m];
+		V s = x ^ c;
+		c = (p[m] & q[m]) | (c & x);
+		p[m] = s;
+	}
+}
+
+// Simplified S-box I as a boolean circuit: n = ((val*(I+1)) ^ (val>>2)) & 0xF.
+// in[0..5] is the 6-bit input MSB-first, n[0..3] the nibble LSB-first.
+template <int I, class V>
+static KEDES_BS_INLINE void bs_sbox(const V in[6], V n[4]) {
+	constexpr int C = (I + 1) & 0xF;
+	const V a[6] = { in[5], in[4], in[3], in[2], in[1], in[0] };
+	V p[4] = { V{}, V{}, V{}, V{} };
+	bool first = true;
+	for (int k = 0; k < 4; ++k) {
+		if (!((C >> k) & 1)) continue;
+		V sh[4];
+		for (int m = 0; m < 4; ++m) sh[m] = (m >= k) ? a[m - k] : V{};
+		if (first) {
+			for (int m = 0; m < 4; ++m) p[m] = sh[m];
+			first = false;
+		} else {
+			bs_add4(p, sh);
+		}
+	}
+	for (int m = 0; m < 4; ++m) n[m] = p[m] ^ a[m + 2];
+}
+
+// L ^= f(R, K_round), with E, the key XOR, the S-box circuit and P applied as renaming
+template <int I, class V, class Keys>
+static KEDES_BS_INLINE void bs_sbox_round(V* L, const V* R, const Keys& keys, int round) {
+	V in[6], n[4];
+	for (int b = 0; b < 6; ++b) {
+		in[b] = R[E_TABLE[I*6 + b] - 1];
+		keys.mix(in[b], round, I*6 + b);
+	}
+	bs_sbox<I>(in, n);
+	for (int k = 0; k < 4; ++k) L[P_INV.t[I*4 + 3 - k]] ^= n[k];
+}
+
+// One round without the swap, l ^= f(r, K_round), on the transposed halves of the IP
+// domain. With bs_ip_split and bs_ip_join it also steps a batch one round at a time, for
+// analysis that looks at the output after every round.
+template <class V, class Keys>
+static KEDES_BS_INLINE void bs_feistel(V* l, const V* r, const Keys& keys, int round) {
+	bs_sbox_round<0>(l, r, keys, round);
+	bs_sbox_round<1>(l, r, keys, round);
+	bs_sbox_round<2>(l, r, keys, round);
+	bs_sbox_round<3>(l, r, keys, round);
+	bs_sbox_round<4>(l, r, keys, round);
+	bs_sbox_round<5>(l, r, keys, round);
+	bs_sbox_round<6>(l, r, keys, round);
+	bs_sbox_round<7>(l, r, keys, round);
+}
+
+// block slices s[64] to the halves L||R = IP(block)
+template <class V>
+static KEDES_BS_INLINE void bs_ip_split(const V s[64], V L[32], V R[32]) {
+	for (int i = 0; i < 32; ++i) {
+		L[i] = s[IP[i] - 1];
+		R[i] = s[IP[32 + i] - 1];
+	}
+}
+
+// halves after the last round to block slices: preoutput is R||L (swap), then IP_INV
+template <class V>
+static KEDES_BS_INLINE void bs_ip_join(const V L[32], const V R[32], V s[64]) {
+	V pre[64];
+	for (int i = 0; i < 32; ++i) {
+		pre[i] = R[i];
+		pre[32 + i] = L[i];
+	}
+	for (int p = 0; p < 64; ++p) s[p] = pre[IP_INV[p] - 1];
+}
+
+// ROUNDS rounds per stage over transposed slices s[64] (slice p = block bit p+1), in place.
+// STAGES = 3 is fused EDE: keys supplies 48 round keys and the halves are swapped back
+// between stages instead of running IP_INV and IP.
+template <int STAGES, class V, class Keys, int ROUNDS = 16>
+static KEDES_BS_INLINE void bs_des_slices(V s[64], const Keys& keys) {
+	V L[32], R[32];
+	bs_ip_split(s, L, R);
+	V* l = L;
+	V* r = R;
+	for (int round = 0; round < ROUNDS * STAGES; ++round) {
+		bs_feistel(l, r, keys, round);
+		// the swap that ends every round cancels against the stage swap at a boundary
+		if (round % ROUNDS != ROUNDS - 1 || round == ROUNDS * STAGES - 1) {
+			V* t = l; l = r; r = t;
+		}
+	}
+	bs_ip_join(l, r, s);
+}
+
+// Transpose 64*lanes blocks in, run the rounds, transpose back out
+template <class V, class Keys, int STAGES = 1, int ROUNDS = 16>
+static KEDES_BS_INLINE void bs_des_batch(uint64_t* blocks, const Keys& keys) {
+	constexpr int LANES = sizeof(V) / sizeof(uint64_t);
+	V s[64];
+	if constexpr (LANES == 1) {
+		for (int k = 0; k < 64; ++k) s[k] = blocks[k];
+	} else {
+		for (int k = 0; k < 64; ++k)
+			for (int l = 0; l < LANES; ++l) s[k][l] = blocks[l*64 + k];
+	}
+	bs_transpose64(s);
+	bs_des_slices<STAGES, V, Keys, ROUNDS>(s, keys);
+	bs_transpose64(s);
+	if constexpr (LANES == 1) {
+		for (int k = 0; k < 64; ++k) blocks[k] = s[k];
+	} else {
+		for (int k = 0; k < 64; ++k)
+			for (int l = 0; l < LANES; ++l) blocks[l*64 + k] = s[k][l];
+	}
+}
+
+// ROUND_KEY_SRC[round][bit] is the C0D0 bit (0-based, MSB-first of 56) that becomes that
+// round key bit: the rotations and PC-2 only select bits of the transformed key
+struct RoundKeySrc {
+	int t[16][48];
+};
+
+static constexpr RoundKeySrc make_round_key_src() {
+	RoundKeySrc r{};
+	int shift = 0;
+	for (int round = 0; round < 16; ++round) {
+		shift += SHIFTS[round];
+		for (int b = 0; b < 48; ++b) {
+			int p = PC2[b] - 1;
+			r.t[round][b] = p < 28 ? (p + shift) % 28 : 28 + (p - 28 + shift) % 28;
+		}
+	}
+	return r;
+}
+
+static constexpr RoundKeySrc ROUND_KEY_SRC = make_round_key_src();
+
+// A different key per block: the blocks' C0D0 values are transposed once, which runs the
+// whole key schedule for every lane at once since each round key bit is then just one
+// of the 56 slices. DECRYPT walks the rounds backwards.
+template <class V, bool DECRYPT>
+struct BsSlicedKeys {
+	V cd[56];
+
+	KEDES_BS_INLINE void mix(V& x, int round, int bit) const {
+		x ^= cd[ROUND_KEY_SRC.t[DECRYPT ? 15 - round : round][bit]];
+	}
+};
+
+// cd0[i] is the C0D0 value (KeySchedule::cd0()) of block i
+template <class V, bool DECRYPT>
+static KEDES_BS_INLINE void bs_slice_keys(BsSlicedKeys<V, DECRYPT>& out, const uint64_t* cd0) {
+	constexpr int LANES = sizeof(V) / sizeof(uint64_t);
+	// 56-bit values shifted to the top so bit c (MSB-first) lands in slice c; gathered
+	// into a flat array first since element-wise vector inserts are slow
+	V t[64];
+	uint64_t flat[64 * LANES];
+	for (int k = 0; k < 64; ++k)
+		for (int l = 0; l < LANES; ++l) flat[k*LANES + l] = cd0[l*64 + k] << 8;
+	__builtin_memcpy(t, flat, sizeof(t));
+	bs_transpose64(t);
+	for (int c = 0; c < 56; ++c) out.cd[c] = t[c];
+}
+
+template <class V, bool DECRYPT>
+static KEDES_BS_INLINE void bs_des_multi_batch(uint64_t* blocks, const uint64_t* cd0) {
+	BsSlicedKeys<V, DECRYPT> sliced;
+	bs_slice_keys(sliced, cd0);
+	bs_des_batch<V>(blocks, sliced);
+}
+
+template <int ROUNDS = 16>
+static inline void bs_des_64(uint64_t* blocks, const uint64_t roundKeys[ROUNDS]) {
+	bs_des_batch<uint64_t, BsBroadcastKeys<uint64_t>, 1, ROUNDS>(blocks, BsBroadcastKeys<uint64_t>{roundKeys});
+}
+
+static inline void bs_des3_64(uint64_t* blocks, const uint64_t roundKeys[48]) {
+	bs_des_batch<uint64_t, BsBroadcastKeys<uint64_t>, 3>(blocks, BsBroadcastKeys<uint64_t>{roundKeys});
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KEDES_BS_X86 1
+
+template <int ROUNDS = 16>
+__attribute__((target("sse2")))
+static void bs_des_128(uint64_t* blocks, const uint64_t roundKeys[ROUNDS]) {
+	bs_des_batch<bs_v128, BsBroadcastKeys<bs_v128>, 1, ROUNDS>(blocks, BsBroadcastKeys<bs_v128>{roundKeys});
+}
+
+template <int ROUNDS = 16>
+__attribute__((target("avx2")))
+static void bs_des_256(uint64_t* blocks, const uint64_t roundKeys[ROUNDS]) {
+	bs_des_batch<bs_v256, BsBroadcastKeys<bs_v256>, 1, ROUNDS>(blocks, BsBroadcastKeys<bs_v256>{roundKeys});
+}
+
+template <int ROUNDS = 16>
+__attribute__((target("avx512f")))
+static void bs_des_512(uint64_t* blocks, const uint64_t roundKeys[ROUNDS]) {
+	bs_des_batch<bs_v512, BsBroadcastKeys<bs_v512>, 1, ROUNDS>(blocks, BsBroadcastKeys<bs_v512>{roundKeys});
+}
+
+__attribute__((target("sse2")))
+static void bs_des3_128(uint64_t* blocks, const uint64_t roundKeys[48]) {
+	bs_des_batch<bs_v128, BsBroadcastKeys<bs_v128>, 3>(blocks, BsBroadcastKeys<bs_v128>{roundKeys});
+}
+
+__attribute__((target("avx2")))
+static void bs_des3_256(uint64_t* blocks, const uint64_t roundKeys[48]) {
+	bs_des_batch<bs_v256, BsBroadcastKeys<bs_v256>, 3>(blocks, BsBroadcastKeys<bs_v256>{roundKeys});
+}
+
+__attribute__((target("avx512f")))
+static void bs_des3_512(uint64_t* blocks, const uint64_t roundKeys[48]) {
+	bs_des_batch<bs_v512, BsBroadcastKeys<bs_v512>, 3>(blocks, BsBroadcastKeys<bs_v512>{roundKeys});
+}
+
+template <bool DECRYPT>
+__attribute__((target("sse2")))
+static void bs_des_multi_128(uint64_t* blocks, const uint64_t* cd0) {
+	bs_des_multi_batch<bs_v128, DECRYPT>(blocks, cd0);
+}
+
+template <bool DECRYPT>
+__attribute__((target("avx2")))
+static void bs_des_multi_256(uint64_t* blocks, const uint64_t* cd0) {
+	bs_des_multi_batch<bs_v256, DECRYPT>(blocks, cd0);
+}
+
+template <bool DECRYPT>
+__attribute__((target("avx512f")))
+static void bs_des_multi_512(uint64_t* blocks, const uint64_t* cd0) {
+	bs_des_multi_batch<bs_v512, DECRYPT>(blocks, cd0);
+}
+#endif
+
+// Bitsliced batch (in blocks) of the active kernel, 0 when it is the scalar engine
+static inline size_t bs_batch_width() {
+	return kedes::kernel_width(kedes::active_kernel());
+}
+
+// Run the block operation on n independent packed blocks in place (round keys in
+// reverse order for decryption). Same result as calling des_block_packed on each one;
+// ROUNDS < 16 runs the reduced-round variants of the simplified S-box engine.
+template <int ROUNDS = 16>
+static inline void des_blocks_packed(uint64_t* blocks, size_t n, const uint64_t roundKeys[ROUNDS]) {
+	kedes::CrossCheckSample sample;
+	if constexpr (ROUNDS == 16) sample.take(blocks, n);
+	size_t width = bs_batch_width();
+	size_t i = 0;
+#ifdef KEDES_BS_X86
+	if (width >= 512)
+		for (; n - i >= 512; i += 512) bs_des_512<ROUNDS>(blocks + i, roundKeys);
+	if (width >= 256)
+		for (; n - i >= 256; i += 256) bs_des_256<ROUNDS>(blocks + i, roundKeys);
+	if (width >= 128)
+		for (; n - i >= 128; i += 128) bs_des_128<ROUNDS>(blocks + i, roundKeys);
+#endif
+	if (width >= 64)
+		for (; n - i >= 64; i += 64) bs_des_64<ROUNDS>(blocks + i, roundKeys);
+	for (; i < n; ++i) blocks[i] = BlockEngine<SimplifiedSBox, OddEvenTransform, ROUNDS>::crypt(blocks[i], roundKeys);
+	if (sample.count) kedes::cross_check(sample, blocks, roundKeys, 1);
+}
+
+// Fused three-key EDE on n independent blocks (48 round keys), same result as
+// des3_block_packed on each one
+static inline void des3_blocks_packed(uint64_t* blocks, size_t n, const uint64_t roundKeys[48]) {
+	kedes::CrossCheckSample sample;
+	sample.take(blocks, n);
+	size_t width = bs_batch_width();
+	size_t i = 0;
+#ifdef KEDES_BS_X86
+	if (width >= 512)
+		for (; n - i >= 512; i += 512) bs_des3_512(blocks + i, roundKeys);
+	if (width >= 256)
+		for (; n - i >= 256; i += 256) bs_des3_256(blocks + i, roundKeys);
+	if (width >= 128)
+		for (; n - i >= 128; i += 128) bs_des3_128(blocks + i, roundKeys);
+#endif
+	if (width >= 64)
+		for (; n - i >= 64; i += 64) bs_des3_64(blocks + i, roundKeys);
+	for (; i < n; ++i) blocks[i] = des3_block_packed(blocks[i], roundKeys);
+	if (sample.count) kedes::cross_check(sample, blocks, roundKeys, 3);
+}
+
+// Same as des_blocks_packed, but block i uses its own key, given as its C0D0 value
+// (KeySchedule::cd0()); DECRYPT selects the direction
+template <bool DECRYPT>
+static inline void des_blocks_multi_packed(uint64_t* blocks, size_t n, const uint64_t* cd0) {
+	kedes::CrossCheckSample sample;
+	sample.take(blocks, n);
+	size_t width = bs_batch_width();
+	size_t i = 0;
+#ifdef KEDES_BS_X86
+	if (width >= 512)
+		for (; n - i >= 512; i += 512) bs_des_multi_512<DECRYPT>(blocks + i, cd0 + i);
+	if (width >= 256)
+		for (; n - i >= 256; i += 256) bs_des_multi_256<DECRYPT>(blocks + i, cd0 + i);
+	if (width >= 128)
+		for (; n - i >= 128; i += 128) bs_des_multi_128<DECRYPT>(blocks + i, cd0 + i);
+#endif
+	if (width >= 64)
+		for (; n - i >= 64; i += 64) bs_des_multi_batch<uint64_t, DECRYPT>(blocks + i, cd0 + i);
+	for (; i < n; ++i) {
+		uint64_t rk[16];
+		round_keys_from_cd0(cd0[i], rk);
+		if (DECRYPT) std::reverse(rk, rk + 16);
+		blocks[i] = des_block_packed(blocks[i], rk);
+	}
+	if (sample.count) kedes::cross_check_multi(sample, blocks, cd0, DECRYPT);
+}
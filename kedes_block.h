@@ -0,0 +1,355 @@
+// Packed KE-DES block engine shared by the encryption and decryption programs.
+// Blocks are held as uint64_t (MSB-first, bit 1 = most significant), the halves L/R
+// as uint32_t and each round key as a packed 48-bit value in a uint64_t, so encrypting
+// a block does not touch the heap.
+// The 1-based tables below are expanded at compile time into byte-indexed lookup
+// tables (one 256-entry table per input byte) and fused S-box+P tables, so a round is
+// a few lookups and XORs and nothing is built at startup.
+// BlockEngine is the engine as a template over an S-box policy, a key-transform policy
+// and a round count; KE-DES proper is BlockEngine<SimplifiedSBox, OddEvenTransform, 16>.
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+// PC-1 table (56 positions) - standard DES PC-1 (1-based positions)
+static constexpr int PC1[56] = {
+	57,49,41,33,25,17,9,
+	1,58,50,42,34,26,18,
+	10,2,59,51,43,35,27,
+	19,11,3,60,52,44,36,
+	63,55,47,39,31,23,15,
+	7,62,54,46,38,30,22,
+	14,6,61,53,45,37,29,
+	21,13,5,28,20,12,4
+};
+
+// PC-2 table (48 positions) - standard DES PC-2 (1-based positions on 56-bit input)
+static constexpr int PC2[48] = {
+	14,17,11,24,1,5,
+	3,28,15,6,21,10,
+	23,19,12,4,26,8,
+	16,7,27,20,13,2,
+	41,52,31,37,47,55,
+	30,40,51,45,33,48,
+	44,49,39,56,34,53,
+	46,42,50,36,29,32
+};
+
+// Left rotation schedule for 16 rounds (standard DES)
+static constexpr int SHIFTS[16] = {1,1,2,2,2,2,2,2,1,2,2,2,2,2,2,1};
+
+// Initial Permutation (IP)
+static constexpr int IP[64] = {
+	58,50,42,34,26,18,10,2,
+	60,52,44,36,28,20,12,4,
+	62,54,46,38,30,22,14,6,
+	64,56,48,40,32,24,16,8,
+	57,49,41,33,25,17,9,1,
+	59,51,43,35,27,19,11,3,
+	61,53,45,37,29,21,13,5,
+	63,55,47,39,31,23,15,7
+};
+
+// Inverse IP
+static constexpr int IP_INV[64] = {
+	40,8,48,16,56,24,64,32,
+	39,7,47,15,55,23,63,31,
+	38,6,46,14,54,22,62,30,
+	37,5,45,13,53,21,61,29,
+	36,4,44,12,52,20,60,28,
+	35,3,43,11,51,19,59,27,
+	34,2,42,10,50,18,58,26,
+	33,1,41,9,49,17,57,25
+};
+
+// Expansion table E (32 -> 48)
+static constexpr int E_TABLE[48] = {
+	32,1,2,3,4,5,
+	4,5,6,7,8,9,
+	8,9,10,11,12,13,
+	12,13,14,15,16,17,
+	16,17,18,19,20,21,
+	20,21,22,23,24,25,
+	24,25,26,27,28,29,
+	28,29,30,31,32,1
+};
+
+// P permutation (32)
+static constexpr int P_TABLE[32] = {
+	16,7,20,21,29,12,28,17,
+	1,15,23,26,5,18,31,10,
+	2,8,24,14,32,27,3,9,
+	19,13,30,6,22,11,4,25
+};
+
+// Apply a 1-based permutation table to an in_bits wide packed value (MSB-first).
+// Output bit i takes input bit table[i-1], exactly like the vector<int> apply_permutation.
+// Only used to build the lookup tables below.
+static constexpr uint64_t permute_packed(uint64_t in, int in_bits, const int* table, int tlen) {
+	uint64_t out = 0;
+	for (int i = 0; i < tlen; ++i) out = (out << 1) | ((in >> (in_bits - table[i])) & 1ULL);
+	return out;
+}
+
+// Byte-indexed permutation: t[k][v] is the output contribution of input byte k
+// (counted from the least significant end) having value v.
+template <int CHUNKS>
+struct PermLUT {
+	uint64_t t[CHUNKS][256];
+
+	constexpr uint64_t operator()(uint64_t in) const {
+		uint64_t out = 0;
+		for (int k = 0; k < CHUNKS; ++k) out |= t[k][(in >> (8*k)) & 0xFF];
+		return out;
+	}
+};
+
+template <int IN_BITS, int TLEN>
+static constexpr PermLUT<(IN_BITS + 7) / 8> make_perm_lut(const int (&table)[TLEN]) {
+	PermLUT<(IN_BITS + 7) / 8> lut{};
+	for (int k = 0; k < (IN_BITS + 7) / 8; ++k)
+		for (int v = 0; v < 256; ++v)
+			lut.t[k][v] = permute_packed((uint64_t)v << (8*k), IN_BITS, table, TLEN);
+	return lut;
+}
+
+static constexpr auto IP_LUT     = make_perm_lut<64>(IP);
+static constexpr auto IP_INV_LUT = make_perm_lut<64>(IP_INV);
+static constexpr auto E_LUT      = make_perm_lut<32>(E_TABLE);
+static constexpr auto PC1_LUT    = make_perm_lut<64>(PC1);
+static constexpr auto PC2_LUT    = make_perm_lut<56>(PC2);
+
+// S-box policies: lookup(box, val) is the 4-bit output of S-box box (0-based) for the
+// 6-bit input val (MSB-first, as taken from E(R) ^ K)
+
+// KE-DES: the simplified sbox_substitution mapping
+struct SimplifiedSBox {
+	static constexpr int lookup(int box, int val) { return ((val * (box+1)) ^ (val >> 2)) & 0xF; }
+};
+
+// Standard DES S1..S8: the outer two bits pick the row, the middle four the column
+struct StandardSBox {
+	static constexpr uint8_t S[8][4][16] = {
+		{{14,4,13,1,2,15,11,8,3,10,6,12,5,9,0,7}, {0,15,7,4,14,2,13,1,10,6,12,11,9,5,3,8},
+		 {4,1,14,8,13,6,2,11,15,12,9,7,3,10,5,0}, {15,12,8,2,4,9,1,7,5,11,3,14,10,0,6,13}},
+		{{15,1,8,14,6,11,3,4,9,7,2,13,12,0,5,10}, {3,13,4,7,15,2,8,14,12,0,1,10,6,9,11,5},
+		 {0,14,7,11,10,4,13,1,5,8,12,6,9,3,2,15}, {13,8,10,1,3,15,4,2,11,6,7,12,0,5,14,9}},
+		{{10,0,9,14,6,3,15,5,1,13,12,7,11,4,2,8}, {13,7,0,9,3,4,6,10,2,8,5,14,12,11,15,1},
+		 {13,6,4,9,8,15,3,0,11,1,2,12,5,10,14,7}, {1,10,13,0,6,9,8,7,4,15,14,3,11,5,2,12}},
+		{{7,13,14,3,0,6,9,10,1,2,8,5,11,12,4,15}, {13,8,11,5,6,15,0,3,4,7,2,12,1,10,14,9},
+		 {10,6,9,0,12,11,7,13,15,1,3,14,5,2,8,4}, {3,15,0,6,10,1,13,8,9,4,5,11,12,7,2,14}},
+		{{2,12,4,1,7,10,11,6,8,5,3,15,13,0,14,9}, {14,11,2,12,4,7,13,1,5,0,15,10,3,9,8,6},
+		 {4,2,1,11,10,13,7,8,15,9,12,5,6,3,0,14}, {11,8,12,7,1,14,2,13,6,15,0,9,10,4,5,3}},
+		{{12,1,10,15,9,2,6,8,0,13,3,4,14,7,5,11}, {10,15,4,2,7,12,9,5,6,1,13,14,0,11,3,8},
+		 {9,14,15,5,2,8,12,3,7,0,4,10,1,13,11,6}, {4,3,2,12,9,5,15,10,11,14,1,7,6,0,8,13}},
+		{{4,11,2,14,15,0,8,13,3,12,9,7,5,10,6,1}, {13,0,11,7,4,9,1,10,14,3,5,12,2,15,8,6},
+		 {1,4,11,13,12,3,7,14,10,15,6,8,0,5,9,2}, {6,11,13,8,1,4,10,7,9,5,0,15,14,2,3,12}},
+		{{13,2,8,4,6,15,11,1,10,9,3,14,5,0,12,7}, {1,15,13,8,10,3,7,4,12,5,6,11,0,14,9,2},
+		 {7,11,4,1,9,12,14,2,0,6,10,13,15,3,5,8}, {2,1,14,7,4,10,8,13,15,12,9,0,3,5,6,11}},
+	};
+
+	static constexpr int lookup(int box, int val) { return S[box][((val >> 4) & 2) | (val & 1)][(val >> 1) & 0xF]; }
+};
+
+// Fused S-box + P tables: SP[i][val] is the P-permuted 32-bit output of S-box i for
+// the 6-bit input val.
+struct SPTable {
+	uint32_t t[8][64];
+};
+
+template <class SBox>
+static constexpr SPTable make_sp_table() {
+	SPTable sp{};
+	for (int i = 0; i < 8; ++i)
+		for (int val = 0; val < 64; ++val) {
+			uint64_t s32 = (uint64_t)SBox::lookup(i, val) << (28 - 4*i);
+			sp.t[i][val] = (uint32_t)permute_packed(s32, 32, P_TABLE, 32);
+		}
+	return sp;
+}
+
+// Packed form of odd_even_transform: C0 = 0,1,0,1,... and D0 = 1,0,1,0,... (56 bits)
+static constexpr uint64_t odd_even_transform_packed(uint64_t /*key56*/) {
+	uint64_t out = 0;
+	for (int j = 1; j <= 56; ++j) {
+		int bit = (j <= 28) ? (j % 2 == 0) : (j % 2 == 1);
+		out = (out << 1) | (uint64_t)bit;
+	}
+	return out;
+}
+
+// Key-transform policies: C0||D0 from the 56-bit PC-1 output
+
+// KE-DES: the odd/even transform (a constant, evaluated once at compile time)
+struct OddEvenTransform {
+	static constexpr uint64_t CD0 = odd_even_transform_packed(0);
+	static constexpr uint64_t apply(uint64_t /*key56*/) { return CD0; }
+};
+
+// Standard DES: C0||D0 is the PC-1 output itself
+struct NoTransform {
+	static constexpr uint64_t apply(uint64_t key56) { return key56; }
+};
+
+// rotate a 28-bit half left
+static constexpr uint32_t rot_left28(uint32_t v, int shifts) {
+	return ((v << shifts) | (v >> (28 - shifts))) & 0x0FFFFFFFu;
+}
+
+// calls f(std::integral_constant<int, i>{}) for i = 0..N-1, expanded at compile time
+template <int N, class F>
+static constexpr inline __attribute__((always_inline)) void unroll(F&& f) {
+	[&]<int... I>(std::integer_sequence<int, I...>) {
+		(f(std::integral_constant<int, I>{}), ...);
+	}(std::make_integer_sequence<int, N>{});
+}
+
+// The block engine for one cipher variant. Every instantiation gets its own fused SP
+// table and rotation table, and its rounds are unrolled, so picking a variant costs
+// nothing at run time. ROUNDS < 16 runs the first ROUNDS rounds of the 16-round schedule
+// (reduced-round variants for analysis). Decryption is crypt() with the round keys reversed.
+template <class SBox, class KeyTransform, int ROUNDS>
+struct BlockEngine {
+	static_assert(ROUNDS >= 1 && ROUNDS <= 16, "the key schedule defines 16 rounds");
+
+	using sbox = SBox;
+	static constexpr int rounds = ROUNDS;
+	// the same variant cut to R rounds; its round keys are the first R of this schedule
+	template <int R>
+	using with_rounds = BlockEngine<SBox, KeyTransform, R>;
+	static constexpr SPTable sp = make_sp_table<SBox>();
+	// total rotation of C and D at round r
+	static constexpr std::array<int, ROUNDS> rotation = [] {
+		std::array<int, ROUNDS> r{};
+		for (int i = 0, total = 0; i < ROUNDS; ++i) r[i] = total += SHIFTS[i];
+		return r;
+	}();
+
+	static constexpr uint64_t cd0(uint64_t key) { return KeyTransform::apply(PC1_LUT(key)); }
+
+	// K1..K(ROUNDS) from C0||D0: rotations and PC-2
+	static constexpr void round_keys_from_cd0(uint64_t key56, uint64_t roundKeys[ROUNDS]) {
+		const uint32_t C = (uint32_t)(key56 >> 28) & 0x0FFFFFFFu;
+		const uint32_t D = (uint32_t)key56 & 0x0FFFFFFFu;
+		unroll<ROUNDS>([&](auto r) {
+			roundKeys[r] = PC2_LUT(((uint64_t)rot_left28(C, rotation[r]) << 28) | rot_left28(D, rotation[r]));
+		});
+	}
+
+	static constexpr void round_keys(uint64_t key, uint64_t roundKeys[ROUNDS]) {
+		round_keys_from_cd0(cd0(key), roundKeys);
+	}
+
+	// Feistel function f on packed halves: P(S(E(R) ^ K)) with S and P fused into sp
+	static constexpr uint32_t f(uint32_t R, uint64_t K48) {
+		uint64_t x = E_LUT(R) ^ K48;
+		return sp.t[0][(x >> 42) & 0x3F] ^ sp.t[1][(x >> 36) & 0x3F]
+		     ^ sp.t[2][(x >> 30) & 0x3F] ^ sp.t[3][(x >> 24) & 0x3F]
+		     ^ sp.t[4][(x >> 18) & 0x3F] ^ sp.t[5][(x >> 12) & 0x3F]
+		     ^ sp.t[6][(x >>  6) & 0x3F] ^ sp.t[7][x & 0x3F];
+	}
+
+	// The state between rounds as the halves of the IP domain: split(), round() with each
+	// round key in turn, then join() gives what crypt() returns for that many rounds. Lets
+	// analysis code take the output after every round in one pass.
+	static constexpr void split(uint64_t block, uint32_t& L, uint32_t& R) {
+		uint64_t ip = IP_LUT(block);
+		L = (uint32_t)(ip >> 32);
+		R = (uint32_t)ip;
+	}
+
+	static constexpr void round(uint32_t& L, uint32_t& R, uint64_t K48) {
+		uint32_t newR = L ^ f(R, K48);
+		L = R;
+		R = newR;
+	}
+
+	static constexpr uint64_t join(uint32_t L, uint32_t R) {
+		// preoutput is R||L (swap)
+		return IP_INV_LUT(((uint64_t)R << 32) | L);
+	}
+
+	static constexpr uint64_t crypt(uint64_t block, const uint64_t roundKeys[ROUNDS]) {
+		uint32_t L, R;
+		split(block, L, R);
+		unroll<ROUNDS>([&](auto r) { round(L, R, roundKeys[r]); });
+		return join(L, R);
+	}
+
+	// Two independent blocks under two schedules, round by round: each round of one chain
+	// overlaps the table loads of the other, so two serial chains (CBC next to CBC-MAC)
+	// cost little more than one
+	static constexpr void crypt2(uint64_t& a, const uint64_t keysA[ROUNDS], uint64_t& b,
+	                             const uint64_t keysB[ROUNDS]) {
+		uint64_t ipA = IP_LUT(a), ipB = IP_LUT(b);
+		uint32_t LA = (uint32_t)(ipA >> 32), RA = (uint32_t)ipA;
+		uint32_t LB = (uint32_t)(ipB >> 32), RB = (uint32_t)ipB;
+		unroll<ROUNDS>([&](auto r) {
+			uint32_t newRA = LA ^ f(RA, keysA[r]);
+			uint32_t newRB = LB ^ f(RB, keysB[r]);
+			LA = RA;
+			RA = newRA;
+			LB = RB;
+			RB = newRB;
+		});
+		a = IP_INV_LUT(((uint64_t)RA << 32) | LA);
+		b = IP_INV_LUT(((uint64_t)RB << 32) | LB);
+	}
+};
+
+using KeDesEngine = BlockEngine<SimplifiedSBox, OddEvenTransform, 16>;
+
+// K1..K16 from the transformed 56-bit C0D0: rotations and PC-2
+static inline void round_keys_from_cd0(uint64_t key56, uint64_t roundKeys[16]) {
+	KeDesEngine::round_keys_from_cd0(key56, roundKeys);
+}
+
+// Generate K1..K16 as packed 48-bit values (same steps as the key schedule in main())
+static inline void generate_round_keys_packed(uint64_t key, uint64_t roundKeys[16]) {
+	KeDesEngine::round_keys(key, roundKeys);
+}
+
+static inline uint32_t feistel_f_packed(uint32_t R, uint64_t K48) {
+	return KeDesEngine::f(R, K48);
+}
+
+// DES-like block operation on a packed 64-bit block. Passing the round keys in reverse
+// order performs decryption.
+static inline uint64_t des_block_packed(uint64_t block, const uint64_t roundKeys[16]) {
+	return KeDesEngine::crypt(block, roundKeys);
+}
+
+// des_block_packed on two independent blocks at once (BlockEngine::crypt2)
+static inline void des_block2_packed(uint64_t& a, const uint64_t keysA[16], uint64_t& b, const uint64_t keysB[16]) {
+	KeDesEngine::crypt2(a, keysA, b, keysB);
+}
+
+// Three chained block operations (48 round keys, 16 per stage) with IP and IP_INV applied
+// once: between stages IP_INV followed by IP cancels and only the final R||L swap of each
+// stage remains
+static inline uint64_t des3_block_packed(uint64_t block, const uint64_t roundKeys[48]) {
+	uint64_t ip = IP_LUT(block);
+	uint32_t L = (uint32_t)(ip >> 32), R = (uint32_t)ip;
+	for (int r = 0; r < 48; ++r) {
+		uint32_t newR = L ^ feistel_f_packed(R, roundKeys[r]);
+		L = R;
+		R = newR;
+		if (r == 15 || r == 31) std::swap(L, R);
+	}
+	uint64_t preout = ((uint64_t)R << 32) | L;
+	return IP_INV_LUT(preout);
+}
+
+// 8 bytes (MSB first) <-> packed block
+static inline uint64_t load_be64(const uint8_t* p) {
+	uint64_t v = 0;
+	for (int i = 0; i < 8; ++i) v = (v << 8) | p[i];
+	return v;
+}
+
+static inline void store_be64(uint64_t v, uint8_t* p) {
+	for (int i = 7; i >= 0; --i) { p[i] = (uint8_t)v; v >>= 8; }
+}
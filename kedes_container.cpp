@@ -0,0 +1,131 @@
+#include "kedes_container.h"
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <ostream>
+
+#include "kedes_util.h"
+
+namespace kedes {
+
+static constexpr char MAGIC[4] = {'K', 'E', 'D', 'S'};
+
+bool is_container(std::span<const std::byte> data) {
+	return data.size() >= sizeof(MAGIC) && std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) == 0;
+}
+
+void encode_header(const ContainerHeader& h, std::span<std::byte, CONTAINER_HEADER_SIZE> out) {
+	std::byte* p = out.data();
+	std::memset(p, 0, CONTAINER_HEADER_SIZE);
+	std::memcpy(p, MAGIC, sizeof(MAGIC));
+	p[4] = std::byte(CONTAINER_VERSION);
+	p[5] = std::byte(static_cast<std::uint8_t>(h.mode));
+	put_le(p + 6, CONTAINER_HEADER_SIZE, 2);
+	put_le(p + 8, h.iv, 8);
+	put_le(p + 16, h.plain_len, 8);
+	put_le(p + 24, h.chunk_bytes, 4);
+}
+
+ContainerError decode_header(std::span<const std::byte> data, ContainerHeader& h) {
+	if (!is_container(data)) return data.size() < sizeof(MAGIC) ? ContainerError::truncated : ContainerError::not_container;
+	if (data.size() < CONTAINER_HEADER_SIZE) return ContainerError::truncated;
+	const std::byte* p = data.data();
+	if (std::to_integer<std::uint8_t>(p[4]) != CONTAINER_VERSION) return ContainerError::bad_version;
+	if (get_le(p + 6, 2) != CONTAINER_HEADER_SIZE) return ContainerError::bad_version;
+	const std::uint8_t mode = std::to_integer<std::uint8_t>(p[5]);
+	if (mode < static_cast<std::uint8_t>(Mode::cbc) || mode > static_cast<std::uint8_t>(Mode::cbc_chunked))
+		return ContainerError::bad_mode;
+	h.mode = static_cast<Mode>(mode);
+	h.iv = get_le(p + 8, 8);
+	h.plain_len = get_le(p + 16, 8);
+	h.chunk_bytes = (std::uint32_t)get_le(p + 24, 4);
+	if (h.plain_len > MAX_PLAIN_LEN) return ContainerError::bad_length;
+	if (h.mode == Mode::cbc_chunked && (h.chunk_bytes == 0 || h.chunk_bytes % BLOCK_SIZE != 0))
+		return ContainerError::bad_segments;
+	return ContainerError::none;
+}
+
+bool write_header(std::ostream& out, const ContainerHeader& h) {
+	std::byte buf[CONTAINER_HEADER_SIZE];
+	encode_header(h, buf);
+	out.write(reinterpret_cast<const char*>(buf), CONTAINER_HEADER_SIZE);
+	return (bool)out;
+}
+
+ContainerError read_header(std::istream& in, ContainerHeader& h) {
+	std::byte buf[CONTAINER_HEADER_SIZE];
+	in.read(reinterpret_cast<char*>(buf), CONTAINER_HEADER_SIZE);
+	return decode_header(std::span<const std::byte>(buf, (std::size_t)in.gcount()), h);
+}
+
+std::size_t segment_index_size(const ContainerHeader& h) {
+	if (h.mode != Mode::cbc_chunked) return 0;
+	return segment_count(cipher_size(h.mode, h.plain_len), h.chunk_bytes) * sizeof(std::uint64_t);
+}
+
+std::uint64_t ciphertext_offset(const ContainerHeader& h) {
+	return CONTAINER_HEADER_SIZE + segment_index_size(h);
+}
+
+void encode_segment_index(std::span<const std::uint64_t> ivs, std::span<std::byte> out) {
+	for (std::size_t i = 0; i < ivs.size(); ++i) put_le(out.data() + i * sizeof(std::uint64_t), ivs[i], 8);
+}
+
+ContainerError decode_segment_index(const ContainerHeader& h, std::span<const std::byte> data,
+                                    std::vector<std::uint64_t>& ivs) {
+	const std::size_t size = segment_index_size(h);
+	ivs.clear();
+	if (data.size() < size) return ContainerError::truncated;
+	ivs.resize(size / sizeof(std::uint64_t));
+	for (std::size_t i = 0; i < ivs.size(); ++i) ivs[i] = get_le(data.data() + i * sizeof(std::uint64_t), 8);
+	return ContainerError::none;
+}
+
+bool write_segment_index(std::ostream& out, std::span<const std::uint64_t> ivs) {
+	std::vector<std::byte> buf(ivs.size() * sizeof(std::uint64_t));
+	encode_segment_index(ivs, buf);
+	out.write(reinterpret_cast<const char*>(buf.data()), (std::streamsize)buf.size());
+	return (bool)out;
+}
+
+ContainerError read_segment_index(std::istream& in, const ContainerHeader& h, std::vector<std::uint64_t>& ivs) {
+	// read a piece at a time: a corrupt plain_len must not turn into one huge allocation
+	const std::size_t size = segment_index_size(h);
+	std::vector<std::byte> buf;
+	std::byte piece[4096];
+	while (buf.size() < size) {
+		const std::size_t want = std::min(sizeof(piece), size - buf.size());
+		in.read(reinterpret_cast<char*>(piece), (std::streamsize)want);
+		buf.insert(buf.end(), piece, piece + in.gcount());
+		if ((std::size_t)in.gcount() < want) break;
+	}
+	return decode_segment_index(h, buf, ivs);
+}
+
+ContainerError check_cipher_size(const ContainerHeader& h, std::uint64_t cipher_bytes) {
+	if (h.mode != Mode::cbc_chunked || cipher_bytes == cipher_size(h.mode, h.plain_len)) return ContainerError::none;
+	return ContainerError::size_mismatch;
+}
+
+std::uint64_t cipher_size(Mode mode, std::uint64_t plain_len) {
+	if (mode == Mode::ctr) return plain_len;
+	const std::uint64_t padded = plain_len + BLOCK_SIZE - (plain_len % BLOCK_SIZE);
+	return mode == Mode::cbc_cmac ? padded + TAG_SIZE : padded;
+}
+
+const char* to_string(ContainerError e) {
+	switch (e) {
+	case ContainerError::none: return "ok";
+	case ContainerError::not_container: return "not a KE-DES container";
+	case ContainerError::bad_version: return "unsupported container version";
+	case ContainerError::bad_mode: return "unknown cipher mode";
+	case ContainerError::truncated: return "truncated container header";
+	case ContainerError::bad_segments: return "invalid segment size";
+	case ContainerError::bad_length: return "plaintext length out of range";
+	case ContainerError::size_mismatch: return "ciphertext size does not match the recorded plaintext length";
+	}
+	return "unknown error";
+}
+
+} // namespace kedes
@@ -0,0 +1,90 @@
+// Binary ciphertext container: a fixed 32-byte header followed by the raw ciphertext.
+//
+//   offset size  field
+//        0    4  magic "KEDS"
+//        4    1  format version (1)
+//        5    1  mode (kedes::Mode)
+//        6    2  header size in bytes (32)
+//        8    8  CBC IV / CTR nonce
+//       16    8  plaintext length in bytes
+//       24    4  chunk size the file was written with (0 = whole file at once)
+//       28    4  reserved, zero
+//
+// In Mode::cbc_cmac the ciphertext is followed by the TAG_SIZE-byte tag (big-endian, like
+// the blocks), so a reader verifies the file in the same pass that decrypts it.
+//
+// In Mode::cbc_chunked, chunk_bytes is the segment size (a nonzero multiple of
+// BLOCK_SIZE) and the header is followed by the segment index: the IV of every segment,
+// 8 bytes each, ahead of the ciphertext, so any segment can be decrypted on its own.
+//
+// plain_len is at most MAX_PLAIN_LEN, so every size and file offset derived from it fits
+// in an off_t.
+//
+// Multi-byte fields are little-endian. The hex text layout of ciphertext.txt remains
+// available as an export format.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <span>
+#include <vector>
+
+#include "kedes.h"
+
+namespace kedes {
+
+constexpr std::size_t CONTAINER_HEADER_SIZE = 32;
+constexpr std::uint8_t CONTAINER_VERSION = 1;
+constexpr std::uint64_t MAX_PLAIN_LEN = std::uint64_t(1) << 62;
+
+struct ContainerHeader {
+	Mode mode = Mode::cbc;
+	std::uint64_t iv = 0;
+	std::uint64_t plain_len = 0;
+	std::uint32_t chunk_bytes = 0;
+};
+
+enum class ContainerError {
+	none,
+	not_container,   // magic does not match
+	bad_version,
+	bad_mode,
+	truncated,       // fewer than CONTAINER_HEADER_SIZE bytes (or a short segment index)
+	bad_segments,    // cbc_chunked segment size not a nonzero multiple of BLOCK_SIZE
+	bad_length,      // plain_len above MAX_PLAIN_LEN
+	size_mismatch,   // cbc_chunked ciphertext size differs from the one plain_len implies
+};
+
+// true if data starts with the container magic
+bool is_container(std::span<const std::byte> data);
+
+void encode_header(const ContainerHeader& h, std::span<std::byte, CONTAINER_HEADER_SIZE> out);
+ContainerError decode_header(std::span<const std::byte> data, ContainerHeader& h);
+
+// header I/O on streams; read_header consumes exactly CONTAINER_HEADER_SIZE bytes
+bool write_header(std::ostream& out, const ContainerHeader& h);
+ContainerError read_header(std::istream& in, ContainerHeader& h);
+
+// cbc_chunked segment index: segment_count() IVs; size and offset are 0 and
+// CONTAINER_HEADER_SIZE for the other modes
+std::size_t segment_index_size(const ContainerHeader& h);
+std::uint64_t ciphertext_offset(const ContainerHeader& h);
+void encode_segment_index(std::span<const std::uint64_t> ivs, std::span<std::byte> out);
+// data starts right after the header; ivs receives segment_count() entries
+ContainerError decode_segment_index(const ContainerHeader& h, std::span<const std::byte> data,
+                                    std::vector<std::uint64_t>& ivs);
+bool write_segment_index(std::ostream& out, std::span<const std::uint64_t> ivs);
+ContainerError read_segment_index(std::istream& in, const ContainerHeader& h, std::vector<std::uint64_t>& ivs);
+// cipher_bytes is what follows ciphertext_offset() in the file. plain_len sets the
+// cbc_chunked index layout, so there a size that disagrees with it is size_mismatch; the
+// other modes report none and leave the difference to the decrypting path.
+ContainerError check_cipher_size(const ContainerHeader& h, std::uint64_t cipher_bytes);
+
+// expected ciphertext size for a plaintext of plain_len bytes in the given mode (including
+// the tag of cbc_cmac)
+std::uint64_t cipher_size(Mode mode, std::uint64_t plain_len);
+
+const char* to_string(ContainerError e);
+
+} // namespace kedes
@@ -0,0 +1,517 @@
+#include "kedes_daemon.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "kedes_bitslice.h"
+#include "kedes_block.h"
+#include "kedes_metrics.h"
+#include "kedes_util.h"
+
+namespace kedes {
+
+namespace {
+
+std::uint64_t now_ns() {
+	return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool read_full(int fd, void* buf, std::size_t n) {
+	auto* p = static_cast<std::uint8_t*>(buf);
+	while (n > 0) {
+		ssize_t got = ::read(fd, p, n);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) return false;
+		p += got;
+		n -= (std::size_t)got;
+	}
+	return true;
+}
+
+// header and payload in one sendmsg where possible; never raises SIGPIPE
+bool send_frame(int fd, const void* header, std::size_t header_len, const std::vector<std::byte>& payload) {
+	iovec iov[2] = {{const_cast<void*>(header), header_len},
+	                {const_cast<std::byte*>(payload.data()), payload.size()}};
+	int first = 0;
+	while (first < 2) {
+		msghdr msg{};
+		msg.msg_iov = iov + first;
+		msg.msg_iovlen = 2 - first;
+		ssize_t sent = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent < 0) return false;
+		auto left = (std::size_t)sent;
+		while (first < 2 && left >= iov[first].iov_len) left -= iov[first++].iov_len;
+		if (first < 2) {
+			iov[first].iov_base = static_cast<std::uint8_t*>(iov[first].iov_base) + left;
+			iov[first].iov_len -= left;
+		}
+	}
+	return true;
+}
+
+// Removes the socket file an earlier run left behind. A path that still
+// accepts connections belongs to a live daemon and is left alone.
+bool remove_stale_socket(const sockaddr_un& addr, std::string& error) {
+	const char* path = addr.sun_path;
+	struct stat st{};
+	if (::lstat(path, &st) < 0) {
+		if (errno == ENOENT) return true;
+		error = errno_text(std::string("stat ") + path);
+		return false;
+	}
+	if (!S_ISSOCK(st.st_mode)) {
+		error = std::string(path) + " exists and is not a socket";
+		return false;
+	}
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		error = errno_text("socket");
+		return false;
+	}
+	int rc;
+	do rc = ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+	while (rc < 0 && errno == EINTR);
+	const int err = rc < 0 ? errno : 0;
+	::close(fd);
+	if (rc < 0 && err == ECONNREFUSED) {
+		if (::unlink(path) < 0 && errno != ENOENT) {
+			error = errno_text(std::string("unlink ") + path);
+			return false;
+		}
+		return true;
+	}
+	if (rc < 0 && err == ENOENT) return true;   // removed since the lstat
+	error = std::string("kedesd already running on ") + path;
+	if (rc < 0) {
+		errno = err;
+		error += " (" + errno_text("connect") + ")";
+	}
+	return false;
+}
+
+std::size_t block_count(std::size_t bytes) {
+	return (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+} // namespace
+
+const char* to_string(DaemonStatus s) {
+	switch (s) {
+	case DaemonStatus::ok: return "ok";
+	case DaemonStatus::bad_padding: return "invalid PKCS#7 padding";
+	case DaemonStatus::bad_length: return "ciphertext size not multiple of 8";
+	case DaemonStatus::bad_request: return "unknown operation or mode";
+	case DaemonStatus::too_large: return "payload too large";
+	}
+	return "unknown status";
+}
+
+bool read_request(int fd, DaemonRequest& req, DaemonStatus& error) {
+	error = DaemonStatus::ok;
+	std::uint8_t h[DAEMON_REQUEST_HEADER_SIZE];
+	if (!read_full(fd, h, sizeof(h))) return false;
+	const auto len = (std::uint32_t)get_le(h, 4);
+	if (len > DAEMON_MAX_PAYLOAD) {
+		error = DaemonStatus::too_large;
+		return false;
+	}
+	req.op = static_cast<DaemonOp>(h[4]);
+	req.mode = static_cast<Mode>(h[5]);
+	req.key = get_le(h + 8, 8);
+	req.iv = get_le(h + 16, 8);
+	req.payload.resize(len);
+	return read_full(fd, req.payload.data(), len);
+}
+
+bool write_request(int fd, const DaemonRequest& req) {
+	std::uint8_t h[DAEMON_REQUEST_HEADER_SIZE] = {};
+	put_le(h, req.payload.size(), 4);
+	h[4] = static_cast<std::uint8_t>(req.op);
+	h[5] = static_cast<std::uint8_t>(req.mode);
+	put_le(h + 8, req.key, 8);
+	put_le(h + 16, req.iv, 8);
+	return send_frame(fd, h, sizeof(h), req.payload);
+}
+
+bool read_response(int fd, DaemonResponse& resp) {
+	std::uint8_t h[DAEMON_RESPONSE_HEADER_SIZE];
+	if (!read_full(fd, h, sizeof(h))) return false;
+	const auto len = (std::uint32_t)get_le(h, 4);
+	if (len > DAEMON_MAX_PAYLOAD + BLOCK_SIZE) return false;
+	resp.status = static_cast<DaemonStatus>(h[4]);
+	resp.payload.resize(len);
+	return read_full(fd, resp.payload.data(), len);
+}
+
+bool write_response(int fd, const DaemonResponse& resp) {
+	std::uint8_t h[DAEMON_RESPONSE_HEADER_SIZE] = {};
+	put_le(h, resp.payload.size(), 4);
+	h[4] = static_cast<std::uint8_t>(resp.status);
+	return send_frame(fd, h, sizeof(h), resp.payload);
+}
+
+void process_requests(std::vector<DaemonRequest*>& reqs, std::vector<DaemonResponse*>& resps,
+                      KeyScheduleCache& cache) {
+	// CTR keystream blocks and CBC ciphertext blocks are independent of each other, so the
+	// whole batch goes through the multi-key kernels in two calls
+	std::vector<KeyedBlock> keystream, cbc_dec;
+	std::vector<std::size_t> chains;   // CBC encryptions, chained within each request
+	std::size_t longest = 0;
+
+	for (std::size_t i = 0; i < reqs.size(); ++i) {
+		const DaemonRequest& req = *reqs[i];
+		DaemonResponse& resp = *resps[i];
+		const std::size_t n = req.payload.size();
+		resp.status = DaemonStatus::ok;
+		resp.payload.clear();
+		if ((req.op != DaemonOp::encrypt && req.op != DaemonOp::decrypt) ||
+		    (req.mode != Mode::cbc && req.mode != Mode::ctr)) {
+			resp.status = DaemonStatus::bad_request;
+			continue;
+		}
+		if (req.mode == Mode::ctr) {
+			for (std::size_t b = 0; b < block_count(n); ++b) keystream.push_back({req.key, req.iv + b});
+		} else if (req.op == DaemonOp::decrypt) {
+			if (n % BLOCK_SIZE != 0) {
+				resp.status = DaemonStatus::bad_length;
+				continue;
+			}
+			auto* p = reinterpret_cast<const uint8_t*>(req.payload.data());
+			for (std::size_t pos = 0; pos < n; pos += BLOCK_SIZE) cbc_dec.push_back({req.key, load_be64(p + pos)});
+		} else {
+			resp.payload.resize(n + BLOCK_SIZE - n % BLOCK_SIZE);
+			std::copy(req.payload.begin(), req.payload.end(), resp.payload.begin());
+			pkcs7_pad(resp.payload, n);
+			chains.push_back(i);
+			longest = std::max(longest, resp.payload.size() / BLOCK_SIZE);
+		}
+	}
+	encrypt_multi(keystream, cache);
+	decrypt_multi(cbc_dec, cache);
+
+	// CBC encryption steps every chain one block at a time: block j of all requests
+	// still running is one kernel call
+	if (!chains.empty()) {
+		std::vector<std::shared_ptr<const KeySchedule>> held(chains.size());
+		std::vector<std::uint64_t> keys(chains.size()), prev(chains.size()), cd0, blocks;
+		for (std::size_t c = 0; c < chains.size(); ++c) {
+			keys[c] = reqs[chains[c]]->key;
+			prev[c] = reqs[chains[c]]->iv;
+		}
+		cache.get_many(keys, held.data());
+		std::vector<std::size_t> active(chains.size());
+		for (std::size_t c = 0; c < chains.size(); ++c) active[c] = c;
+		std::size_t total = 0;
+		for (std::size_t j = 0; j < longest; ++j) {
+			// drop the chains that have run out of blocks
+			active.erase(std::remove_if(active.begin(), active.end(), [&](std::size_t c) {
+				return resps[chains[c]]->payload.size() / BLOCK_SIZE <= j;
+			}), active.end());
+			cd0.resize(active.size());
+			blocks.resize(active.size());
+			bool same = true;
+			for (std::size_t a = 0; a < active.size(); ++a) {
+				const std::size_t c = active[a];
+				auto* p = reinterpret_cast<const uint8_t*>(resps[chains[c]]->payload.data()) + j * BLOCK_SIZE;
+				blocks[a] = load_be64(p) ^ prev[c];
+				cd0[a] = held[c]->cd0();
+				same = same && cd0[a] == cd0[0];
+			}
+			if (same) held[active[0]]->encrypt_blocks(blocks.data(), blocks.size());
+			else des_blocks_multi_packed<false>(blocks.data(), blocks.size(), cd0.data());
+			for (std::size_t a = 0; a < active.size(); ++a) {
+				const std::size_t c = active[a];
+				prev[c] = blocks[a];
+				store_be64(blocks[a], reinterpret_cast<uint8_t*>(resps[chains[c]]->payload.data()) + j * BLOCK_SIZE);
+			}
+			total += active.size();
+		}
+		count(Counter::blocks_encrypted, total);
+	}
+
+	// hand the results back to their requests
+	std::size_t next_ks = 0, next_dec = 0;
+	for (std::size_t i = 0; i < reqs.size(); ++i) {
+		const DaemonRequest& req = *reqs[i];
+		DaemonResponse& resp = *resps[i];
+		if (resp.status != DaemonStatus::ok) continue;
+		const std::size_t n = req.payload.size();
+		if (req.mode == Mode::ctr) {
+			resp.payload.resize(n);
+			uint8_t stream[BLOCK_SIZE];
+			for (std::size_t pos = 0; pos < n; pos += BLOCK_SIZE) {
+				store_be64(keystream[next_ks++].block, stream);
+				for (std::size_t k = 0; k < BLOCK_SIZE && pos + k < n; ++k) resp.payload[pos + k] = req.payload[pos + k] ^ std::byte(stream[k]);
+			}
+		} else if (req.op == DaemonOp::decrypt) {
+			resp.payload.resize(n);
+			auto* in = reinterpret_cast<const uint8_t*>(req.payload.data());
+			auto* out = reinterpret_cast<uint8_t*>(resp.payload.data());
+			uint64_t prev = req.iv;
+			for (std::size_t pos = 0; pos < n; pos += BLOCK_SIZE) {
+				store_be64(cbc_dec[next_dec++].block ^ prev, out + pos);
+				prev = load_be64(in + pos);
+			}
+			std::size_t len;
+			if (pkcs7_unpad(resp.payload, len) == Status::ok) resp.payload.resize(len);
+			else resp.status = DaemonStatus::bad_padding;
+		}
+	}
+}
+
+RequestBatcher::RequestBatcher(KeyScheduleCache& cache, BatcherOptions opt)
+	: cache_(cache), opt_(opt), thread_([this] { loop(); }) {}
+
+RequestBatcher::~RequestBatcher() {
+	{
+		std::lock_guard<std::mutex> lk(m_);
+		stop_ = true;
+	}
+	cv_.notify_one();
+	thread_.join();
+}
+
+DaemonResponse RequestBatcher::submit(DaemonRequest req) {
+	Pending p;
+	p.req = std::move(req);
+	std::future<void> done = p.done.get_future();
+	{
+		std::lock_guard<std::mutex> lk(m_);
+		queue_.push_back(&p);
+		queued_blocks_ += block_count(p.req.payload.size());
+	}
+	cv_.notify_one();
+	done.wait();
+	return std::move(p.resp);
+}
+
+void RequestBatcher::loop() {
+	std::vector<Pending*> batch;
+	std::vector<DaemonRequest*> reqs;
+	std::vector<DaemonResponse*> resps;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lk(m_);
+			cv_.wait(lk, [&] { return stop_ || !queue_.empty(); });
+			if (queue_.empty()) return;   // stopping, nothing left to serve
+			if (opt_.window_us > 0) {
+				auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(opt_.window_us);
+				cv_.wait_until(lk, deadline, [&] { return stop_ || queued_blocks_ >= opt_.max_blocks; });
+			}
+			batch.swap(queue_);
+			queued_blocks_ = 0;
+		}
+		reqs.clear();
+		resps.clear();
+		for (Pending* p : batch) {
+			reqs.push_back(&p->req);
+			resps.push_back(&p->resp);
+		}
+		process_requests(reqs, resps, cache_);
+		batches_.fetch_add(1, std::memory_order_relaxed);
+		requests_.fetch_add(batch.size(), std::memory_order_relaxed);
+		for (Pending* p : batch) p->done.set_value();
+		batch.clear();
+	}
+}
+
+void LatencyWindow::record(std::uint64_t ns) {
+	std::lock_guard<std::mutex> lk(m_);
+	if (samples_.size() < WINDOW) samples_.push_back(ns);
+	else samples_[next_] = ns;
+	next_ = (next_ + 1) % WINDOW;
+	++count_;
+}
+
+void LatencyWindow::take(std::uint64_t& count, std::uint64_t& p50, std::uint64_t& p99) {
+	std::vector<std::uint64_t> s;
+	{
+		std::lock_guard<std::mutex> lk(m_);
+		s.swap(samples_);
+		count = count_;
+		count_ = 0;
+		next_ = 0;
+	}
+	p50 = p99 = 0;
+	if (s.empty()) return;
+	std::sort(s.begin(), s.end());
+	p50 = percentile(s, 50);
+	p99 = percentile(s, 99);
+}
+
+Daemon::Daemon(DaemonOptions opt)
+	: opt_(std::move(opt)), cache_(opt_.cache_capacity), batcher_(cache_, opt_.batch) {}
+
+Daemon::~Daemon() {
+	stop();
+}
+
+bool Daemon::listen(std::string& error) {
+	if (opt_.tcp_port > 65535) {
+		error = "TCP port " + std::to_string(opt_.tcp_port) + " out of range";
+		return false;
+	}
+	if (opt_.tcp_port > 0) {
+		listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listen_fd_ < 0) {
+			error = errno_text("socket");
+			return false;
+		}
+		int one = 1;
+		::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t)opt_.tcp_port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+			error = errno_text("bind 127.0.0.1:" + std::to_string(opt_.tcp_port));
+			return false;
+		}
+	} else {
+		sockaddr_un addr{};
+		if (opt_.socket_path.empty() || opt_.socket_path.size() >= sizeof(addr.sun_path)) {
+			error = "socket path is empty or too long";
+			return false;
+		}
+		listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listen_fd_ < 0) {
+			error = errno_text("socket");
+			return false;
+		}
+		addr.sun_family = AF_UNIX;
+		std::memcpy(addr.sun_path, opt_.socket_path.c_str(), opt_.socket_path.size());
+		if (!remove_stale_socket(addr, error)) return false;
+		if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+			error = errno_text("bind " + opt_.socket_path);
+			return false;
+		}
+		// remembered so stop() never unlinks a socket another daemon has bound since
+		struct stat st{};
+		if (::stat(opt_.socket_path.c_str(), &st) == 0) {
+			socket_dev_ = st.st_dev;
+			socket_ino_ = st.st_ino;
+		}
+	}
+	if (::listen(listen_fd_, 128) < 0) {
+		error = errno_text("listen");
+		return false;
+	}
+	return true;
+}
+
+void Daemon::serve() {
+	while (!stopping_.load()) {
+		int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (stopping_.load()) break;
+			// out of descriptors and the like: back off instead of spinning
+			if (errno != EINTR && errno != ECONNABORTED) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			continue;
+		}
+		if (opt_.tcp_port > 0) {
+			int one = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+		std::lock_guard<std::mutex> lk(conn_m_);
+		if (stopping_.load()) {
+			::close(fd);
+			break;
+		}
+		conns_.insert(fd);
+		std::thread([this, fd] { connection(fd); }).detach();
+	}
+}
+
+void Daemon::connection(int fd) {
+	DaemonRequest req;
+	DaemonStatus error;
+	while (read_request(fd, req, error)) {
+		const std::uint64_t start = now_ns();
+		count(Counter::bytes_in, req.payload.size());
+		DaemonResponse resp = batcher_.submit(std::move(req));
+		if (!write_response(fd, resp)) break;
+		count(Counter::bytes_out, resp.payload.size());
+		const std::uint64_t ns = now_ns() - start;
+		latency_.record(ns);
+		record_latency(Stage::request, ns);
+		req = DaemonRequest();
+	}
+	if (error == DaemonStatus::too_large) write_response(fd, DaemonResponse{DaemonStatus::too_large, {}});
+
+	std::lock_guard<std::mutex> lk(conn_m_);
+	conns_.erase(fd);
+	::close(fd);
+	conn_cv_.notify_all();
+}
+
+void Daemon::stop() {
+	if (listen_fd_ < 0) return;
+	stopping_.store(true);
+	::shutdown(listen_fd_, SHUT_RDWR);   // wakes accept()
+
+	std::unique_lock<std::mutex> lk(conn_m_);
+	for (int fd : conns_) ::shutdown(fd, SHUT_RDWR);
+	conn_cv_.wait(lk, [&] { return conns_.empty(); });
+	lk.unlock();
+
+	::close(listen_fd_);
+	listen_fd_ = -1;
+	if (opt_.tcp_port <= 0) {
+		struct stat st{};
+		if (::stat(opt_.socket_path.c_str(), &st) == 0 && st.st_dev == socket_dev_ && st.st_ino == socket_ino_)
+			::unlink(opt_.socket_path.c_str());
+	}
+}
+
+DaemonClient::~DaemonClient() {
+	if (fd_ >= 0) ::close(fd_);
+}
+
+bool DaemonClient::connect_unix(const std::string& path, std::string& error) {
+	sockaddr_un addr{};
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+		error = "socket path is empty or too long";
+		return false;
+	}
+	fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	addr.sun_family = AF_UNIX;
+	std::memcpy(addr.sun_path, path.c_str(), path.size());
+	if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+		error = errno_text("connect " + path);
+		return false;
+	}
+	return true;
+}
+
+bool DaemonClient::connect_tcp(int port, std::string& error) {
+	fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+		error = errno_text("connect 127.0.0.1:" + std::to_string(port));
+		return false;
+	}
+	int one = 1;
+	::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return true;
+}
+
+bool DaemonClient::call(const DaemonRequest& req, DaemonResponse& resp) {
+	return fd_ >= 0 && write_request(fd_, req) && read_response(fd_, resp);
+}
+
+} // namespace kedes
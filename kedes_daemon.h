@@ -0,0 +1,208 @@
+// Local encryption service: wire protocol, request batcher, server and client.
+// kedesd keeps expanded key schedules resident in a KeyScheduleCache and serves requests
+// over a Unix domain socket or loopback TCP. Each connection is read by its own thread.
+// Requests that arrive while a batch is being processed are coalesced into the next one:
+// their blocks go through encrypt_multi/decrypt_multi together. Any batch that mixes keys
+// runs on the per-lane key kernel.
+//
+// Request: a 24-byte header followed by the payload
+//
+//   offset size  field
+//        0    4  payload length in bytes
+//        4    1  operation (DaemonOp)
+//        5    1  mode (kedes::Mode)
+//        6    2  reserved, zero
+//        8    8  key
+//       16    8  CBC IV / CTR nonce
+//
+// Response: an 8-byte header followed by the payload
+//
+//        0    4  payload length in bytes
+//        4    1  status (DaemonStatus)
+//        5    3  reserved, zero
+//
+// Multi-byte fields are little-endian. CBC encryption pads with PKCS#7 the same way
+// encrypt() does. CBC decryption strips the padding; when the padding is invalid the full
+// plaintext comes back with status bad_padding. CTR is its own inverse, so both
+// operations apply the keystream. A connection may pipeline requests; responses come
+// back in request order.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "kedes.h"
+#include "kedes_multikey.h"
+
+namespace kedes {
+
+constexpr std::size_t DAEMON_REQUEST_HEADER_SIZE = 24;
+constexpr std::size_t DAEMON_RESPONSE_HEADER_SIZE = 8;
+constexpr std::uint32_t DAEMON_MAX_PAYLOAD = 16u << 20;
+constexpr const char* DAEMON_DEFAULT_SOCKET = "/tmp/kedesd.sock";
+
+enum class DaemonOp : std::uint8_t { encrypt = 1, decrypt = 2 };
+
+enum class DaemonStatus : std::uint8_t {
+	ok = 0,
+	bad_padding = 1,     // CBC decrypt: invalid PKCS#7 padding, full plaintext returned
+	bad_length = 2,      // CBC decrypt: payload not a multiple of the block size
+	bad_request = 3,     // unknown operation or mode
+	too_large = 4,       // payload above DAEMON_MAX_PAYLOAD (the connection is closed)
+};
+
+struct DaemonRequest {
+	DaemonOp op = DaemonOp::encrypt;
+	Mode mode = Mode::cbc;
+	std::uint64_t key = 0;
+	std::uint64_t iv = 0;
+	std::vector<std::byte> payload;
+};
+
+struct DaemonResponse {
+	DaemonStatus status = DaemonStatus::ok;
+	std::vector<std::byte> payload;
+};
+
+const char* to_string(DaemonStatus s);
+
+// Blocking framed I/O on a connected socket; false on EOF, error or a malformed frame
+bool read_request(int fd, DaemonRequest& req, DaemonStatus& error);
+bool write_request(int fd, const DaemonRequest& req);
+bool read_response(int fd, DaemonResponse& resp);
+bool write_response(int fd, const DaemonResponse& resp);
+
+// Runs a set of requests as one batched pass (the batcher's unit of work)
+void process_requests(std::vector<DaemonRequest*>& reqs, std::vector<DaemonResponse*>& resps,
+                      KeyScheduleCache& cache);
+
+struct BatcherOptions {
+	unsigned window_us = 0;             // extra wait for more requests once one is queued
+	std::size_t max_blocks = 1u << 16;  // stop waiting once this many blocks are queued
+};
+
+// Coalesces requests submitted by many threads. One thread drains the queue: whatever
+// accumulated while the previous batch ran (plus what arrives within window_us) goes
+// through process_requests() as one batch.
+class RequestBatcher {
+public:
+	RequestBatcher(KeyScheduleCache& cache, BatcherOptions opt = {});
+	~RequestBatcher();
+
+	RequestBatcher(const RequestBatcher&) = delete;
+	RequestBatcher& operator=(const RequestBatcher&) = delete;
+
+	// blocks until the request has been processed
+	DaemonResponse submit(DaemonRequest req);
+
+	std::uint64_t batches() const { return batches_.load(std::memory_order_relaxed); }
+	std::uint64_t requests() const { return requests_.load(std::memory_order_relaxed); }
+
+private:
+	struct Pending {
+		DaemonRequest req;
+		DaemonResponse resp;
+		std::promise<void> done;
+	};
+
+	void loop();
+
+	KeyScheduleCache& cache_;
+	BatcherOptions opt_;
+	std::mutex m_;
+	std::condition_variable cv_;
+	std::vector<Pending*> queue_;
+	std::size_t queued_blocks_ = 0;
+	bool stop_ = false;
+	std::atomic<std::uint64_t> batches_{0};
+	std::atomic<std::uint64_t> requests_{0};
+	std::thread thread_;
+};
+
+// Request latencies (read of the request to the reply being written) over a reporting
+// window; keeps the most recent WINDOW samples for the percentiles
+class LatencyWindow {
+public:
+	static constexpr std::size_t WINDOW = 1u << 16;
+
+	void record(std::uint64_t ns);
+	// count since the last take, and p50/p99 in ns over the retained samples; resets the window
+	void take(std::uint64_t& count, std::uint64_t& p50, std::uint64_t& p99);
+
+private:
+	std::mutex m_;
+	std::vector<std::uint64_t> samples_;
+	std::size_t next_ = 0;
+	std::uint64_t count_ = 0;
+};
+
+struct DaemonOptions {
+	std::string socket_path = DAEMON_DEFAULT_SOCKET;
+	int tcp_port = 0;                   // > 0 listens on 127.0.0.1:port instead of the socket
+	std::size_t cache_capacity = 4096;
+	BatcherOptions batch;
+};
+
+class Daemon {
+public:
+	explicit Daemon(DaemonOptions opt);
+	~Daemon();
+
+	Daemon(const Daemon&) = delete;
+	Daemon& operator=(const Daemon&) = delete;
+
+	bool listen(std::string& error);
+	// accept connections until stop(); one thread per connection
+	void serve();
+	// stops accepting, closes open connections and waits for their threads
+	void stop();
+
+	const KeyScheduleCache& cache() const { return cache_; }
+	const RequestBatcher& batcher() const { return batcher_; }
+	LatencyWindow& latency() { return latency_; }
+
+private:
+	void connection(int fd);
+
+	DaemonOptions opt_;
+	KeyScheduleCache cache_;
+	RequestBatcher batcher_;
+	LatencyWindow latency_;
+	int listen_fd_ = -1;
+	dev_t socket_dev_ = 0;              // the socket file bind() created
+	ino_t socket_ino_ = 0;
+	std::atomic<bool> stopping_{false};
+	std::mutex conn_m_;
+	std::condition_variable conn_cv_;
+	std::unordered_set<int> conns_;
+};
+
+// One connection to kedesd
+class DaemonClient {
+public:
+	DaemonClient() = default;
+	~DaemonClient();
+
+	DaemonClient(const DaemonClient&) = delete;
+	DaemonClient& operator=(const DaemonClient&) = delete;
+
+	bool connect_unix(const std::string& path, std::string& error);
+	bool connect_tcp(int port, std::string& error);
+	// false when the connection fails; a request error is reported in resp.status
+	bool call(const DaemonRequest& req, DaemonResponse& resp);
+
+private:
+	int fd_ = -1;
+};
+
+} // namespace kedes
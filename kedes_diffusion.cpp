@@ -0,0 +1,272 @@
+#include "kedes_diffusion.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <type_traits>
+
+#include "kedes_bitslice.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
+
+namespace kedes {
+
+namespace {
+
+constexpr std::size_t GROUP = 64;               // samples per group, one bit each after the transpose
+constexpr std::size_t LANES = 65 * GROUP;       // lane v * GROUP + s: sample s with input bit v - 1 flipped (v = 0: none)
+constexpr std::size_t MATRIX = 64 * 64;
+
+// word n of the sample sequence for seed
+std::uint64_t sample_word(std::uint64_t seed, std::uint64_t n) {
+	return mix64(mix64(seed) + n * 0x9E3779B97F4A7C15ULL);
+}
+
+constexpr std::uint64_t input_bit(std::size_t v) {
+	return v ? 1ULL << (64 - v) : 0;
+}
+
+// one task's counters
+struct Tally {
+	std::vector<std::uint64_t> flips;
+	std::vector<std::uint64_t> joint;
+
+	Tally(int rounds, bool bic) : flips((std::size_t)rounds * MATRIX), joint(bic ? MATRIX : 0) {}
+};
+
+// Adds one flipped input bit's differences to its matrix row (and the joint counts):
+// d[j] has bit s set if output bit j of sample s changed
+void count_diffs(const std::uint64_t d[64], std::uint64_t* row, std::uint64_t* joint) {
+	for (int j = 0; j < 64; ++j) row[j] += (std::uint64_t)__builtin_popcountll(d[j]);
+	if (!joint) return;
+	for (int j = 0; j < 64; ++j)
+		for (int k = j + 1; k < 64; ++k) joint[j * 64 + k] += (std::uint64_t)__builtin_popcountll(d[j] & d[k]);
+}
+
+// Adds the output differences of one group of blocks to a round's matrix (and the joint counts)
+void count_group(const std::uint64_t* out, std::uint64_t* flips, std::uint64_t* joint) {
+	for (std::size_t i = 0; i < 64; ++i) {
+		std::uint64_t d[64];
+		for (std::size_t s = 0; s < GROUP; ++s) d[s] = out[(i + 1) * GROUP + s] ^ out[s];
+		bs_transpose64(d);
+		count_diffs(d, flips + i * 64, joint);
+	}
+}
+
+// The same for a group kept as slices, out[v * 64 + j] = output bit j of the 64 samples
+// with input bit v - 1 flipped: the differences are already transposed
+void count_sliced(const std::uint64_t* out, std::uint64_t* flips, std::uint64_t* joint) {
+	for (std::size_t i = 0; i < 64; ++i) {
+		std::uint64_t d[64];
+		for (std::size_t j = 0; j < 64; ++j) d[j] = out[(i + 1) * 64 + j] ^ out[j];
+		count_diffs(d, flips + i * 64, joint);
+	}
+}
+
+// One group of lanes: the input blocks and, for key flips, every lane's schedule as
+// C0||D0 and as 16 round keys (a reduced variant uses the first ones)
+struct Group {
+	bool key_flips = false;
+	std::uint64_t rk[16];
+	std::vector<std::uint64_t> in = std::vector<std::uint64_t>(LANES);
+	std::vector<std::uint64_t> cd, lane_keys;
+};
+
+template <class Engine>
+void fill_group(const AvalancheOptions& opt, std::uint64_t g, Group& group) {
+	for (std::size_t s = 0; s < GROUP; ++s) {
+		const std::uint64_t n = 2 * (g * GROUP + s);
+		const std::uint64_t block = sample_word(opt.seed, n);
+		const std::uint64_t key = sample_word(opt.seed, n + 1);
+		for (std::size_t v = 0; v <= 64; ++v) {
+			const std::size_t lane = v * GROUP + s;
+			if (!group.key_flips) {
+				group.in[lane] = block ^ input_bit(v);
+				continue;
+			}
+			group.in[lane] = block;
+			group.cd[lane] = Engine::cd0(key ^ input_bit(v));
+			Engine::round_keys_from_cd0(group.cd[lane], &group.lane_keys[lane * 16]);
+		}
+	}
+}
+
+// Per-task buffers for stepping a group through the rounds
+struct GroupState {
+	std::vector<std::uint64_t> halves = std::vector<std::uint64_t>(LANES);   // L||R per lane or slices per flip
+	std::vector<std::uint64_t> out = std::vector<std::uint64_t>(LANES);
+	std::vector<BsSlicedKeys<std::uint64_t, false>> keys;                   // per flip, for key flips
+};
+
+// The scalar engine: every lane's halves carry over from one round to the next, so a
+// report up to R rounds costs R rounds per block
+template <class Engine>
+void scalar_rounds(const Group& group, int rounds, GroupState& st, Tally& tally) {
+	for (std::size_t l = 0; l < LANES; ++l) {
+		uint32_t L, R;
+		Engine::split(group.in[l], L, R);
+		st.halves[l] = ((std::uint64_t)L << 32) | R;
+	}
+	for (int r = 0; r < rounds; ++r) {
+		for (std::size_t l = 0; l < LANES; ++l) {
+			uint32_t L = (uint32_t)(st.halves[l] >> 32), R = (uint32_t)st.halves[l];
+			Engine::round(L, R, group.key_flips ? group.lane_keys[l * 16 + r] : group.rk[r]);
+			st.halves[l] = ((std::uint64_t)L << 32) | R;
+			st.out[l] = Engine::join(L, R);
+		}
+		const bool last_round = r + 1 == rounds;
+		count_group(st.out.data(), &tally.flips[(std::size_t)r * MATRIX],
+		            last_round && !tally.joint.empty() ? tally.joint.data() : nullptr);
+	}
+}
+
+// The simplified S-box, bitsliced 64 lanes to a word: the 64 samples of one flipped bit
+// are one batch, transposed once and kept as slices of the halves from round to round.
+// After each round the output slices are exactly what the counts need.
+template <class Keys>
+void sliced_rounds(const Group& group, int rounds, GroupState& st, Tally& tally, const Keys* keys,
+                   std::size_t key_stride) {
+	for (std::size_t v = 0; v <= 64; ++v) {
+		std::uint64_t s[64];
+		std::copy_n(&group.in[v * GROUP], GROUP, s);
+		bs_transpose64(s);
+		bs_ip_split(s, &st.halves[v * 64], &st.halves[v * 64 + 32]);
+	}
+	for (int r = 0; r < rounds; ++r) {
+		// the halves swap every round, so which 32 slices hold L alternates
+		const std::size_t left = r % 2 ? 32 : 0;
+		for (std::size_t v = 0; v <= 64; ++v) {
+			std::uint64_t* h = &st.halves[v * 64];
+			bs_feistel(h + left, h + (32 - left), keys[v * key_stride], r);
+			bs_ip_join(h + (32 - left), h + left, &st.out[v * 64]);
+		}
+		const bool last_round = r + 1 == rounds;
+		count_sliced(st.out.data(), &tally.flips[(std::size_t)r * MATRIX],
+		             last_round && !tally.joint.empty() ? tally.joint.data() : nullptr);
+	}
+}
+
+template <class Engine>
+void step_group(const Group& group, int rounds, GroupState& st, Tally& tally) {
+	if constexpr (std::is_same_v<typename Engine::sbox, SimplifiedSBox>) {
+		if (group.key_flips) {
+			for (std::size_t v = 0; v <= 64; ++v) bs_slice_keys(st.keys[v], &group.cd[v * GROUP]);
+			sliced_rounds(group, rounds, st, tally, st.keys.data(), 1);
+		} else {
+			const BsBroadcastKeys<std::uint64_t> keys{group.rk};
+			sliced_rounds(group, rounds, st, tally, &keys, 0);
+		}
+	} else {
+		scalar_rounds<Engine>(group, rounds, st, tally);
+	}
+}
+
+void run_groups(const AvalancheOptions& opt, std::uint64_t first, std::uint64_t last, Tally& tally) {
+	Group group;
+	GroupState st;
+	group.key_flips = opt.input == AvalancheInput::key;
+	if (group.key_flips) {
+		group.cd.resize(LANES);
+		group.lane_keys.resize(LANES * 16);
+		st.keys.resize(65);
+	}
+	visit_variant(opt.variant, 16, [&](auto engine) { decltype(engine)::round_keys(opt.key, group.rk); });
+
+	// one pass through opt.rounds rounds per group, counting after each
+	for (std::uint64_t g = first; g < last; ++g) {
+		visit_variant(opt.variant, 16, [&](auto engine) {
+			fill_group<decltype(engine)>(opt, g, group);
+			step_group<decltype(engine)>(group, opt.rounds, st, tally);
+		});
+	}
+}
+
+} // namespace
+
+const char* to_string(AvalancheInput in) {
+	return in == AvalancheInput::key ? "key" : "plaintext";
+}
+
+bool parse_avalanche_input(const std::string& name, AvalancheInput& in) {
+	if (name == "plaintext") in = AvalancheInput::plaintext;
+	else if (name == "key") in = AvalancheInput::key;
+	else return false;
+	return true;
+}
+
+DiffusionStats AvalancheResult::stats(int round) const {
+	DiffusionStats st;
+	st.avalanche_min = 64;
+	double sum = 0, squares = 0;
+	for (int i = 0; i < 64; ++i) {
+		double weight = 0;
+		for (int j = 0; j < 64; ++j) {
+			const double p = probability(round, i, j);
+			const double bias = p - 0.5;
+			weight += p;
+			squares += bias * bias;
+			st.sac_max_bias = std::max(st.sac_max_bias, std::fabs(bias));
+			st.dependent += p > 0;
+		}
+		sum += weight;
+		st.avalanche_min = std::min(st.avalanche_min, weight);
+		st.avalanche_max = std::max(st.avalanche_max, weight);
+	}
+	st.mean = sum / (double)MATRIX;
+	st.sac_rms_bias = std::sqrt(squares / (double)MATRIX);
+	return st;
+}
+
+double AvalancheResult::max_bit_correlation() const {
+	if (joint.empty() || samples == 0) return 0;
+	// probability of each output bit changing, over every flipped input bit
+	double p[64] = {};
+	for (int i = 0; i < 64; ++i)
+		for (int j = 0; j < 64; ++j) p[j] += probability(rounds, i, j) / 64;
+	double worst = 0;
+	for (int j = 0; j < 64; ++j) {
+		for (int k = j + 1; k < 64; ++k) {
+			const double spread = std::sqrt(p[j] * (1 - p[j]) * p[k] * (1 - p[k]));
+			// a bit that always or never changes has no correlation to speak of
+			if (spread <= 0) continue;
+			const double both = (double)joint[j * 64 + k] / (double)pairs();
+			worst = std::max(worst, std::fabs(both - p[j] * p[k]) / spread);
+		}
+	}
+	return worst;
+}
+
+bool run_avalanche(const AvalancheOptions& opt, AvalancheResult& result, std::string& error) {
+	result = AvalancheResult{};
+	if (opt.rounds < 1 || opt.rounds > 16) {
+		error = "round count must be between 1 and 16";
+		return false;
+	}
+	const auto t0 = std::chrono::steady_clock::now();
+	const std::uint64_t groups = (opt.samples + GROUP - 1) / GROUP;
+	const std::size_t tasks = (std::size_t)std::min<std::uint64_t>(
+		std::max<std::uint64_t>(groups, 1), opt.pool ? 4 * ((std::uint64_t)opt.pool->size() + 1) : 1);
+	std::vector<Tally> tallies(tasks, Tally(opt.rounds, opt.bit_independence));
+	auto task = [&](std::size_t t) {
+		run_groups(opt, groups * t / tasks, groups * (t + 1) / tasks, tallies[t]);
+	};
+	if (opt.pool) {
+		opt.pool->parallel_for(tasks, task);
+	} else {
+		task(0);
+	}
+
+	result.flips.assign((std::size_t)opt.rounds * MATRIX, 0);
+	result.joint.assign(opt.bit_independence ? MATRIX : 0, 0);
+	for (const Tally& t : tallies) {
+		std::transform(t.flips.begin(), t.flips.end(), result.flips.begin(), result.flips.begin(), std::plus<>());
+		std::transform(t.joint.begin(), t.joint.end(), result.joint.begin(), result.joint.begin(), std::plus<>());
+	}
+	result.rounds = opt.rounds;
+	result.samples = groups * GROUP;
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	return true;
+}
+
+} // namespace kedes
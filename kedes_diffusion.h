@@ -0,0 +1,84 @@
+// Avalanche and diffusion statistics. Each sample is a random block (or, with
+// AvalancheInput::key, a random key and block). It is encrypted together with its 64
+// one-bit variants, and for every round count 1..rounds the output bits that changed are
+// counted per (input bit, output bit). That yields one 64x64 flip-probability matrix per
+// round. The strict avalanche criterion asks every entry of the final matrix to be 1/2.
+// The earlier matrices show how many rounds the variant needs to get there.
+//
+// Samples run 64 at a time. A group's 65 x 64 blocks go through the rounds once, one round
+// at a time, and are counted after each one, so a report up to R rounds costs R rounds per
+// block. With the simplified S-box they stay bitsliced throughout (kedes_bitslice.h, one
+// 64-lane word per flipped bit, sliced keys for key flips). After each round the slices
+// already give, per output bit, which of the 64 samples changed, so one popcount counts
+// the whole group. Other variants carry each block's halves through the scalar engine
+// and transpose the differences. Each pool task owns its histograms and the caller sums
+// them at the end; the workers never share a counter. Samples come from a counter-based
+// generator, so the result depends only on the seed and the sample count, not on the
+// thread count.
+//
+// Bit numbers are 0-based from the most significant bit: input bit 0 is DES bit 1.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kedes.h"
+#include "kedes_variant.h"
+
+namespace kedes {
+
+enum class AvalancheInput { plaintext, key };
+
+const char* to_string(AvalancheInput in);
+bool parse_avalanche_input(const std::string& name, AvalancheInput& in);
+
+struct AvalancheOptions {
+	VariantKind variant = VariantKind::kedes;
+	int rounds = 16;
+	AvalancheInput input = AvalancheInput::plaintext;
+	std::uint64_t samples = 1u << 20;               // rounded up to a multiple of 64
+	std::uint64_t seed = 1;
+	std::uint64_t key = 0x133457799BBCDFF1ULL;      // fixed key of the plaintext flips
+	// also count joint flips of every pair of output bits at the final round (bit independence)
+	bool bit_independence = false;
+	ThreadPool* pool = nullptr;                     // nullptr runs on the calling thread
+};
+
+// Summary of one round's matrix
+struct DiffusionStats {
+	double mean = 0;             // mean flip probability over all (input, output) bits; ideal 0.5
+	double avalanche_min = 0;    // output bits changed per flipped input bit, lowest and highest
+	double avalanche_max = 0;    // mean over the input bits (ideal 32)
+	double sac_max_bias = 0;     // max |p - 0.5| over the matrix
+	double sac_rms_bias = 0;     // root mean square of p - 0.5
+	int dependent = 0;           // entries with p > 0; 4096 means every output bit depends on every input bit
+};
+
+struct AvalancheResult {
+	int rounds = 0;
+	std::uint64_t samples = 0;
+	// flips[((r - 1) * 64 + i) * 64 + j]: samples in which output bit j changed after r
+	// rounds when input bit i was flipped
+	std::vector<std::uint64_t> flips;
+	// joint[j * 64 + k] (j < k): flipped (sample, input bit) pairs in which output bits j
+	// and k both changed after the final round; empty unless bit_independence was set
+	std::vector<std::uint64_t> joint;
+	double seconds = 0;
+
+	double probability(int round, int in, int out) const {
+		return (double)flips[((std::size_t)(round - 1) * 64 + in) * 64 + out] / (double)samples;
+	}
+	DiffusionStats stats(int round) const;
+	// Bit independence: the largest |correlation| between the change indicators of two output
+	// bits at the final round, over all flipped input bits together (0 without joint counts)
+	double max_bit_correlation() const;
+	// flipped-bit pairs evaluated per round
+	std::uint64_t pairs() const { return samples * 64; }
+};
+
+// false (with error set) for a round count outside 1..16
+bool run_avalanche(const AvalancheOptions& opt, AvalancheResult& result, std::string& error);
+
+} // namespace kedes
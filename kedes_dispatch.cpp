@@ -0,0 +1,204 @@
+#include "kedes_dispatch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "kedes_block.h"
+#include "kedes_metrics.h"
+#include "kedes_reference.h"
+#include "kedes_util.h"
+
+namespace kedes {
+
+namespace {
+
+std::atomic<Kernel> active{Kernel::automatic};
+std::atomic<unsigned> interval{0};
+// blocks this thread has seen since its last sampled one
+thread_local std::uint64_t since_sample = 0;
+
+const char* const KERNEL_NAMES[] = {"auto", "scalar", "bs64", "sse2", "avx2", "avx512"};
+
+void read_env() {
+	Kernel k = Kernel::automatic;
+	if (const char* name = std::getenv("KEDES_KERNEL")) {
+		if (!parse_kernel(name, k) || !kernel_supported(k)) {
+			std::fprintf(stderr, "kedes: KEDES_KERNEL=%s is not available here; using %s\n", name,
+			             to_string(best_kernel()));
+			k = Kernel::automatic;
+		}
+	}
+	active.store(k == Kernel::automatic ? best_kernel() : k);
+	if (const char* text = std::getenv("KEDES_CROSS_CHECK")) {
+		std::uint64_t n = 0;
+		if (parse_unsigned(text, n) && n <= UINT32_MAX) interval.store((unsigned)n);
+		else std::fprintf(stderr, "kedes: KEDES_CROSS_CHECK=%s is not a sampling interval; cross-check stays off\n", text);
+	}
+}
+
+void ensure_init() {
+	static const bool done = (read_env(), true);
+	(void)done;
+}
+
+// 1-based bit vectors of packed round keys, as the reference engine takes them
+std::vector<std::vector<int>> reference_keys(const std::uint64_t* roundKeys) {
+	std::vector<std::vector<int>> keys(16, std::vector<int>(49));
+	for (int r = 0; r < 16; ++r)
+		for (int b = 1; b <= 48; ++b) keys[r][b] = (int)((roundKeys[r] >> (48 - b)) & 1);
+	return keys;
+}
+
+std::uint64_t reference_crypt(std::uint64_t block, const std::uint64_t* roundKeys, int stages) {
+	for (int s = 0; s < stages; ++s) block = reference_block(block, reference_keys(roundKeys + 16 * s));
+	return block;
+}
+
+[[noreturn]] void mismatch(const char* what, std::uint64_t k1, std::uint64_t in, std::uint64_t out,
+                           std::uint64_t expected) {
+	std::fprintf(stderr,
+	             "kedes: cross-check failed (%s, kernel %s): round key K1 %012llx, block %016llx -> %016llx, "
+	             "reference %016llx\n",
+	             what, to_string(active_kernel()), (unsigned long long)k1, (unsigned long long)in,
+	             (unsigned long long)out, (unsigned long long)expected);
+	std::abort();
+}
+
+} // namespace
+
+const char* to_string(Kernel k) {
+	return KERNEL_NAMES[(unsigned)k];
+}
+
+bool parse_kernel(const std::string& name, Kernel& k) {
+	for (unsigned i = 0; i < sizeof(KERNEL_NAMES) / sizeof(KERNEL_NAMES[0]); ++i) {
+		if (name == KERNEL_NAMES[i]) {
+			k = (Kernel)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool kernel_supported(Kernel k) {
+	switch (k) {
+	case Kernel::automatic:
+	case Kernel::scalar:
+	case Kernel::bs64:
+		return true;
+#if defined(__x86_64__) || defined(__i386__)
+	case Kernel::sse2:
+		return __builtin_cpu_supports("sse2");
+	case Kernel::avx2:
+		return __builtin_cpu_supports("avx2");
+	case Kernel::avx512:
+		return __builtin_cpu_supports("avx512f");
+#endif
+	default:
+		return false;
+	}
+}
+
+Kernel best_kernel() {
+	for (Kernel k : {Kernel::avx512, Kernel::avx2, Kernel::sse2})
+		if (kernel_supported(k)) return k;
+	return Kernel::bs64;
+}
+
+std::size_t kernel_width(Kernel k) {
+	switch (k) {
+	case Kernel::automatic: return kernel_width(best_kernel());
+	case Kernel::scalar: return 0;
+	case Kernel::bs64: return 64;
+	case Kernel::sse2: return 128;
+	case Kernel::avx2: return 256;
+	case Kernel::avx512: return 512;
+	}
+	return 0;
+}
+
+Kernel active_kernel() {
+	ensure_init();
+	return active.load(std::memory_order_relaxed);
+}
+
+bool set_kernel(Kernel k) {
+	ensure_init();
+	if (!kernel_supported(k)) return false;
+	active.store(k == Kernel::automatic ? best_kernel() : k);
+	return true;
+}
+
+void set_cross_check(unsigned n) {
+	ensure_init();
+	interval.store(n);
+}
+
+unsigned cross_check_interval() {
+	ensure_init();
+	return interval.load(std::memory_order_relaxed);
+}
+
+void CrossCheckSample::take(const std::uint64_t* blocks, std::size_t n) {
+	const unsigned every = cross_check_interval();
+	if (every == 0 || n == 0) return;
+	// the next sampled block is every - since_sample blocks away
+	std::size_t i = since_sample >= every ? 0 : every - 1 - since_sample;
+	for (; i < n && count < MAX; i += every) {
+		index[count] = i;
+		input[count] = blocks[i];
+		++count;
+	}
+	since_sample = count ? n - 1 - index[count - 1] : since_sample + n;
+}
+
+void cross_check(const CrossCheckSample& s, const std::uint64_t* out, const std::uint64_t* roundKeys, int stages) {
+	for (int j = 0; j < s.count; ++j) {
+		const std::uint64_t expected = reference_crypt(s.input[j], roundKeys, stages);
+		if (out[s.index[j]] != expected) mismatch("batch", roundKeys[0], s.input[j], out[s.index[j]], expected);
+	}
+	count(Counter::blocks_cross_checked, (std::uint64_t)s.count);
+}
+
+void cross_check_multi(const CrossCheckSample& s, const std::uint64_t* out, const std::uint64_t* cd0, bool decrypt) {
+	for (int j = 0; j < s.count; ++j) {
+		std::uint64_t rk[16];
+		round_keys_from_cd0(cd0[s.index[j]], rk);
+		if (decrypt) std::reverse(rk, rk + 16);
+		const std::uint64_t expected = reference_crypt(s.input[j], rk, 1);
+		if (out[s.index[j]] != expected) mismatch("multi-key batch", rk[0], s.input[j], out[s.index[j]], expected);
+	}
+	count(Counter::blocks_cross_checked, (std::uint64_t)s.count);
+}
+
+bool cross_check_due() {
+	const unsigned every = cross_check_interval();
+	if (every == 0 || ++since_sample < every) return false;
+	since_sample = 0;
+	return true;
+}
+
+void cross_check_block(std::uint64_t in, std::uint64_t out, const std::uint64_t* roundKeys, int stages) {
+	const std::uint64_t expected = reference_crypt(in, roundKeys, stages);
+	if (out != expected) mismatch("block", roundKeys[0], in, out, expected);
+	count(Counter::blocks_cross_checked);
+}
+
+void cross_check_schedule(std::uint64_t key, const std::uint64_t roundKeys[16]) {
+	const std::vector<std::vector<int>> ref = reference_round_keys(key);
+	for (int r = 0; r < 16; ++r) {
+		std::uint64_t packed = 0;
+		for (int b = 1; b <= 48; ++b) packed = (packed << 1) | (std::uint64_t)ref[r][b];
+		if (packed != roundKeys[r]) {
+			std::fprintf(stderr, "kedes: cross-check failed (key schedule): key %016llx, K%d %012llx, reference %012llx\n",
+			             (unsigned long long)key, r + 1, (unsigned long long)roundKeys[r],
+			             (unsigned long long)packed);
+			std::abort();
+		}
+	}
+}
+
+} // namespace kedes
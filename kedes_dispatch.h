@@ -0,0 +1,71 @@
+// Kernel dispatch for the block and mode functions. Every batch of independent blocks
+// (ECB, CTR keystream, CBC decryption, the multi-key and EDE paths) goes through the
+// dispatchers in kedes_bitslice.h, which run the bitsliced kernel of the active
+// Kernel and finish the leftovers with the narrower ones. The active kernel is the
+// widest one the CPU supports unless KEDES_KERNEL or set_kernel() picks another.
+//
+// Cross-check mode samples blocks (1 in every `interval` per thread, at most
+// CrossCheckSample::MAX from any one batch call) and recomputes them with the original
+// vector<int> reference engine (kedes_reference.h); a mismatch prints the kernel, round
+// key and block to stderr and aborts. Key schedules built while it is on are checked
+// against the reference key schedule. KEDES_CROSS_CHECK=N turns it on from the
+// environment.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace kedes {
+
+enum class Kernel : unsigned {
+	automatic,   // widest supported; never the active kernel itself
+	scalar,      // packed table engine, one block at a time
+	bs64,        // bitsliced on uint64_t slices (64 blocks)
+	sse2,        // 128-bit slices (128 blocks)
+	avx2,        // 256-bit slices (256 blocks)
+	avx512,      // 512-bit slices (512 blocks)
+};
+
+const char* to_string(Kernel k);
+bool parse_kernel(const std::string& name, Kernel& k);   // "auto", "scalar", "bs64", "sse2", "avx2", "avx512"
+bool kernel_supported(Kernel k);
+Kernel best_kernel();
+// blocks per bitsliced batch (0 for scalar)
+std::size_t kernel_width(Kernel k);
+
+// The kernel in use. The first call (from here or any block function) reads KEDES_KERNEL
+// and KEDES_CROSS_CHECK; an unknown or unsupported KEDES_KERNEL falls back to automatic
+// with a warning on stderr.
+Kernel active_kernel();
+// false (and no change) if the CPU lacks k; automatic selects best_kernel()
+bool set_kernel(Kernel k);
+
+// 0 turns the cross-check off
+void set_cross_check(unsigned interval);
+unsigned cross_check_interval();
+
+// Blocks picked for the cross-check, taken before a kernel overwrites them in place
+struct CrossCheckSample {
+	static constexpr int MAX = 64;
+	int count = 0;
+	std::size_t index[MAX];
+	std::uint64_t input[MAX];
+
+	// picks up to MAX of blocks[0..n) per the interval; cheap no-op when checking is off
+	void take(const std::uint64_t* blocks, std::size_t n);
+};
+
+// Recomputes the sampled blocks with the reference engine and aborts if out differs.
+// roundKeys holds 16 * stages keys (stages = 3 for fused EDE, one reference pass per stage).
+void cross_check(const CrossCheckSample& s, const std::uint64_t* out, const std::uint64_t* roundKeys, int stages);
+// the multi-key form: block i was keyed by the schedule with C0||D0 = cd0[i]
+void cross_check_multi(const CrossCheckSample& s, const std::uint64_t* out, const std::uint64_t* cd0, bool decrypt);
+// Single-block calls: cross_check_due() counts one block toward the interval and says
+// whether to check it with cross_check_block()
+bool cross_check_due();
+void cross_check_block(std::uint64_t in, std::uint64_t out, const std::uint64_t* roundKeys, int stages);
+// the packed key schedule of key against the reference one
+void cross_check_schedule(std::uint64_t key, const std::uint64_t roundKeys[16]);
+
+} // namespace kedes
@@ -0,0 +1,226 @@
+#include "kedes_hex.h"
+
+#include <array>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEDES_HEX_X86 1
+#endif
+
+namespace kedes {
+
+static constexpr char DIGITS[] = "0123456789ABCDEF";
+
+static inline bool is_hex(char c) {
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static inline unsigned nibble(char c) {
+	// '0'-'9' -> 0-9, 'A'-'F' / 'a'-'f' -> 10-15 (letters have bit 0x40 set)
+	return (c & 0xF) + ((c >> 6) & 1) * 9;
+}
+
+// scalar versions, also used for the tails of the vector loops
+
+static std::size_t compact_scalar(const char* in, std::size_t n, char* out) {
+	std::size_t k = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		if (is_hex(in[i])) out[k++] = in[i];
+	return k;
+}
+
+static void decode_scalar(const char* d, std::size_t n, std::byte* out) {
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = std::byte((nibble(d[2*i]) << 4) | nibble(d[2*i + 1]));
+}
+
+static std::size_t encode_scalar(const std::byte* data, std::size_t n, std::size_t& column, char* out) {
+	char* p = out;
+	for (std::size_t i = 0; i < n; ++i) {
+		unsigned v = std::to_integer<unsigned>(data[i]);
+		*p++ = DIGITS[v >> 4];
+		*p++ = DIGITS[v & 0xF];
+		if (++column == 16) {
+			*p++ = '\n';
+			column = 0;
+		}
+	}
+	return (std::size_t)(p - out);
+}
+
+#ifdef KEDES_HEX_X86
+
+// pshufb controls that move the bytes selected by an 8-bit mask to the front
+struct PackLUT {
+	alignas(16) std::array<std::array<std::uint8_t, 8>, 256> t{};
+	constexpr PackLUT() {
+		for (int m = 0; m < 256; ++m) {
+			int k = 0;
+			for (int b = 0; b < 8; ++b)
+				if (m & (1 << b)) t[m][k++] = (std::uint8_t)b;
+			for (; k < 8; ++k) t[m][k] = 0x80;
+		}
+	}
+};
+static constexpr PackLUT PACK{};
+
+__attribute__((target("ssse3")))
+static inline __m128i hex_mask_128(__m128i v) {
+	// signed compares: bytes >= 0x80 are negative and fail both ranges
+	const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+	                                    _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+	                                    _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+	return _mm_or_si128(digit, alpha);
+}
+
+// Left-pack the hex digits of 8 characters; writes 8 bytes at out and returns the count.
+// Writing a full 8 bytes is safe as long as out + 8 does not pass the end of the
+// current input position, which holds because the output never runs ahead of the input.
+__attribute__((target("ssse3")))
+static inline std::size_t pack8(__m128i v, unsigned mask, char* out) {
+	const __m128i ctl = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(PACK.t[mask].data()));
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(v, ctl));
+	return (std::size_t)__builtin_popcount(mask);
+}
+
+__attribute__((target("ssse3")))
+static std::size_t compact_ssse3(const char* in, std::size_t n, char* out) {
+	std::size_t i = 0, k = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		const unsigned mask = (unsigned)_mm_movemask_epi8(hex_mask_128(v));
+		if (mask == 0xFFFF) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), v);
+			k += 16;
+		} else if (mask != 0) {
+			k += pack8(v, mask & 0xFF, out + k);
+			k += pack8(_mm_srli_si128(v, 8), mask >> 8, out + k);
+		}
+	}
+	return k + compact_scalar(in + i, n - i, out + k);
+}
+
+__attribute__((target("avx2")))
+static std::size_t compact_avx2(const char* in, std::size_t n, char* out) {
+	std::size_t i = 0, k = 0;
+	for (; i + 32 <= n; i += 32) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+		const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+		                                       _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+		const __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+		                                       _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+		const std::uint32_t mask = (std::uint32_t)_mm256_movemask_epi8(_mm256_or_si256(digit, alpha));
+		if (mask == 0xFFFFFFFFu) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + k), v);
+			k += 32;
+		} else if (mask != 0) {
+			const __m128i lo = _mm256_castsi256_si128(v);
+			const __m128i hi = _mm256_extracti128_si256(v, 1);
+			k += pack8(lo, mask & 0xFF, out + k);
+			k += pack8(_mm_srli_si128(lo, 8), (mask >> 8) & 0xFF, out + k);
+			k += pack8(hi, (mask >> 16) & 0xFF, out + k);
+			k += pack8(_mm_srli_si128(hi, 8), mask >> 24, out + k);
+		}
+	}
+	return k + compact_scalar(in + i, n - i, out + k);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i nibbles_128(__m128i v) {
+	const __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('9')), _mm_set1_epi8(9));
+	return _mm_add_epi8(_mm_and_si128(v, _mm_set1_epi8(0x0F)), letter);
+}
+
+__attribute__((target("ssse3")))
+static void decode_ssse3(const char* d, std::size_t n, std::byte* out) {
+	const __m128i weights = _mm_set1_epi16(0x0110);   // 16 * high digit + low digit
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + 2*i));
+		const __m128i pairs = _mm_maddubs_epi16(nibbles_128(v), weights);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(pairs, pairs));
+	}
+	decode_scalar(d + 2*i, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void decode_avx2(const char* d, std::size_t n, std::byte* out) {
+	const __m256i weights = _mm256_set1_epi16(0x0110);
+	std::size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d + 2*i));
+		const __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('9')), _mm256_set1_epi8(9));
+		const __m256i nib = _mm256_add_epi8(_mm256_and_si256(v, _mm256_set1_epi8(0x0F)), letter);
+		const __m256i pairs = _mm256_maddubs_epi16(nib, weights);
+		// packus works per 128-bit lane: keep qwords 0 and 2
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(pairs, pairs), 0x08);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_castsi256_si128(packed));
+	}
+	decode_scalar(d + 2*i, n - i, out + i);
+}
+
+__attribute__((target("ssse3")))
+static std::size_t encode_ssse3(const std::byte* data, std::size_t n, std::size_t& column, char* out) {
+	const __m128i digits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(DIGITS));
+	const __m128i low4 = _mm_set1_epi8(0x0F);
+	char* p = out;
+	std::size_t i = 0;
+	// finish a partial line first so the vector loop works on whole lines
+	if (column != 0) {
+		std::size_t head = n < 16 - column ? n : 16 - column;
+		p += encode_scalar(data, head, column, p);
+		i = head;
+	}
+	for (; i + 16 <= n; i += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		const __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), low4));
+		const __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, low4));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16), _mm_unpackhi_epi8(hi, lo));
+		p[32] = '\n';
+		p += 33;
+	}
+	p += encode_scalar(data + i, n - i, column, p);
+	return (std::size_t)(p - out);
+}
+
+// widest instruction set usable for the codec, decided once via CPUID
+static int hex_isa() {
+	static const int isa = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("ssse3") ? 1 : 0;
+	return isa;
+}
+
+#endif
+
+std::size_t hex_encode_lines(std::span<const std::byte> data, std::size_t& column, char* out) {
+#ifdef KEDES_HEX_X86
+	if (hex_isa() >= 1) return encode_ssse3(data.data(), data.size(), column, out);
+#endif
+	return encode_scalar(data.data(), data.size(), column, out);
+}
+
+std::size_t hex_compact(std::span<const char> text, char* digits) {
+#ifdef KEDES_HEX_X86
+	switch (hex_isa()) {
+	case 2: return compact_avx2(text.data(), text.size(), digits);
+	case 1: return compact_ssse3(text.data(), text.size(), digits);
+	}
+#endif
+	return compact_scalar(text.data(), text.size(), digits);
+}
+
+void hex_decode_digits(const char* digits, std::size_t n, std::byte* out) {
+#ifdef KEDES_HEX_X86
+	switch (hex_isa()) {
+	case 2: return decode_avx2(digits, n, out);
+	case 1: return decode_ssse3(digits, n, out);
+	}
+#endif
+	decode_scalar(digits, n, out);
+}
+
+} // namespace kedes
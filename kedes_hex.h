@@ -0,0 +1,29 @@
+// Hex codec for the ciphertext.txt text layout: uppercase digit pairs, 16 bytes per line.
+// The decoder accepts anything the original getline/isxdigit parser accepted: every
+// non-hex character (newlines, spaces, "0x" prefixes, labels) is dropped and the
+// remaining digits are paired up in order. SSSE3/AVX2 paths are picked at runtime.
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+namespace kedes {
+
+// characters needed to encode n bytes starting at the given column (bytes already on
+// the current line); the trailing newline written at end of file is not included
+constexpr std::size_t hex_encoded_size(std::size_t n, std::size_t column = 0) {
+	return 2 * n + (column + n) / 16;
+}
+
+// Encode data as uppercase pairs, breaking the line after every 16th byte. column is
+// carried across calls so a file can be encoded in pieces. Returns characters written;
+// out must have room for hex_encoded_size(data.size(), column).
+std::size_t hex_encode_lines(std::span<const std::byte> data, std::size_t& column, char* out);
+
+// Copy only the hex digits of text to digits (which may alias text); returns the count
+std::size_t hex_compact(std::span<const char> text, char* digits);
+
+// Convert 2*n hex digits (as produced by hex_compact) to n bytes
+void hex_decode_digits(const char* digits, std::size_t n, std::byte* out);
+
+} // namespace kedes
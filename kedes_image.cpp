@@ -0,0 +1,234 @@
+// kedes_image: sector-addressed encryption of disk and VM images (kedes_sector.h). Every
+// sector is encrypted under a tweak taken from its sector number, so the image keeps its
+// size and any range of sectors can be encrypted, decrypted, read or rewritten on its own;
+// sectors outside the range are never read or written.
+//
+// usage: kedes_image encrypt|decrypt IMAGE [options]    transform sectors in place
+//        kedes_image read IMAGE OUTPUT [options]        decrypt sectors into OUTPUT
+//        kedes_image write IMAGE INPUT [options]        encrypt INPUT into the image
+//   --key HEX         key (default 133457799BBCDFF1)
+//   --sector BYTES    sector size, a multiple of 8 (default 512)
+//   --first N         first sector (default 0)
+//   --count N         sectors to process (default: to the end of the image); K/M/G
+//                     suffixes are powers of two. write takes its count from INPUT.
+//   -t, --threads     worker threads (default: one per hardware thread)
+//   --kernel NAME     bitsliced kernel (see kedes_dispatch.h)
+// A trailing partial sector of the image is left as it is. For write, a partial last
+// sector of INPUT is merged with what the image holds there (a whole sector decrypted, or
+// the raw bytes of the image's trailing partial sector) and zero-filled past its end.
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "kedes_dispatch.h"
+#include "kedes_sector.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
+
+using namespace std;
+using kedes::errno_text;
+using kedes::parse_count;
+using kedes::parse_hex64;
+
+static uint64_t image_sectors(int fd, size_t sector_bytes) {
+	const off_t end = lseek(fd, 0, SEEK_END);
+	return end < 0 ? 0 : (uint64_t)end / sector_bytes;
+}
+
+// the image's trailing partial sector is stored as it is, so its bytes are read raw
+static bool read_raw_tail(int fd, uint64_t offset, span<std::byte> out, string& error) {
+	for (size_t got = 0; got < out.size();) {
+		const ssize_t n = pread(fd, out.data() + got, out.size() - got, (off_t)(offset + got));
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			error = errno_text("read");
+			return false;
+		}
+		if (n == 0) break;
+		got += (size_t)n;
+	}
+	return true;
+}
+
+// decrypts sectors [first, first + count) of the image into path
+static bool read_image(int fd, const kedes::SectorCipher& cipher, uint64_t first, uint64_t count, const string& path,
+                       kedes::ThreadPool* pool, uint64_t& sectors, string& error) {
+	ofstream out(path, ios::binary);
+	if (!out) {
+		error = "cannot open " + path;
+		return false;
+	}
+	const size_t sb = cipher.sector_bytes();
+	const uint64_t available = image_sectors(fd, sb);
+	count = first < available ? min(count, available - first) : 0;
+	vector<std::byte> buf((size_t)min<uint64_t>(count, max<size_t>(1, kedes::IMAGE_BATCH_BYTES / sb)) * sb);
+	for (sectors = 0; sectors < count;) {
+		const size_t n = (size_t)min<uint64_t>(count - sectors, buf.size() / sb);
+		const span<std::byte> data(buf.data(), n * sb);
+		if (!kedes::read_sectors(fd, cipher, first + sectors, data, pool, error)) return false;
+		out.write(reinterpret_cast<const char*>(data.data()), (streamsize)data.size());
+		if (!out) {
+			error = "cannot write " + path;
+			return false;
+		}
+		sectors += n;
+	}
+	return true;
+}
+
+// encrypts path into the image from sector first on
+static bool write_image(int fd, const kedes::SectorCipher& cipher, uint64_t first, const string& path,
+                        kedes::ThreadPool* pool, uint64_t& sectors, string& error) {
+	ifstream in(path, ios::binary);
+	if (!in) {
+		error = "cannot open " + path;
+		return false;
+	}
+	const size_t sb = cipher.sector_bytes();
+	vector<std::byte> buf(max<size_t>(1, kedes::IMAGE_BATCH_BYTES / sb) * sb);
+	for (sectors = 0;;) {
+		in.read(reinterpret_cast<char*>(buf.data()), (streamsize)buf.size());
+		const size_t got = (size_t)in.gcount();
+		if (got == 0) break;
+		size_t len = got;
+		if (got % sb != 0) {
+			// partial last sector: keep the rest of what the image holds there, decrypted
+			// from a whole sector or raw from the image's trailing partial one
+			const uint64_t last = first + sectors + got / sb;
+			const span<std::byte> tail(buf.data() + got / sb * sb, sb);
+			vector<std::byte> old(sb);
+			const uint64_t whole = image_sectors(fd, sb);
+			if (last < whole) {
+				if (!kedes::read_sectors(fd, cipher, last, old, pool, error)) return false;
+			} else if (last == whole) {
+				if (!read_raw_tail(fd, last * sb, old, error)) return false;
+			}
+			copy(old.begin() + (ptrdiff_t)(got % sb), old.end(), tail.begin() + (ptrdiff_t)(got % sb));
+			len = (got / sb + 1) * sb;
+		}
+		if (!kedes::write_sectors(fd, cipher, first + sectors, span<const std::byte>(buf.data(), len), pool, error))
+			return false;
+		sectors += len / sb;
+		if (got < buf.size()) break;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3) {
+		cerr << "usage: kedes_image encrypt|decrypt IMAGE [options]\n"
+		     << "       kedes_image read IMAGE OUTPUT [options]\n"
+		     << "       kedes_image write IMAGE INPUT [options]\n";
+		return 1;
+	}
+	const string command = argv[1];
+	const string image = argv[2];
+	const bool in_place = command == "encrypt" || command == "decrypt";
+	if (!in_place && command != "read" && command != "write") {
+		cerr << "Unknown command " << command << " (expected encrypt, decrypt, read or write)\n";
+		return 1;
+	}
+	if (!in_place && argc < 4) {
+		cerr << "kedes_image " << command << " needs an image and a " << (command == "read" ? "output" : "input")
+		     << " file\n";
+		return 1;
+	}
+	const string other = in_place ? string() : string(argv[3]);
+
+	uint64_t key = 0x133457799BBCDFF1ULL;
+	size_t sector_bytes = 512;
+	uint64_t first = 0;
+	uint64_t count = UINT64_MAX;
+	unsigned threads = 0;
+	for (int i = in_place ? 3 : 4; i < argc; ++i) {
+		string a = argv[i];
+		if (i + 1 == argc) {
+			cerr << "Unknown option " << a << " (or missing its value)\n";
+			return 1;
+		}
+		auto next = [&]() { return string(argv[++i]); };
+		if (a == "-t" || a == "--threads" || a == "--sector" || a == "--first" || a == "--count") {
+			string v = next();
+			uint64_t n;
+			const bool thread_count = a == "-t" || a == "--threads";
+			if (!parse_count(v, n) || (thread_count && n > UINT32_MAX)) {
+				cerr << "Invalid " << a << " value " << v << " (expected a number, K/M/G suffixes allowed)\n";
+				return 1;
+			}
+			if (thread_count) threads = (unsigned)n;
+			else if (a == "--sector") sector_bytes = (size_t)n;
+			else (a == "--first" ? first : count) = n;
+		} else if (a == "--key") {
+			string v = next();
+			if (!parse_hex64(v, key)) {
+				cerr << "Invalid key " << v << " (expected up to 16 hex digits)\n";
+				return 1;
+			}
+		} else if (a == "--kernel") {
+			string name = next();
+			kedes::Kernel k;
+			if (!kedes::parse_kernel(name, k) || !kedes::set_kernel(k)) {
+				cerr << "Kernel " << name << " is unknown or not supported by this CPU\n";
+				return 1;
+			}
+		} else {
+			cerr << "Unknown option " << a << "\n";
+			return 1;
+		}
+	}
+	if (!kedes::SectorCipher::valid_sector_size(sector_bytes)) {
+		cerr << "Invalid sector size " << sector_bytes << " (expected a nonzero multiple of 8)\n";
+		return 1;
+	}
+	if (command == "write" && count != UINT64_MAX) {
+		cerr << "--count does not apply to write; the input sets it\n";
+		return 1;
+	}
+
+	const int fd = open(image.c_str(), command == "read" ? O_RDONLY : (command == "write" ? O_RDWR | O_CREAT : O_RDWR),
+	                    0644);
+	if (fd < 0) {
+		perror(image.c_str());
+		return 1;
+	}
+
+	const kedes::KeySchedule ks(key);
+	const kedes::SectorCipher cipher(ks, sector_bytes);
+	kedes::ThreadPool pool(threads);
+	const auto t0 = chrono::steady_clock::now();
+	uint64_t sectors = 0;
+	string error;
+	bool ok;
+	if (in_place) ok = kedes::crypt_image_sectors(fd, cipher, command == "decrypt", first, count, &pool, sectors, error);
+	else if (command == "read") ok = read_image(fd, cipher, first, count, other, &pool, sectors, error);
+	else ok = write_image(fd, cipher, first, other, &pool, sectors, error);
+	if (ok && command != "read" && fsync(fd) != 0) {
+		error = errno_text("fsync");
+		ok = false;
+	}
+	close(fd);
+	if (!ok) {
+		cerr << "Error: " << error << "\n";
+		return 1;
+	}
+
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	const double mb = (double)sectors * (double)sector_bytes / 1e6;
+	printf("%s: %llu sectors of %zu bytes from %llu (%.1f MB) in %.3f s on %u threads: %.1f MB/s\n", command.c_str(),
+	       (unsigned long long)sectors, sector_bytes, (unsigned long long)first, mb, seconds, pool.size(),
+	       seconds > 0 ? mb / seconds : 0.0);
+	return 0;
+}
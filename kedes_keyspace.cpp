@@ -0,0 +1,315 @@
+#include "kedes_keyspace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <type_traits>
+#include <unordered_set>
+
+#include "kedes_bitslice.h"
+#include "kedes_container.h"
+#include "kedes_hex.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
+
+namespace kedes {
+
+namespace {
+
+constexpr std::uint64_t CHUNK_KEYS = 1u << 16;   // keys per pool task
+constexpr std::size_t BATCH_KEYS = 512;          // keys per kernel call (one 512-lane batch)
+constexpr int SKETCH_BITS = 14;
+constexpr std::size_t SKETCH_REGISTERS = std::size_t(1) << SKETCH_BITS;
+
+// true if K1..K(rounds) read every bit of C0||D0 through PC-2, so that the schedule and
+// C0||D0 determine each other
+template <class Engine>
+constexpr bool schedule_reads_cd0() {
+	bool seen[56] = {};
+	for (int r = 0; r < Engine::rounds; ++r) {
+		for (int p : PC2) {
+			// bit p of the rotated C||D is bit (p - 1 + rotation) mod 28 of its half
+			const int half = p <= 28 ? 0 : 28;
+			seen[half + (p - 1 - half + Engine::rotation[r]) % 28] = true;
+		}
+	}
+	for (bool b : seen)
+		if (!b) return false;
+	return true;
+}
+
+template <class Engine>
+std::uint64_t fingerprint(std::uint64_t cd0, const std::uint64_t* roundKeys) {
+	if constexpr (schedule_reads_cd0<Engine>()) {
+		return cd0;
+	} else {
+		std::uint64_t h = 0;
+		for (int r = 0; r < Engine::rounds; ++r) h = mix64(h ^ roundKeys[r]);
+		return h;
+	}
+}
+
+template <class Engine>
+std::uint64_t key_fingerprint(std::uint64_t key) {
+	const std::uint64_t cd = Engine::cd0(key);
+	std::uint64_t rk[Engine::rounds];
+	Engine::round_keys_from_cd0(cd, rk);
+	return fingerprint<Engine>(cd, rk);
+}
+
+// HyperLogLog over the fingerprints
+struct Sketch {
+	std::uint8_t reg[SKETCH_REGISTERS] = {};
+
+	void add(std::uint64_t fp) {
+		const std::uint64_t h = mix64(fp);
+		const std::uint64_t rest = h << SKETCH_BITS;
+		const std::uint8_t rank = rest ? (std::uint8_t)(__builtin_clzll(rest) + 1) : (std::uint8_t)(64 - SKETCH_BITS + 1);
+		std::uint8_t& r = reg[h >> (64 - SKETCH_BITS)];
+		r = std::max(r, rank);
+	}
+
+	void merge(const Sketch& o) {
+		for (std::size_t i = 0; i < SKETCH_REGISTERS; ++i) reg[i] = std::max(reg[i], o.reg[i]);
+	}
+
+	double estimate() const {
+		const double m = (double)SKETCH_REGISTERS;
+		double sum = 0;
+		std::size_t zeros = 0;
+		for (std::uint8_t r : reg) {
+			sum += std::ldexp(1.0, -r);
+			zeros += r == 0;
+		}
+		const double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+		// linear counting while many registers are still empty
+		if (e <= 2.5 * m && zeros) return m * std::log(m / (double)zeros);
+		return e;
+	}
+};
+
+struct SweepState {
+	const SweepOptions& opt;
+	std::atomic<std::uint64_t> matches{0};
+	std::atomic<std::uint64_t> schedule_bits{0};
+	std::mutex m;   // guards the members below
+	std::vector<std::uint64_t> first_matches;
+	std::unordered_set<std::uint64_t> distinct;
+	bool exact = true;
+	Sketch sketch;
+
+	explicit SweepState(const SweepOptions& o) : opt(o) {}
+};
+
+template <class Engine>
+void sweep_chunk(SweepState& st, std::uint64_t first, std::uint64_t n) {
+	// the multi-key kernels implement the simplified S-box with the full 16-round schedule
+	constexpr bool BITSLICED = std::is_same_v<typename Engine::sbox, SimplifiedSBox> && Engine::rounds == 16;
+	static_assert(!BITSLICED || schedule_reads_cd0<Engine>());
+	const std::vector<KnownPair>& pairs = st.opt.pairs;
+
+	std::vector<std::uint64_t> fps;
+	std::vector<std::uint64_t> found;
+	std::uint64_t matches = 0;
+	std::uint64_t cd[BATCH_KEYS], blocks[BATCH_KEYS];
+	bool ok[BATCH_KEYS];
+	for (std::uint64_t done = 0; done < n; done += BATCH_KEYS) {
+		const std::size_t b = (std::size_t)std::min<std::uint64_t>(BATCH_KEYS, n - done);
+		const std::uint64_t key0 = first + done;
+		if constexpr (BITSLICED) {
+			for (std::size_t i = 0; i < b; ++i) {
+				cd[i] = Engine::cd0(key0 + i);
+				ok[i] = true;
+				// consecutive keys often differ only in ignored bits; the sort below does the rest
+				if (fps.empty() || fps.back() != cd[i]) fps.push_back(cd[i]);
+			}
+			for (const KnownPair& p : pairs) {
+				std::fill(blocks, blocks + b, p.plain);
+				des_blocks_multi_packed<false>(blocks, b, cd);
+				for (std::size_t i = 0; i < b; ++i) ok[i] &= blocks[i] == p.cipher;
+			}
+		} else {
+			for (std::size_t i = 0; i < b; ++i) {
+				const std::uint64_t c = Engine::cd0(key0 + i);
+				std::uint64_t rk[Engine::rounds];
+				Engine::round_keys_from_cd0(c, rk);
+				const std::uint64_t fp = fingerprint<Engine>(c, rk);
+				if (fps.empty() || fps.back() != fp) fps.push_back(fp);
+				ok[i] = std::all_of(pairs.begin(), pairs.end(),
+				                    [&](const KnownPair& p) { return Engine::crypt(p.plain, rk) == p.cipher; });
+			}
+		}
+		for (std::size_t i = 0; i < b; ++i) {
+			if (!ok[i]) continue;
+			++matches;
+			if (found.size() < st.opt.keep_matches) found.push_back(key0 + i);
+		}
+	}
+
+	// which key bits move the schedule, probed around the first key
+	const std::uint64_t fp0 = key_fingerprint<Engine>(first);
+	std::uint64_t bits = 0;
+	for (int i = 0; i < 64; ++i)
+		if (key_fingerprint<Engine>(first ^ (1ULL << i)) != fp0) bits |= 1ULL << i;
+	st.schedule_bits.fetch_or(bits, std::memory_order_relaxed);
+	st.matches.fetch_add(matches, std::memory_order_relaxed);
+
+	std::sort(fps.begin(), fps.end());
+	fps.erase(std::unique(fps.begin(), fps.end()), fps.end());
+	Sketch sketch;
+	for (std::uint64_t fp : fps) sketch.add(fp);
+
+	std::lock_guard<std::mutex> lk(st.m);
+	st.sketch.merge(sketch);
+	if (st.exact) {
+		st.distinct.insert(fps.begin(), fps.end());
+		if (st.distinct.size() > st.opt.exact_limit) {
+			st.exact = false;
+			st.distinct = {};
+		}
+	}
+	if (!found.empty()) {
+		st.first_matches.insert(st.first_matches.end(), found.begin(), found.end());
+		std::sort(st.first_matches.begin(), st.first_matches.end());
+		if (st.first_matches.size() > st.opt.keep_matches) st.first_matches.resize(st.opt.keep_matches);
+	}
+}
+
+template <class Engine>
+void sweep(SweepState& st, std::uint64_t count, SweepResult& result) {
+	using clock = std::chrono::steady_clock;
+	const SweepOptions& opt = st.opt;
+	const auto t0 = clock::now();
+	auto last_report = t0;
+	const std::uint64_t chunks = count / CHUNK_KEYS + (count % CHUNK_KEYS != 0);
+	// chunks are handed to the pool in rounds, between which progress is reported
+	const std::uint64_t per_round = opt.pool ? 4 * (std::uint64_t)opt.pool->size() + 4 : 16;
+
+	for (std::uint64_t c = 0; c < chunks;) {
+		const std::uint64_t n = std::min(per_round, chunks - c);
+		auto task = [&](std::size_t i) {
+			const std::uint64_t k = (c + i) * CHUNK_KEYS;
+			sweep_chunk<Engine>(st, opt.start + k, std::min(CHUNK_KEYS, count - k));
+		};
+		if (opt.pool) {
+			opt.pool->parallel_for((std::size_t)n, task);
+		} else {
+			for (std::size_t i = 0; i < n; ++i) task(i);
+		}
+		c += n;
+
+		const auto now = clock::now();
+		if (opt.progress && c < chunks && std::chrono::duration<double>(now - last_report).count() >= opt.progress_seconds) {
+			last_report = now;
+			opt.progress({std::min(c * CHUNK_KEYS, count), count, st.matches.load(),
+			              std::chrono::duration<double>(now - t0).count()});
+		}
+	}
+
+	result.keys = count;
+	result.matches = st.matches.load();
+	result.first_matches = st.first_matches;
+	result.distinct_exact = st.exact;
+	result.distinct_schedules = st.exact ? st.distinct.size() : (std::uint64_t)std::llround(st.sketch.estimate());
+	result.schedule_bits = st.schedule_bits.load();
+	result.seconds = std::chrono::duration<double>(clock::now() - t0).count();
+}
+
+bool read_file(const std::string& path, std::string& data, std::string& error) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		error = "cannot open " + path;
+		return false;
+	}
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return true;
+}
+
+std::uint64_t block_at(const std::byte* p) {
+	return load_be64(reinterpret_cast<const std::uint8_t*>(p));
+}
+
+} // namespace
+
+bool sweep_keys(const SweepOptions& opt, SweepResult& result, std::string& error) {
+	result = SweepResult{};
+	// stop at the top of the keyspace rather than wrapping
+	const std::uint64_t count = opt.start ? std::min(opt.count, 0 - opt.start) : opt.count;
+	SweepState st(opt);
+	const bool known = visit_variant(opt.variant, opt.rounds, [&](auto engine) {
+		sweep<decltype(engine)>(st, count, result);
+	});
+	if (!known) {
+		error = "round count must be between 1 and 16";
+		return false;
+	}
+	return true;
+}
+
+bool load_known_pairs(const std::string& plain_path, const std::string& cipher_path, Mode mode, std::uint64_t iv,
+                      std::size_t max_pairs, std::vector<KnownPair>& pairs, std::string& error) {
+	pairs.clear();
+	std::string text, raw;
+	if (!read_file(plain_path, text, error) || !read_file(cipher_path, raw, error)) return false;
+	std::vector<std::byte> plain(text.size() + BLOCK_SIZE);
+	std::transform(text.begin(), text.end(), plain.begin(), [](char c) { return std::byte((unsigned char)c); });
+
+	std::vector<std::byte> cipher;
+	const std::span<const std::byte> rawBytes(reinterpret_cast<const std::byte*>(raw.data()), raw.size());
+	if (is_container(rawBytes)) {
+		ContainerHeader h;
+		const ContainerError e = decode_header(rawBytes, h);
+		if (e != ContainerError::none) {
+			error = cipher_path + ": " + to_string(e);
+			return false;
+		}
+		// a cbc_chunked container is taken up to the end of its first segment
+		std::vector<std::uint64_t> ivs;
+		ContainerError ie = decode_segment_index(h, rawBytes.subspan(CONTAINER_HEADER_SIZE), ivs);
+		if (ie == ContainerError::none) ie = check_cipher_size(h, rawBytes.size() - ciphertext_offset(h));
+		if (ie != ContainerError::none) {
+			error = cipher_path + ": " + to_string(ie);
+			return false;
+		}
+		mode = h.mode;
+		iv = ivs.empty() ? h.iv : ivs[0];
+		std::span<const std::byte> body = rawBytes.subspan(ciphertext_offset(h));
+		if (!ivs.empty()) body = body.first(std::min<std::size_t>(body.size(), h.chunk_bytes));
+		cipher.assign(body.begin(), body.end());
+	} else {
+		const std::size_t digits = hex_compact(raw, raw.data());
+		cipher.resize(digits / 2);
+		hex_decode_digits(raw.data(), cipher.size(), cipher.data());
+	}
+
+	std::size_t blocks = cipher.size() / BLOCK_SIZE;
+	if (mode != Mode::ctr) {
+		plain.resize(pkcs7_pad(plain, text.size()));
+		blocks = std::min(blocks, plain.size() / BLOCK_SIZE);
+	} else {
+		blocks = std::min(blocks, text.size() / BLOCK_SIZE);
+	}
+	blocks = std::min(blocks, max_pairs);
+	std::uint64_t chain = iv;
+	for (std::size_t i = 0; i < blocks; ++i) {
+		const std::uint64_t p = block_at(plain.data() + i * BLOCK_SIZE);
+		const std::uint64_t c = block_at(cipher.data() + i * BLOCK_SIZE);
+		if (mode != Mode::ctr) {
+			pairs.push_back({p ^ chain, c});
+			chain = c;
+		} else {
+			pairs.push_back({iv + i, c ^ p});
+		}
+	}
+	if (pairs.empty()) {
+		error = "no whole block in both " + plain_path + " and " + cipher_path;
+		return false;
+	}
+	return true;
+}
+
+} // namespace kedes
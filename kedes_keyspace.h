@@ -0,0 +1,83 @@
+// Keyspace sweeps: every key of a range is expanded and tried against known
+// plaintext/ciphertext blocks, and the round-key schedules are fingerprinted so that
+// equivalent keys (different keys, identical schedules) can be counted. The sweep runs on
+// the compile-time engine of the chosen variant (kedes_variant.h). With the simplified
+// S-box at 16 rounds the candidate keys go through the multi-key bitsliced kernels, one
+// key per lane; other variants use the unrolled scalar engine.
+//
+// The fingerprint of a schedule is C0||D0 whenever the rounds in use read every bit of it
+// through PC-2 (always so at 16 rounds), since the schedule then determines C0||D0 and
+// vice versa; reduced schedules that leave bits unread are fingerprinted by a hash of
+// their round keys. Distinct fingerprints are counted exactly up to
+// SweepOptions::exact_limit and estimated with a HyperLogLog sketch beyond it. The first
+// key of every chunk is also re-expanded with each of its 64 bits flipped, which finds the
+// key bits that reach the schedule at all.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "kedes.h"
+#include "kedes_variant.h"
+
+namespace kedes {
+
+// one block: a key matches when E_key(plain) == cipher
+struct KnownPair {
+	std::uint64_t plain;
+	std::uint64_t cipher;
+};
+
+struct SweepProgress {
+	std::uint64_t keys_done;
+	std::uint64_t keys_total;
+	std::uint64_t matches;
+	double seconds;
+};
+
+struct SweepOptions {
+	VariantKind variant = VariantKind::kedes;
+	int rounds = 16;
+	std::uint64_t start = 0;
+	std::uint64_t count = 1ULL << 24;
+	std::vector<KnownPair> pairs;        // no pairs: every key matches, only the schedules are counted
+	ThreadPool* pool = nullptr;          // nullptr runs on the calling thread
+	std::size_t keep_matches = 16;       // matching keys to report, lowest first
+	std::size_t exact_limit = 1u << 22;  // distinct fingerprints counted exactly up to this many
+	// called from the calling thread about every progress_seconds
+	std::function<void(const SweepProgress&)> progress;
+	double progress_seconds = 5;
+};
+
+struct SweepResult {
+	std::uint64_t keys = 0;
+	std::uint64_t matches = 0;
+	std::vector<std::uint64_t> first_matches;
+	std::uint64_t distinct_schedules = 0;
+	bool distinct_exact = true;          // false once the count comes from the sketch
+	std::uint64_t schedule_bits = 0;     // key bits seen to change a schedule (bit i = key bit 2^i)
+	double seconds = 0;
+
+	double keys_per_second() const { return seconds > 0 ? (double)keys / seconds : 0; }
+	// average number of keys sharing one schedule
+	double class_size() const { return distinct_schedules ? (double)keys / (double)distinct_schedules : 0; }
+	// key bits that select the schedule: 56 for DES (the parity bits are ignored), 0 for
+	// KE-DES, whose odd/even transform overwrites all of C0||D0
+	int effective_key_bits() const { return __builtin_popcountll(schedule_bits); }
+};
+
+// false (with error set) for a round count outside 1..16
+bool sweep_keys(const SweepOptions& opt, SweepResult& result, std::string& error);
+
+// Known pairs from the first max_pairs blocks of a plaintext file and its encryption.
+// cipher_path is a container (mode and IV from its header) or hex text (mode and iv as
+// given). CBC and cbc_cmac pairs are (P_i ^ C_(i-1), C_i) including the PKCS#7 padding
+// block, cbc_chunked pairs the same within the first segment; CTR pairs are
+// (nonce + i, C_i ^ P_i) over whole blocks.
+bool load_known_pairs(const std::string& plain_path, const std::string& cipher_path, Mode mode, std::uint64_t iv,
+                      std::size_t max_pairs, std::vector<KnownPair>& pairs, std::string& error);
+
+} // namespace kedes
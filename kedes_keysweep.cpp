@@ -0,0 +1,220 @@
+// kedes_keysweep: keyspace sweep for equivalent-key analysis. Every key of a range is
+// tried against known plaintext/ciphertext blocks on all cores (kedes_keyspace.h); the
+// report lists the matching keys, how many distinct round-key schedules the range maps
+// to, which key bits reach the schedule at all, and the sweep rate in keys per second.
+//
+// usage: kedes_keysweep [--variant kedes|standard] [--rounds R] [--start HEX] [--count N | --bits B]
+//                       [--plain FILE] [--cipher FILE] [-m cbc|ctr] [--iv HEX] [--pairs N]
+//                       [--pair PLAIN:CIPHER]... [-t threads] [--kernel NAME] [--matches N]
+//                       [--progress SECONDS] [--json FILE]
+//   --variant           kedes (default) or standard (DES S-boxes and key schedule)
+//   --rounds R          rounds 1..16 (default 16)
+//   --start HEX         first key (default 0)
+//   --count N           keys to sweep, K/M/G suffixes are powers of two (default 16M)
+//   --bits B            sweep the 2^B keys that share the upper 64 - B bits of --start
+//   --plain, --cipher   known plaintext and its encryption (default plaintext.txt and
+//                       ciphertext.txt); the ciphertext is a container or hex text
+//   -m, --mode, --iv    mode (cbc or ctr, default cbc) and IV of a hex ciphertext;
+//                       containers carry their own
+//   --pairs N           known blocks to take from the files (default 2)
+//   --pair P:C          a known block as two 16-digit hex values, instead of the files;
+//                       may be repeated
+//   -t, --threads       sweep threads (default: one per hardware thread)
+//   --kernel NAME       bitsliced kernel for the KE-DES variants (see kedes_dispatch.h)
+//   --matches N         matching keys to list (default 16)
+//   --progress SECONDS  progress line on stderr every SECONDS (default 5, 0 = off)
+//   --json FILE         also write the report as JSON to FILE ("-" for stdout)
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "kedes_dispatch.h"
+#include "kedes_keyspace.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
+
+using namespace std;
+using kedes::parse_hex64;
+
+struct SweepCli {
+	kedes::SweepOptions sweep;
+	string plain_path = "plaintext.txt";
+	string cipher_path = "ciphertext.txt";
+	kedes::Mode mode = kedes::Mode::cbc;
+	uint64_t iv = 0;
+	size_t pairs = 2;
+	unsigned threads = 0;
+	string json;
+};
+
+static string hex16(uint64_t v) {
+	char buf[17];
+	snprintf(buf, sizeof(buf), "%016llX", (unsigned long long)v);
+	return buf;
+}
+
+static void write_json(ostream& out, const SweepCli& cli, const kedes::SweepResult& r, unsigned threads) {
+	const kedes::SweepOptions& o = cli.sweep;
+	out << "{\n  \"schema\": 1,\n  \"variant\": \"" << kedes::to_string(o.variant) << "\",\n  \"rounds\": " << o.rounds
+	    << ",\n  \"start\": \"" << hex16(o.start) << "\",\n  \"keys\": " << r.keys
+	    << ",\n  \"known_blocks\": " << o.pairs.size() << ",\n  \"threads\": " << threads
+	    << ",\n  \"seconds\": " << fixed << setprecision(3) << r.seconds << ",\n  \"keys_per_second\": "
+	    << setprecision(0) << r.keys_per_second() << ",\n  \"matches\": " << r.matches << ",\n  \"first_matches\": [";
+	for (size_t i = 0; i < r.first_matches.size(); ++i) out << (i ? ", " : "") << "\"" << hex16(r.first_matches[i]) << "\"";
+	out << "],\n  \"distinct_schedules\": " << r.distinct_schedules << ",\n  \"distinct_exact\": "
+	    << (r.distinct_exact ? "true" : "false") << ",\n  \"keys_per_schedule\": " << setprecision(3) << r.class_size()
+	    << ",\n  \"schedule_key_bits\": " << r.effective_key_bits() << ",\n  \"schedule_bit_mask\": \""
+	    << hex16(r.schedule_bits) << "\"\n}\n";
+}
+
+int main(int argc, char** argv)
+{
+	SweepCli cli;
+	kedes::SweepOptions& opt = cli.sweep;
+	int bits = -1;
+	for (int i = 1; i < argc; ++i) {
+		string a = argv[i];
+		if (i + 1 == argc) {
+			cerr << "Unknown option " << a << " (or missing its value)\n";
+			return 1;
+		}
+		auto next = [&]() { return string(argv[++i]); };
+		uint64_t n = 0;
+		auto number = [&](uint64_t lo, uint64_t hi) {
+			const string v = next();
+			if (kedes::parse_unsigned(v, n) && n >= lo && n <= hi) return true;
+			cerr << "Invalid " << a << " value " << v << " (expected " << lo << " to " << hi << ")\n";
+			return false;
+		};
+		if (a == "--rounds") {
+			if (!number(1, 16)) return 1;
+			opt.rounds = (int)n;
+		} else if (a == "--count") {
+			const string v = next();
+			if (!kedes::parse_count(v, opt.count)) {
+				cerr << "Invalid --count value " << v << " (expected a number, K/M/G suffixes allowed)\n";
+				return 1;
+			}
+		} else if (a == "--bits") {
+			if (!number(0, 63)) return 1;
+			bits = (int)n;
+		} else if (a == "--plain") cli.plain_path = next();
+		else if (a == "--cipher") cli.cipher_path = next();
+		else if (a == "--pairs") {
+			if (!number(1, SIZE_MAX)) return 1;
+			cli.pairs = (size_t)n;
+		} else if (a == "-t" || a == "--threads") {
+			if (!number(0, UINT32_MAX)) return 1;
+			cli.threads = (unsigned)n;
+		} else if (a == "--matches") {
+			if (!number(0, SIZE_MAX)) return 1;
+			opt.keep_matches = (size_t)n;
+		} else if (a == "--progress") {
+			const string v = next();
+			if (!kedes::parse_decimal(v, opt.progress_seconds)) {
+				cerr << "Invalid --progress value " << v << " (expected seconds)\n";
+				return 1;
+			}
+		} else if (a == "--json") cli.json = next();
+		else if (a == "--variant") {
+			string v = next();
+			if (!kedes::parse_variant(v, opt.variant)) {
+				cerr << "Unknown variant " << v << " (expected kedes or standard)\n";
+				return 1;
+			}
+		} else if (a == "--start" || a == "--iv") {
+			string v = next();
+			if (!parse_hex64(v, a == "--start" ? opt.start : cli.iv)) {
+				cerr << "Invalid " << a << " value " << v << " (expected up to 16 hex digits)\n";
+				return 1;
+			}
+		} else if (a == "--pair") {
+			string v = next();
+			const size_t colon = v.find(':');
+			kedes::KnownPair p;
+			if (colon == string::npos || !parse_hex64(v.substr(0, colon), p.plain)
+			    || !parse_hex64(v.substr(colon + 1), p.cipher)) {
+				cerr << "Invalid known block " << v << " (expected PLAIN:CIPHER in hex)\n";
+				return 1;
+			}
+			opt.pairs.push_back(p);
+		} else if (a == "-m" || a == "--mode") {
+			string mode = next();
+			if (mode == "cbc") cli.mode = kedes::Mode::cbc;
+			else if (mode == "ctr") cli.mode = kedes::Mode::ctr;
+			else {
+				cerr << "Unknown mode " << mode << " (expected cbc or ctr)\n";
+				return 1;
+			}
+		} else if (a == "--kernel") {
+			string name = next();
+			kedes::Kernel k;
+			if (!kedes::parse_kernel(name, k) || !kedes::set_kernel(k)) {
+				cerr << "Kernel " << name << " is unknown or not supported by this CPU\n";
+				return 1;
+			}
+		} else {
+			cerr << "Unknown option " << a << "\n";
+			return 1;
+		}
+	}
+	if (bits >= 0) {
+		opt.count = 1ULL << bits;
+		opt.start &= ~(opt.count - 1);
+	}
+	if (opt.pairs.empty()) {
+		string error;
+		if (!kedes::load_known_pairs(cli.plain_path, cli.cipher_path, cli.mode, cli.iv, cli.pairs, opt.pairs, error)) {
+			cerr << "Error: " << error << "\n";
+			return 1;
+		}
+	}
+
+	kedes::ThreadPool pool(cli.threads);
+	opt.pool = &pool;
+	if (opt.progress_seconds > 0) {
+		opt.progress = [](const kedes::SweepProgress& p) {
+			fprintf(stderr, "  %llu / %llu keys (%.1f%%), %.1f M keys/s, %llu matches\n",
+			        (unsigned long long)p.keys_done, (unsigned long long)p.keys_total,
+			        100.0 * (double)p.keys_done / (double)p.keys_total, (double)p.keys_done / p.seconds / 1e6,
+			        (unsigned long long)p.matches);
+		};
+	}
+
+	kedes::SweepResult r;
+	string error;
+	if (!kedes::sweep_keys(opt, r, error)) {
+		cerr << "Error: " << error << "\n";
+		return 1;
+	}
+
+	const unsigned threads = pool.size();
+	printf("variant %s, %d rounds, keys %s..%s, %zu known blocks\n", kedes::to_string(opt.variant), opt.rounds,
+	       hex16(opt.start).c_str(), hex16(opt.start + (r.keys - 1)).c_str(), opt.pairs.size());
+	printf("swept %llu keys in %.3f s on %u threads: %.2f M keys/s\n", (unsigned long long)r.keys, r.seconds, threads,
+	       r.keys_per_second() / 1e6);
+	printf("matching keys: %llu\n", (unsigned long long)r.matches);
+	for (uint64_t k : r.first_matches) printf("  %s\n", hex16(k).c_str());
+	if (r.matches > r.first_matches.size()) printf("  ...\n");
+	printf("distinct schedules: %llu (%s), %.1f keys per schedule\n", (unsigned long long)r.distinct_schedules,
+	       r.distinct_exact ? "exact" : "estimated", r.class_size());
+	printf("key bits that reach the schedule: %d of 64 (mask %s)\n", r.effective_key_bits(),
+	       hex16(r.schedule_bits).c_str());
+
+	if (cli.json == "-") {
+		write_json(cout, cli, r, threads);
+	} else if (!cli.json.empty()) {
+		ofstream out(cli.json);
+		write_json(out, cli, r, threads);
+		if (!out) {
+			cerr << "Error writing " << cli.json << "\n";
+			return 1;
+		}
+	}
+	return 0;
+}
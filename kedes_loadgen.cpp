@@ -0,0 +1,218 @@
+// kedes_loadgen: load generator for kedesd. Each connection runs on its own thread and
+// keeps one request in flight. Latency is measured per request at the client (write of
+// the request to the full reply), and the percentiles are exact over every sample.
+//
+// usage: kedes_loadgen [--socket PATH | --tcp PORT] [-c N] [-n N | --duration SECONDS]
+//                      [--size BYTES] [--op encrypt|decrypt] [-m cbc|ctr] [--keys N] [--verify]
+//   --socket PATH       daemon socket (default /tmp/kedesd.sock); --tcp PORT for 127.0.0.1:PORT
+//   -c, --connections   concurrent connections (default 8)
+//   -n, --requests      requests per connection (default 10000)
+//   --duration SECONDS  run for a fixed time instead of a request count
+//   --size BYTES        plaintext bytes per request (default 64)
+//   --op                encrypt (default) or decrypt; decrypt sends ciphertext made locally
+//   -m, --mode          cbc (default) or ctr
+//   --keys N            distinct keys spread over the requests (default 1)
+//   --verify            compare every reply with libkedes run in-process
+// Counts and sizes take K/M/G suffixes (powers of two).
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kedes.h"
+#include "kedes_daemon.h"
+#include "kedes_util.h"
+
+using namespace std;
+using kedes::percentile;
+
+struct LoadOptions {
+	string socket_path = kedes::DAEMON_DEFAULT_SOCKET;
+	int tcp_port = 0;
+	unsigned connections = 8;
+	uint64_t requests = 10000;
+	double duration = 0;
+	size_t size = 64;
+	kedes::DaemonOp op = kedes::DaemonOp::encrypt;
+	kedes::Mode mode = kedes::Mode::cbc;
+	unsigned keys = 1;
+	bool verify = false;
+};
+
+// one prepared request per key, with the reply libkedes gives for it
+struct Workload {
+	kedes::DaemonRequest req;
+	vector<byte> expect;
+};
+
+struct WorkerResult {
+	vector<uint64_t> ns;
+	uint64_t errors = 0;
+	uint64_t mismatches = 0;
+	string failure;
+};
+
+static vector<Workload> make_workloads(const LoadOptions& opt) {
+	vector<Workload> w(opt.keys);
+	vector<byte> plain(opt.size);
+	for (size_t i = 0; i < plain.size(); ++i) plain[i] = byte(i * 131 + 7);
+	for (unsigned k = 0; k < opt.keys; ++k) {
+		kedes::DaemonRequest& req = w[k].req;
+		req.op = opt.op;
+		req.mode = opt.mode;
+		req.key = 0x133457799BBCDFF1ULL + k * 0x9E3779B97F4A7C15ULL;
+		req.iv = k;
+		const kedes::KeySchedule ks(req.key);
+		if (opt.mode == kedes::Mode::ctr) {
+			req.payload = plain;
+			w[k].expect = kedes::ctr_crypt(ks, req.iv, plain);
+		} else if (opt.op == kedes::DaemonOp::encrypt) {
+			req.payload = plain;
+			w[k].expect = kedes::encrypt(ks, plain, req.iv);
+		} else {
+			req.payload = kedes::encrypt(ks, plain, req.iv);
+			w[k].expect = plain;
+		}
+	}
+	return w;
+}
+
+int main(int argc, char** argv)
+{
+	LoadOptions opt;
+	for (int i = 1; i < argc; ++i) {
+		string a = argv[i];
+		if (a == "--verify") {
+			opt.verify = true;
+			continue;
+		}
+		if (i + 1 == argc) {
+			cerr << "Unknown option " << a << " (or missing its value)\n";
+			return 1;
+		}
+		const string v = argv[++i];
+		uint64_t n = 0;
+		auto number = [&](uint64_t lo, uint64_t hi) {
+			if (kedes::parse_count(v, n) && n >= lo && n <= hi) return true;
+			cerr << "Invalid " << a << " value " << v << " (expected " << lo << " to " << hi
+			     << ", K/M/G suffixes allowed)\n";
+			return false;
+		};
+		if (a == "--socket") opt.socket_path = v;
+		else if (a == "--tcp") {
+			if (!kedes::parse_unsigned(v, n) || n < 1 || n > 65535) {
+				cerr << "Invalid --tcp port " << v << " (expected 1 to 65535)\n";
+				return 1;
+			}
+			opt.tcp_port = (int)n;
+		} else if (a == "-c" || a == "--connections") {
+			if (!number(1, UINT32_MAX)) return 1;
+			opt.connections = (unsigned)n;
+		} else if (a == "-n" || a == "--requests") {
+			if (!number(0, UINT64_MAX)) return 1;
+			opt.requests = n;
+		} else if (a == "--duration") {
+			if (!kedes::parse_decimal(v, opt.duration)) {
+				cerr << "Invalid --duration value " << v << " (expected seconds)\n";
+				return 1;
+			}
+		} else if (a == "--size") {
+			if (!number(0, SIZE_MAX)) return 1;
+			opt.size = (size_t)n;
+		} else if (a == "--keys") {
+			if (!number(1, UINT32_MAX)) return 1;
+			opt.keys = (unsigned)n;
+		} else if (a == "--op") {
+			if (v == "encrypt" || v == "enc") opt.op = kedes::DaemonOp::encrypt;
+			else if (v == "decrypt" || v == "dec") opt.op = kedes::DaemonOp::decrypt;
+			else {
+				cerr << "Unknown operation " << v << " (expected encrypt or decrypt)\n";
+				return 1;
+			}
+		} else if (a == "-m" || a == "--mode") {
+			if (v == "cbc") opt.mode = kedes::Mode::cbc;
+			else if (v == "ctr") opt.mode = kedes::Mode::ctr;
+			else {
+				cerr << "Unknown mode " << v << " (expected cbc or ctr)\n";
+				return 1;
+			}
+		} else {
+			cerr << "Unknown option " << a << "\n";
+			return 1;
+		}
+	}
+	if (opt.size > kedes::DAEMON_MAX_PAYLOAD - kedes::BLOCK_SIZE) {
+		cerr << "Request size above the daemon limit of " << kedes::DAEMON_MAX_PAYLOAD - kedes::BLOCK_SIZE << " bytes\n";
+		return 1;
+	}
+
+	const vector<Workload> work = make_workloads(opt);
+	vector<WorkerResult> results(opt.connections);
+	atomic<unsigned> ready{0};
+	atomic<bool> go{false};
+	const auto deadline_after = chrono::duration<double>(opt.duration);
+
+	auto worker = [&](unsigned id) {
+		WorkerResult& r = results[id];
+		kedes::DaemonClient client;
+		bool connected = opt.tcp_port > 0 ? client.connect_tcp(opt.tcp_port, r.failure)
+		                                  : client.connect_unix(opt.socket_path, r.failure);
+		ready.fetch_add(1);
+		while (!go.load()) this_thread::yield();
+		if (!connected) return;
+
+		const auto deadline = chrono::steady_clock::now() + deadline_after;
+		kedes::DaemonResponse resp;
+		for (uint64_t i = 0; opt.duration > 0 || i < opt.requests; ++i) {
+			if (opt.duration > 0 && chrono::steady_clock::now() >= deadline) break;
+			const Workload& w = work[(id + i * opt.connections) % work.size()];
+			const auto t0 = chrono::steady_clock::now();
+			if (!client.call(w.req, resp)) {
+				r.failure = "connection lost";
+				return;
+			}
+			r.ns.push_back((uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
+			if (resp.status != kedes::DaemonStatus::ok) ++r.errors;
+			else if (opt.verify && resp.payload != w.expect) ++r.mismatches;
+		}
+	};
+
+	vector<thread> threads;
+	for (unsigned c = 0; c < opt.connections; ++c) threads.emplace_back(worker, c);
+	while (ready.load() < opt.connections) this_thread::yield();
+	const auto t0 = chrono::steady_clock::now();
+	go.store(true);
+	for (thread& t : threads) t.join();
+	const double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+	vector<uint64_t> ns;
+	uint64_t errors = 0, mismatches = 0;
+	bool failed = false;
+	for (const WorkerResult& r : results) {
+		ns.insert(ns.end(), r.ns.begin(), r.ns.end());
+		errors += r.errors;
+		mismatches += r.mismatches;
+		if (!r.failure.empty()) {
+			cerr << "Error: " << r.failure << "\n";
+			failed = true;
+		}
+	}
+	sort(ns.begin(), ns.end());
+	const double n = (double)ns.size();
+	printf("requests %zu over %u connections in %.3f s: %.0f req/s, %.1f MB/s\n", ns.size(), opt.connections, secs,
+	       n / secs, n * (double)opt.size / secs / 1e6);
+	if (!ns.empty()) {
+		printf("latency us: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", (double)ns.front() / 1e3,
+		       percentile(ns, 50) / 1e3, percentile(ns, 90) / 1e3, percentile(ns, 99) / 1e3,
+		       percentile(ns, 99.9) / 1e3, (double)ns.back() / 1e3);
+	}
+	if (errors) printf("error replies: %llu\n", (unsigned long long)errors);
+	if (opt.verify) printf("verify: %llu mismatches\n", (unsigned long long)mismatches);
+	return failed || errors || mismatches ? 1 : 0;
+}
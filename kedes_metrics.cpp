@@ -0,0 +1,206 @@
+#include "kedes_metrics.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <pthread.h>
+
+namespace kedes {
+
+namespace {
+
+// bucket i counts samples in [2^(i-1), 2^i) ns; the last one is open-ended (> 1 minute)
+constexpr unsigned BUCKETS = 37;
+
+struct Histogram {
+	std::array<std::atomic<std::uint64_t>, BUCKETS> buckets{};
+	std::atomic<std::uint64_t> count{0};
+	std::atomic<std::uint64_t> sum_ns{0};
+};
+
+struct Registry {
+	std::atomic<bool> enabled{false};
+	std::array<std::atomic<std::uint64_t>, (unsigned)Counter::count_> counters{};
+	std::array<Histogram, (unsigned)Stage::count_> stages;
+
+	// dump target set by enable_metrics()
+	std::mutex dump_m;
+	std::string path;
+	MetricsFormat fmt = MetricsFormat::json;
+};
+
+Registry& registry() {
+	static Registry r;
+	return r;
+}
+
+const char* const COUNTER_NAMES[] = {
+	"key_schedules", "blocks_encrypted", "blocks_decrypted", "bytes_in", "bytes_out", "padding_errors",
+	"blocks_cross_checked", "tag_errors",
+};
+const char* const STAGE_NAMES[] = {"key_schedule", "cipher", "read", "write", "io_wait", "request"};
+
+std::uint64_t now_ns() {
+	return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned bucket_of(std::uint64_t ns) {
+	unsigned b = ns ? 64 - (unsigned)__builtin_clzll(ns) : 0;
+	return b < BUCKETS ? b : BUCKETS - 1;
+}
+
+// upper bound of a bucket in ns (approximate quantiles report this value)
+std::uint64_t bucket_le(unsigned b) {
+	return std::uint64_t(1) << b;
+}
+
+std::uint64_t quantile_ns(const Histogram& h, double q) {
+	const std::uint64_t total = h.count.load(std::memory_order_relaxed);
+	if (total == 0) return 0;
+	const std::uint64_t rank = (std::uint64_t)(q * (double)total + 0.5);
+	std::uint64_t seen = 0;
+	for (unsigned b = 0; b < BUCKETS; ++b) {
+		seen += h.buckets[b].load(std::memory_order_relaxed);
+		if (seen >= rank && seen > 0) return bucket_le(b);
+	}
+	return bucket_le(BUCKETS - 1);
+}
+
+void write_json(std::ostream& out) {
+	Registry& r = registry();
+	out << "{\n  \"counters\": {";
+	for (unsigned c = 0; c < (unsigned)Counter::count_; ++c)
+		out << (c ? ", " : "") << "\"" << COUNTER_NAMES[c] << "\": " << r.counters[c].load(std::memory_order_relaxed);
+	out << "},\n  \"stages\": {\n";
+	for (unsigned s = 0; s < (unsigned)Stage::count_; ++s) {
+		const Histogram& h = r.stages[s];
+		out << "    \"" << STAGE_NAMES[s] << "\": {\"count\": " << h.count.load(std::memory_order_relaxed)
+		    << ", \"sum_ns\": " << h.sum_ns.load(std::memory_order_relaxed)
+		    << ", \"p50_ns\": " << quantile_ns(h, 0.50) << ", \"p99_ns\": " << quantile_ns(h, 0.99)
+		    << ", \"buckets\": [";
+		bool first = true;
+		for (unsigned b = 0; b < BUCKETS; ++b) {
+			std::uint64_t n = h.buckets[b].load(std::memory_order_relaxed);
+			if (n == 0) continue;
+			out << (first ? "" : ", ") << "[" << bucket_le(b) << ", " << n << "]";
+			first = false;
+		}
+		out << "]}" << (s + 1 < (unsigned)Stage::count_ ? "," : "") << "\n";
+	}
+	out << "  }\n}\n";
+}
+
+void write_prometheus(std::ostream& out) {
+	Registry& r = registry();
+	for (unsigned c = 0; c < (unsigned)Counter::count_; ++c) {
+		out << "# TYPE kedes_" << COUNTER_NAMES[c] << "_total counter\n"
+		    << "kedes_" << COUNTER_NAMES[c] << "_total " << r.counters[c].load(std::memory_order_relaxed) << "\n";
+	}
+	out << "# TYPE kedes_stage_seconds histogram\n";
+	for (unsigned s = 0; s < (unsigned)Stage::count_; ++s) {
+		const Histogram& h = r.stages[s];
+		std::uint64_t cumulative = 0;
+		for (unsigned b = 0; b + 1 < BUCKETS; ++b) {
+			cumulative += h.buckets[b].load(std::memory_order_relaxed);
+			out << "kedes_stage_seconds_bucket{stage=\"" << STAGE_NAMES[s] << "\",le=\""
+			    << (double)bucket_le(b) * 1e-9 << "\"} " << cumulative << "\n";
+		}
+		const std::uint64_t total = h.count.load(std::memory_order_relaxed);
+		out << "kedes_stage_seconds_bucket{stage=\"" << STAGE_NAMES[s] << "\",le=\"+Inf\"} " << total << "\n"
+		    << "kedes_stage_seconds_sum{stage=\"" << STAGE_NAMES[s] << "\"} "
+		    << (double)h.sum_ns.load(std::memory_order_relaxed) * 1e-9 << "\n"
+		    << "kedes_stage_seconds_count{stage=\"" << STAGE_NAMES[s] << "\"} " << total << "\n";
+	}
+}
+
+void dump_to_target() {
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lk(r.dump_m);
+	if (r.path.empty()) return;
+	if (r.path == "-") {
+		write_metrics(std::cout, r.fmt);
+		std::cout.flush();
+		return;
+	}
+	std::ofstream out(r.path, std::ios::trunc);
+	write_metrics(out, r.fmt);
+	if (!out) std::cerr << "Error writing metrics to " << r.path << "\n";
+}
+
+} // namespace
+
+bool metrics_enabled() {
+	return registry().enabled.load(std::memory_order_relaxed);
+}
+
+void set_metrics_enabled(bool on) {
+	registry().enabled.store(on, std::memory_order_relaxed);
+}
+
+void count(Counter c, std::uint64_t n) {
+	Registry& r = registry();
+	if (!r.enabled.load(std::memory_order_relaxed)) return;
+	r.counters[(unsigned)c].fetch_add(n, std::memory_order_relaxed);
+}
+
+void record_latency(Stage s, std::uint64_t ns) {
+	Registry& r = registry();
+	if (!r.enabled.load(std::memory_order_relaxed)) return;
+	Histogram& h = r.stages[(unsigned)s];
+	h.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+	h.count.fetch_add(1, std::memory_order_relaxed);
+	h.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+StageTimer::StageTimer(Stage s)
+	: stage_(s), start_(metrics_enabled() ? now_ns() : 0) {}
+
+StageTimer::~StageTimer() {
+	if (start_) record_latency(stage_, now_ns() - start_);
+}
+
+void write_metrics(std::ostream& out, MetricsFormat fmt) {
+	if (fmt == MetricsFormat::prometheus) write_prometheus(out);
+	else write_json(out);
+}
+
+bool parse_metrics_format(const std::string& name, MetricsFormat& fmt) {
+	if (name == "json") fmt = MetricsFormat::json;
+	else if (name == "prom" || name == "prometheus") fmt = MetricsFormat::prometheus;
+	else return false;
+	return true;
+}
+
+void enable_metrics(const std::string& path, MetricsFormat fmt, int sig) {
+	Registry& r = registry();
+	{
+		std::lock_guard<std::mutex> lk(r.dump_m);
+		const bool first = r.path.empty();
+		r.path = path;
+		r.fmt = fmt;
+		if (first) std::atexit(dump_to_target);
+	}
+	set_metrics_enabled(true);
+	if (sig == 0) return;
+
+	// threads started later inherit the blocked signal; the helper collects it with sigwait
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, sig);
+	pthread_sigmask(SIG_BLOCK, &set, nullptr);
+	std::thread([set] {
+		for (;;) {
+			int got = 0;
+			if (sigwait(&set, &got) == 0) dump_to_target();
+		}
+	}).detach();
+}
+
+} // namespace kedes
@@ -0,0 +1,67 @@
+// Hot-path instrumentation: event counters and per-stage latency histograms.
+// Everything is off until enabled; when off a counter or timer costs one relaxed load.
+// Recording is lock-free (relaxed atomics), so the pool workers and the stream stages
+// can all report into the same registry. Instrumentation sits at mode-call and chunk
+// granularity, never per block.
+#pragma once
+
+#include <csignal>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+namespace kedes {
+
+enum class Counter : unsigned {
+	key_schedules,
+	blocks_encrypted,    // block cipher calls in the encrypt direction (CBC and CTR keystream)
+	blocks_decrypted,
+	bytes_in,
+	bytes_out,
+	padding_errors,
+	blocks_cross_checked, // blocks recomputed by the reference engine (kedes_dispatch.h)
+	tag_errors,           // Mode::cbc_cmac ciphertexts rejected by their tag
+	count_
+};
+
+enum class Stage : unsigned {
+	key_schedule,
+	cipher,              // one mode call (cbc_*_blocks, ctr_crypt)
+	read,                // source / file reads
+	write,               // sink / file writes
+	io_wait,             // cipher stage waiting for the reader
+	request,             // daemon request, read to reply written
+	count_
+};
+
+enum class MetricsFormat { json, prometheus };
+
+bool metrics_enabled();
+void set_metrics_enabled(bool on);
+
+void count(Counter c, std::uint64_t n = 1);
+void record_latency(Stage s, std::uint64_t ns);
+
+// records the lifetime of the object as one latency sample of the stage
+class StageTimer {
+public:
+	explicit StageTimer(Stage s);
+	~StageTimer();
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+	Stage stage_;
+	std::uint64_t start_;   // 0 when metrics were off at construction
+};
+
+void write_metrics(std::ostream& out, MetricsFormat fmt);
+bool parse_metrics_format(const std::string& name, MetricsFormat& fmt);   // "json" or "prom"
+
+// Enable metrics and dump them to path ("-" = stdout) at exit and each time sig arrives
+// (0 = at exit only). The signal is blocked in the calling thread and handled by a
+// helper thread, so call this before starting any other thread.
+void enable_metrics(const std::string& path, MetricsFormat fmt, int sig = SIGUSR1);
+
+} // namespace kedes
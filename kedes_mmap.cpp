@@ -0,0 +1,155 @@
+#include "kedes_mmap.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kedes_util.h"
+
+namespace kedes {
+
+MappedFile::~MappedFile() {
+	std::string ignored;
+	close(size_, ignored);
+}
+
+bool MappedFile::open_read(const std::string& path, std::string& error) {
+	fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd_ < 0) {
+		error = errno_text("cannot open " + path);
+		return false;
+	}
+	struct stat st;
+	if (::fstat(fd_, &st) != 0) {
+		error = errno_text(path);
+		return false;
+	}
+	size_ = (std::size_t)st.st_size;
+	if (size_ == 0) return true;
+	void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+	if (p == MAP_FAILED) {
+		size_ = 0;
+		error = errno_text("cannot map " + path);
+		return false;
+	}
+	base_ = static_cast<std::byte*>(p);
+	// hints only: read-ahead for a front-to-back pass, huge pages where file THP is on
+	::madvise(p, size_, MADV_SEQUENTIAL);
+	::madvise(p, size_, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+	::madvise(p, size_, MADV_HUGEPAGE);
+#endif
+	return true;
+}
+
+bool MappedFile::create(const std::string& path, std::size_t size, std::string& error) {
+	fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd_ < 0) {
+		error = errno_text("cannot open " + path + " for writing");
+		return false;
+	}
+	writable_ = true;
+	if (size == 0) return true;
+	// reserve the blocks now; file systems without fallocate get a sparse ftruncate
+	int rc = ::posix_fallocate(fd_, 0, (off_t)size);
+	if (rc == EOPNOTSUPP || rc == EINVAL) rc = ::ftruncate(fd_, (off_t)size) == 0 ? 0 : errno;
+	if (rc != 0) {
+		errno = rc;
+		error = errno_text("cannot size " + path);
+		return false;
+	}
+	void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (p == MAP_FAILED) {
+		error = errno_text("cannot map " + path);
+		return false;
+	}
+	base_ = static_cast<std::byte*>(p);
+	size_ = size;
+	::madvise(p, size_, MADV_SEQUENTIAL);
+	return true;
+}
+
+bool MappedFile::close(std::size_t final_size, std::string& error) {
+	bool ok = true;
+	if (base_) {
+		if (writable_ && ::msync(base_, size_, MS_SYNC) != 0) {
+			error = errno_text("msync");
+			ok = false;
+		}
+		::munmap(base_, size_);
+		base_ = nullptr;
+	}
+	if (fd_ >= 0) {
+		if (writable_ && final_size < size_ && ::ftruncate(fd_, (off_t)final_size) != 0) {
+			error = errno_text("ftruncate");
+			ok = false;
+		}
+		if (::close(fd_) != 0 && ok) {
+			error = errno_text("close");
+			ok = false;
+		}
+		fd_ = -1;
+	}
+	size_ = 0;
+	return ok;
+}
+
+std::size_t encrypt_mapped(const KeySchedule& ks, Mode mode, std::uint64_t iv, std::span<const std::byte> in,
+                           std::span<std::byte> out, ThreadPool* pool, const SegmentLayout& segments) {
+	if (mode == Mode::ctr) {
+		ctr_crypt(ks, iv, 0, in, out.first(in.size()), pool);
+		return in.size();
+	}
+	// whole blocks go mapping to mapping; the tail is padded in an 8-byte block of its own
+	// (followed by the tag in cbc_cmac)
+	const std::size_t full = in.size() / BLOCK_SIZE * BLOCK_SIZE;
+	std::byte tail[2 * BLOCK_SIZE];
+	std::copy(in.begin() + (std::ptrdiff_t)full, in.end(), tail);
+	pkcs7_pad(tail, in.size() - full);
+	std::size_t tail_len = BLOCK_SIZE;
+	if (mode == Mode::cbc_cmac) {
+		AuthCipher auth(ks, iv);
+		auth.encrypt_blocks(in.first(full), out.data());
+		auth.encrypt_blocks(std::span<const std::byte>(tail, BLOCK_SIZE), tail);
+		const std::uint64_t tag = auth.tag();
+		for (std::size_t i = 0; i < TAG_SIZE; ++i) tail[BLOCK_SIZE + i] = std::byte(tag >> (56 - 8 * i));
+		tail_len += TAG_SIZE;
+	} else if (mode == Mode::cbc_chunked) {
+		if (segment_count(full + BLOCK_SIZE, segments.bytes) > segments.ivs.size()) return 0;
+		std::uint64_t chain = iv;
+		cbc_encrypt_segments(ks, segments, 0, in.first(full), out, chain, pool);
+		cbc_encrypt_segments(ks, segments, full, std::span<const std::byte>(tail, BLOCK_SIZE),
+		                     std::span<std::byte>(tail, BLOCK_SIZE), chain);
+	} else {
+		const std::uint64_t chain = cbc_encrypt_blocks(ks, in.first(full), out, iv);
+		cbc_encrypt_blocks(ks, std::span<std::byte>(tail, BLOCK_SIZE), chain);
+	}
+	std::copy(tail, tail + tail_len, out.begin() + (std::ptrdiff_t)full);
+	return full + tail_len;
+}
+
+Status decrypt_mapped(const KeySchedule& ks, Mode mode, std::uint64_t iv, std::span<const std::byte> in,
+                      std::span<std::byte> out, std::size_t& len, ThreadPool* pool, const SegmentLayout& segments) {
+	len = 0;
+	if (mode == Mode::ctr) {
+		ctr_crypt(ks, iv, 0, in, out.first(in.size()), pool);
+		len = in.size();
+		return Status::ok;
+	}
+	if (mode == Mode::cbc_cmac) return decrypt_authenticated(ks, in, out, len, iv);
+	if (in.size() % BLOCK_SIZE != 0) return Status::bad_length;
+	if (mode == Mode::cbc_chunked) {
+		std::uint64_t chain = iv;
+		if (cbc_decrypt_segments(ks, segments, 0, in, out, chain, pool) != Status::ok) return Status::bad_segments;
+	} else {
+		cbc_decrypt_blocks(ks, in, out, iv, pool);
+	}
+	return pkcs7_unpad(out.first(in.size()), len);
+}
+
+} // namespace kedes
@@ -0,0 +1,62 @@
+// Memory-mapped binary path: the input is mapped read-only and the output file is created
+// at its final size and mapped read-write, so the cipher reads straight from one mapping
+// and writes straight into the other. Nothing is copied through an intermediate buffer;
+// the only staging is the 8-byte PKCS#7 tail block. The input gets sequential (and, where
+// the kernel supports it for file mappings, huge page) hints. Output space is reserved up
+// front with posix_fallocate, so a full disk is reported as an error instead of a SIGBUS
+// on a later page fault.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+#include "kedes.h"
+
+namespace kedes {
+
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// whole file, read-only; an empty file gives an empty span
+	bool open_read(const std::string& path, std::string& error);
+	// creates or truncates path, reserves size bytes and maps them read-write
+	bool create(const std::string& path, std::size_t size, std::string& error);
+	// unmaps (writable mappings are synced first) and, for a created file, shrinks it to
+	// final_size (e.g. once the padding has been stripped)
+	bool close(std::size_t final_size, std::string& error);
+
+	std::span<std::byte> data() { return {base_, size_}; }
+	std::span<const std::byte> data() const { return {base_, size_}; }
+	std::size_t size() const { return size_; }
+
+private:
+	int fd_ = -1;
+	std::byte* base_ = nullptr;
+	std::size_t size_ = 0;
+	bool writable_ = false;
+};
+
+// CBC with PKCS#7 padding (out must hold cipher_size(mode, in.size()) bytes, which
+// includes the tag of cbc_cmac) or CTR (in.size() bytes) from in to out; returns the
+// number of bytes written. cbc_chunked encrypts the segments of `segments` in parallel;
+// 0 (nothing written) when segments.ivs is too short for in.
+std::size_t encrypt_mapped(const KeySchedule& ks, Mode mode, std::uint64_t iv, std::span<const std::byte> in,
+                           std::span<std::byte> out, ThreadPool* pool = nullptr, const SegmentLayout& segments = {});
+
+// The inverse; out needs in.size() bytes. For CBC the ciphertext must be whole blocks
+// (bad_length otherwise) and len receives the unpadded length (in.size() when the
+// padding is invalid, as with decrypt()). cbc_cmac checks the tag as it decrypts, as
+// with decrypt_authenticated(). cbc_chunked returns bad_segments when segments.ivs is
+// too short for in.
+Status decrypt_mapped(const KeySchedule& ks, Mode mode, std::uint64_t iv, std::span<const std::byte> in,
+                      std::span<std::byte> out, std::size_t& len, ThreadPool* pool = nullptr,
+                      const SegmentLayout& segments = {});
+
+} // namespace kedes
@@ -0,0 +1,122 @@
+#include "kedes_multikey.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "kedes_bitslice.h"
+#include "kedes_metrics.h"
+
+namespace kedes {
+
+KeyScheduleCache::KeyScheduleCache(std::size_t capacity)
+	: capacity_(std::max<std::size_t>(capacity, 1)) {}
+
+std::shared_ptr<const KeySchedule> KeyScheduleCache::get(std::uint64_t key) {
+	{
+		std::lock_guard<std::mutex> lk(m_);
+		auto it = index_.find(key);
+		if (it != index_.end()) {
+			lru_.splice(lru_.begin(), lru_, it->second);
+			++hits_;
+			return it->second->second;
+		}
+		++misses_;
+	}
+	// expand outside the lock; a racing miss on the same key just builds it twice
+	auto ks = std::make_shared<const KeySchedule>(key);
+
+	std::lock_guard<std::mutex> lk(m_);
+	auto it = index_.find(key);
+	if (it != index_.end()) return it->second->second;
+	insert_locked(key, ks);
+	return ks;
+}
+
+void KeyScheduleCache::get_many(std::span<const std::uint64_t> keys, std::shared_ptr<const KeySchedule>* out) {
+	std::lock_guard<std::mutex> lk(m_);
+	for (std::size_t i = 0; i < keys.size(); ++i) {
+		// runs of one key (consecutive records of a tenant) need a single lookup
+		if (i > 0 && keys[i] == keys[i - 1]) {
+			out[i] = out[i - 1];
+			++hits_;
+			continue;
+		}
+		auto it = index_.find(keys[i]);
+		if (it != index_.end()) {
+			lru_.splice(lru_.begin(), lru_, it->second);
+			++hits_;
+			out[i] = it->second->second;
+			continue;
+		}
+		++misses_;
+		out[i] = std::make_shared<const KeySchedule>(keys[i]);
+		insert_locked(keys[i], out[i]);
+	}
+}
+
+void KeyScheduleCache::insert_locked(std::uint64_t key, const std::shared_ptr<const KeySchedule>& ks) {
+	lru_.emplace_front(key, ks);
+	index_[key] = lru_.begin();
+	if (lru_.size() > capacity_) {
+		index_.erase(lru_.back().first);
+		lru_.pop_back();
+	}
+}
+
+std::size_t KeyScheduleCache::size() const {
+	std::lock_guard<std::mutex> lk(m_);
+	return lru_.size();
+}
+
+std::uint64_t KeyScheduleCache::hits() const {
+	std::lock_guard<std::mutex> lk(m_);
+	return hits_;
+}
+
+std::uint64_t KeyScheduleCache::misses() const {
+	std::lock_guard<std::mutex> lk(m_);
+	return misses_;
+}
+
+void KeyScheduleCache::clear() {
+	std::lock_guard<std::mutex> lk(m_);
+	lru_.clear();
+	index_.clear();
+}
+
+static void crypt_multi(std::span<KeyedBlock> items, KeyScheduleCache& cache, bool decrypt) {
+	// one bitsliced batch of the widest kernel at a time
+	constexpr std::size_t batch = 512;
+	std::uint64_t keys[batch];
+	std::shared_ptr<const KeySchedule> held[batch];
+	std::uint64_t cd0[batch];
+	std::uint64_t blocks[batch];
+
+	for (std::size_t base = 0; base < items.size(); base += batch) {
+		const std::size_t n = std::min(batch, items.size() - base);
+		for (std::size_t i = 0; i < n; ++i) keys[i] = items[base + i].key;
+		cache.get_many(std::span<const std::uint64_t>(keys, n), held);
+		bool same = true;
+		for (std::size_t i = 0; i < n; ++i) {
+			cd0[i] = held[i]->cd0();
+			blocks[i] = items[base + i].block;
+			same = same && cd0[i] == cd0[0];
+		}
+		// blocks under one schedule go through the broadcast-key kernel
+		if (same) des_blocks_packed(blocks, n, decrypt ? held[0]->decrypt_keys() : held[0]->encrypt_keys());
+		else if (decrypt) des_blocks_multi_packed<true>(blocks, n, cd0);
+		else des_blocks_multi_packed<false>(blocks, n, cd0);
+		for (std::size_t i = 0; i < n; ++i) items[base + i].block = blocks[i];
+	}
+	count(decrypt ? Counter::blocks_decrypted : Counter::blocks_encrypted, items.size());
+}
+
+void encrypt_multi(std::span<KeyedBlock> items, KeyScheduleCache& cache) {
+	crypt_multi(items, cache, false);
+}
+
+void decrypt_multi(std::span<KeyedBlock> items, KeyScheduleCache& cache) {
+	crypt_multi(items, cache, true);
+}
+
+} // namespace kedes
@@ -0,0 +1,61 @@
+// Multi-key (multi-tenant) block API.
+// A batch of (key, block) pairs is encrypted or decrypted in one call. Schedules come from an
+// LRU cache keyed by the raw 64-bit key. The blocks run through the bitsliced kernels with
+// per-lane keys: one transpose of the transformed keys (C0D0) turns the whole key schedule
+// into slice selection, so blocks under different keys share the same SIMD registers.
+// When every schedule in a batch turns out to be the same, the broadcast-key kernel is
+// used instead. That is always the case with this cipher's odd/even transform, which
+// discards the key bits.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+
+#include "kedes.h"
+
+namespace kedes {
+
+struct KeyedBlock {
+	std::uint64_t key;
+	std::uint64_t block;        // packed big-endian block, replaced in place
+};
+
+// Thread-safe LRU cache of expanded key schedules. Entries are shared, so a schedule
+// handed out stays valid after it is evicted.
+class KeyScheduleCache {
+public:
+	explicit KeyScheduleCache(std::size_t capacity = 4096);
+
+	std::shared_ptr<const KeySchedule> get(std::uint64_t key);
+	// out[i] = get(keys[i]) under a single lock; misses are expanded while holding it
+	void get_many(std::span<const std::uint64_t> keys, std::shared_ptr<const KeySchedule>* out);
+
+	std::size_t size() const;
+	std::size_t capacity() const { return capacity_; }
+	std::uint64_t hits() const;
+	std::uint64_t misses() const;
+	void clear();
+
+private:
+	using Entry = std::pair<std::uint64_t, std::shared_ptr<const KeySchedule>>;
+
+	void insert_locked(std::uint64_t key, const std::shared_ptr<const KeySchedule>& ks);
+
+	std::size_t capacity_;
+	mutable std::mutex m_;
+	std::list<Entry> lru_;      // most recently used first
+	std::unordered_map<std::uint64_t, std::list<Entry>::iterator> index_;
+	std::uint64_t hits_ = 0;
+	std::uint64_t misses_ = 0;
+};
+
+// ECB on every pair with its own key; items are updated in place
+void encrypt_multi(std::span<KeyedBlock> items, KeyScheduleCache& cache);
+void decrypt_multi(std::span<KeyedBlock> items, KeyScheduleCache& cache);
+
+} // namespace kedes
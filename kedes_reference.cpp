@@ -0,0 +1,172 @@
+#include "kedes_reference.h"
+
+#include "kedes_block.h"
+
+using namespace std;
+
+namespace kedes {
+
+static vector<int> ull_to_bits_msb(unsigned long long v, int n) {
+	vector<int> out(n+1); // 1-based
+	for (int i = 1; i <= n; ++i) {
+		int shift = n - i;
+		out[i] = ( (v >> shift) & 1ULL ) ? 1 : 0;
+	}
+	return out;
+}
+
+static vector<int> apply_permutation(const vector<int>& in, const int* table, int tlen) {
+	vector<int> out(tlen+1);
+	for (int i = 0; i < tlen; ++i) {
+		out[i+1] = in[ table[i] ];
+	}
+	return out;
+}
+
+static void odd_even_transform(vector<int>& b) {
+	// produce C0 = 0,1,0,1,... for positions 1..28
+	// and    D0 = 1,0,1,0,... for positions 29..56
+	int n = (int)b.size()-1;
+	for (int j = 1; j <= n; ++j) {
+		if (j <= 28) {
+			// first half: odd positions = 0, even = 1 -> 0,1,0,1,...
+			b[j] = (j % 2 == 0) ? 1 : 0;
+		} else {
+			// second half: odd positions = 1, even = 0 -> 1,0,1,0,...
+			b[j] = (j % 2 == 1) ? 1 : 0;
+		}
+	}
+}
+
+static void rot_left(vector<int>& v, int shifts) {
+	// v is 1-based indexed
+	int n = (int)v.size()-1;
+	if (n == 0) return;
+	shifts %= n;
+	if (shifts == 0) return;
+	vector<int> tmp(n+1);
+	for (int i = 1; i <= n; ++i) {
+		int src = ((i + shifts - 1) % n) + 1;
+		tmp[i] = v[src];
+	}
+	v = tmp;
+}
+
+// Convert 8 bytes (MSB first) to 1-based 64-bit vector
+static vector<int> bytes_to_bits_msb(const vector<uint8_t>& bytes, int start) {
+	// start index in bytes vector (0-based); expects at least 8 bytes available
+	vector<int> bits(64+1);
+	for (int i = 0; i < 8; ++i) {
+		uint8_t b = bytes[start + i];
+		for (int bit = 0; bit < 8; ++bit) {
+			int pos = i*8 + bit; // 0..63
+			// MSB-first: bit 0 is highest bit of byte
+			bits[pos+1] = ( (b >> (7 - bit)) & 1 ) ? 1 : 0;
+		}
+	}
+	return bits;
+}
+
+static vector<uint8_t> bits64_to_bytes(const vector<int>& bits) {
+	vector<uint8_t> out(8, 0);
+	for (int i = 0; i < 8; ++i) {
+		uint8_t b = 0;
+		for (int bit = 0; bit < 8; ++bit) {
+			int pos = i*8 + bit; // 0..63
+			b = (b << 1) | (bits[pos+1] & 1);
+		}
+		out[i] = b;
+	}
+	return out;
+}
+
+// Simplified S-box substitution: maps each 6-bit value to 4-bit deterministically.
+// This keeps the implementation concise; you can replace this with standard DES S-boxes if desired.
+static void sbox_substitution(const vector<int>& in48, vector<int>& out32) {
+	// in48: 1-based 48 bits; out32 will be 1-based 32 bits
+	for (int i = 0; i < 8; ++i) {
+		int base = i*6;
+		int val = 0;
+		for (int b = 0; b < 6; ++b) val = (val << 1) | in48[base + b + 1];
+		// deterministic mapping: mix and reduce to 4 bits
+		int nibble = ((val * (i+1)) ^ (val >> 2)) & 0xF;
+		// put nibble into out32
+		for (int b = 0; b < 4; ++b) {
+			out32[i*4 + b + 1] = ( (nibble >> (3 - b)) & 1 );
+		}
+	}
+}
+
+// Feistel function f: takes 32-bit R (1-based) and 48-bit subkey (1-based), returns 32-bit vector (1-based)
+static vector<int> feistel_f(const vector<int>& R32, const vector<int>& K48) {
+	// expand R from 32->48
+	vector<int> Rexp = apply_permutation(R32, E_TABLE, 48);
+	// XOR with key
+	vector<int> tmp(48+1);
+	for (int i = 1; i <= 48; ++i) tmp[i] = Rexp[i] ^ K48[i];
+	// S-box substitution (simplified)
+	vector<int> sbout(32+1);
+	sbox_substitution(tmp, sbout);
+	// P permutation
+	vector<int> pout = apply_permutation(sbout, P_TABLE, 32);
+	return pout;
+}
+
+// DES-like encrypt single 64-bit block (1-based vector) with provided 16 round keys (each 1-based 48 bits)
+vector<int> des_encrypt_block(const vector<int>& block64, const vector<vector<int>>& roundKeys) {
+	// Apply IP
+	vector<int> ip = apply_permutation(block64, IP, 64);
+	// split L and R
+	vector<int> L(32+1), R(32+1);
+	for (int i = 1; i <= 32; ++i) { L[i] = ip[i]; R[i] = ip[32 + i]; }
+
+	// 16 rounds
+	for (int r = 0; r < 16; ++r) {
+		vector<int> f = feistel_f(R, roundKeys[r]);
+		vector<int> newR(32+1);
+		for (int i = 1; i <= 32; ++i) newR[i] = L[i] ^ f[i];
+		L = R;
+		R = newR;
+	}
+
+	// preoutput is R||L (swap)
+	vector<int> preout(64+1);
+	for (int i = 1; i <= 32; ++i) {
+		preout[i] = R[i];
+		preout[32 + i] = L[i];
+	}
+	// apply IP_INV
+	vector<int> out = apply_permutation(preout, IP_INV, 64);
+	return out;
+}
+
+vector<vector<int>> reference_round_keys(uint64_t key) {
+	vector<int> key64 = ull_to_bits_msb(key, 64);
+	vector<int> key56 = apply_permutation(key64, PC1, 56);
+	odd_even_transform(key56);
+	vector<int> C(29), D(29); // 1-based sizes 28
+	for (int i = 1; i <= 28; ++i) {
+		C[i] = key56[i];
+		D[i] = key56[28 + i];
+	}
+
+	vector<vector<int>> roundKeysBits;
+	for (int round = 0; round < 16; ++round) {
+		rot_left(C, SHIFTS[round]);
+		rot_left(D, SHIFTS[round]);
+		vector<int> CD(57);
+		for (int i = 1; i <= 28; ++i) CD[i] = C[i];
+		for (int i = 1; i <= 28; ++i) CD[28 + i] = D[i];
+		roundKeysBits.push_back(apply_permutation(CD, PC2, 48));
+	}
+	return roundKeysBits;
+}
+
+uint64_t reference_block(uint64_t block, const vector<vector<int>>& roundKeys) {
+	vector<uint8_t> bytes(8);
+	store_be64(block, bytes.data());
+	vector<uint8_t> out = bits64_to_bytes(des_encrypt_block(bytes_to_bits_msb(bytes, 0), roundKeys));
+	return load_be64(out.data());
+}
+
+} // namespace kedes
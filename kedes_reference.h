@@ -0,0 +1,21 @@
+// Original bit-per-element (vector<int>) implementation of the KE-DES key schedule and
+// block function. It is slow and allocates on every step; it is kept as the reference
+// the packed and bitsliced engines are checked against.
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace kedes {
+
+// K1..K16 as 1-based 48-bit vectors (same steps as the original main())
+std::vector<std::vector<int>> reference_round_keys(std::uint64_t key);
+
+// DES-like encrypt single 64-bit block (1-based vector) with provided 16 round keys (each 1-based 48 bits)
+std::vector<int> des_encrypt_block(const std::vector<int>& block64, const std::vector<std::vector<int>>& roundKeys);
+
+// Packed convenience wrapper: runs des_encrypt_block on a 64-bit block (reverse the
+// round keys to decrypt)
+std::uint64_t reference_block(std::uint64_t block, const std::vector<std::vector<int>>& roundKeys);
+
+} // namespace kedes
@@ -0,0 +1,188 @@
+#include "kedes_sector.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+
+#include "kedes_block.h"
+#include "kedes_metrics.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
+
+namespace kedes {
+
+// multiplication by x in GF(2^64), as for the CMAC subkeys
+static std::uint64_t gf_double(std::uint64_t v) {
+	return (v << 1) ^ ((v >> 63) ? 0x1B : 0);
+}
+
+SectorCipher::SectorCipher(const KeySchedule& ks, std::size_t sector_bytes)
+	: ks_(ks),
+	  sector_bytes_(std::max(BLOCK_SIZE, sector_bytes / BLOCK_SIZE * BLOCK_SIZE)) {}
+
+// XEX over nsectors whole sectors at data, sector numbers from first. Blocks go through the
+// block kernels a window at a time; the tweaks of the sectors starting in a window are
+// encrypted as one batch too.
+static void xex_range(const KeySchedule& ks, std::size_t sector_bytes, std::uint64_t first, uint8_t* data,
+                      std::size_t nsectors, bool decrypt) {
+	constexpr std::size_t batch_blocks = 4096;
+	uint64_t batch[batch_blocks];
+	uint64_t masks[batch_blocks];
+	uint64_t starts[batch_blocks];
+	const std::size_t per_sector = sector_bytes / BLOCK_SIZE;
+	const std::size_t total = nsectors * per_sector;
+
+	uint64_t t = 0;
+	for (std::size_t done = 0; done < total;) {
+		const std::size_t count = std::min(batch_blocks, total - done);
+		// sectors whose first block lies in [done, done + count)
+		const std::size_t first_start = (done + per_sector - 1) / per_sector;
+		std::size_t nstarts = 0;
+		for (std::size_t s = first_start; s * per_sector < done + count; ++s) starts[nstarts++] = first + s;
+		ks.encrypt_blocks(starts, nstarts);
+
+		for (std::size_t i = 0; i < count; ++i) {
+			const std::size_t b = done + i;
+			if (b % per_sector == 0) t = starts[b / per_sector - first_start];
+			// block j is masked with E_K(s) * x^(j+1): never E_K(s) itself
+			t = gf_double(t);
+			masks[i] = t;
+			batch[i] = load_be64(data + b * BLOCK_SIZE) ^ t;
+		}
+		if (decrypt) ks.decrypt_blocks(batch, count);
+		else ks.encrypt_blocks(batch, count);
+		for (std::size_t i = 0; i < count; ++i) store_be64(batch[i] ^ masks[i], data + (done + i) * BLOCK_SIZE);
+		done += count;
+	}
+}
+
+void SectorCipher::crypt(std::uint64_t first, std::span<std::byte> data, bool decrypt, ThreadPool* pool) const {
+	StageTimer timer(Stage::cipher);
+	const std::size_t nsectors = data.size() / sector_bytes_;
+	count(decrypt ? Counter::blocks_decrypted : Counter::blocks_encrypted, nsectors * (sector_bytes_ / BLOCK_SIZE));
+	auto* p = reinterpret_cast<uint8_t*>(data.data());
+	// sectors are independent: runs of about CHUNK_BYTES go out as one task each
+	const std::size_t per_task = std::max<std::size_t>(1, CHUNK_BYTES / sector_bytes_);
+	const std::size_t tasks = (nsectors + per_task - 1) / per_task;
+	auto task = [&](std::size_t k) {
+		const std::size_t s = k * per_task;
+		xex_range(ks_, sector_bytes_, first + s, p + s * sector_bytes_, std::min(per_task, nsectors - s), decrypt);
+	};
+	if (pool == nullptr || tasks < 2) {
+		for (std::size_t k = 0; k < tasks; ++k) task(k);
+	} else {
+		pool->parallel_for(tasks, task);
+	}
+}
+
+void SectorCipher::encrypt(std::uint64_t first, std::span<std::byte> data, ThreadPool* pool) const {
+	crypt(first, data, false, pool);
+}
+
+void SectorCipher::decrypt(std::uint64_t first, std::span<std::byte> data, ThreadPool* pool) const {
+	crypt(first, data, true, pool);
+}
+
+// whole-buffer pread/pwrite, retried on short transfers; pread stops early at end of file
+static bool read_at(int fd, std::byte* buf, std::size_t len, std::uint64_t offset, std::size_t& got,
+                    std::string& error) {
+	StageTimer timer(Stage::read);
+	got = 0;
+	while (got < len) {
+		const ssize_t n = ::pread(fd, buf + got, len - got, (off_t)(offset + got));
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			error = errno_text("read");
+			return false;
+		}
+		if (n == 0) break;
+		got += (std::size_t)n;
+	}
+	count(Counter::bytes_in, got);
+	return true;
+}
+
+static bool write_at(int fd, const std::byte* buf, std::size_t len, std::uint64_t offset, std::string& error) {
+	StageTimer timer(Stage::write);
+	for (std::size_t done = 0; done < len;) {
+		const ssize_t n = ::pwrite(fd, buf + done, len - done, (off_t)(offset + done));
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			error = errno_text("write");
+			return false;
+		}
+		done += (std::size_t)n;
+	}
+	count(Counter::bytes_out, len);
+	return true;
+}
+
+static std::size_t batch_sectors(const SectorCipher& cipher) {
+	return std::max<std::size_t>(1, IMAGE_BATCH_BYTES / cipher.sector_bytes());
+}
+
+bool crypt_image_sectors(int fd, const SectorCipher& cipher, bool decrypt, std::uint64_t first, std::uint64_t count,
+                         ThreadPool* pool, std::uint64_t& sectors, std::string& error) {
+	sectors = 0;
+	const off_t end = ::lseek(fd, 0, SEEK_END);
+	if (end < 0) {
+		error = errno_text("seek");
+		return false;
+	}
+	const std::size_t sb = cipher.sector_bytes();
+	const std::uint64_t image_sectors = (std::uint64_t)end / sb;
+	if (first >= image_sectors) return true;
+	count = std::min(count, image_sectors - first);
+
+	std::vector<std::byte> buf(std::min<std::uint64_t>(count, batch_sectors(cipher)) * sb);
+	while (sectors < count) {
+		const std::size_t n = (std::size_t)std::min<std::uint64_t>(count - sectors, buf.size() / sb);
+		const std::uint64_t offset = (first + sectors) * sb;
+		std::size_t got;
+		if (!read_at(fd, buf.data(), n * sb, offset, got, error)) return false;
+		if (got < n * sb) {
+			error = "image shrank while it was being processed";
+			return false;
+		}
+		const std::span<std::byte> data(buf.data(), n * sb);
+		if (decrypt) cipher.decrypt(first + sectors, data, pool);
+		else cipher.encrypt(first + sectors, data, pool);
+		if (!write_at(fd, buf.data(), n * sb, offset, error)) return false;
+		sectors += n;
+	}
+	return true;
+}
+
+bool read_sectors(int fd, const SectorCipher& cipher, std::uint64_t first, std::span<std::byte> out,
+                  ThreadPool* pool, std::string& error) {
+	const std::size_t sb = cipher.sector_bytes();
+	const std::size_t len = out.size() / sb * sb;
+	std::size_t got;
+	if (!read_at(fd, out.data(), len, first * sb, got, error)) return false;
+	if (got < len) {
+		error = "sector range runs past the end of the image";
+		return false;
+	}
+	cipher.decrypt(first, out.first(len), pool);
+	return true;
+}
+
+bool write_sectors(int fd, const SectorCipher& cipher, std::uint64_t first, std::span<const std::byte> plain,
+                   ThreadPool* pool, std::string& error) {
+	const std::size_t sb = cipher.sector_bytes();
+	const std::size_t nsectors = plain.size() / sb;
+	std::vector<std::byte> buf(std::min(nsectors, batch_sectors(cipher)) * sb);
+	for (std::size_t done = 0; done < nsectors;) {
+		const std::size_t n = std::min(nsectors - done, buf.size() / sb);
+		std::copy_n(plain.begin() + (std::ptrdiff_t)(done * sb), n * sb, buf.begin());
+		cipher.encrypt(first + done, std::span<std::byte>(buf.data(), n * sb), pool);
+		if (!write_at(fd, buf.data(), n * sb, (first + done) * sb, error)) return false;
+		done += n;
+	}
+	return true;
+}
+
+} // namespace kedes
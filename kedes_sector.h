@@ -0,0 +1,69 @@
+// Sector-addressed mode for disk and VM images: every sector of a fixed size is encrypted
+// on its own under a tweak derived from its sector number, so any sector can be read or
+// rewritten without touching the rest of the image and ciphertext stays the size of the
+// plaintext. The construction is single-key XEX over the block function: block j of
+// sector s is C = E_K(P ^ T_j) ^ T_j with T_j = E_K(s) * x^(j+1) in GF(2^64) (reduction
+// 0x1B). The masks start at x, never 1, which is what lets the tweak and the data share
+// one key; a separate tweak key as in XTS is not available, since the odd/even transform
+// gives every key the same schedule. Sector sizes are whole blocks, so no ciphertext
+// stealing is needed. Blocks within a sector are independent, so sectors go through the
+// bitsliced kernels in batches and sector ranges spread over a pool.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+#include "kedes.h"
+
+namespace kedes {
+
+class SectorCipher {
+public:
+	// sector_bytes should pass valid_sector_size(); others are rounded down to whole blocks.
+	// ks must outlive the SectorCipher.
+	SectorCipher(const KeySchedule& ks, std::size_t sector_bytes = 512);
+
+	// a nonzero multiple of BLOCK_SIZE (512 and 4096 are the usual ones)
+	static bool valid_sector_size(std::size_t sector_bytes) {
+		return sector_bytes != 0 && sector_bytes % BLOCK_SIZE == 0;
+	}
+
+	std::size_t sector_bytes() const { return sector_bytes_; }
+
+	// sectors first, first + 1, ... stored back to back in data, in place; a trailing
+	// partial sector is left untouched. With a pool, runs of sectors go in parallel.
+	void encrypt(std::uint64_t first, std::span<std::byte> data, ThreadPool* pool = nullptr) const;
+	void decrypt(std::uint64_t first, std::span<std::byte> data, ThreadPool* pool = nullptr) const;
+
+private:
+	void crypt(std::uint64_t first, std::span<std::byte> data, bool decrypt, ThreadPool* pool) const;
+
+	const KeySchedule& ks_;
+	std::size_t sector_bytes_;
+};
+
+// Bytes the image functions below read, transform and write per batch
+constexpr std::size_t IMAGE_BATCH_BYTES = 4 << 20;
+
+// Image files, addressed in sectors. Each call reads, transforms and writes a bounded batch
+// at a time with pread/pwrite, so only the sectors named are touched and memory stays flat
+// regardless of the range. All return false with error set on an I/O failure.
+
+// Encrypts (or decrypts) sectors [first, first + count) of the image in place; the range is
+// clamped to the image's whole sectors and sectors receives the number processed
+bool crypt_image_sectors(int fd, const SectorCipher& cipher, bool decrypt, std::uint64_t first, std::uint64_t count,
+                         ThreadPool* pool, std::uint64_t& sectors, std::string& error);
+
+// Decrypts out.size() / sector_bytes sectors starting at first into out; false when they
+// are not all inside the image
+bool read_sectors(int fd, const SectorCipher& cipher, std::uint64_t first, std::span<std::byte> out,
+                  ThreadPool* pool, std::string& error);
+
+// Encrypts plain (whole sectors) into the image starting at sector first, extending the
+// file when the range runs past its end
+bool write_sectors(int fd, const SectorCipher& cipher, std::uint64_t first, std::span<const std::byte> plain,
+                   ThreadPool* pool, std::string& error);
+
+} // namespace kedes
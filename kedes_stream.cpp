@@ -0,0 +1,304 @@
+#include "kedes_stream.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "kedes_block.h"
+#include "kedes_hex.h"
+#include "kedes_metrics.h"
+
+namespace kedes {
+
+namespace {
+
+struct Chunk {
+	std::vector<std::byte> data;   // chunk_bytes plus room for a padding block and tag
+	std::size_t len = 0;
+	bool last = false;
+};
+
+// blocking hand-off between two pipeline stages
+class ChunkQueue {
+public:
+	void push(Chunk* c) {
+		{
+			std::lock_guard<std::mutex> lk(m_);
+			q_.push_back(c);
+		}
+		cv_.notify_one();
+	}
+
+	Chunk* pop() {
+		std::unique_lock<std::mutex> lk(m_);
+		cv_.wait(lk, [this] { return !q_.empty(); });
+		Chunk* c = q_.front();
+		q_.pop_front();
+		return c;
+	}
+
+private:
+	std::mutex m_;
+	std::condition_variable cv_;
+	std::deque<Chunk*> q_;
+};
+
+using Transform = std::function<void(Chunk&)>;
+
+// reader thread -> transform on the calling thread -> writer thread. A final chunk
+// shorter than min_last (at most chunk_bytes) is appended to the one before it.
+void run_pipeline(const Source& in, const Sink& out, std::size_t chunk_bytes, std::size_t min_last,
+                  const Transform& transform, StreamStats& stats) {
+	// the reader holds a chunk plus one lookahead (to know which chunk is the last), the
+	// cipher stage one, and the writer one with one more queued in front of it
+	constexpr int NBUF = 5;
+	std::vector<Chunk> bufs(NBUF);
+	ChunkQueue free_q, filled_q, ready_q;
+	for (auto& b : bufs) {
+		b.data.resize(chunk_bytes + BLOCK_SIZE + TAG_SIZE);
+		free_q.push(&b);
+	}
+
+	auto fill = [&](Chunk* c) {
+		c->len = 0;
+		StageTimer timer(Stage::read);
+		while (c->len < chunk_bytes) {
+			std::size_t n = in(std::span<std::byte>(c->data).subspan(c->len, chunk_bytes - c->len));
+			if (n == 0) break;
+			c->len += n;
+		}
+	};
+
+	std::thread reader([&] {
+		Chunk* cur = free_q.pop();
+		fill(cur);
+		for (;;) {
+			// a short chunk means the source hit end of input
+			if (cur->len < chunk_bytes) break;
+			Chunk* next = free_q.pop();
+			fill(next);
+			if (next->len == 0) {
+				free_q.push(next);
+				break;
+			}
+			if (next->len < min_last) {
+				std::copy_n(next->data.begin(), next->len, cur->data.begin() + (std::ptrdiff_t)cur->len);
+				cur->len += next->len;
+				free_q.push(next);
+				break;
+			}
+			cur->last = false;
+			filled_q.push(cur);
+			cur = next;
+		}
+		cur->last = true;
+		filled_q.push(cur);
+	});
+
+	std::thread writer([&] {
+		for (;;) {
+			Chunk* c = ready_q.pop();
+			const bool last = c->last;
+			// keep draining after an error so the other stages never block
+			if (!stats.write_error) {
+				StageTimer timer(Stage::write);
+				if (!out(std::span<const std::byte>(c->data.data(), c->len), last)) stats.write_error = true;
+			}
+			stats.bytes_out += c->len;
+			count(Counter::bytes_out, c->len);
+			free_q.push(c);
+			if (last) return;
+		}
+	});
+
+	for (;;) {
+		Chunk* c;
+		{
+			StageTimer timer(Stage::io_wait);
+			c = filled_q.pop();
+		}
+		const bool last = c->last;
+		stats.bytes_in += c->len;
+		count(Counter::bytes_in, c->len);
+		transform(*c);
+		ready_q.push(c);
+		if (last) break;
+	}
+	reader.join();
+	writer.join();
+}
+
+} // namespace
+
+std::size_t ChunkCipher::update(std::span<std::byte> buf, std::size_t len, bool last) {
+	if (auth_) return update_auth(buf, len, last);
+	if (opt_.mode == Mode::ctr) {
+		std::span<std::byte> data = buf.first(len);
+		ctr_crypt(ks_, opt_.iv, offset_, data, data, opt_.pool);
+		offset_ += len;
+		return len;
+	}
+	const bool chunked = opt_.mode == Mode::cbc_chunked;
+	// a segment index too short for the data ends the output where it ran out
+	if (status_ == Status::bad_segments) return 0;
+	if (!decrypt_) {
+		if (last) len = pkcs7_pad(buf, len);
+		std::span<std::byte> data = buf.first(len);
+		if (!chunked) chain_ = cbc_encrypt_blocks(ks_, data, chain_);
+		else if ((status_ = cbc_encrypt_segments(ks_, opt_.segments, offset_, data, data, chain_, opt_.pool)) != Status::ok)
+			return 0;
+		offset_ += len;
+		return len;
+	}
+	if (last) {
+		// truncate to the nearest lower multiple of 8
+		std::size_t keep = len / BLOCK_SIZE * BLOCK_SIZE;
+		truncated_ = len - keep;
+		len = keep;
+	}
+	std::span<std::byte> data = buf.first(len);
+	if (!chunked) chain_ = cbc_decrypt_blocks(ks_, data, chain_, opt_.pool);
+	else if ((status_ = cbc_decrypt_segments(ks_, opt_.segments, offset_, data, data, chain_, opt_.pool)) != Status::ok)
+		return 0;
+	offset_ += len;
+	if (last) status_ = pkcs7_unpad(data, len);
+	return len;
+}
+
+// cbc_cmac: the MAC chain runs next to the CBC chain, and the tag follows the padded
+// final chunk
+std::size_t ChunkCipher::update_auth(std::span<std::byte> buf, std::size_t len, bool last) {
+	auto tag_at = [&] { return reinterpret_cast<uint8_t*>(buf.data() + len); };
+	if (!decrypt_) {
+		if (last) len = pkcs7_pad(buf, len);
+		auth_->encrypt_blocks(buf.first(len), buf.data());
+		if (last) {
+			store_be64(auth_->tag(), tag_at());
+			len += TAG_SIZE;
+		}
+		return len;
+	}
+	std::uint64_t tag = 0;
+	if (last) {
+		std::size_t keep = len / BLOCK_SIZE * BLOCK_SIZE;
+		truncated_ = len - keep;
+		len = keep;
+		if (len < BLOCK_SIZE + TAG_SIZE) {
+			count(Counter::tag_errors);
+			status_ = Status::bad_tag;
+			return 0;
+		}
+		len -= TAG_SIZE;
+		tag = load_be64(tag_at());
+	}
+	auth_->decrypt_blocks(buf.first(len), buf.data());
+	if (last) {
+		if (auth_->tag() != tag) {
+			count(Counter::tag_errors);
+			status_ = Status::bad_tag;
+			return 0;
+		}
+		status_ = pkcs7_unpad(buf.first(len), len);
+	}
+	return len;
+}
+
+// the chunk size of a pipeline: whole blocks, and room for the shortest last chunk
+static std::size_t pipeline_chunk_bytes(const StreamOptions& opt, const ChunkCipher& cipher) {
+	return std::max({BLOCK_SIZE, cipher.min_last_chunk(), opt.chunk_bytes / BLOCK_SIZE * BLOCK_SIZE});
+}
+
+StreamStats stream_encrypt(const Source& in, const Sink& out, const KeySchedule& ks, const StreamOptions& opt) {
+	StreamStats stats;
+	ChunkCipher cipher(ks, opt, false);
+	run_pipeline(in, out, pipeline_chunk_bytes(opt, cipher), cipher.min_last_chunk(),
+	             [&](Chunk& c) { c.len = cipher.update(c.data, c.len, c.last); }, stats);
+	stats.status = cipher.status();
+	return stats;
+}
+
+StreamStats stream_decrypt(const Source& in, const Sink& out, const KeySchedule& ks, const StreamOptions& opt) {
+	StreamStats stats;
+	ChunkCipher cipher(ks, opt, true);
+	run_pipeline(in, out, pipeline_chunk_bytes(opt, cipher), cipher.min_last_chunk(),
+	             [&](Chunk& c) { c.len = cipher.update(c.data, c.len, c.last); }, stats);
+	stats.status = cipher.status();
+	stats.truncated = cipher.truncated();
+	return stats;
+}
+
+Source istream_source(std::istream& in) {
+	return [&in](std::span<std::byte> buf) -> std::size_t {
+		in.read(reinterpret_cast<char*>(buf.data()), (std::streamsize)buf.size());
+		return (std::size_t)in.gcount();
+	};
+}
+
+Sink ostream_sink(std::ostream& out) {
+	return [&out](std::span<const std::byte> data, bool) {
+		out.write(reinterpret_cast<const char*>(data.data()), (std::streamsize)data.size());
+		return (bool)out;
+	};
+}
+
+Source hex_source(std::istream& in, bool* odd_digit) {
+	struct State {
+		std::istream& in;
+		bool* odd_digit;
+		std::vector<char> digits = std::vector<char>(64 * 1024);
+		std::size_t pos = 0, len = 0;   // unconsumed digits
+	};
+	auto st = std::make_shared<State>(State{in, odd_digit});
+	if (odd_digit) *odd_digit = false;
+
+	return [st](std::span<std::byte> buf) -> std::size_t {
+		std::size_t n = 0;
+		while (n < buf.size()) {
+			if (st->len - st->pos < 2) {
+				// carry an unpaired digit over to the next read
+				std::size_t keep = st->len - st->pos;
+				if (keep) st->digits[0] = st->digits[st->pos];
+				char* text = st->digits.data() + keep;
+				st->in.read(text, (std::streamsize)(st->digits.size() - keep));
+				std::size_t got = (std::size_t)st->in.gcount();
+				st->pos = 0;
+				st->len = keep + hex_compact(std::span<const char>(text, got), text);
+				if (got == 0) {
+					if (st->odd_digit) *st->odd_digit = keep != 0;
+					break;
+				}
+				continue;
+			}
+			std::size_t pairs = std::min((st->len - st->pos) / 2, buf.size() - n);
+			hex_decode_digits(st->digits.data() + st->pos, pairs, buf.data() + n);
+			st->pos += 2 * pairs;
+			n += pairs;
+		}
+		return n;
+	};
+}
+
+Sink hex_sink(std::ostream& out) {
+	struct State {
+		std::ostream& out;
+		std::size_t column = 0;   // bytes written on the current line
+		std::vector<char> text{};
+	};
+	auto st = std::make_shared<State>(State{out});
+
+	return [st](std::span<const std::byte> data, bool last) {
+		st->text.resize(hex_encoded_size(data.size(), st->column) + 1);
+		std::size_t len = hex_encode_lines(data, st->column, st->text.data());
+		if (last) st->text[len++] = '\n';
+		st->out.write(st->text.data(), (std::streamsize)len);
+		return (bool)st->out;
+	};
+}
+
+} // namespace kedes
@@ -0,0 +1,98 @@
+// Constant-memory streaming encrypt/decrypt.
+// A reader thread fills fixed-size chunks from a Source, the calling thread runs the
+// cipher over them and a writer thread drains them into a Sink. A handful of chunk
+// buffers circulate between the three stages (double buffering on both sides), so memory
+// use stays at a few chunks regardless of the input size. Padding is added or removed
+// on the final chunk only. In Mode::cbc_cmac the tag is appended to, or checked against
+// the end of, the final chunk; decryption reports Status::bad_tag only once the whole
+// input has gone through, so output written before then is unverified.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <optional>
+#include <span>
+
+#include "kedes.h"
+
+namespace kedes {
+
+// Fills buf with up to buf.size() bytes; returns the count, 0 at end of input
+using Source = std::function<std::size_t(std::span<std::byte> buf)>;
+// Consumes data; last is set on the final call. Returns false on a write error.
+using Sink = std::function<bool(std::span<const std::byte> data, bool last)>;
+
+struct StreamOptions {
+	Mode mode = Mode::cbc;
+	std::uint64_t iv = 0;                // CBC IV or CTR nonce
+	std::size_t chunk_bytes = 1 << 20;   // rounded down to a multiple of BLOCK_SIZE
+	ThreadPool* pool = nullptr;          // parallel CBC decryption / CTR / segments within a chunk
+	SegmentLayout segments;              // cbc_chunked; the IVs must outlive the stream, and
+	                                     // running out of them ends it with bad_segments
+};
+
+struct StreamStats {
+	Status status = Status::ok;
+	std::uint64_t bytes_in = 0;
+	std::uint64_t bytes_out = 0;
+	std::uint64_t truncated = 0;         // trailing bytes dropped from a CBC ciphertext
+	bool write_error = false;
+	bool read_error = false;             // file pipeline only; sources cannot report errors
+};
+
+// Chunk-at-a-time cipher state (CBC chain and offset, CTR offset or AuthCipher) shared by the stream
+// and file pipelines. update() transforms buf[0..len) in place and returns the output
+// length of the chunk; buf needs BLOCK_SIZE + TAG_SIZE bytes of room past len for the
+// padding block and tag of the last chunk. Chunks must be multiples of BLOCK_SIZE except
+// the last.
+class ChunkCipher {
+public:
+	ChunkCipher(const KeySchedule& ks, const StreamOptions& opt, bool decrypt)
+		: ks_(ks), opt_(opt), decrypt_(decrypt), chain_(opt.iv) {
+		if (opt.mode == Mode::cbc_cmac) auth_.emplace(ks, opt.iv);
+	}
+
+	std::size_t update(std::span<std::byte> buf, std::size_t len, bool last);
+
+	// A last chunk shorter than this cannot be processed on its own (CBC decryption
+	// unpads the final whole block, and cbc_cmac also needs the tag next to it); the
+	// pipelines append such a tail to the chunk before it, so the last chunk may run this
+	// many bytes over the chunk size.
+	std::size_t min_last_chunk() const {
+		if (!decrypt_ || opt_.mode == Mode::ctr) return 0;
+		return auth_ ? BLOCK_SIZE + TAG_SIZE : BLOCK_SIZE;
+	}
+
+	Status status() const { return status_; }
+	std::uint64_t truncated() const { return truncated_; }
+
+private:
+	std::size_t update_auth(std::span<std::byte> buf, std::size_t len, bool last);
+
+	const KeySchedule& ks_;
+	StreamOptions opt_;
+	bool decrypt_;
+	std::uint64_t chain_;
+	std::uint64_t offset_ = 0;
+	std::optional<AuthCipher> auth_;
+	Status status_ = Status::ok;
+	std::uint64_t truncated_ = 0;
+};
+
+StreamStats stream_encrypt(const Source& in, const Sink& out, const KeySchedule& ks, const StreamOptions& opt);
+StreamStats stream_decrypt(const Source& in, const Sink& out, const KeySchedule& ks, const StreamOptions& opt);
+
+// raw binary adapters over iostreams
+Source istream_source(std::istream& in);
+Sink ostream_sink(std::ostream& out);
+
+// Hex text adapters in the ciphertext.txt layout: the source keeps only hex digits (so
+// whitespace, "0x" and labels are skipped as before) and pairs them across chunk
+// boundaries; an unpaired final digit is reported through odd_digit. The sink writes
+// uppercase pairs, 16 bytes per line, plus the final newline.
+Source hex_source(std::istream& in, bool* odd_digit);
+Sink hex_sink(std::ostream& out);
+
+} // namespace kedes
@@ -0,0 +1,649 @@
+// kedes_test: library tests, run by ctest. Every mode is taken through each I/O path the
+// frontends use and compared with the whole-buffer result; the remaining cases cover the
+// modules beside the modes.
+// The in-place entry points are checked to make no heap allocation, with the global
+// operator new replaced by a counting one.
+//
+// usage: kedes_test [NAME]   runs the cases whose name contains NAME (default: all)
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "kedes.h"
+#include "kedes_aio.h"
+#include "kedes_batch.h"
+#include "kedes_container.h"
+#include "kedes_daemon.h"
+#include "kedes_dispatch.h"
+#include "kedes_hex.h"
+#include "kedes_mmap.h"
+#include "kedes_multikey.h"
+#include "kedes_sector.h"
+#include "kedes_stream.h"
+#include "kedes_thread_pool.h"
+#include "kedes_util.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static atomic<uint64_t> heap_allocs{0};
+
+void* operator new(size_t n) {
+	heap_allocs.fetch_add(1, memory_order_relaxed);
+	if (void* p = malloc(n ? n : 1)) return p;
+	throw bad_alloc();
+}
+
+// out of line, or GCC sees free() paired with operator new (-Wmismatched-new-delete)
+[[gnu::noinline]] void operator delete(void* p) noexcept { free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept { free(p); }
+
+static int failures = 0;
+static string current;   // case and parameters, for failure messages
+
+#define CHECK(cond)                                                                                       \
+	do {                                                                                                  \
+		if (!(cond)) {                                                                                    \
+			++failures;                                                                                   \
+			fprintf(stderr, "%s:%d: [%s] CHECK(%s) failed\n", __FILE__, __LINE__, current.c_str(), #cond); \
+		}                                                                                                 \
+	} while (0)
+
+static constexpr uint64_t KEY = 0x133457799BBCDFF1ULL;
+static constexpr uint64_t IV = 0x0123456789ABCDEFULL;
+static constexpr size_t SEGMENT = 4096;
+// empty, partial, exact and multi-block inputs, and one past CHUNK_BYTES so the parallel
+// CBC decrypt and CTR split it
+static const size_t SIZES[] = {0, 1, 7, 8, 9, 4095, 4096, 20001, 2 * kedes::CHUNK_BYTES + 13};
+static const kedes::Mode MODES[] = {kedes::Mode::cbc, kedes::Mode::ctr, kedes::Mode::cbc_cmac,
+                                    kedes::Mode::cbc_chunked};
+
+static const char* mode_name(kedes::Mode m) {
+	switch (m) {
+	case kedes::Mode::cbc: return "cbc";
+	case kedes::Mode::ctr: return "ctr";
+	case kedes::Mode::cbc_cmac: return "cbc-cmac";
+	case kedes::Mode::cbc_chunked: return "cbc-chunked";
+	}
+	return "?";
+}
+
+static vector<byte> random_bytes(size_t n, uint64_t seed) {
+	mt19937_64 rng(seed);
+	vector<byte> v(n);
+	for (byte& b : v) b = byte(rng() >> 56);
+	return v;
+}
+
+// per-segment IVs for a cbc-chunked ciphertext of cipher_len bytes
+static vector<uint64_t> segment_ivs(const kedes::KeySchedule& ks, size_t cipher_len) {
+	vector<uint64_t> ivs(kedes::segment_count(cipher_len, SEGMENT));
+	kedes::derive_segment_ivs(ks, IV, ivs);
+	return ivs;
+}
+
+// the whole-buffer library calls, the reference every other path is compared with
+static vector<byte> encrypt_whole(const kedes::KeySchedule& ks, kedes::Mode mode, const vector<byte>& plain,
+                                  kedes::ThreadPool* pool) {
+	vector<byte> c = plain;
+	c.resize(kedes::cipher_size(mode, plain.size()));
+	switch (mode) {
+	case kedes::Mode::cbc: return kedes::encrypt(ks, plain, IV);
+	case kedes::Mode::ctr: return kedes::ctr_crypt(ks, IV, plain, pool);
+	case kedes::Mode::cbc_cmac: c.resize(kedes::encrypt_authenticated(ks, c, plain.size(), IV)); return c;
+	case kedes::Mode::cbc_chunked: {
+		c.resize(kedes::pkcs7_pad(c, plain.size()));
+		const vector<uint64_t> ivs = segment_ivs(ks, c.size());
+		if (uint64_t chain = IV; kedes::cbc_encrypt_segments(ks, {SEGMENT, ivs}, 0, c, c, chain, pool) != kedes::Status::ok)
+			return {};
+		return c;
+	}
+	}
+	return {};
+}
+
+static kedes::Status decrypt_whole(const kedes::KeySchedule& ks, kedes::Mode mode, const vector<byte>& cipher,
+                                   kedes::ThreadPool* pool, vector<byte>& plain) {
+	plain = cipher;
+	size_t len = plain.size();
+	kedes::Status s = kedes::Status::ok;
+	switch (mode) {
+	case kedes::Mode::cbc: return kedes::decrypt(ks, cipher, plain, IV, pool);
+	case kedes::Mode::ctr: kedes::ctr_crypt(ks, IV, 0, plain, plain, pool); return s;
+	case kedes::Mode::cbc_cmac: s = kedes::decrypt_authenticated(ks, plain, len, IV); break;
+	case kedes::Mode::cbc_chunked: {
+		const vector<uint64_t> ivs = segment_ivs(ks, cipher.size());
+		if (uint64_t chain = IV; (s = kedes::cbc_decrypt_segments(ks, {SEGMENT, ivs}, 0, plain, plain, chain, pool)) == kedes::Status::ok)
+			s = kedes::pkcs7_unpad(plain, len);
+		break;
+	}
+	}
+	plain.resize(len);
+	return s;
+}
+
+struct TempDir {
+	fs::path path;
+	TempDir() {
+		path = fs::temp_directory_path() / ("kedes_test." + to_string(getpid()));
+		fs::remove_all(path);
+		fs::create_directories(path);
+	}
+	~TempDir() {
+		error_code ec;
+		fs::remove_all(path, ec);
+	}
+	string operator/(const string& name) const { return (path / name).string(); }
+};
+
+static void write_file(const string& path, const vector<byte>& data) {
+	ofstream out(path, ios::binary);
+	out.write(reinterpret_cast<const char*>(data.data()), (streamsize)data.size());
+}
+
+static vector<byte> read_file(const string& path) {
+	ifstream in(path, ios::binary);
+	string s((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	vector<byte> v(s.size());
+	memcpy(v.data(), s.data(), s.size());
+	return v;
+}
+
+static void test_known_answer() {
+	// first block of the shipped ciphertext.txt (CBC, zero IV, "ABCDEFGH")
+	const kedes::KeySchedule ks(KEY);
+	CHECK(ks.encrypt_block(0x4142434445464748ULL) == 0x7FB2BFBD6F12DF6FULL);
+	CHECK(ks.decrypt_block(0x7FB2BFBD6F12DF6FULL) == 0x4142434445464748ULL);
+}
+
+static void test_in_place_allocations() {
+	const kedes::KeySchedule ks(KEY);
+	const kedes::TripleKeySchedule ede(KEY, KEY ^ 0x0101010101010101ULL, ~KEY);
+	vector<byte> buf(64 * 1024 + kedes::BLOCK_SIZE);
+	size_t len = 0;
+	// warm-up: first-use setup (kernel selection and the like) is not the hot path
+	kedes::decrypt_in_place(ks, span<byte>(buf.data(), kedes::encrypt_in_place(ks, buf, 100, IV)), len, IV);
+	kedes::decrypt_in_place(ede, span<byte>(buf.data(), kedes::encrypt_in_place(ede, buf, 100, IV)), len, IV);
+
+	for (size_t n : {size_t(0), size_t(1), size_t(8), size_t(1000), size_t(64 * 1024)}) {
+		current = "in-place " + to_string(n);
+		const vector<byte> plain = random_bytes(n, n);
+		copy(plain.begin(), plain.end(), buf.begin());
+		const uint64_t a0 = heap_allocs.load();
+		const size_t clen = kedes::encrypt_in_place(ks, buf, n, IV);
+		const kedes::Status s = kedes::decrypt_in_place(ks, span<byte>(buf.data(), clen), len, IV);
+		const size_t eclen = kedes::encrypt_in_place(ede, buf, len, IV);
+		const kedes::Status es = kedes::decrypt_in_place(ede, span<byte>(buf.data(), eclen), len, IV);
+		CHECK(heap_allocs.load() == a0);
+		CHECK(s == kedes::Status::ok && es == kedes::Status::ok);
+		CHECK(len == n && equal(plain.begin(), plain.end(), buf.begin()));
+	}
+
+	current = "in-place errors";
+	const uint64_t a0 = heap_allocs.load();
+	CHECK(kedes::encrypt_in_place(ks, span<byte>(buf.data(), 7), 7, IV) == 0);   // no room for the padding
+	CHECK(kedes::decrypt_in_place(ks, span<byte>(buf.data(), 12), len, IV) == kedes::Status::bad_length);
+	CHECK(heap_allocs.load() == a0);
+}
+
+static void test_whole_buffer() {
+	const kedes::KeySchedule ks(KEY);
+	kedes::ThreadPool pool(4);
+	for (kedes::Mode mode : MODES)
+		for (size_t n : SIZES)
+			for (kedes::ThreadPool* p : {(kedes::ThreadPool*)nullptr, &pool}) {
+				current = string("whole ") + mode_name(mode) + " " + to_string(n) + (p ? " pool" : "");
+				const vector<byte> plain = random_bytes(n, n + 1);
+				const vector<byte> cipher = encrypt_whole(ks, mode, plain, p);
+				CHECK(cipher.size() == kedes::cipher_size(mode, n));
+				CHECK(cipher == encrypt_whole(ks, mode, plain, nullptr));
+				vector<byte> back;
+				CHECK(decrypt_whole(ks, mode, cipher, p, back) == kedes::Status::ok);
+				CHECK(back == plain);
+			}
+
+	current = "cbc-cmac tamper";
+	const vector<byte> plain = random_bytes(100, 7);
+	vector<byte> cipher = encrypt_whole(ks, kedes::Mode::cbc_cmac, plain, nullptr);
+	for (size_t at : {size_t(0), cipher.size() / 2, cipher.size() - 1}) {
+		vector<byte> bad = cipher;
+		bad[at] ^= byte(1);
+		size_t len = 1;
+		CHECK(kedes::decrypt_authenticated(ks, bad, len, IV) == kedes::Status::bad_tag);
+		CHECK(len == 0);
+	}
+	size_t len = 1;
+	CHECK(kedes::decrypt_authenticated(ks, cipher, len, IV ^ 1) == kedes::Status::bad_tag);
+
+	current = "ede";
+	const kedes::TripleKeySchedule ede(KEY, KEY + 2, KEY + 4);
+	for (size_t n : SIZES) {
+		const vector<byte> p = random_bytes(n, 3 * n);
+		vector<byte> back;
+		CHECK(kedes::decrypt(ede, kedes::encrypt(ede, p, IV), back, IV, &pool) == kedes::Status::ok);
+		CHECK(back == p);
+		CHECK(kedes::ctr_crypt(ede, IV, kedes::ctr_crypt(ede, IV, p), &pool) == p);
+	}
+
+	current = "cbc-chunked short index";
+	{
+		const vector<byte> p = random_bytes(3 * SEGMENT, 5);
+		const vector<uint64_t> ivs = segment_ivs(ks, p.size());
+		const vector<uint64_t> short_ivs(ivs.begin(), ivs.begin() + 2);   // of the 3 the data spans
+		vector<byte> out(p.size());
+		uint64_t chain = IV;
+		CHECK(kedes::cbc_encrypt_segments(ks, {SEGMENT, short_ivs}, 0, p, out, chain) == kedes::Status::bad_segments);
+		CHECK(chain == IV && all_of(out.begin(), out.end(), [](byte b) { return b == byte(0); }));
+		// a call that stays inside a segment it entered mid-way needs no IV
+		CHECK(kedes::cbc_encrypt_segments(ks, {SEGMENT, {}}, 8, span<const byte>(p.data(), 16), out, chain) == kedes::Status::ok);
+		const vector<byte> c = encrypt_whole(ks, kedes::Mode::cbc_chunked, p, &pool);
+		out.resize(c.size());
+		chain = IV;
+		CHECK(kedes::cbc_decrypt_segments(ks, {SEGMENT, short_ivs}, 0, c, out, chain, &pool) == kedes::Status::bad_segments);
+	}
+
+	current = "ctr range";
+	const vector<byte> big = random_bytes(50000, 9);
+	const vector<byte> ctr = kedes::ctr_crypt(ks, IV, big);
+	const vector<byte> part = kedes::ctr_decrypt_range(ks, IV, ctr, 12345, 1000);
+	CHECK(equal(part.begin(), part.end(), big.begin() + 12345) && part.size() == 1000);
+}
+
+static void test_stream() {
+	const kedes::KeySchedule ks(KEY);
+	kedes::ThreadPool pool(4);
+	for (kedes::Mode mode : MODES)
+		for (size_t n : SIZES) {
+			current = string("stream ") + mode_name(mode) + " " + to_string(n);
+			const vector<byte> plain = random_bytes(n, n + 2);
+			kedes::StreamOptions opt;
+			opt.mode = mode;
+			opt.iv = IV;
+			opt.chunk_bytes = 3000;   // not a multiple of the segment size, so chunks straddle segments
+			opt.pool = &pool;
+			const vector<uint64_t> ivs = segment_ivs(ks, kedes::cipher_size(kedes::Mode::cbc_chunked, n));
+			opt.segments = {SEGMENT, ivs};
+
+			stringstream in(string(reinterpret_cast<const char*>(plain.data()), plain.size())), out;
+			const kedes::StreamStats es = kedes::stream_encrypt(kedes::istream_source(in), kedes::ostream_sink(out), ks, opt);
+			const string c = out.str();
+			const vector<byte> expect = encrypt_whole(ks, mode, plain, nullptr);
+			CHECK(!es.write_error && c.size() == expect.size() && memcmp(c.data(), expect.data(), c.size()) == 0);
+
+			stringstream cin_(c), pout;
+			const kedes::StreamStats ds = kedes::stream_decrypt(kedes::istream_source(cin_), kedes::ostream_sink(pout), ks, opt);
+			CHECK(ds.status == kedes::Status::ok && ds.bytes_out == n);
+			CHECK(pout.str() == string(reinterpret_cast<const char*>(plain.data()), plain.size()));
+
+			// the ciphertext.txt hex layout through the same pipeline
+			stringstream hin(string(reinterpret_cast<const char*>(plain.data()), plain.size())), hout;
+			kedes::stream_encrypt(kedes::istream_source(hin), kedes::hex_sink(hout), ks, opt);
+			bool odd = false;
+			stringstream hback(hout.str()), hplain;
+			const kedes::StreamStats hs = kedes::stream_decrypt(kedes::hex_source(hback, &odd), kedes::ostream_sink(hplain), ks, opt);
+			CHECK(!odd && hs.status == kedes::Status::ok);
+			CHECK(hplain.str() == string(reinterpret_cast<const char*>(plain.data()), plain.size()));
+		}
+
+	// a stray byte past a chunk boundary is a last chunk shorter than a block: it is dropped
+	// and the padding in the chunk before it still comes off
+	for (kedes::Mode mode : MODES) {
+		if (mode == kedes::Mode::ctr) continue;
+		current = string("stream tail ") + mode_name(mode);
+		kedes::StreamOptions opt;
+		opt.mode = mode;
+		opt.iv = IV;
+		opt.chunk_bytes = 4096;
+		const size_t n = 2 * opt.chunk_bytes - kedes::BLOCK_SIZE - (mode == kedes::Mode::cbc_cmac ? kedes::TAG_SIZE : 0) + 3;
+		const vector<byte> plain = random_bytes(n, 17);
+		const vector<uint64_t> ivs = segment_ivs(ks, kedes::cipher_size(kedes::Mode::cbc_chunked, n));
+		opt.segments = {SEGMENT, ivs};
+		stringstream in(string(reinterpret_cast<const char*>(plain.data()), plain.size())), hex;
+		kedes::stream_encrypt(kedes::istream_source(in), kedes::hex_sink(hex), ks, opt);
+		bool odd = false;
+		stringstream tail(hex.str() + "AB"), back;
+		const kedes::StreamStats ds = kedes::stream_decrypt(kedes::hex_source(tail, &odd), kedes::ostream_sink(back), ks, opt);
+		CHECK(ds.bytes_in == 2 * opt.chunk_bytes + 1);
+		CHECK(ds.status == kedes::Status::ok && ds.truncated == 1);
+		CHECK(back.str() == string(reinterpret_cast<const char*>(plain.data()), plain.size()));
+	}
+
+	// input that outruns the segment index stops the output instead of guessing an IV
+	current = "stream short index";
+	const vector<byte> plain = random_bytes(5 * SEGMENT, 19);
+	const vector<uint64_t> ivs = segment_ivs(ks, SEGMENT);
+	kedes::StreamOptions opt;
+	opt.mode = kedes::Mode::cbc_chunked;
+	opt.iv = IV;
+	opt.chunk_bytes = SEGMENT;
+	opt.segments = {SEGMENT, ivs};
+	stringstream in(string(reinterpret_cast<const char*>(plain.data()), plain.size())), out;
+	const kedes::StreamStats es = kedes::stream_encrypt(kedes::istream_source(in), kedes::ostream_sink(out), ks, opt);
+	CHECK(es.status == kedes::Status::bad_segments && out.str().size() <= ivs.size() * SEGMENT);
+}
+
+static void test_hex() {
+	const vector<byte> data = random_bytes(1000, 23);
+	for (size_t column : {size_t(0), size_t(5), size_t(15)}) {
+		current = "hex column " + to_string(column);
+		string text(kedes::hex_encoded_size(data.size(), column), '\0');
+		size_t col = column;
+		CHECK(kedes::hex_encode_lines(data, col, text.data()) == text.size());
+		CHECK(col == (column + data.size()) % 16);
+		// the decoder drops the line breaks and anything else that is not a digit
+		text.insert(text.size() / 2 + 1, " ;\r\n");
+		CHECK(kedes::hex_compact(text, text.data()) == 2 * data.size());
+		vector<byte> back(data.size());
+		kedes::hex_decode_digits(text.data(), back.size(), back.data());
+		CHECK(back == data);
+	}
+}
+
+static void test_aio(const TempDir& dir) {
+	const kedes::KeySchedule ks(KEY);
+	vector<kedes::IoBackend> backends = {kedes::IoBackend::threads};
+	if (kedes::uring_available()) backends.push_back(kedes::IoBackend::uring);
+	for (kedes::IoBackend backend : backends)
+		for (kedes::Mode mode : MODES)
+			for (size_t n : SIZES) {
+				current = string("aio ") + kedes::to_string(backend) + " " + mode_name(mode) + " " + to_string(n);
+				const vector<byte> plain = random_bytes(n, n + 3);
+				const vector<uint64_t> ivs = segment_ivs(ks, kedes::cipher_size(kedes::Mode::cbc_chunked, n));
+				write_file(dir / "aio.plain", plain);
+				kedes::FileCryptOptions opt;
+				opt.stream.mode = mode;
+				opt.stream.iv = IV;
+				opt.stream.chunk_bytes = 8192;
+				opt.stream.segments = {SEGMENT, ivs};
+				opt.backend = backend;
+				opt.out_offset = opt.in_offset = 0;
+
+				int in = open((dir / "aio.plain").c_str(), O_RDONLY | O_CLOEXEC);
+				int out = open((dir / "aio.cipher").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				kedes::IoBackend used;
+				kedes::StreamStats es = kedes::file_encrypt(in, out, ks, opt, &used);
+				close(in);
+				close(out);
+				CHECK(used == backend && !es.read_error && !es.write_error);
+				CHECK(read_file(dir / "aio.cipher") == encrypt_whole(ks, mode, plain, nullptr));
+
+				in = open((dir / "aio.cipher").c_str(), O_RDONLY | O_CLOEXEC);
+				out = open((dir / "aio.back").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				kedes::StreamStats ds = kedes::file_decrypt(in, out, ks, opt);
+				close(in);
+				close(out);
+				CHECK(ds.status == kedes::Status::ok && !ds.read_error && !ds.write_error);
+				CHECK(read_file(dir / "aio.back") == plain);
+			}
+}
+
+static void test_mmap(const TempDir& dir) {
+	const kedes::KeySchedule ks(KEY);
+	kedes::ThreadPool pool(4);
+	for (kedes::Mode mode : MODES)
+		for (size_t n : SIZES) {
+			current = string("mmap ") + mode_name(mode) + " " + to_string(n);
+			const vector<byte> plain = random_bytes(n, n + 4);
+			const vector<uint64_t> ivs = segment_ivs(ks, kedes::cipher_size(kedes::Mode::cbc_chunked, n));
+			const kedes::SegmentLayout seg{SEGMENT, ivs};
+			write_file(dir / "map.plain", plain);
+			string error;
+			{
+				kedes::MappedFile in, out;
+				CHECK(in.open_read(dir / "map.plain", error));
+				CHECK(out.create(dir / "map.cipher", kedes::cipher_size(mode, n), error));
+				const size_t len = kedes::encrypt_mapped(ks, mode, IV, in.data(), out.data(), &pool, seg);
+				CHECK(out.close(len, error));
+			}
+			const vector<byte> cipher = read_file(dir / "map.cipher");
+			CHECK(cipher == encrypt_whole(ks, mode, plain, nullptr));
+			{
+				kedes::MappedFile in, out;
+				CHECK(in.open_read(dir / "map.cipher", error));
+				CHECK(out.create(dir / "map.back", in.size(), error));
+				size_t len = 0;
+				CHECK(kedes::decrypt_mapped(ks, mode, IV, in.data(), out.data(), len, &pool, seg) == kedes::Status::ok);
+				CHECK(out.close(len, error));
+			}
+			CHECK(read_file(dir / "map.back") == plain);
+		}
+}
+
+static void test_batch(const TempDir& dir) {
+	for (kedes::Mode mode : MODES) {
+		current = string("batch ") + mode_name(mode);
+		const fs::path src = dir.path / "batch" / mode_name(mode);
+		fs::create_directories(src / "sub");
+		vector<pair<string, vector<byte>>> files;
+		for (size_t n : {size_t(0), size_t(5), size_t(4096), size_t(30001)}) {
+			const string name = (src / (n % 2 ? "sub" : "") / ("f" + to_string(n))).string();
+			files.emplace_back(name, random_bytes(n, n + 5));
+			write_file(name, files.back().second);
+		}
+		kedes::ThreadPool pool(4);
+		kedes::BatchOptions opt;
+		opt.mode = mode;
+		opt.iv = IV;
+		opt.segment_bytes = SEGMENT;
+		opt.pool = &pool;
+		vector<kedes::BatchJob> jobs;
+		string error;
+		CHECK(kedes::load_jobs(src.string(), "", opt, KEY, jobs, error));
+		CHECK(jobs.size() == files.size());
+		for (const kedes::BatchResult& r : kedes::run_batch(jobs, opt)) CHECK(r.ok && r.message.empty());
+
+		// a second run leaves the .bin outputs alone
+		jobs.clear();
+		CHECK(kedes::load_jobs(src.string(), "", opt, KEY, jobs, error));
+		CHECK(jobs.size() == files.size());
+
+		// decryption takes only the .bin files, into another tree
+		opt.decrypt = true;
+		jobs.clear();
+		const fs::path out = dir.path / "batch" / (string(mode_name(mode)) + ".out");
+		CHECK(kedes::load_jobs(src.string(), out.string(), opt, KEY, jobs, error));
+		CHECK(jobs.size() == files.size());
+		for (const kedes::BatchResult& r : kedes::run_batch(jobs, opt)) CHECK(r.ok && r.message.empty());
+		for (const auto& [name, data] : files) CHECK(read_file((out / fs::relative(name, src)).string()) == data);
+	}
+
+	current = "batch clashes";
+	string error;
+	CHECK(!kedes::check_outputs({{"a", "a", KEY}}, error));
+	CHECK(!kedes::check_outputs({{"a", "x.bin", KEY}, {"b", "./x.bin", KEY}}, error));
+	CHECK(!kedes::check_outputs({{"a", "a.bin", KEY}, {"a.bin", "a.bin.bin", KEY}}, error));
+	CHECK(kedes::check_outputs({{"a", "a.bin", KEY}, {"b", "b.bin", KEY}}, error));
+}
+
+static void test_container() {
+	current = "container header";
+	kedes::ContainerHeader h, back;
+	h.mode = kedes::Mode::cbc_chunked;
+	h.iv = IV;
+	h.plain_len = 100000;
+	h.chunk_bytes = SEGMENT;
+	byte buf[kedes::CONTAINER_HEADER_SIZE];
+	kedes::encode_header(h, buf);
+	CHECK(kedes::decode_header(buf, back) == kedes::ContainerError::none);
+	CHECK(back.mode == h.mode && back.iv == h.iv && back.plain_len == h.plain_len && back.chunk_bytes == h.chunk_bytes);
+	CHECK(kedes::check_cipher_size(h, kedes::cipher_size(h.mode, h.plain_len)) == kedes::ContainerError::none);
+	CHECK(kedes::check_cipher_size(h, kedes::cipher_size(h.mode, h.plain_len) + 8) == kedes::ContainerError::size_mismatch);
+
+	// a plain_len near 2^64 would wrap cipher_size
+	for (uint64_t len : {UINT64_MAX, UINT64_MAX - 7, kedes::MAX_PLAIN_LEN + 1}) {
+		h.plain_len = len;
+		kedes::encode_header(h, buf);
+		CHECK(kedes::decode_header(buf, back) == kedes::ContainerError::bad_length);
+	}
+	h.chunk_bytes = 12;
+	h.plain_len = 8;
+	kedes::encode_header(h, buf);
+	CHECK(kedes::decode_header(buf, back) == kedes::ContainerError::bad_segments);
+	CHECK(kedes::decode_header(span<const byte>(buf, 20), back) == kedes::ContainerError::truncated);
+	buf[0] = byte('X');
+	CHECK(kedes::decode_header(buf, back) == kedes::ContainerError::not_container);
+}
+
+static void test_sector(const TempDir& dir) {
+	const kedes::KeySchedule ks(KEY);
+	kedes::ThreadPool pool(4);
+	for (size_t sb : {size_t(8), size_t(512), size_t(4096), size_t(8 * 1000)}) {
+		current = "sector " + to_string(sb);
+		const kedes::SectorCipher sc(ks, sb);
+		const vector<byte> plain = random_bytes(sb * 37, sb);
+		vector<byte> data = plain;
+		sc.encrypt(100, data, &pool);
+		CHECK(data != plain);
+		// any sector encrypts on its own to the same bytes
+		vector<byte> one(plain.begin() + 5 * sb, plain.begin() + 6 * sb);
+		sc.encrypt(105, one);
+		CHECK(equal(one.begin(), one.end(), data.begin() + 5 * sb));
+		sc.decrypt(100, data, &pool);
+		CHECK(data == plain);
+
+		const string image = dir / "image";
+		fs::remove(image);
+		const int fd = open(image.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		string error;
+		uint64_t sectors = 0;
+		CHECK(kedes::write_sectors(fd, sc, 0, plain, &pool, error));
+		vector<byte> read(plain.size());
+		CHECK(kedes::read_sectors(fd, sc, 0, read, &pool, error) && read == plain);
+		CHECK(kedes::crypt_image_sectors(fd, sc, true, 0, UINT64_MAX, &pool, sectors, error) && sectors == 37);
+		close(fd);
+		CHECK(read_file(image) == plain);
+	}
+}
+
+static void test_multikey() {
+	current = "multikey";
+	kedes::KeyScheduleCache cache(4);
+	mt19937_64 rng(13);
+	vector<kedes::KeyedBlock> items(1000);
+	for (size_t i = 0; i < items.size(); ++i) items[i] = {KEY + i % 7, rng()};
+	vector<kedes::KeyedBlock> copy = items;
+	kedes::encrypt_multi(items, cache);
+	for (size_t i = 0; i < items.size(); ++i) CHECK(items[i].block == kedes::KeySchedule(copy[i].key).encrypt_block(copy[i].block));
+	kedes::decrypt_multi(items, cache);
+	for (size_t i = 0; i < items.size(); ++i) CHECK(items[i].block == copy[i].block);
+}
+
+static void test_kernels() {
+	const kedes::KeySchedule ks(KEY);
+	mt19937_64 rng(11);
+	vector<uint64_t> blocks(3000);
+	for (uint64_t& b : blocks) b = rng();
+	for (kedes::Kernel k : {kedes::Kernel::scalar, kedes::Kernel::bs64, kedes::Kernel::sse2, kedes::Kernel::avx2,
+	                        kedes::Kernel::avx512}) {
+		if (!kedes::set_kernel(k)) continue;
+		current = string("kernel ") + kedes::to_string(k);
+		vector<uint64_t> b = blocks;
+		ks.encrypt_blocks(b.data(), b.size());
+		for (size_t i = 0; i < b.size(); ++i) CHECK(b[i] == ks.encrypt_block(blocks[i]));
+		ks.decrypt_blocks(b.data(), b.size());
+		CHECK(b == blocks);
+	}
+	kedes::set_kernel(kedes::Kernel::automatic);
+}
+
+static void test_daemon(const TempDir& dir) {
+	current = "daemon";
+	kedes::DaemonOptions opt;
+	opt.socket_path = dir / "d.sock";
+	// a socket file nobody listens on is stale and replaced
+	{
+		const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, opt.socket_path.c_str(), opt.socket_path.size());
+		CHECK(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+		close(fd);
+	}
+	kedes::Daemon first(opt);
+	string error;
+	CHECK(first.listen(error));
+	thread serving([&] { first.serve(); });
+
+	// a live socket is not taken over
+	kedes::Daemon second(opt);
+	CHECK(!second.listen(error) && error.find("already running") != string::npos);
+
+	kedes::DaemonClient client;
+	CHECK(client.connect_unix(opt.socket_path, error));
+	kedes::DaemonRequest req;
+	req.key = KEY;
+	req.iv = IV;
+	req.payload = random_bytes(1000, 1);
+	kedes::DaemonResponse resp;
+	CHECK(client.call(req, resp) && resp.status == kedes::DaemonStatus::ok);
+	CHECK(resp.payload == kedes::encrypt(kedes::KeySchedule(KEY), req.payload, IV));
+
+	first.stop();
+	serving.join();
+	CHECK(!fs::exists(opt.socket_path));
+}
+
+static void test_parsers() {
+	current = "parsers";
+	uint64_t v = 0;
+	CHECK(kedes::parse_unsigned("42", v) && v == 42);
+	for (const char* bad : {"", "abc", "-3", "+3", " 1", "1x", "99999999999999999999"}) CHECK(!kedes::parse_unsigned(bad, v));
+	CHECK(kedes::parse_hex64("133457799BBCDFF1", v) && v == KEY);
+	CHECK(kedes::parse_hex64("0x1f", v) && v == 0x1F);
+	for (const char* bad : {"", "zz", "-1", " 1", "1 ", "0x", "12345678901234567"}) CHECK(!kedes::parse_hex64(bad, v));
+	CHECK(kedes::parse_count("4k", v) && v == 4096);
+	CHECK(kedes::parse_count("3M", v) && v == (3u << 20));
+	for (const char* bad : {"", "abc", "-3", "1x", "k", "99999999999999999999", "20000000000G"}) CHECK(!kedes::parse_count(bad, v));
+	double d = 0;
+	CHECK(kedes::parse_decimal("0.25", d) && d == 0.25);
+	CHECK(kedes::parse_decimal("10", d) && d == 10);
+	for (const char* bad : {"", ".", "-1", "1e3", "1.2.3", "inf"}) CHECK(!kedes::parse_decimal(bad, d));
+	const vector<int> sample = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+	CHECK(kedes::percentile(sample, 50) == 5 && kedes::percentile(sample, 99) == 10 && kedes::percentile(sample, 0) == 1);
+	CHECK(kedes::percentile(vector<int>(), 50) == 0);
+}
+
+int main(int argc, char** argv) {
+	const string filter = argc > 1 ? argv[1] : "";
+	const TempDir dir;
+	const vector<pair<string, function<void()>>> cases = {
+		{"known_answer", test_known_answer},
+		{"in_place_allocations", test_in_place_allocations},
+		{"whole_buffer", test_whole_buffer},
+		{"stream", test_stream},
+		{"hex", test_hex},
+		{"aio", [&] { test_aio(dir); }},
+		{"mmap", [&] { test_mmap(dir); }},
+		{"batch", [&] { test_batch(dir); }},
+		{"container", test_container},
+		{"sector", [&] { test_sector(dir); }},
+		{"multikey", test_multikey},
+		{"kernels", test_kernels},
+		{"daemon", [&] { test_daemon(dir); }},
+		{"parsers", test_parsers},
+	};
+	for (const auto& [name, run] : cases) {
+		if (name.find(filter) == string::npos) continue;
+		const int before = failures;
+		run();
+		printf("%-22s %s\n", name.c_str(), failures == before ? "ok" : "FAILED");
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+#include "kedes_thread_pool.h"
+
+#include <algorithm>
+
+namespace kedes {
+
+ThreadPool::ThreadPool(unsigned workers) {
+	if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned i = 0; i < workers; ++i) queues_.push_back(std::make_unique<Queue>());
+	for (unsigned i = 0; i < workers; ++i) threads_.emplace_back([this, i] { worker_loop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lk(wake_m_);
+		stop_ = true;
+	}
+	wake_cv_.notify_all();
+	for (auto& t : threads_) t.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::push(std::size_t q, std::function<void()> job) {
+	pending_.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> lk(queues_[q]->m);
+		queues_[q]->jobs.push_back(std::move(job));
+	}
+	{
+		// counted under wake_m_ so a worker checking the predicate cannot miss it
+		std::lock_guard<std::mutex> lk(wake_m_);
+		queued_.fetch_add(1);
+	}
+	wake_cv_.notify_one();
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+	push(next_queue_.fetch_add(1) % queues_.size(), std::move(job));
+}
+
+bool ThreadPool::try_pop(std::size_t self, std::function<void()>& job) {
+	const std::size_t n = queues_.size();
+	// own deque first (LIFO end), then steal the oldest job of the others
+	if (self < n) {
+		Queue& q = *queues_[self];
+		std::lock_guard<std::mutex> lk(q.m);
+		if (!q.jobs.empty()) {
+			job = std::move(q.jobs.back());
+			q.jobs.pop_back();
+			queued_.fetch_sub(1);
+			return true;
+		}
+	}
+	for (std::size_t k = 1; k <= n; ++k) {
+		Queue& q = *queues_[(self + k) % n];
+		std::lock_guard<std::mutex> lk(q.m);
+		if (!q.jobs.empty()) {
+			job = std::move(q.jobs.front());
+			q.jobs.pop_front();
+			queued_.fetch_sub(1);
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::run(std::function<void()>& job) {
+	job();
+	job = nullptr;
+	if (pending_.fetch_sub(1) == 1) {
+		std::lock_guard<std::mutex> lk(wake_m_);
+		idle_cv_.notify_all();
+	}
+}
+
+void ThreadPool::worker_loop(std::size_t self) {
+	std::function<void()> job;
+	for (;;) {
+		if (try_pop(self, job)) {
+			run(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lk(wake_m_);
+		wake_cv_.wait(lk, [this] { return stop_ || queued_.load() > 0; });
+		if (stop_ && queued_.load() == 0) return;
+	}
+}
+
+void ThreadPool::parallel_for(std::size_t n, const std::function<void(std::size_t)>& task) {
+	if (n == 0) return;
+	if (n == 1) {
+		task(0);
+		return;
+	}
+
+	// left is only decremented under done_m, so once the caller has seen it reach zero
+	// and taken done_m itself no task touches this frame any more
+	std::atomic<std::size_t> left{n};
+	std::mutex done_m;
+	std::condition_variable done_cv;
+
+	// contiguous index runs per worker; pushed in reverse so the owner pops them in order
+	const std::size_t w = queues_.size();
+	for (std::size_t q = 0; q < w; ++q) {
+		std::size_t lo = n * q / w, hi = n * (q + 1) / w;
+		for (std::size_t i = hi; i-- > lo;) {
+			push(q, [&, i] {
+				task(i);
+				std::lock_guard<std::mutex> lk(done_m);
+				if (left.fetch_sub(1) == 1) done_cv.notify_all();
+			});
+		}
+	}
+
+	// help out until our own tasks are done
+	std::function<void()> job;
+	while (left.load() > 0) {
+		if (try_pop(w, job)) {
+			run(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lk(done_m);
+		done_cv.wait(lk, [&] { return left.load() == 0; });
+	}
+	std::lock_guard<std::mutex> lk(done_m);
+}
+
+void ThreadPool::wait_idle() {
+	std::unique_lock<std::mutex> lk(wake_m_);
+	idle_cv_.wait(lk, [this] { return pending_.load() == 0; });
+}
+
+} // namespace kedes
@@ -0,0 +1,66 @@
+// Work-stealing thread pool used by the parallel modes and the batch runner.
+// Each worker owns a deque: it pops its own work from the back and, when that runs dry,
+// steals from the front of the other workers' deques. Threads calling parallel_for()
+// help run tasks until their own tasks are finished.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kedes {
+
+class ThreadPool {
+public:
+	// workers == 0 picks one worker per hardware thread (the caller of parallel_for
+	// also runs tasks)
+	explicit ThreadPool(unsigned workers = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned size() const { return (unsigned)threads_.size(); }
+
+	// queue a job on the next worker deque (round-robin)
+	void submit(std::function<void()> job);
+
+	// run task(i) for every i in [0, n) and return once all of them have finished;
+	// indices are handed out to the workers in contiguous runs
+	void parallel_for(std::size_t n, const std::function<void(std::size_t)>& task);
+
+	// block until every submitted job has finished
+	void wait_idle();
+
+	// process-wide pool sized to the machine
+	static ThreadPool& shared();
+
+private:
+	struct Queue {
+		std::mutex m;
+		std::deque<std::function<void()>> jobs;
+	};
+
+	void push(std::size_t q, std::function<void()> job);
+	bool try_pop(std::size_t self, std::function<void()>& job);
+	void run(std::function<void()>& job);
+	void worker_loop(std::size_t self);
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::vector<std::thread> threads_;
+	std::mutex wake_m_;
+	std::condition_variable wake_cv_;
+	std::condition_variable idle_cv_;
+	std::atomic<std::size_t> queued_{0};
+	std::atomic<std::size_t> pending_{0};
+	std::atomic<std::size_t> next_queue_{0};
+	bool stop_ = false;
+};
+
+} // namespace kedes
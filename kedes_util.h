@@ -0,0 +1,107 @@
+// Small helpers shared by the library modules and the command-line tools: little-endian
+// fields, the SplitMix64 finalizer, errno messages, strict number parsing and percentiles. Internal;
+// not part of the libkedes API.
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace kedes {
+
+// n-byte little-endian field at p
+inline void put_le(std::uint8_t* p, std::uint64_t v, int n) {
+	for (int i = 0; i < n; ++i) p[i] = (std::uint8_t)(v >> (8 * i));
+}
+
+inline std::uint64_t get_le(const std::uint8_t* p, int n) {
+	std::uint64_t v = 0;
+	for (int i = n - 1; i >= 0; --i) v = (v << 8) | p[i];
+	return v;
+}
+
+inline void put_le(std::byte* p, std::uint64_t v, int n) {
+	put_le(reinterpret_cast<std::uint8_t*>(p), v, n);
+}
+
+inline std::uint64_t get_le(const std::byte* p, int n) {
+	return get_le(reinterpret_cast<const std::uint8_t*>(p), n);
+}
+
+// SplitMix64 finalizer: a cheap bijective 64-bit mix
+constexpr std::uint64_t mix64(std::uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+// "what: <strerror(errno)>"
+inline std::string errno_text(const std::string& what) {
+	return what + ": " + std::strerror(errno);
+}
+
+// 1 to 16 hex digits with an optional 0x prefix; false for anything else (signs,
+// spaces, trailing characters)
+inline bool parse_hex64(const std::string& s, std::uint64_t& v) {
+	const std::size_t skip = s.size() > 2 && s[0] == '0' && (s[1] | 0x20) == 'x' ? 2 : 0;
+	if (s.size() == skip || s.size() - skip > 16) return false;
+	for (std::size_t i = skip; i < s.size(); ++i)
+		if (!std::isxdigit((unsigned char)s[i])) return false;
+	v = std::strtoull(s.c_str() + skip, nullptr, 16);
+	return true;
+}
+
+// decimal digits only; false on anything else or overflow
+inline bool parse_unsigned(const std::string& s, std::uint64_t& v) {
+	if (s.empty()) return false;
+	for (char c : s)
+		if (!std::isdigit((unsigned char)c)) return false;
+	errno = 0;
+	v = std::strtoull(s.c_str(), nullptr, 10);
+	return errno == 0;
+}
+
+// decimal with an optional K/M/G suffix (powers of two); false for anything else
+inline bool parse_count(const std::string& s, std::uint64_t& v) {
+	int shift = 0;
+	switch (s.empty() ? 0 : s.back() | 0x20) {
+	case 'k': shift = 10; break;
+	case 'm': shift = 20; break;
+	case 'g': shift = 30; break;
+	}
+	if (!parse_unsigned(shift ? s.substr(0, s.size() - 1) : s, v)) return false;
+	if (v > (UINT64_MAX >> shift)) return false;
+	v <<= shift;
+	return true;
+}
+
+// non-negative decimal such as "10" or "0.25"; false for anything else
+inline bool parse_decimal(const std::string& s, double& v) {
+	bool digit = false, point = false;
+	for (char c : s) {
+		if (std::isdigit((unsigned char)c)) digit = true;
+		else if (c == '.' && !point) point = true;
+		else return false;
+	}
+	if (!digit) return false;
+	v = std::strtod(s.c_str(), nullptr);
+	return true;
+}
+
+// nearest-rank percentile (p in percent) of a sorted sample; T() when it is empty
+template <class T>
+T percentile(const std::vector<T>& sorted, double p) {
+	if (sorted.empty()) return T();
+	const std::size_t rank = (std::size_t)(p / 100.0 * (double)sorted.size() + 0.999999);
+	return sorted[std::min(sorted.size(), std::max<std::size_t>(rank, 1)) - 1];
+}
+
+} // namespace kedes
@@ -0,0 +1,149 @@
+// kedesd: local KE-DES encryption daemon (protocol and batching are described in kedes_daemon.h)
+//
+// usage: kedesd [--socket PATH | --tcp PORT] [--window US] [--max-batch BLOCKS] [--cache N]
+//               [--report SECONDS] [-q] [--metrics FILE] [--metrics-format json|prom]
+//   --socket PATH      Unix domain socket to listen on (default /tmp/kedesd.sock); a stale
+//                      socket file is replaced, one a running daemon answers on is an error
+//   --tcp PORT         listen on 127.0.0.1:PORT instead
+//   --window US        wait up to US microseconds for more requests before running a batch
+//                      (default 0: a batch is whatever queued up while the previous one ran)
+//   --max-batch N      end the wait early once N blocks are queued (default 65536)
+//   --cache N          key schedules kept resident (default 4096)
+//   --report SECONDS   print request rate and p50/p99 latency every SECONDS (default 10, 0 = off)
+//   -q, --quiet        only errors; no startup line or reports
+//   --metrics FILE     record counters and stage latencies (the request stage is the daemon's
+//                      per-request latency); written at exit and on SIGUSR1
+// SIGINT or SIGTERM closes the connections, removes the socket and prints a final report.
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <pthread.h>
+
+#include "kedes_daemon.h"
+#include "kedes_metrics.h"
+#include "kedes_util.h"
+
+using namespace std;
+
+struct ReportState {
+	uint64_t requests = 0;
+	uint64_t batches = 0;
+	chrono::steady_clock::time_point at = chrono::steady_clock::now();
+};
+
+static void report(kedes::Daemon& d, ReportState& last) {
+	uint64_t n = 0, p50 = 0, p99 = 0;
+	d.latency().take(n, p50, p99);
+	const auto now = chrono::steady_clock::now();
+	const double secs = chrono::duration<double>(now - last.at).count();
+	const uint64_t requests = d.batcher().requests(), batches = d.batcher().batches();
+	const uint64_t dr = requests - last.requests, db = batches - last.batches;
+	const uint64_t lookups = d.cache().hits() + d.cache().misses();
+	fprintf(stderr, "requests %llu (%.0f/s), batches %llu (%.1f req/batch), p50 %.1f us, p99 %.1f us, "
+	        "%zu keys cached (%.1f%% hits)\n",
+	        (unsigned long long)n, secs > 0 ? (double)n / secs : 0.0, (unsigned long long)db,
+	        db ? (double)dr / (double)db : 0.0, (double)p50 / 1e3, (double)p99 / 1e3, d.cache().size(),
+	        lookups ? 100.0 * (double)d.cache().hits() / (double)lookups : 0.0);
+	last.requests = requests;
+	last.batches = batches;
+	last.at = now;
+}
+
+int main(int argc, char** argv)
+{
+	kedes::DaemonOptions opt;
+	unsigned report_secs = 10;
+	bool quiet = false;
+	string metrics_file;
+	string metrics_format = "json";
+	for (int i = 1; i < argc; ++i) {
+		string a = argv[i];
+		if (a == "-q" || a == "--quiet") {
+			quiet = true;
+			continue;
+		}
+		if (i + 1 == argc) {
+			cerr << "Unknown option " << a << " (or missing its value)\n";
+			return 1;
+		}
+		const string v = argv[++i];
+		uint64_t n = 0;
+		auto number = [&](uint64_t lo, uint64_t hi) {
+			if (kedes::parse_unsigned(v, n) && n >= lo && n <= hi) return true;
+			cerr << "Invalid " << a << " value " << v << " (expected " << lo << " to " << hi << ")\n";
+			return false;
+		};
+		if (a == "--socket") opt.socket_path = v;
+		else if (a == "--tcp") {
+			if (!number(1, 65535)) return 1;
+			opt.tcp_port = (int)n;
+		} else if (a == "--window") {
+			if (!number(0, UINT32_MAX)) return 1;
+			opt.batch.window_us = (unsigned)n;
+		} else if (a == "--max-batch") {
+			if (!number(1, SIZE_MAX)) return 1;
+			opt.batch.max_blocks = (size_t)n;
+		} else if (a == "--cache") {
+			if (!number(1, SIZE_MAX)) return 1;
+			opt.cache_capacity = (size_t)n;
+		} else if (a == "--report") {
+			if (!number(0, UINT32_MAX)) return 1;
+			report_secs = (unsigned)n;
+		} else if (a == "--metrics") metrics_file = v;
+		else if (a == "--metrics-format") metrics_format = v;
+		else {
+			cerr << "Unknown option " << a << "\n";
+			return 1;
+		}
+	}
+
+	// every thread inherits the blocked shutdown signals; main collects them with sigtimedwait
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+	if (!metrics_file.empty()) {
+		kedes::MetricsFormat fmt;
+		if (!kedes::parse_metrics_format(metrics_format, fmt)) {
+			cerr << "Unknown metrics format " << metrics_format << " (expected json or prom)\n";
+			return 1;
+		}
+		kedes::enable_metrics(metrics_file, fmt);
+	}
+
+	kedes::Daemon daemon(opt);
+	string error;
+	if (!daemon.listen(error)) {
+		cerr << "Error: " << error << "\n";
+		return 1;
+	}
+	if (!quiet) {
+		if (opt.tcp_port > 0) cerr << "kedesd listening on 127.0.0.1:" << opt.tcp_port << "\n";
+		else cerr << "kedesd listening on " << opt.socket_path << "\n";
+	}
+	thread server([&] { daemon.serve(); });
+
+	ReportState last;
+	for (;;) {
+		timespec timeout{report_secs ? (time_t)report_secs : 3600, 0};
+		int sig = sigtimedwait(&set, nullptr, &timeout);
+		if (sig == SIGINT || sig == SIGTERM) break;
+		if (sig < 0 && errno == EAGAIN && report_secs && !quiet) report(daemon, last);
+	}
+
+	daemon.stop();
+	server.join();
+	if (!quiet) report(daemon, last);
+	return 0;
+}